@@ -1,8 +1,14 @@
 #include <iostream>
 #include <memory>
 #include <cstring>
+#include <cmath>
+#include <new>
+#include <algorithm>
+#include <chrono>
 #include <imgui.h>
 #include "audio.h"
+#include "threadpool.h"
+#include "sys.h"
 
 int AudioDevice::_pa_stream_callback_raw(
     const void* input_buffer,
@@ -59,34 +65,142 @@ void AudioDevice::_pa_stop()
         printf("PortAudio error: %s\n", Pa_GetErrorText(err));
 }
 
-AudioDevice::AudioDevice(int output_device)
-:   ring_buffer(SAMPLE_RATE / 2)
+bool AudioDevice::Config::operator==(const Config& other) const
 {
-    PaError err;
+    return output_device == other.output_device &&
+        sample_rate == other.sample_rate &&
+        latency == other.latency;
+}
+
+std::vector<AudioDevice::DeviceInfo> AudioDevice::output_devices()
+{
+    std::vector<DeviceInfo> devices;
+    PaHostApiIndex host_api = Pa_GetDefaultHostApi();
+
+    for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); i++)
+    {
+        const PaDeviceInfo* info = Pa_GetDeviceInfo(i);
+        if (info->hostApi != host_api || info->maxOutputChannels < 2) continue;
+
+        devices.push_back({ info->name, (int)info->defaultSampleRate });
+    }
+
+    return devices;
+}
+
+int AudioDevice::find_output_device(const std::string& name)
+{
+    PaHostApiIndex host_api = Pa_GetDefaultHostApi();
+
+    if (!name.empty())
+    {
+        for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); i++)
+        {
+            const PaDeviceInfo* info = Pa_GetDeviceInfo(i);
+
+            if (info->hostApi == host_api && info->maxOutputChannels >= 2 && name == info->name)
+                return i;
+        }
+
+        std::cout << "output device \"" << name << "\" not found, using default\n";
+    }
 
-    // if output_device == -1, use default output device
-    if (output_device == -1 && (output_device = Pa_GetDefaultOutputDevice()) == paNoDevice)
+    PaDeviceIndex device = Pa_GetDefaultOutputDevice();
+    if (device == paNoDevice)
     {
         printf("no default output device found\n");
-        output_device = 0;
+        device = 0;
     }
-    
+
+    return device;
+}
+
+int AudioDevice::choose_sample_rate(int device_index, int requested_rate)
+{
+    const PaDeviceInfo* info = Pa_GetDeviceInfo(device_index);
+    int native_rate = info ? (int)info->defaultSampleRate : 48000;
+    if (requested_rate <= 0) return native_rate;
+
     PaStreamParameters out_params;
     out_params.channelCount = 2;
-    out_params.device = output_device;
+    out_params.device = device_index;
     out_params.hostApiSpecificStreamInfo = nullptr;
     out_params.sampleFormat = paFloat32;
-    out_params.suggestedLatency = 0.05;
-    err = Pa_OpenStream(
+    out_params.suggestedLatency = info ? info->defaultLowOutputLatency : 0.05;
+
+    if (Pa_IsFormatSupported(nullptr, &out_params, requested_rate) != paFormatIsSupported)
+    {
+        std::cout << requested_rate << " Hz is not supported by the output device, using " << native_rate << " Hz\n";
+        return native_rate;
+    }
+
+    return requested_rate;
+}
+
+size_t AudioDevice::ring_buffer_capacity(double latency)
+{
+    // room for the whole latency plus the largest block that may be written at once.
+    // this assumes the highest sample rate, since the device may fall back to another rate
+    return (size_t)(MAX_SAMPLE_RATE * latency + MAX_BLOCK_SIZE) * 2;
+}
+
+PaError AudioDevice::open_stream()
+{
+    // give the device half of the latency, and let the ring buffer make up the rest
+    PaStreamParameters out_params;
+    out_params.channelCount = 2;
+    out_params.device = _device_index;
+    out_params.hostApiSpecificStreamInfo = nullptr;
+    out_params.sampleFormat = paFloat32;
+    out_params.suggestedLatency = _latency / 2.0;
+
+    PaError err = Pa_OpenStream(
         &pa_stream,
         nullptr,
         &out_params, // num output channels (stereo)
-        SAMPLE_RATE, // sample rate
+        _sample_rate, // sample rate
         paFramesPerBufferUnspecified, // num frames per buffer (am using own buffer so this is not needed)
         0, // stream flags
         _pa_stream_callback_raw, // callback function
         (void*)this // user data
     );
+
+    if (err != paNoError)
+    {
+        pa_stream = nullptr;
+        return err;
+    }
+
+    // the device may not give the exact latency that was asked for
+    double device_latency = Pa_GetStreamInfo(pa_stream)->outputLatency;
+    double queue_latency = _latency - device_latency;
+    if (queue_latency < _latency / 4.0) queue_latency = _latency / 4.0;
+    _queue_target = (size_t)(queue_latency * _sample_rate) * 2;
+
+    return paNoError;
+}
+
+AudioDevice::AudioDevice(const Config& config)
+:   _device_index(find_output_device(config.output_device)),
+    _sample_rate(choose_sample_rate(_device_index, config.sample_rate)),
+    _latency(std::clamp(config.latency, MIN_LATENCY, MAX_LATENCY)),
+    ring_buffer(ring_buffer_capacity(_latency))
+{
+    PaError err;
+    _callback_signal = sys::semaphore_create();
+
+    err = open_stream();
+
+    // fall back to the default device
+    if (err != paNoError && (_device_index != Pa_GetDefaultOutputDevice() || config.sample_rate > 0))
+    {
+        printf("could not open output device: %s\n", Pa_GetErrorText(err));
+
+        _device_index = find_output_device("");
+        _sample_rate = choose_sample_rate(_device_index, 0);
+        err = open_stream();
+    }
+
     if (err != paNoError) _pa_panic(err);
 
     err = Pa_StartStream(pa_stream);
@@ -96,19 +210,42 @@ AudioDevice::AudioDevice(int output_device)
 AudioDevice::~AudioDevice()
 {
     stop();
+    sys::semaphore_destroy(_callback_signal);
 }
 
 void AudioDevice::stop() {
     if (pa_stream == nullptr) return;
 
-    PaError err;
-    err = Pa_StopStream(pa_stream);
+    Pa_StopStream(pa_stream);
+    Pa_CloseStream(pa_stream);
     pa_stream = nullptr;
 }
 
+std::string AudioDevice::device_name() const
+{
+    const PaDeviceInfo* info = Pa_GetDeviceInfo(_device_index);
+    return info ? info->name : "";
+}
+
 void AudioDevice::queue(float* buf, size_t buf_size)
 {
+    // a full ring buffer would look empty, so always leave one slot free
+    size_t space = ring_buffer.writable() - 1;
+
+    if (buf_size > space)
+    {
+        _overruns++;
+        buf_size = space;
+    }
+
     ring_buffer.write(buf, buf_size);
+    _has_queued = true;
+}
+
+void AudioDevice::reset_xrun_counts()
+{
+    _underruns = 0;
+    _overruns = 0;
 }
 
 size_t AudioDevice::samples_queued() const
@@ -116,6 +253,11 @@ size_t AudioDevice::samples_queued() const
     return ring_buffer.queued();
 }
 
+bool AudioDevice::wait_for_callback(int timeout_ms)
+{
+    return sys::semaphore_wait(_callback_signal, timeout_ms);
+}
+
 static inline float clampf(float value, float min, float max)
 {
     if (value > max) return max;
@@ -131,19 +273,57 @@ int AudioDevice::_pa_stream_callback(
     PaStreamCallbackFlags status_flags
 ) {
     float* out = (float*) output_buffer;
-    float sample_count = frame_count * 2;
+    size_t sample_count = frame_count * 2;
 
     // read from the ring buffer and write to out
     // writes zeros for any remaining samples that were not written to
-    for (size_t i = ring_buffer.read(out, sample_count); i < sample_count; i++)
+    size_t samples_read = ring_buffer.read(out, sample_count);
+
+    for (size_t i = samples_read; i < sample_count; i++)
     {
         out[i] = 0.0f;
     };
 
+    // the ring buffer is empty until the render thread starts, which isn't an underrun
+    if ((samples_read < sample_count && _has_queued) || (status_flags & paOutputUnderflow))
+        _underruns++;
+
+    if (status_flags & paOutputOverflow)
+        _overruns++;
+
     _frames_written += frame_count;
+
+    // wake up the render thread so it can refill the ring buffer
+    sys::semaphore_post(_callback_signal);
     return 0;
 }
 
+void DspLoadMeter::record(double render_time, double block_time)
+{
+    // time constants of the rolling average and the peak decay, in seconds
+    constexpr double AVERAGE_TIME = 0.5;
+    constexpr double PEAK_DECAY_TIME = 2.0;
+
+    float block_load = render_time / block_time;
+    float alpha = 1.0 - exp(-block_time / AVERAGE_TIME);
+    float peak = _peak * exp(-block_time / PEAK_DECAY_TIME);
+
+    _load = _load + (block_load - _load) * alpha;
+    _peak = block_load > peak ? block_load : peak;
+    _render_time = render_time;
+    _block_time = block_time;
+
+    if (render_time > block_time)
+        _late_blocks++;
+}
+
+void DspLoadMeter::reset()
+{
+    _load = 0.0f;
+    _peak = 0.0f;
+    _late_blocks = 0;
+}
+
 using namespace audiomod;
 //////////////////////////////////////
 //   NOTE EVENT / MIDI CONVERSION   //
@@ -180,6 +360,23 @@ size_t NoteEvent::write_midi(MidiMessage* out) const
     return out->size();
 }
 
+bool NoteEventList::push(const NoteEvent& event)
+{
+    if (_count == CAPACITY) return false;
+
+    // events usually arrive in order, so search from the back
+    size_t i = _count;
+    while (i > 0 && _events[i - 1].frame > event.frame)
+    {
+        _events[i] = _events[i - 1];
+        i--;
+    }
+
+    _events[i] = event;
+    _count++;
+    return true;
+}
+
 bool NoteEvent::read_midi(const MidiMessage* in)
 {
     switch (in->status & 0xf0) { // the last 4 bits are for the channel number
@@ -203,28 +400,89 @@ bool NoteEvent::read_midi(const MidiMessage* in)
 
 
 //////////////////////
-//   MODULE GRAPH   //
+//    PROFILING     //
 //////////////////////
 
-ModuleNode::ModuleNode(ModuleContext& modctx, std::unique_ptr<ModuleBase>&& mod)
-:   modctx(modctx), _module(std::move(mod))
+void NodeProfile::record(uint64_t ns)
 {
-    output_array = new float[modctx.frames_per_buffer * modctx.num_channels];
+    // the bucket index is twice the base-2 log of the time,
+    // plus one if the time is in the upper half of its octave
+    size_t bucket = 0;
+
+    if (ns >= 2)
+    {
+        int msb = 63 - __builtin_clzll(ns);
+        bucket = msb * 2 + ((ns >> (msb - 1)) & 1);
+    }
+
+    if (bucket >= BUCKET_COUNT) bucket = BUCKET_COUNT - 1;
+
+    _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    _total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t max = _max_ns.load(std::memory_order_relaxed);
+    while (ns > max && !_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed));
+}
+
+double NodeProfile::bucket_start(size_t bucket)
+{
+    // bucket 2n starts at 2^n, and bucket 2n+1 starts at 1.5 * 2^n
+    double octave = (double)(1ull << (bucket / 2));
+    return (bucket % 2) ? octave * 1.5 : octave;
 }
 
-ModuleNode::~ModuleNode()
+ProfileStats NodeProfile::collect()
 {
-    delete[] output_array;
-    for (float*& ptr : input_arrays)
-        delete[] ptr;
+    uint32_t counts[BUCKET_COUNT];
+    uint64_t count = 0;
+
+    for (size_t i = 0; i < BUCKET_COUNT; i++)
+    {
+        counts[i] = _buckets[i].exchange(0, std::memory_order_relaxed);
+        count += counts[i];
+    }
+
+    ProfileStats stats;
+    stats.count = count;
+    stats.total_us = _total_ns.exchange(0, std::memory_order_relaxed) / 1000.0;
+    stats.max_us = _max_ns.exchange(0, std::memory_order_relaxed) / 1000.0;
+    stats.mean_us = count > 0 ? stats.total_us / count : 0.0;
+    stats.p99_us = 0.0;
+
+    // find the bucket that contains the 99th percentile
+    uint64_t threshold = count - count / 100;
+    uint64_t accum = 0;
+
+    for (size_t i = 0; i < BUCKET_COUNT && count > 0; i++)
+    {
+        accum += counts[i];
+
+        if (accum >= threshold)
+        {
+            double end = i + 1 < BUCKET_COUNT ? bucket_start(i + 1) : bucket_start(i);
+            stats.p99_us = std::min(end / 1000.0, stats.max_us);
+            break;
+        }
+    }
+
+    return stats;
 }
 
+
+
+//////////////////////
+//   MODULE GRAPH   //
+//////////////////////
+
+ModuleNode::ModuleNode(ModuleContext& modctx, std::unique_ptr<ModuleBase>&& mod)
+:   modctx(modctx), _module(std::move(mod))
+{}
+
 void ModuleNode::add_input(const ModuleNodeRc&& module)
 {
     assert(module);
 
     input_nodes.push_back(module);
-    input_arrays.push_back(new float[modctx.frames_per_buffer * modctx.num_channels]);
 }
 
 bool ModuleNode::remove_input(ModuleNodeRc& module)
@@ -234,8 +492,6 @@ bool ModuleNode::remove_input(ModuleNodeRc& module)
     for (auto it = input_nodes.begin(); it != input_nodes.end(); it++) {
         if (*it == module) {
             input_nodes.erase(it);
-            delete[] input_arrays.back();
-            input_arrays.pop_back();
             return false;
         }
     }
@@ -279,10 +535,22 @@ private:
 public:
     DummyModule() : ModuleBase(false) {}
 
-    virtual void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count)
+    virtual void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count)
     {}
 };
 
+void ModuleContext::report_error(const std::string& error)
+{
+    std::lock_guard lock(_error_mutex);
+    if (_error.empty()) _error = error;
+}
+
+std::string ModuleContext::error() const
+{
+    std::lock_guard lock(_error_mutex);
+    return _error;
+}
+
 ModuleContext::ModuleContext(int sample_rate, int num_channels, size_t buffer_size)
 :   sample_rate(sample_rate),
     num_channels(num_channels),
@@ -299,62 +567,434 @@ ModuleContext::ModuleContext(int sample_rate, int num_channels, size_t buffer_si
 ModuleContext::~ModuleContext()
 {
     delete[] audio_buffer;
+    delete _plan.load();
+}
+
+ModuleContext::GraphPlan::~GraphPlan()
+{
+    for (float* buf : buffers)
+        ::operator delete[](buf, std::align_val_t(BUFFER_ALIGNMENT));
+
+    for (float* buf : input_copies)
+        ::operator delete[](buf, std::align_val_t(BUFFER_ALIGNMENT));
+
+    for (float* buf : tap_buffers)
+        ::operator delete[](buf, std::align_val_t(BUFFER_ALIGNMENT));
 }
 
 void ModuleContext::make_dirty()
-{}
+{
+    _dirty = true;
+}
 
-void ModuleContext::process_node(ModuleNode& node)
+std::unique_ptr<ModuleContext::GraphPlan> ModuleContext::compile_graph() const
 {
+    auto plan = std::make_unique<GraphPlan>();
+    std::vector<ProcessStep>& steps = plan->steps;
+
+    // iterative post-order traversal starting from the destination,
+    // so every node is placed after all of its inputs
+    struct StackEntry {
+        ModuleNode* node;
+        size_t next_input;
+    };
+
+    std::vector<StackEntry> stack;
+    stack.push_back({ _dest.get(), 0 });
+
+    while (!stack.empty())
+    {
+        StackEntry& top = stack.back();
+
+        if (top.next_input < top.node->input_nodes.size())
+        {
+            ModuleNode* input = top.node->input_nodes[top.next_input++].get();
+            stack.push_back({ input, 0 });
+        }
+        else
+        {
+            ModuleNode* node = top.node;
+            node->step_index = steps.size();
+            steps.push_back({ node, SIZE_MAX, 0, nullptr, plan->input_steps.size(), node->input_nodes.size() });
+            plan->nodes.push_back(node->shared_from_this());
+
+            // link the inputs to this step
+            for (ModuleNodeRc& input : node->input_nodes)
+            {
+                steps[input->step_index].output_step = node->step_index;
+                plan->input_steps.push_back(input->step_index);
+            }
+
+            stack.pop_back();
+        }
+    }
+
+    plan->parallelism = 0;
+    for (const ProcessStep& step : steps)
+    {
+        if (step.num_inputs == 0) plan->parallelism++;
+    }
+
+    // a single chain of modules can't be split up, so it is
+    // processed on the calling thread without waking any workers
+    plan->thread_pool = _thread_pool;
+    plan->parallel = _thread_pool && _thread_pool->thread_count() > 0 && plan->parallelism > 1;
+
+    assign_buffers(*plan);
+
+    // wire up input pointers
     const size_t buf_size = frames_per_buffer * num_channels;
+    plan->inputs.resize(plan->input_steps.size());
+    plan->input_copies.resize(plan->input_steps.size(), nullptr);
 
-    // get data in inputs
-    size_t i = 0;
-    for (ModuleNodeRc& input : node.input_nodes)
+    for (ProcessStep& step : steps)
+    {
+        bool writable = step.node->module().writable_inputs();
+
+        for (size_t i = step.first_input; i < step.first_input + step.num_inputs; i++)
+        {
+            // only give the module a copy if it wants to modify it,
+            // otherwise it reads the input's output buffer directly
+            if (writable)
+            {
+                float* copy = new (std::align_val_t(BUFFER_ALIGNMENT)) float[buf_size];
+                plan->input_copies[i] = copy;
+                plan->inputs[i] = copy;
+            }
+            else
+            {
+                plan->inputs[i] = steps[plan->input_steps[i]].output;
+            }
+        }
+    }
+
+    // allocate tap buffers and point the tapped steps at them
+    for (const ModuleNodeRc& tap : _taps)
     {
-        process_node(*input);
-        input->module().send_events(node.module());
+        float* buf = new (std::align_val_t(BUFFER_ALIGNMENT)) float[buf_size];
+        memset(buf, 0, buf_size * sizeof(float));
+        plan->tap_buffers.push_back(buf);
+
+        // step_index is left over from an older plan if the node is not in this one
+        size_t k = tap->step_index;
+        if (k < steps.size() && steps[k].node == tap.get())
+            steps[k].tap = buf;
+    }
+
+    // allocate parallel processing state
+    if (plan->parallel)
+    {
+        plan->pending_inputs = std::make_unique<std::atomic<size_t>[]>(steps.size());
+        plan->ready_queue = std::make_unique<std::atomic<size_t>[]>(steps.size());
+    }
+
+    return plan;
+}
+
+void ModuleContext::assign_buffers(GraphPlan& plan) const
+{
+    std::vector<ProcessStep>& steps = plan.steps;
+
+    struct FreeBuffer {
+        size_t buffer;
+        size_t released_at; // the step that last read from the buffer
+    };
+
+    std::vector<FreeBuffer> free_buffers;
+    size_t buffer_count = 0;
+
+    // the first step of each node's subtree. since the steps are in post-order,
+    // the subtree of a step is the contiguous range [first_step, step], and those
+    // are the only steps guaranteed to finish before it when processing in parallel
+    std::vector<size_t> first_step(steps.size());
+
+    for (size_t k = 0; k < steps.size(); k++)
+    {
+        const ProcessStep& step = steps[k];
+
+        first_step[k] = k;
+        for (size_t i = step.first_input; i < step.first_input + step.num_inputs; i++)
+            first_step[k] = std::min(first_step[k], first_step[plan.input_steps[i]]);
+
+        // find a free buffer whose last reader has finished by the time this step runs.
+        // search from the back so recently used (and likely cached) buffers are preferred
+        size_t buffer = SIZE_MAX;
+
+        for (size_t i = free_buffers.size() - 1; i != SIZE_MAX; i--)
+        {
+            if (!plan.parallel || free_buffers[i].released_at >= first_step[k])
+            {
+                buffer = free_buffers[i].buffer;
+                free_buffers.erase(free_buffers.begin() + i);
+                break;
+            }
+        }
+
+        if (buffer == SIZE_MAX)
+            buffer = buffer_count++;
         
-        // copy input's output array to my input array
-        memcpy(node.input_arrays[i], input->output_array, buf_size * sizeof(float));
-        i++;
-    }
-
-    node.module().process(
-        node.input_arrays.data(),
-        node.output_array,
-        node.input_nodes.size(),
-        buf_size,
-        sample_rate,
-        num_channels
-    );
+        steps[k].buffer = buffer;
+
+        // the outputs of the inputs are no longer needed once this step has run
+        for (size_t i = step.first_input; i < step.first_input + step.num_inputs; i++)
+            free_buffers.push_back({ steps[plan.input_steps[i]].buffer, k });
+    }
+
+    // allocate the buffers
+    const size_t buf_size = frames_per_buffer * num_channels;
+
+    while (plan.buffers.size() < buffer_count)
+    {
+        float* buf = new (std::align_val_t(BUFFER_ALIGNMENT)) float[buf_size];
+        memset(buf, 0, buf_size * sizeof(float));
+        plan.buffers.push_back(buf);
+    }
+
+    for (ProcessStep& step : steps)
+        step.output = plan.buffers[step.buffer];
 }
 
-size_t ModuleContext::process(float* &buffer)
+void ModuleContext::commit()
+{
+    if (_dirty)
+    {
+        std::unique_ptr<GraphPlan> plan = compile_graph();
+        _dirty = false;
+
+        GraphPlan* old_plan = _plan.exchange(plan.release(), std::memory_order_seq_cst);
+        _reclaimer.retire(std::shared_ptr<GraphPlan>(old_plan));
+    }
+
+    _reclaimer.collect();
+}
+
+size_t ModuleContext::buffer_pool_size() const
+{
+    GraphPlan* plan = _plan.load(std::memory_order_relaxed);
+    return plan ? plan->buffers.size() : 0;
+}
+
+size_t ModuleContext::add_tap(const ModuleNodeRc& node)
+{
+    _taps.push_back(node);
+    _dirty = true;
+    return _taps.size() - 1;
+}
+
+void ModuleContext::clear_taps()
+{
+    _taps.clear();
+    _dirty = true;
+}
+
+const float* ModuleContext::tap_output(size_t tap) const
+{
+    GraphPlan* plan = _plan.load(std::memory_order_relaxed);
+    if (plan == nullptr || tap >= plan->tap_buffers.size()) return nullptr;
+    return plan->tap_buffers[tap];
+}
+
+void ModuleContext::process_step(const GraphPlan& plan, const ProcessStep& step)
 {
     const size_t buf_size = frames_per_buffer * num_channels;
+    ModuleNode& node = *step.node;
+    ModuleBase& module = node.module();
+
+    bool inputs_silent = true;
+
+    // get data in inputs
+    for (size_t i = step.first_input; i < step.first_input + step.num_inputs; i++)
+    {
+        const ProcessStep& input = plan.steps[plan.input_steps[i]];
+        input.node->module().send_events(module);
+        inputs_silent = inputs_silent && input.node->output_silent;
+
+        if (plan.input_copies[i])
+            memcpy(plan.input_copies[i], input.output, buf_size * sizeof(float));
+    }
+
+    if (!inputs_silent)
+        node.silent_input_frames = 0;
+    else if (node.silent_input_frames < SIZE_MAX - frames_per_buffer)
+        node.silent_input_frames += frames_per_buffer;
     
-    size_t i = 0;
-    for (ModuleNodeRc& input_node : _dest->input_nodes)
+    // bypass the module if its inputs have been silent for longer than its tail.
+    // the output buffer may be shared with other nodes, so it still needs to be cleared
+    size_t tail = module.tail_frames();
+
+    const bool profiling = _profiling.load(std::memory_order_relaxed);
+    std::chrono::steady_clock::time_point start_time;
+    if (profiling) start_time = std::chrono::steady_clock::now();
+
+    if (inputs_silent && tail != SIZE_MAX && node.silent_input_frames >= tail + frames_per_buffer)
+    {
+        memset(step.output, 0, buf_size * sizeof(float));
+        module.idle(frames_per_buffer);
+        module._silent_output = true;
+    }
+    else
+    {
+        module._silent_output = false;
+        module.process(
+            (const float**) plan.inputs.data() + step.first_input,
+            step.output,
+            step.num_inputs,
+            frames_per_buffer,
+            sample_rate,
+            num_channels
+        );
+    }
+
+    node.output_silent = module._silent_output;
+
+    if (profiling)
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start_time;
+        node._profile.record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    // the output buffer may be reused by a later step, so the tap copies it now
+    if (step.tap)
+    {
+        for (int c = 0; c < num_channels; c++)
+        {
+            const float* plane = step.output + c * frames_per_buffer;
+
+            for (size_t i = 0; i < (size_t)frames_per_buffer; i++)
+                step.tap[i * num_channels + c] = plane[i];
+        }
+    }
+}
+
+size_t ModuleContext::wait_ready(const GraphPlan& plan, size_t ticket)
+{
+    size_t step_index = plan.ready_queue[ticket].load(std::memory_order_acquire);
+    if (step_index != SIZE_MAX) return step_index;
+
+    // steps usually finish within a few microseconds, so spin for a bit first
+    auto spin_end = std::chrono::steady_clock::now() + std::chrono::microseconds(READY_SPIN_US);
+
+    while ((step_index = plan.ready_queue[ticket].load(std::memory_order_acquire)) == SIZE_MAX)
+    {
+        if (std::chrono::steady_clock::now() >= spin_end)
+        {
+            std::unique_lock<std::mutex> lock(_ready_mutex);
+            _ready_waiters.fetch_add(1);
+            _ready_cond.wait(lock, [&]() {
+                return (step_index = plan.ready_queue[ticket].load()) != SIZE_MAX;
+            });
+            _ready_waiters.fetch_sub(1);
+            break;
+        }
+
+        std::this_thread::yield();
+    }
+
+    return step_index;
+}
+
+void ModuleContext::_parallel_task(void* userdata, size_t thread_index)
+{
+    ModuleContext& self = *((ModuleContext*)userdata);
+    const GraphPlan& plan = *self._parallel_plan;
+    const size_t step_count = plan.steps.size();
+
+    while (true)
     {
-        process_node(*input_node);
-        input_node->module().send_events(_dest->module());
+        size_t ticket = self._ready_read.fetch_add(1, std::memory_order_relaxed);
+        if (ticket >= step_count) break;
 
-        // copy input's output array to my input array
-        memcpy(_dest->input_arrays[i], input_node->output_array, buf_size * sizeof(float));
+        // wait for the step with this ticket to become ready. it is guaranteed
+        // to be posted eventually, since every step becomes ready exactly once
+        size_t step_index = self.wait_ready(plan, ticket);
+
+        const ProcessStep& step = plan.steps[step_index];
+        self.process_step(plan, step);
+
+        // if this was the last input of the output node to be processed,
+        // the output node is now ready
+        if (step.output_step != SIZE_MAX &&
+            plan.pending_inputs[step.output_step].fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            size_t slot = self._ready_write.fetch_add(1, std::memory_order_relaxed);
+            plan.ready_queue[slot].store(step.output_step);
+
+            // a waiter registers itself before checking its slot one last time,
+            // so either it sees the step or it is woken up here
+            if (self._ready_waiters.load() > 0)
+            {
+                { std::lock_guard<std::mutex> lock(self._ready_mutex); }
+                self._ready_cond.notify_all();
+            }
+        }
     }
+}
+
+size_t ModuleContext::process(float* &buffer)
+{
+    const size_t buf_size = frames_per_buffer * num_channels;
 
-    // combine all inputs into one buffer
-    for (size_t i = 0; i < frames_per_buffer * num_channels; i += 2) {
-        audio_buffer[i] = 0.0f;
-        audio_buffer[i + 1] = 0.0f;
+    _reclaimer.begin_read();
+    GraphPlan* plan = _plan.load(std::memory_order_seq_cst);
 
-        for (const float* input_array : _dest->input_arrays) {
-            audio_buffer[i] += input_array[i];
-            audio_buffer[i + 1] += input_array[i + 1];
+    if (plan == nullptr)
+    {
+        // nothing has been committed yet
+        memset(audio_buffer, 0, buf_size * sizeof(float));
+    }
+    else
+    {
+        if (plan->parallel)
+        {
+            // reset dependency counters and queue the steps that have no inputs
+            size_t ready_count = 0;
+
+            for (size_t i = 0; i < plan->steps.size(); i++)
+            {
+                plan->pending_inputs[i].store(plan->steps[i].num_inputs, std::memory_order_relaxed);
+                plan->ready_queue[i].store(SIZE_MAX, std::memory_order_relaxed);
+            }
+
+            for (size_t i = 0; i < plan->steps.size(); i++)
+            {
+                if (plan->steps[i].num_inputs == 0)
+                    plan->ready_queue[ready_count++].store(i, std::memory_order_relaxed);
+            }
+
+            _ready_write.store(ready_count, std::memory_order_relaxed);
+            _ready_read.store(0, std::memory_order_relaxed);
+            _parallel_plan = plan;
+
+            plan->thread_pool->run(_parallel_task, this, plan->parallelism);
+        }
+        else
+        {
+            for (const ProcessStep& step : plan->steps)
+                process_step(*plan, step);
+        }
+
+        // combine all inputs into one interleaved buffer
+        const ProcessStep& dest = plan->steps.back();
+        const float** dest_inputs = (const float**) plan->inputs.data() + dest.first_input;
+
+        memset(audio_buffer, 0, buf_size * sizeof(float));
+
+        for (size_t j = 0; j < dest.num_inputs; j++)
+        {
+            const float* input = dest_inputs[j];
+
+            for (int c = 0; c < num_channels; c++)
+            {
+                const float* plane = input + c * frames_per_buffer;
+                
+                for (size_t i = 0; i < (size_t)frames_per_buffer; i++)
+                    audio_buffer[i * num_channels + c] += plane[i];
+            }
         }
     }
 
+    _reclaimer.end_read();
+
     buffer = audio_buffer;
     _frame_time += frames_per_buffer;
     return buf_size;
@@ -403,4 +1043,35 @@ bool ModuleBase::render_interface() {
     } ImGui::End();
 
     return _interface_shown;
-}
\ No newline at end of file
+}
+
+
+
+#ifdef UNIT_TESTS
+#include <catch2/catch_amalgamated.hpp>
+
+TEST_CASE("NodeProfile statistics", "[audio]")
+{
+    NodeProfile profile;
+
+    // 99 fast blocks and one slow block
+    for (int i = 0; i < 99; i++)
+        profile.record(10000);
+    profile.record(1000000);
+
+    ProfileStats stats = profile.collect();
+    REQUIRE(stats.count == 100);
+    REQUIRE(stats.max_us == Catch::Approx(1000.0));
+    REQUIRE(stats.mean_us == Catch::Approx((99 * 10.0 + 1000.0) / 100.0));
+
+    // the 99th percentile is in the bucket holding 10 us
+    REQUIRE(stats.p99_us >= 10.0);
+    REQUIRE(stats.p99_us < 15.0);
+
+    // collecting resets the statistics
+    stats = profile.collect();
+    REQUIRE(stats.count == 0);
+    REQUIRE(stats.max_us == 0.0);
+}
+
+#endif
@@ -2,16 +2,55 @@
 #include <vector>
 #include <memory>
 #include <string>
+#include <mutex>
+#include <condition_variable>
 #include <portaudio.h>
 
 #include "util.h"
 
+class ThreadPool;
+
+namespace sys
+{
+    struct semaphore_t;
+}
+
 class AudioDevice {
+public:
+    struct Config
+    {
+        // name of the output device, or empty for the default device
+        std::string output_device;
+
+        // the sample rate to open the device at, or 0 for the device's native sample rate
+        int sample_rate = 0;
+
+        // the total amount of time between rendering audio and hearing it, in seconds.
+        // this is split between the device's own buffer and the ring buffer
+        double latency = 0.05;
+
+        bool operator==(const Config& other) const;
+        inline bool operator!=(const Config& other) const { return !(*this == other); };
+    };
+
+    struct DeviceInfo
+    {
+        std::string name;
+        int default_sample_rate;
+    };
+
 private:
-    PaStream* pa_stream;
+    PaStream* pa_stream = nullptr;
+
+    // device parameters, resolved from the config when the device is opened
+    int _device_index;
+    int _sample_rate;
+    double _latency;
 
-    // a ring buffer that should hold up to 0.5 seconds of audio
-    // size in bytes: sample_rate() / 2 * sizeof(float)
+    // the amount of samples the render thread should keep in the ring buffer
+    size_t _queue_target = 0;
+
+    // a ring buffer that can hold the queue target plus one large block of audio
     RingBuffer<float> ring_buffer;
     
     size_t _thread_buffer_size = 0;
@@ -21,7 +60,20 @@ private:
     //std::atomic<double> _time = 0.0;
     std::atomic<uint64_t> _frames_written = 0;
 
-    static constexpr float SAMPLE_RATE = 48000;
+    // xrun counters. underruns are counted when the ring buffer runs dry or
+    // the host reports an output underflow, and overruns when audio had to be
+    // dropped because the ring buffer was full or the host reports an overflow
+    std::atomic<uint64_t> _underruns = 0;
+    std::atomic<uint64_t> _overruns = 0;
+    std::atomic<bool> _has_queued = false;
+
+    // posted by the stream callback every time it reads from the ring buffer
+    sys::semaphore_t* _callback_signal = nullptr;
+
+    static int find_output_device(const std::string& name);
+    static int choose_sample_rate(int device_index, int requested_rate);
+    static size_t ring_buffer_capacity(double latency);
+    PaError open_stream();
 
     // this function will convert userdata to an AudioDevice* and call _pa_stream_callback
     static int _pa_stream_callback_raw(
@@ -44,18 +96,91 @@ public:
     static bool _pa_start();
     static void _pa_stop();
 
+    // limits of the configuration that the ring buffer leaves room for
+    static constexpr size_t MAX_BLOCK_SIZE = 8192;
+    static constexpr int MAX_SAMPLE_RATE = 192000;
+    static constexpr double MIN_LATENCY = 0.005;
+    static constexpr double MAX_LATENCY = 0.5;
+
+    /**
+    * Get the output devices of the default host API.
+    * The names are what Config::output_device expects.
+    **/
+    static std::vector<DeviceInfo> output_devices();
+
     AudioDevice(const AudioDevice&) = delete;
-    AudioDevice(int output_device);
+
+    /**
+    * Open and start an output stream. If the requested device or sample rate
+    * can't be used, it falls back to the default device at its native rate.
+    **/
+    AudioDevice(const Config& config);
     ~AudioDevice();
 
-    inline int sample_rate() const { return SAMPLE_RATE; };
+    inline int sample_rate() const { return _sample_rate; };
     inline int num_channels() const { return 2; };
+    inline double latency() const { return _latency; };
     inline double time() const { return Pa_GetStreamTime(pa_stream); };
     inline uint64_t frames_written() const { return _frames_written; }
     void stop();
 
+    // name of the device that was opened
+    std::string device_name() const;
+
     void queue(float* buf, size_t size);
     size_t samples_queued() const;
+    inline size_t queue_target() const { return _queue_target; };
+    inline size_t queue_capacity() const { return ring_buffer.capacity(); };
+
+    inline uint64_t underrun_count() const { return _underruns; };
+    inline uint64_t overrun_count() const { return _overruns; };
+    void reset_xrun_counts();
+
+    /**
+    * Block until the stream callback has read from the ring buffer.
+    * This is used to wake up the render thread when the device needs more audio.
+    * @param timeout_ms The maximum amount of time to wait for, in milliseconds
+    * @returns False if the timeout elapsed
+    **/
+    bool wait_for_callback(int timeout_ms);
+};
+
+/**
+* Measures how long each block of audio takes to render, relative to the
+* amount of time the block lasts. If rendering takes longer than that,
+* the device will eventually run out of audio. This is written to by the
+* render thread, and can be read from any thread.
+**/
+class DspLoadMeter
+{
+private:
+    std::atomic<float> _load = 0.0f;
+    std::atomic<float> _peak = 0.0f;
+    std::atomic<float> _render_time = 0.0f;
+    std::atomic<float> _block_time = 0.0f;
+    std::atomic<uint64_t> _late_blocks = 0;
+
+public:
+    /**
+    * Record the render time of a block
+    * @param render_time The time it took to render the block, in seconds
+    * @param block_time The duration of the block, in seconds
+    **/
+    void record(double render_time, double block_time);
+    void reset();
+
+    // rolling average of the render time divided by the block time
+    inline float load() const { return _load; };
+
+    // the highest load of a single block, decaying over time
+    inline float peak() const { return _peak; };
+
+    // render time and duration of the last block, in seconds
+    inline float render_time() const { return _render_time; };
+    inline float block_time() const { return _block_time; };
+
+    // amount of blocks that took longer to render than they last
+    inline uint64_t late_blocks() const { return _late_blocks; };
 };
 
 class Song;
@@ -96,10 +221,77 @@ namespace audiomod
         int key;
         float volume;
 
+        // offset of the event from the start of the next processed block, in frames
+        uint32_t frame = 0;
+
+        // for a note on, how many frames into the note to start playing. this is
+        // set for notes that were already sounding when playback started or
+        // jumped. synths that can not start in the middle of a note ignore it
+        uint32_t start_offset = 0;
+
         size_t write_midi(MidiMessage* out) const;
         bool read_midi(const MidiMessage* in);
     };
 
+    /**
+    * The note events for the next block, ordered by frame offset. Synths can
+    * collect events in this from event(), and split their render loop at the
+    * offsets to play the events at the exact frame. It does not allocate.
+    **/
+    class NoteEventList
+    {
+    public:
+        static constexpr size_t CAPACITY = 256;
+
+        /**
+        * Insert an event after all events with the same or an earlier frame offset.
+        * @returns False if the list is full
+        **/
+        bool push(const NoteEvent& event);
+
+        inline void clear() { _count = 0; };
+        inline size_t size() const { return _count; };
+        inline const NoteEvent& operator[](size_t index) const { return _events[index]; };
+
+    private:
+        NoteEvent _events[CAPACITY];
+        size_t _count = 0;
+    };
+
+    struct ProfileStats
+    {
+        uint64_t count;   // amount of times the node was processed
+        double total_us;  // total time spent processing, in microseconds
+        double mean_us;
+        double p99_us;    // 99th percentile, rounded up to the nearest histogram bucket
+        double max_us;
+    };
+
+    /**
+    * A histogram of the time a node takes to process a block. It is written by
+    * whichever thread processes the node, and collected by the ui thread.
+    * Both only use atomic operations, so neither has to wait for the other.
+    **/
+    class NodeProfile
+    {
+    public:
+        // buckets are half an octave wide, starting at 1 ns
+        static constexpr size_t BUCKET_COUNT = 64;
+
+        void record(uint64_t ns);
+
+        // get the statistics recorded since the last call, and reset them
+        ProfileStats collect();
+
+        // the lower bound of a histogram bucket, in nanoseconds
+        static double bucket_start(size_t bucket);
+
+    private:
+        std::atomic<uint32_t> _buckets[BUCKET_COUNT] = {};
+        std::atomic<uint64_t> _total_ns = 0;
+        std::atomic<uint64_t> _max_ns = 0;
+    };
+
     // The actual module
     class ModuleBase;
 
@@ -117,18 +309,26 @@ namespace audiomod
         std::unique_ptr<ModuleBase> _module;
         ModuleContext& modctx;
 
-        std::vector<float*> input_arrays;
         std::vector<ModuleNodeRc> input_nodes;
-
         ModuleNodeRc output_node;
-        float* output_array;
+
+        // index of this node in the plan currently being compiled
+        size_t step_index = 0;
+
+        // true if the output of the last processed block was silent.
+        // this and silent_input_frames are only accessed by the processing thread
+        bool output_silent = false;
+
+        // how many frames all inputs have been silent for, including the current block
+        size_t silent_input_frames = 0;
+
+        NodeProfile _profile;
 
         bool remove_input(ModuleNodeRc& module);
         void add_input(const ModuleNodeRc&& module);
 
     public:
         ModuleNode(ModuleContext& modctx, std::unique_ptr<ModuleBase>&& module);
-        ~ModuleNode();
         
         // Connect this module's output to a node's input
         void connect(ModuleNodeRc& dest);
@@ -152,6 +352,11 @@ namespace audiomod
         inline ModuleNodeRc& get_output() {
             return output_node;
         }
+
+        // processing times of this node, recorded while profiling is enabled in the context
+        inline NodeProfile& profile() {
+            return _profile;
+        }
     };
 
     class ModuleContext
@@ -169,8 +374,120 @@ namespace audiomod
         static constexpr size_t DUMMY_BUFFER_SAMPLE_COUNT = 256;
         float dummy_buffer[DUMMY_BUFFER_SAMPLE_COUNT];
 
+        struct ProcessStep
+        {
+            ModuleNode* node;
+
+            // index of the step this node outputs to, or SIZE_MAX for the destination
+            size_t output_step;
+
+            // index of the buffer in the pool this node writes its output to
+            size_t buffer;
+            float* output;
+
+            // range of this step's entries in the input arrays of the plan
+            size_t first_input;
+            size_t num_inputs;
+
+            // if the node is tapped, its output is interleaved into this buffer
+            float* tap = nullptr;
+        };
+
+        // an immutable, compiled version of the graph. it is built on the thread that
+        // edits the graph and then published to the processing thread, so the processing
+        // thread never reads the connections of the nodes, which may change at any time
+        struct GraphPlan
+        {
+            // flat, topologically sorted list of nodes to process each block.
+            // inputs always come before the node they are connected to, and
+            // the destination node is always last.
+            std::vector<ProcessStep> steps;
+
+            // keeps the nodes alive for as long as the plan may be processed
+            std::vector<ModuleNodeRc> nodes;
+
+            // the step index of each input, and the pointer passed to the module
+            // for each input. these are indexed by ProcessStep::first_input
+            std::vector<size_t> input_steps;
+            std::vector<const float*> inputs;
+
+            // private copies of the inputs, for modules that ask for writable inputs.
+            // null for the inputs of other modules
+            std::vector<float*> input_copies;
+
+            // pool of scratch buffers that node outputs are assigned to.
+            // a buffer is reused by a later node once every node reading from it
+            // is guaranteed to have been processed, so the amount of buffers depends
+            // on the shape of the graph rather than the amount of nodes
+            std::vector<float*> buffers;
+
+            // interleaved copies of the outputs of tapped nodes, indexed by tap
+            std::vector<float*> tap_buffers;
+
+            // parallel processing state. every step is put in the ready queue once
+            // all of its inputs have been processed, and threads take tickets to
+            // pull steps from the queue in order.
+            ThreadPool* thread_pool = nullptr;
+            bool parallel = false;
+
+            // the most steps that can be processed at once. every node has a single
+            // output, so this is the amount of steps without inputs
+            size_t parallelism = 1;
+            std::unique_ptr<std::atomic<size_t>[]> pending_inputs;
+            std::unique_ptr<std::atomic<size_t>[]> ready_queue;
+
+            ~GraphPlan();
+        };
+
+        // alignment of node buffers. every channel of a buffer is aligned
+        // as well when frames_per_buffer is a multiple of 16
+        static constexpr size_t BUFFER_ALIGNMENT = 64;
+
+        // set when the graph was edited, only accessed by the editing thread
+        bool _dirty = true;
+        ThreadPool* _thread_pool = nullptr;
+        std::vector<ModuleNodeRc> _taps;
+
+        // the plan the processing thread uses. replaced plans are retired
+        // to the reclaimer and destroyed once the processing thread is done with them
+        std::atomic<GraphPlan*> _plan = nullptr;
+        EpochReclaimer _reclaimer;
+
+        // if set, the time each node takes to process is recorded in its profile
+        std::atomic<bool> _profiling = false;
+
+        // set for contexts that don't render to an audio device
+        bool _offline = false;
+
+        // the first error reported by a module while processing offline
+        mutable std::mutex _error_mutex;
+        std::string _error;
+
+        // ticket counters for the parallel ready queue
+        std::atomic<size_t> _ready_write = 0;
+        std::atomic<size_t> _ready_read = 0;
+
+        // threads waiting for a step in the ready queue sleep here once they
+        // have spun for a while, and are woken up when a step is posted
+        std::mutex _ready_mutex;
+        std::condition_variable _ready_cond;
+        std::atomic<size_t> _ready_waiters = 0;
+
+        // the plan that is being processed in parallel
+        GraphPlan* _parallel_plan = nullptr;
+
         void make_dirty();
-        void process_node(ModuleNode& node);
+        std::unique_ptr<GraphPlan> compile_graph() const;
+        void assign_buffers(GraphPlan& plan) const;
+        void process_step(const GraphPlan& plan, const ProcessStep& step);
+
+        // how long a thread spins on the ready queue before going to sleep
+        static constexpr int READY_SPIN_US = 20;
+
+        // wait for a step to be posted to a slot of the ready queue
+        size_t wait_ready(const GraphPlan& plan, size_t ticket);
+
+        static void _parallel_task(void* userdata, size_t thread_index);
     
     public:
         ModuleContext(const ModuleContext&) = delete;
@@ -193,18 +510,107 @@ namespace audiomod
             return node;
         }
 
+        /**
+        * Set the thread pool used to process independent parts of the graph
+        * concurrently. If null, the graph is processed on the calling thread.
+        * This takes effect on the next commit. The pool must outlive the context,
+        * or be unset before it is destroyed.
+        **/
+        inline void set_thread_pool(ThreadPool* pool) { _thread_pool = pool; _dirty = true; };
+        inline ThreadPool* thread_pool() const { return _thread_pool; };
+
+        /**
+        * Compile the graph if it was edited since the last commit, and publish it to
+        * the processing thread with an atomic swap. Edits to the graph are not heard
+        * until they are committed. Replaced plans, and the nodes only they reference,
+        * are destroyed here once the processing thread is no longer using them.
+        * This must be called from the thread that edits the graph.
+        **/
+        void commit();
+
+        /**
+        * Used to defer the destruction of objects that the processing thread may
+        * be reading. process() counts as a read.
+        **/
+        inline EpochReclaimer& reclaimer() { return _reclaimer; };
+
+        /**
+        * Enable or disable recording the processing time of each node.
+        * It costs two clock reads per node, so it is off by default.
+        **/
+        inline void set_profiling(bool enabled) { _profiling = enabled; };
+        inline bool profiling() const { return _profiling; };
+
+        /**
+        * Mark the context as rendering offline, such as for an export. Modules
+        * then take as long as they need for each block instead of keeping up
+        * with an audio device. This must be set before the first block is processed.
+        **/
+        inline void set_offline(bool offline) { _offline = offline; };
+        inline bool offline() const { return _offline; };
+
+        /**
+        * Report that a module could not process a block of an offline context
+        * correctly. Only the first error is kept. This may lock, so it must not
+        * be called while processing for an audio device.
+        **/
+        void report_error(const std::string& error);
+
+        // the first error reported with report_error, or an empty string
+        std::string error() const;
+
+        // the amount of scratch buffers allocated for node outputs in the committed graph
+        size_t buffer_pool_size() const;
+
+        /**
+        * Capture the output of a node on every block, such as to render stems
+        * alongside the main mix. This takes effect on the next commit.
+        * @returns The index to pass to tap_output()
+        **/
+        size_t add_tap(const ModuleNodeRc& node);
+
+        // remove all taps. this takes effect on the next commit
+        void clear_taps();
+
+        /**
+        * Get the interleaved output of a tapped node from the last processed block.
+        * The buffer is all zeroes if the node is not connected to the destination,
+        * and null if the tap has not been committed yet.
+        * This may only be called by the processing thread, after process().
+        **/
+        const float* tap_output(size_t tap) const;
+
         inline uint64_t time_in_frames() const { return _frame_time; };
         inline double time_in_seconds() const { return (double)_frame_time / sample_rate; };
 
+        /**
+        * Process one block of audio using the last committed graph.
+        * This never waits on the thread that edits the graph.
+        * Modules work on planar buffers, and this is where they are mixed
+        * down and interleaved for the device.
+        * @param buffer Receives an interleaved buffer of frames_per_buffer frames
+        * @returns The amount of samples in the buffer
+        **/
         size_t process(float* &buffer);
     };
 
     class ModuleBase
     {
+    friend ModuleContext;
+
     protected:
         bool _has_interface;
         bool _interface_shown = false;
 
+        // if set, the module receives private copies of its inputs that it may write to.
+        // otherwise, the input pointers point directly to the output buffers of the
+        // input nodes and must not be modified.
+        bool _writable_inputs = false;
+
+        // set this in process() if the output buffer is known to be all zeroes.
+        // it is reset to false before each call to process().
+        bool _silent_output = false;
+
         virtual void _interface_proc() {};
 
     public:
@@ -237,6 +643,9 @@ namespace audiomod
 
         // does this module have an interface?
         bool has_interface() const;
+
+        // does this module need to write to its input buffers?
+        inline bool writable_inputs() const { return _writable_inputs; };
         
         // render the ImGui interface
         virtual bool render_interface();
@@ -251,7 +660,38 @@ namespace audiomod
         // load a serialized state. return true if successful, otherwise return false
         virtual bool load_state(std::istream& istream, size_t size) { return true; };
 
+        /**
+        * Get the amount of frames this module may continue to produce sound after
+        * its inputs have become silent. Once all inputs have been silent for longer
+        * than this, the module is bypassed and idle() is called instead of process().
+        * If SIZE_MAX, the module is never bypassed.
+        **/
+        virtual size_t tail_frames() const { return SIZE_MAX; };
+
+        /**
+        * Called on the audio thread in place of process() while the module is bypassed.
+        * Modules should use this to read messages sent from the ui thread, so that
+        * state changes are not lost and ui requests are still answered.
+        * @param frames The amount of frames that would have been processed
+        **/
+        virtual void idle(size_t frames) {};
+
+        // was the output of the last processed block silent?
+        inline bool output_silent() const { return _silent_output; };
+
         float* get_audio();
-        virtual void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) = 0;
+
+        /**
+        * Process a block of audio. Buffers are planar: each channel is stored
+        * contiguously, and channel c of a buffer starts at buf + c * frames.
+        * Every sample of the output buffer must be written.
+        * @param inputs The output buffers of the input nodes
+        * @param output The buffer to write to
+        * @param num_inputs The amount of input buffers
+        * @param frames The amount of frames in each channel
+        * @param sample_rate The sample rate of the context
+        * @param channel_count The amount of channels in each buffer
+        **/
+        virtual void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) = 0;
     };
 }
\ No newline at end of file
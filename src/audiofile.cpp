@@ -1,25 +1,99 @@
 #include "audiofile.h"
 #include "sys.h"
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 
 namespace audiofile {
-    WavWriter::WavWriter(std::ostream& stream, size_t total_frames, uint16_t channels, uint32_t sample_rate) :
-    _channels(channels),
+    size_t bytes_per_sample(SampleFormat format)
+    {
+        switch (format)
+        {
+            case SampleFormat::Int16: return 2;
+            case SampleFormat::Int24: return 3;
+            case SampleFormat::Float32: return 4;
+        }
+
+        return 0;
+    }
+
+    Quantizer::Quantizer(int bits, bool dither)
+    :   _scale((float)(1 << (bits - 1))),
+        _dither(dither)
+    {}
+
+    void Quantizer::process(const float* input, int32_t* output, size_t count)
+    {
+        const float scale = _scale;
+        const float max_value = scale - 1.0f;
+
+        // tpdf dither is the sum of two uniform random values of
+        // +-0.5 LSB each. it is generated ahead so the conversion
+        // loop below stays simple enough to vectorize
+        float noise[BATCH_SIZE];
+
+        if (_dither)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                // xorshift32
+                uint32_t x = _rng_state;
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                _rng_state = x;
+
+                // the two halves of the random number are the two uniform values
+                float a = (float)(x & 0xFFFF) / 65536.0f;
+                float b = (float)(x >> 16) / 65536.0f;
+                noise[i] = a - b;
+            }
+        }
+        else
+        {
+            memset(noise, 0, count * sizeof(float));
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            float v = input[i] * scale + noise[i];
+            v = std::min(std::max(v, -scale), max_value);
+
+            // round to nearest, then clamp again since
+            // rounding may have pushed the sample past the max
+            int32_t s = (int32_t)(v + (v >= 0.0f ? 0.5f : -0.5f));
+            output[i] = std::min(s, (int32_t)max_value);
+        }
+    }
+
+    WavWriter::WavWriter(
+        std::ostream& stream,
+        size_t total_frames,
+        uint16_t channels,
+        uint32_t sample_rate,
+        SampleFormat format,
+        bool dither
+    ) :
+    Writer(total_frames * channels),
     stream(stream),
-    total_samples(total_frames * channels),
-    written_samples(0)
+    _channels(channels),
+    _format(format),
+    _quantizer(format == SampleFormat::Int24 ? 24 : 16, dither && format != SampleFormat::Float32),
+    _buffer(BUFFER_SIZE)
     {
-        // TODO: 24-bit samples?
-        const uint32_t BYTES_PER_SAMPLE = sizeof(uint16_t);
+        const uint32_t BYTES_PER_SAMPLE = bytes_per_sample(format);
         uint32_t num_samples = total_frames * channels;
         uint32_t chunk_size = num_samples * BYTES_PER_SAMPLE;
 
+        // 1 = integer pcm, 3 = ieee float
+        uint16_t audio_format = format == SampleFormat::Float32 ? 3 : 1;
+
         // write wav header
         stream << "RIFF";
         push_bytes(stream, (uint32_t)(36 + chunk_size));
         stream << "WAVEfmt ";
-        push_bytes(stream, (uint32_t)16); // pcm mode
-        push_bytes(stream, (uint16_t)1); // audio format
+        push_bytes(stream, (uint32_t)16); // fmt chunk size
+        push_bytes(stream, audio_format); // audio format
         push_bytes(stream, channels); // number of channels
         push_bytes(stream, sample_rate); // sample rate
         push_bytes(stream, (uint32_t)(sample_rate * channels * BYTES_PER_SAMPLE)); // byte rate
@@ -31,19 +105,177 @@ namespace audiofile {
         push_bytes(stream, chunk_size); // chunk size
     }
 
-    void WavWriter::write_block(float* data, size_t size) {
-        for (size_t i = 0; i < size; i++) {
-            if (written_samples >= total_samples) break;
+    WavWriter::~WavWriter()
+    {
+        flush();
+    }
+
+    void WavWriter::flush()
+    {
+        if (_buffer_used == 0) return;
+        stream.write(_buffer.data(), _buffer_used);
+        _buffer_used = 0;
+    }
+
+    void WavWriter::encode(const float* data, size_t count)
+    {
+        const size_t sample_size = bytes_per_sample(_format);
+        if (_buffer_used + count * sample_size > _buffer.size())
+            flush();
 
-            float float_smp = data[i];
-            if (float_smp > 1.0f) float_smp = 1.0f;
-            if (float_smp < -1.0f) float_smp = -1.0f;
+        char* out = _buffer.data() + _buffer_used;
+        _buffer_used += count * sample_size;
 
-            //float int_smp = (float_smp + 1.0f) / 2.0f * UINT16_MAX;
-            float int_smp = float_smp * INT16_MAX;
-            push_bytes(stream, (int16_t)int_smp);
+        if (_format == SampleFormat::Float32)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                uint32_t bits;
+                memcpy(&bits, data + i, sizeof(bits));
 
-            written_samples++;
+                out[i * 4 + 0] = (char)(bits);
+                out[i * 4 + 1] = (char)(bits >> 8);
+                out[i * 4 + 2] = (char)(bits >> 16);
+                out[i * 4 + 3] = (char)(bits >> 24);
+            }
+
+            return;
+        }
+
+        int32_t quantized[Quantizer::BATCH_SIZE];
+        _quantizer.process(data, quantized, count);
+
+        if (_format == SampleFormat::Int16)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                out[i * 2 + 0] = (char)(quantized[i]);
+                out[i * 2 + 1] = (char)(quantized[i] >> 8);
+            }
         }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                out[i * 3 + 0] = (char)(quantized[i]);
+                out[i * 3 + 1] = (char)(quantized[i] >> 8);
+                out[i * 3 + 2] = (char)(quantized[i] >> 16);
+            }
+        }
+    }
+
+    void WavWriter::write_block(const float* data, size_t size) {
+        size = std::min(size, total_samples - written_samples);
+
+        for (size_t i = 0; i < size; i += Quantizer::BATCH_SIZE)
+            encode(data + i, std::min(Quantizer::BATCH_SIZE, size - i));
+
+        written_samples += size;
+    }
+}
+
+
+
+#ifdef UNIT_TESTS
+#include <catch2/catch_amalgamated.hpp>
+#include <sstream>
+#include <cmath>
+
+// read the sample data of a wav file written by a WavWriter
+static std::string wav_data(const std::string& file)
+{
+    // the header is always 44 bytes long
+    return file.substr(44);
+}
+
+TEST_CASE("WavWriter 16-bit output", "[audiofile]")
+{
+    std::stringstream stream;
+    const float samples[] = { 0.0f, 1.0f, -1.0f, 0.5f, 2.0f, -2.0f };
+
+    {
+        audiofile::WavWriter writer(stream, 3, 2, 48000);
+        writer.write_block(samples, 6);
     }
-}
\ No newline at end of file
+
+    std::string data = wav_data(stream.str());
+    REQUIRE(data.size() == 12);
+
+    auto sample = [&](size_t i) {
+        return (int16_t)((uint8_t)data[i * 2] | ((uint8_t)data[i * 2 + 1] << 8));
+    };
+
+    REQUIRE(sample(0) == 0);
+    REQUIRE(sample(1) == 32767);
+    REQUIRE(sample(2) == -32768);
+    REQUIRE(sample(3) == 16384);
+    REQUIRE(sample(4) == 32767);
+    REQUIRE(sample(5) == -32768);
+}
+
+TEST_CASE("WavWriter 24-bit and float output", "[audiofile]")
+{
+    const float samples[] = { 0.25f, -0.25f };
+
+    std::stringstream stream24;
+    {
+        audiofile::WavWriter writer(stream24, 1, 2, 48000, audiofile::SampleFormat::Int24);
+        writer.write_block(samples, 2);
+    }
+
+    std::string data24 = wav_data(stream24.str());
+    REQUIRE(data24.size() == 6);
+
+    auto sample24 = [&](size_t i) {
+        int32_t v = (uint8_t)data24[i * 3] | ((uint8_t)data24[i * 3 + 1] << 8) | ((uint8_t)data24[i * 3 + 2] << 16);
+        if (v & 0x800000) v -= 0x1000000;
+        return v;
+    };
+
+    REQUIRE(sample24(0) == 2097152);
+    REQUIRE(sample24(1) == -2097152);
+
+    std::stringstream stream32;
+    {
+        audiofile::WavWriter writer(stream32, 1, 2, 48000, audiofile::SampleFormat::Float32);
+        writer.write_block(samples, 2);
+    }
+
+    std::string data32 = wav_data(stream32.str());
+    REQUIRE(data32.size() == 8);
+
+    float read[2];
+    memcpy(read, data32.data(), sizeof(read)); // assumes a little-endian machine
+    REQUIRE(read[0] == 0.25f);
+    REQUIRE(read[1] == -0.25f);
+}
+
+TEST_CASE("WavWriter dither stays within one LSB", "[audiofile]")
+{
+    const size_t count = 4096;
+    std::vector<float> samples(count, 0.1f);
+    std::stringstream stream;
+
+    {
+        audiofile::WavWriter writer(stream, count, 1, 48000, audiofile::SampleFormat::Int16, true);
+        writer.write_block(samples.data(), count);
+    }
+
+    std::string data = wav_data(stream.str());
+    REQUIRE(data.size() == count * 2);
+
+    const float expected = 0.1f * 32768.0f;
+    double sum = 0.0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        int16_t s = (int16_t)((uint8_t)data[i * 2] | ((uint8_t)data[i * 2 + 1] << 8));
+        REQUIRE(fabsf(s - expected) <= 1.5f);
+        sum += s;
+    }
+
+    // the noise averages out
+    REQUIRE(fabs(sum / count - expected) < 0.1);
+}
+
+#endif
@@ -2,21 +2,166 @@
 #include <cstddef>
 #include <cstdint>
 #include <ostream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace audiofile {
-    class WavWriter {
+    enum class SampleFormat : uint8_t {
+        Int16,
+        Int24,
+        Float32
+    };
+
+    // the amount of bytes a sample takes up in a file
+    size_t bytes_per_sample(SampleFormat format);
+
+    /**
+    * Converts float samples to integers of a given bit depth,
+    * optionally adding TPDF dither before rounding.
+    **/
+    class Quantizer {
     private:
-        std::ostream& stream;
+        float _scale;
+        bool _dither;
 
-        int _channels;
+        // state of the random number generator used for dithering
+        uint32_t _rng_state = 0x9E3779B9;
 
     public:
-        WavWriter(std::ostream& stream, size_t total_frames, uint16_t channels, uint32_t sample_rate);
+        // samples are converted in batches of this size
+        static constexpr size_t BATCH_SIZE = 1024;
+
+        Quantizer(int bits, bool dither);
+
+        // convert up to BATCH_SIZE samples
+        void process(const float* input, int32_t* output, size_t count);
+    };
+
+    // base class for writers of audio files
+    class Writer {
+    public:
+        Writer(size_t total_samples) : total_samples(total_samples), written_samples(0) {};
+        virtual ~Writer() = default;
 
         size_t total_samples;
         size_t written_samples;
 
-        // Write a block of audio data to the stream
-        void write_block(float* data, size_t size);
+        // Write a block of interleaved audio data to the stream.
+        // Anything past total_samples is ignored.
+        virtual void write_block(const float* data, size_t size) = 0;
+
+        // Write all buffered samples to the stream. This must be called
+        // after the last block is written and before the stream is closed.
+        virtual void flush() = 0;
+    };
+
+    class WavWriter : public Writer {
+    private:
+        std::ostream& stream;
+
+        int _channels;
+        SampleFormat _format;
+        Quantizer _quantizer;
+
+        // encoded samples waiting to be written to the stream. they are
+        // written in large chunks, since writes to a stream are slow
+        static constexpr size_t BUFFER_SIZE = 1 << 16;
+        std::vector<char> _buffer;
+        size_t _buffer_used = 0;
+
+        void encode(const float* data, size_t count);
+
+    public:
+        /**
+        * Write the header of a wav file to a stream. The samples are written with write_block.
+        * @param format The format samples are stored as in the file
+        * @param dither If true, TPDF dither is added before samples are rounded to
+        *               integers. This has no effect on floating-point formats.
+        **/
+        WavWriter(
+            std::ostream& stream,
+            size_t total_frames,
+            uint16_t channels,
+            uint32_t sample_rate,
+            SampleFormat format = SampleFormat::Int16,
+            bool dither = false
+        );
+
+        // flushes the buffered samples to the stream
+        ~WavWriter();
+
+        WavWriter(const WavWriter&) = delete;
+
+        void write_block(const float* data, size_t size) override;
+        void flush() override;
+    };
+
+    /**
+    * Writes a FLAC file. Each channel of a block is encoded with whichever of the
+    * fixed predictors or an LPC predictor compresses best, and stereo blocks also
+    * try the FLAC side channel modes. Blocks are encoded on a separate thread, so
+    * compression overlaps with whatever produces the samples.
+    **/
+    class FlacWriter : public Writer {
+    private:
+        std::ostream& stream;
+
+        int _channels;
+        int _bits;
+        Quantizer _quantizer;
+
+        // frames per FLAC block
+        static constexpr size_t BLOCK_SIZE = 4096;
+
+        // the amount of blocks that can wait to be encoded before write_block waits
+        static constexpr size_t QUEUE_CAPACITY = 8;
+
+        struct Block {
+            uint32_t number;
+            size_t frames;
+            std::vector<int32_t> samples; // planar
+        };
+
+        // the block being filled by write_block
+        Block _block;
+        uint32_t _block_count = 0;
+
+        std::deque<Block> _queue;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        bool _encoding = false;
+        bool _quit = false;
+        std::thread _thread;
+
+        void _thread_proc();
+        void encode_block(const Block& block, std::vector<uint8_t>& out) const;
+        void submit_block();
+
+    public:
+        /**
+        * Write the header of a FLAC file to a stream. The samples are written with write_block.
+        * @param format Int16 or Int24. FLAC does not store floating-point samples,
+        *               so Float32 is written as 24-bit
+        * @param dither If true, TPDF dither is added before samples are rounded to integers.
+        **/
+        FlacWriter(
+            std::ostream& stream,
+            size_t total_frames,
+            uint16_t channels,
+            uint32_t sample_rate,
+            SampleFormat format = SampleFormat::Int16,
+            bool dither = false
+        );
+
+        // flushes the buffered samples to the stream
+        ~FlacWriter();
+
+        FlacWriter(const FlacWriter&) = delete;
+
+        void write_block(const float* data, size_t size) override;
+        void flush() override;
     };
 }
@@ -0,0 +1,263 @@
+/**
+* Buffers for reading and writing little-endian binary data in memory.
+* These replace push_bytes and pull_bytes where large amounts of data are
+* handled, since going through a stream one byte at a time is slow.
+**/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include "sys.h"
+
+// appends binary data to a growing buffer
+class BinaryWriter
+{
+private:
+    std::vector<uint8_t> _data;
+
+public:
+    inline const uint8_t* data() const { return _data.data(); }
+    inline size_t size() const { return _data.size(); }
+
+    // take the written data, leaving the writer empty
+    inline std::vector<uint8_t> release()
+    {
+        std::vector<uint8_t> out;
+        out.swap(_data);
+        return out;
+    }
+
+    inline void put_bytes(const void* src, size_t size)
+    {
+        const uint8_t* bytes = (const uint8_t*)src;
+        _data.insert(_data.end(), bytes, bytes + size);
+    }
+
+    template <typename T>
+    inline void put(T value)
+    {
+        value = swap_little_endian(value);
+        put_bytes(&value, sizeof(T));
+    }
+
+    // write an array of values. on little-endian machines this is a single copy
+    template <typename T>
+    inline void put_array(const T* values, size_t count)
+    {
+        if (!IS_BIG_ENDIAN)
+            put_bytes(values, count * sizeof(T));
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+                put(values[i]);
+        }
+    }
+
+    // write a string prefixed with its length as a value of type L
+    template <typename L>
+    inline void put_string(const std::string& str)
+    {
+        put((L)str.size());
+        put_bytes(str.data(), str.size());
+    }
+
+    // pad with zeroes until the size is a multiple of alignment
+    inline void align(size_t alignment)
+    {
+        _data.resize((_data.size() + alignment - 1) / alignment * alignment, 0);
+    }
+
+    // reserve space for a value that is written later with patch
+    template <typename T>
+    inline size_t reserve()
+    {
+        size_t offset = _data.size();
+        _data.resize(offset + sizeof(T), 0);
+        return offset;
+    }
+
+    inline void patch_bytes(size_t offset, const void* src, size_t size)
+    {
+        memcpy(_data.data() + offset, src, size);
+    }
+
+    template <typename T>
+    inline void patch(size_t offset, T value)
+    {
+        value = swap_little_endian(value);
+        patch_bytes(offset, &value, sizeof(T));
+    }
+};
+
+/**
+* Reads binary data from a block of memory, which is not copied.
+* Reading past the end sets an error flag and returns zeroes,
+* so a value only has to be checked with ok() after a section is read.
+**/
+class BinaryReader
+{
+private:
+    const uint8_t* _data;
+    size_t _size;
+    size_t _pos = 0;
+    bool _ok = true;
+
+public:
+    BinaryReader(const uint8_t* data, size_t size) : _data(data), _size(size) {};
+
+    inline bool ok() const { return _ok; }
+    inline size_t pos() const { return _pos; }
+    inline size_t size() const { return _size; }
+    inline size_t remaining() const { return _size - _pos; }
+
+    // mark the data as invalid, e.g. if a value is out of range
+    inline void fail() { _ok = false; }
+
+    // returns a pointer to the next size bytes, or nullptr if there are not enough
+    inline const uint8_t* get_bytes(size_t size)
+    {
+        if (!_ok || size > _size - _pos)
+        {
+            _ok = false;
+            return nullptr;
+        }
+
+        const uint8_t* ptr = _data + _pos;
+        _pos += size;
+        return ptr;
+    }
+
+    template <typename T>
+    inline T get()
+    {
+        T value{};
+        const uint8_t* ptr = get_bytes(sizeof(T));
+        if (ptr == nullptr) return value;
+
+        memcpy(&value, ptr, sizeof(T));
+        return swap_little_endian(value);
+    }
+
+    // read an array of values. on little-endian machines this is a single copy
+    template <typename T>
+    inline bool get_array(T* values, size_t count)
+    {
+        if (count > remaining() / sizeof(T))
+        {
+            _ok = false;
+            return false;
+        }
+
+        const uint8_t* ptr = get_bytes(count * sizeof(T));
+        if (ptr == nullptr) return false;
+
+        memcpy(values, ptr, count * sizeof(T));
+
+        if (IS_BIG_ENDIAN)
+        {
+            for (size_t i = 0; i < count; i++)
+                values[i] = swap_little_endian(values[i]);
+        }
+
+        return true;
+    }
+
+    // read a string prefixed with its length as a value of type L
+    template <typename L>
+    inline bool get_string(std::string& str)
+    {
+        L size = get<L>();
+        const uint8_t* ptr = get_bytes(size);
+        if (ptr == nullptr) return false;
+
+        str.assign((const char*)ptr, size);
+        return true;
+    }
+
+    // skip bytes until the position is a multiple of alignment
+    inline void align(size_t alignment)
+    {
+        size_t next = (_pos + alignment - 1) / alignment * alignment;
+        get_bytes(next - _pos);
+    }
+};
+
+// a read-only stream buffer over a block of memory, so it can be read
+// with an std::istream without copying it into a stringstream first
+class MemoryStreamBuf : public std::streambuf
+{
+public:
+    MemoryStreamBuf(const uint8_t* data, size_t size)
+    {
+        char* begin = (char*)data;
+        setg(begin, begin, begin + size);
+    }
+
+protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+    {
+        if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+
+        char* pos;
+        if (dir == std::ios_base::beg) pos = eback() + off;
+        else if (dir == std::ios_base::cur) pos = gptr() + off;
+        else pos = egptr() + off;
+
+        if (pos < eback() || pos > egptr()) return pos_type(off_type(-1));
+
+        setg(eback(), pos, egptr());
+        return pos_type(pos - eback());
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+};
+
+// a stream buffer that appends everything written to it to a BinaryWriter
+class WriterStreamBuf : public std::streambuf
+{
+private:
+    BinaryWriter& _writer;
+    size_t _start;
+
+public:
+    WriterStreamBuf(BinaryWriter& writer) : _writer(writer), _start(writer.size()) {};
+
+    // the amount of bytes written through this stream buffer
+    inline size_t written() const { return _writer.size() - _start; }
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        if (ch != traits_type::eof())
+        {
+            char c = traits_type::to_char_type(ch);
+            _writer.put_bytes(&c, 1);
+        }
+
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize count) override
+    {
+        _writer.put_bytes(s, count);
+        return count;
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+    {
+        // only telling the position is supported
+        if (off == 0 && dir == std::ios_base::cur && (which & std::ios_base::out))
+            return pos_type(written());
+
+        return pos_type(off_type(-1));
+    }
+};
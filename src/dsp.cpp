@@ -2,86 +2,83 @@
 
 #include <cstring>
 
-size_t convert_from_stereo(float* src, float** dest, size_t channel_count, size_t frames_per_buffer, bool interleave)
+void mix_buffers(float* dest, const float** src, size_t src_count, size_t sample_count, float gain)
 {
-    size_t sample_count;
-    size_t buffer_size = frames_per_buffer * 2;
-
-    if (channel_count == 1)
+    if (src_count == 0)
     {
-        float* dest_mono = dest[0];
+        memset(dest, 0, sample_count * sizeof(float));
+        return;
+    }
 
-        if (interleave)
-        {
-            // send interleaved buffer
-            sample_count = buffer_size;
-            memcpy(dest_mono, src, buffer_size);
-        }
-        else // convert to mono
-        {
-            sample_count = frames_per_buffer;
-            for (size_t i = 0; i < frames_per_buffer; i++)
-                dest_mono[i] = src[i * 2] + src[i * 2 + 1];
-        }
+    const float* first = src[0];
+    for (size_t i = 0; i < sample_count; i++)
+        dest[i] = first[i] * gain;
+
+    for (size_t k = 1; k < src_count; k++)
+    {
+        const float* buf = src[k];
+        for (size_t i = 0; i < sample_count; i++)
+            dest[i] += buf[i] * gain;
     }
+}
 
-    // separate each channel
-    else if (channel_count == 2)
+void connect_stereo_inputs(const float* src, float** scratch, const float** ports, size_t port_count, size_t frames)
+{
+    // mono: sum both channels
+    if (port_count == 1)
     {
-        sample_count = frames_per_buffer;
+        float* mono = scratch[0];
+        for (size_t i = 0; i < frames; i++)
+            mono[i] = src[i] + src[frames + i];
 
-        for (size_t i = 0; i < frames_per_buffer; i++)
-        {
-            dest[0][i] = src[i * 2];
-            dest[1][i] = src[i * 2 + 1];
-        }
+        ports[0] = mono;
     }
 
-    // unsupported channel count, initialize buffers to 0
-    else
+    // stereo: read the channels in place
+    else if (port_count == 2)
     {
-        sample_count = frames_per_buffer;
-
-        for (int c = 0; c < channel_count; c++)
-            for (int i = 0; i < frames_per_buffer; i++)
-                dest[c][i] = 0.0f;
+        ports[0] = src;
+        ports[1] = src + frames;
     }
 
-    return sample_count;
+    // unsupported channel count, read silence
+    else
+    {
+        for (size_t c = 0; c < port_count; c++)
+        {
+            memset(scratch[c], 0, frames * sizeof(float));
+            ports[c] = scratch[c];
+        }
+    }
 }
 
-void convert_to_stereo(float** src, float* dest, size_t channel_count, size_t frames_per_buffer, bool interleave)
+void connect_stereo_outputs(float* dest, float** scratch, float** ports, size_t port_count, size_t frames)
 {
-    size_t buffer_size = frames_per_buffer * 2;
-
-    // mono
-    if (channel_count == 1)
+    if (port_count == 2)
     {
-        float* buf = src[0];
-
-        if (interleave) {
-            memcpy(dest, src, buffer_size);
-        } else {
-            for (size_t i = 0; i < frames_per_buffer; i++) {
-                dest[i * 2] = buf[i];
-                dest[i * 2 + 1] = buf[i];
-            }
-        }
+        ports[0] = dest;
+        ports[1] = dest + frames;
     }
+    else
+    {
+        for (size_t c = 0; c < port_count; c++)
+            ports[c] = scratch[c];
+    }
+}
 
-    // stereo
-    else if (channel_count == 2)
+void finish_stereo_outputs(float* dest, float** scratch, size_t port_count, size_t frames)
+{
+    // mono: copy to both channels
+    if (port_count == 1)
     {
-        for (size_t i = 0; i < frames_per_buffer; i++) {
-            dest[i * 2] = src[0][i];
-            dest[i * 2 + 1] = src[1][i];
-        }
+        memcpy(dest, scratch[0], frames * sizeof(float));
+        memcpy(dest + frames, scratch[0], frames * sizeof(float));
     }
 
     // unsupported channel count, set to 0
-    else
+    else if (port_count != 2)
     {
-        memset(dest, 0, buffer_size * sizeof(float));
+        memset(dest, 0, frames * 2 * sizeof(float));
     }
 }
 
@@ -1,8 +1,43 @@
 #pragma once
 #include "util.h"
 
-size_t convert_from_stereo(float* src, float** dest, size_t channel_count, size_t frames_per_buffer, bool interleave);
-void convert_to_stereo(float** src, float* dest, size_t channel_count, size_t frames_per_buffer, bool interleave);
+/**
+* Sum a list of buffers into dest, scaled by a gain.
+* Buffers in the module graph are planar, so a whole block can be
+* mixed in one pass regardless of the channel count.
+* @param dest The buffer to write to. It is cleared if there are no sources
+* @param src The buffers to mix
+* @param src_count The amount of buffers to mix
+* @param sample_count The amount of samples in each buffer, over all channels
+**/
+void mix_buffers(float* dest, const float** src, size_t src_count, size_t sample_count, float gain = 1.0f);
+
+/**
+* Get the buffers a plugin's audio input ports should be connected to
+* for a planar stereo input. A stereo plugin reads the input channels in place.
+* A mono plugin reads the sum of both channels, which is written to scratch[0].
+* Other port counts read silence from the scratch buffers.
+* @param src The planar stereo input
+* @param scratch One frames-long buffer per port
+* @param ports Receives the buffer for each port
+* @param port_count The amount of audio input ports
+* @param frames The amount of frames in the block
+**/
+void connect_stereo_inputs(const float* src, float** scratch, const float** ports, size_t port_count, size_t frames);
+
+/**
+* Get the buffers a plugin's audio output ports should be connected to
+* for a planar stereo output. A stereo plugin writes to the output channels in place.
+* Other port counts write to the scratch buffers, and finish_stereo_outputs
+* must be called after the plugin has run.
+**/
+void connect_stereo_outputs(float* dest, float** scratch, float** ports, size_t port_count, size_t frames);
+
+/**
+* Write the output of a plugin that was not connected in place to dest.
+* A mono output is copied to both channels, other port counts produce silence.
+**/
+void finish_stereo_outputs(float* dest, float** scratch, size_t port_count, size_t frames);
 
 // 2nd-order IIR filters
 class Filter2ndOrder
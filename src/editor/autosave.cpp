@@ -0,0 +1,688 @@
+#include "editor.h"
+#include "../binio.h"
+#include "../sys.h"
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <limits>
+
+// the journal is a header followed by records of the form
+// { u32 payload size, u32 checksum, payload }. the first byte of the
+// payload tells whether it is a whole project file or a single chunk
+static constexpr uint32_t JOURNAL_VERSION = 1;
+static constexpr uint8_t RECORD_SNAPSHOT = 0;
+static constexpr uint8_t RECORD_CHUNK = 1;
+
+// the journal is compacted once it grows past this many bytes more than the project file
+static constexpr size_t COMPACT_SLACK = 1024 * 1024;
+
+// FNV-1a
+static uint32_t checksum(const uint8_t* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void put_journal_header(BinaryWriter& w)
+{
+    w.put_bytes("SnBj", 4);
+    w.put<uint32_t>(JOURNAL_VERSION);
+}
+
+static void put_record(BinaryWriter& w, const BinaryWriter& payload)
+{
+    w.put<uint32_t>((uint32_t) payload.size());
+    w.put<uint32_t>(checksum(payload.data(), payload.size()));
+    w.put_bytes(payload.data(), payload.size());
+}
+
+static void put_snapshot_record(BinaryWriter& w, const std::vector<ProjectChunk>& chunks)
+{
+    BinaryWriter image;
+    Song::write_chunks(image, chunks);
+
+    BinaryWriter payload;
+    payload.put<uint8_t>(RECORD_SNAPSHOT);
+    payload.put_bytes(image.data(), image.size());
+    put_record(w, payload);
+}
+
+static void put_chunk_record(BinaryWriter& w, const ProjectChunk& chunk)
+{
+    BinaryWriter payload;
+    payload.put<uint8_t>(RECORD_CHUNK);
+    payload.put_bytes(chunk.id.id, 4);
+    payload.put<uint32_t>(chunk.id.index);
+    payload.put_bytes(chunk.data.data(), chunk.data.size());
+    put_record(w, payload);
+}
+
+static std::vector<ProjectChunk>::iterator find_chunk(std::vector<ProjectChunk>& chunks, const ProjectChunkId& id)
+{
+    return std::find_if(chunks.begin(), chunks.end(), [&](const ProjectChunk& chunk) {
+        return chunk.id == id;
+    });
+}
+
+/**
+* Replay the records of a journal. Reading stops at the first record that is
+* incomplete or does not match its checksum, which is where a crash
+* interrupted the last write.
+* @returns false if the journal does not start with a snapshot
+**/
+static bool read_journal(const uint8_t* data, size_t size, std::vector<ProjectChunk>& chunks)
+{
+    BinaryReader r(data, size);
+    const uint8_t* magic_number = r.get_bytes(4);
+    uint32_t version = r.get<uint32_t>();
+
+    if (!r.ok() || memcmp(magic_number, "SnBj", 4) != 0 || version != JOURNAL_VERSION) return false;
+
+    bool has_snapshot = false;
+
+    while (r.remaining() > 0)
+    {
+        uint32_t payload_size = r.get<uint32_t>();
+        uint32_t sum = r.get<uint32_t>();
+        const uint8_t* payload = r.get_bytes(payload_size);
+
+        if (!r.ok() || payload_size == 0 || checksum(payload, payload_size) != sum) break;
+
+        BinaryReader p(payload, payload_size);
+        uint8_t kind = p.get<uint8_t>();
+
+        if (kind == RECORD_SNAPSHOT)
+        {
+            if (!Song::read_chunks(payload + p.pos(), p.remaining(), chunks)) break;
+            has_snapshot = true;
+        }
+        else if (kind == RECORD_CHUNK && has_snapshot)
+        {
+            const char* id = (const char*) p.get_bytes(4);
+            uint32_t index = p.get<uint32_t>();
+            if (!p.ok()) break;
+
+            auto it = find_chunk(chunks, ProjectChunkId(id, index));
+            if (it == chunks.end()) break;
+
+            it->data.assign(payload + p.pos(), payload + payload_size);
+        }
+        else break;
+    }
+
+    return has_snapshot;
+}
+
+// write a file next to its destination, then move it over the destination,
+// so a crash never leaves a half-written file in its place
+static bool replace_file(const std::filesystem::path& path, const BinaryWriter& contents)
+{
+    std::filesystem::path tmp_path = path;
+    tmp_path += ".tmp";
+
+    std::ofstream file(tmp_path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file.is_open()) return false;
+
+    file.write((const char*) contents.data(), contents.size());
+    file.close();
+
+    std::error_code ec;
+    if (file.fail())
+    {
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+
+    std::filesystem::rename(tmp_path, path, ec);
+    return !ec;
+}
+
+Autosave::Autosave(const std::filesystem::path& directory, const Song& song)
+:   _journal_path(directory/"autosave.journal"),
+    _recovery_path(directory/"recovered.journal")
+{
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+
+    // a journal that is still there means the last session did not exit cleanly
+    if (std::filesystem::exists(_journal_path, ec))
+        std::filesystem::rename(_journal_path, _recovery_path, ec);
+
+    rebase(song, true);
+    _thread = std::thread(&Autosave::_thread_proc, this);
+}
+
+Autosave::~Autosave()
+{
+    {
+        std::lock_guard lock(_queue_mutex);
+        _running = false;
+    }
+
+    _queue_cond.notify_one();
+    _thread.join();
+
+    // the session ended normally, so there is nothing to recover
+    remove_journal();
+}
+
+Autosave::Shape Autosave::shape_of(const Song& song)
+{
+    return Shape {
+        song.channels.size(),
+        song.length(),
+        song.max_patterns(),
+        song.fx_mixer.size()
+    };
+}
+
+//////////////////////
+// UI THREAD        //
+//////////////////////
+
+void Autosave::send(Request&& request)
+{
+    {
+        std::lock_guard lock(_queue_mutex);
+        _queue.push_back(std::move(request));
+    }
+
+    _queue_cond.notify_one();
+}
+
+void Autosave::mark_dirty(const ProjectChunkId& chunk)
+{
+    if (std::find(_dirty.begin(), _dirty.end(), chunk) == _dirty.end())
+        _dirty.push_back(chunk);
+}
+
+void Autosave::record(const change::Action& action)
+{
+    // an edit during a snapshot means it no longer matches the file on disk
+    _build_clean = false;
+
+    auto effect_target = [](int target_index, change::FXRackTargetType target_type) {
+        if (target_type == change::FXRackTargetType::TargetFXBus)
+            return ProjectChunkId("MIXR");
+
+        return ProjectChunkId("CHAN", target_index);
+    };
+
+    switch (action.get_type())
+    {
+        case change::SongTempo:
+            mark_dirty("SONG");
+            break;
+
+        case change::ChannelVolume:
+            mark_dirty(ProjectChunkId("CHAN", static_cast<const change::ChangeChannelVolume&>(action).channel_index));
+            break;
+
+        case change::ChannelPanning:
+            mark_dirty(ProjectChunkId("CHAN", static_cast<const change::ChangeChannelPanning&>(action).channel_index));
+            break;
+
+        case change::ChannelOutput:
+            mark_dirty(ProjectChunkId("CHAN", static_cast<const change::ChangeChannelOutput&>(action).channel_index));
+            break;
+
+        case change::AddEffect: {
+            auto& effect = static_cast<const change::ChangeAddEffect&>(action);
+            mark_dirty(effect_target(effect.target_index, effect.target_type));
+            break;
+        }
+
+        case change::RemoveEffect: {
+            auto& effect = static_cast<const change::ChangeRemoveEffect&>(action);
+            mark_dirty(effect_target(effect.target_index, effect.target_type));
+            break;
+        }
+
+        case change::SwapEffect: {
+            auto& effect = static_cast<const change::ChangeSwapEffect&>(action);
+            mark_dirty(effect_target(effect.target_index, effect.target_type));
+            break;
+        }
+
+        case change::NoteAdd:
+            mark_dirty(ProjectChunkId("CHAN", static_cast<const change::ChangeAddNote&>(action).channel_index));
+            break;
+
+        case change::NoteRemove:
+            mark_dirty(ProjectChunkId("CHAN", static_cast<const change::ChangeRemoveNote&>(action).channel_index));
+            break;
+
+        case change::NoteChange:
+            mark_dirty(ProjectChunkId("CHAN", static_cast<const change::ChangeNote&>(action).channel_index));
+            break;
+
+        case change::SequenceChange:
+            mark_dirty(ProjectChunkId("CHAN", static_cast<const change::ChangeSequence&>(action).channel));
+            break;
+
+        // changes to the structure of the song, and anything else, are written as a snapshot
+        default:
+            _structure_dirty = true;
+            break;
+    }
+}
+
+void Autosave::begin_snapshot(const Song& song, bool clean)
+{
+    _building = true;
+    _build_clean = clean;
+    _build_shape = shape_of(song);
+    _build.clear();
+    _build_pos = 0;
+    _structure_dirty = false;
+
+    for (const ProjectChunkId& id : song.chunk_ids())
+        _build.push_back({ id, {} });
+
+    _build_versions.assign(_build.size(), 0);
+}
+
+// serialize the snapshot for up to the given amount of seconds, and
+// send it to the io thread once it is done
+void Autosave::continue_snapshot(const Song& song, double budget)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // edits are picked up by comparing chunk versions once the snapshot is done
+    _dirty.clear();
+
+    // the rest of the song is serialized a few chunks per frame
+    while (_build_pos < _build.size())
+    {
+        BinaryWriter w;
+        _build_versions[_build_pos] = song.chunk_version(_build[_build_pos].id);
+        song.serialize_chunk(w, _build[_build_pos].id);
+        _build[_build_pos++].data = w.release();
+
+        if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= budget)
+            break;
+    }
+
+    if (_build_pos < _build.size()) return;
+
+    // not every edit goes through the undo stack, so any chunk that changed after
+    // it was serialized is serialized again. this makes the snapshot a consistent
+    // copy of the song as it is in this frame
+    for (size_t i = 0; i < _build.size(); i++)
+    {
+        if (song.chunk_version(_build[i].id) == _build_versions[i]) continue;
+
+        BinaryWriter w;
+        song.serialize_chunk(w, _build[i].id);
+        _build[i].data = w.release();
+    }
+
+    if (_save_path.empty())
+    {
+        Request request { Request::Snapshot };
+        request.chunks = std::move(_build);
+        request.clean = _build_clean;
+        send(std::move(request));
+    }
+    else
+    {
+        Request request { Request::Save };
+        request.chunks = std::move(_build);
+        request.path = std::move(_save_path);
+        send(std::move(request));
+        _save_path.clear();
+    }
+
+    _building = false;
+    _base_shape = _build_shape;
+    _last_snapshot = start;
+    _build.clear();
+}
+
+void Autosave::update(const Song& song)
+{
+    auto now = std::chrono::steady_clock::now();
+    Shape shape = shape_of(song);
+
+    if (_building)
+    {
+        // chunks that were already serialized can't be reused if the structure changed
+        if (_structure_dirty || shape != _build_shape)
+            begin_snapshot(song, false);
+    }
+    else if (_structure_dirty || shape != _base_shape ||
+        std::chrono::duration<double>(now - _last_snapshot).count() >= SNAPSHOT_INTERVAL)
+    {
+        begin_snapshot(song, false);
+    }
+
+    if (_building)
+    {
+        continue_snapshot(song, SNAPSHOT_FRAME_BUDGET);
+    }
+    else
+    {
+        // the shape has not changed since the last snapshot, so each
+        // chunk that changed can be written on its own
+        for (const ProjectChunkId& id : _dirty)
+        {
+            if (memcmp(id.id, "CHAN", 4) == 0 && id.index >= song.channels.size()) continue;
+
+            BinaryWriter w;
+            song.serialize_chunk(w, id);
+
+            Request request { Request::Chunk };
+            request.chunks.push_back({ id, w.release() });
+            send(std::move(request));
+        }
+
+        _dirty.clear();
+    }
+}
+
+void Autosave::rebase(const Song& song, bool clean)
+{
+    // a save has to be finished with the song it was started with, before this
+    assert(_save_path.empty());
+    _dirty.clear();
+    begin_snapshot(song, clean);
+}
+
+void Autosave::save(const Song& song, const std::filesystem::path& path)
+{
+    // the saved song replaces any snapshot that was in progress,
+    // and is written out by update() once it is serialized
+    begin_snapshot(song, false);
+    _dirty.clear();
+    _save_path = path;
+}
+
+void Autosave::finish_save(const Song& song)
+{
+    if (_save_path.empty()) return;
+
+    if (_structure_dirty || shape_of(song) != _build_shape)
+        begin_snapshot(song, false);
+
+    continue_snapshot(song, std::numeric_limits<double>::infinity());
+}
+
+bool Autosave::poll_status(std::string& status)
+{
+    std::lock_guard lock(_status_mutex);
+    if (_status.empty()) return false;
+
+    status = std::move(_status);
+    _status.clear();
+    return true;
+}
+
+bool Autosave::has_recovery() const
+{
+    std::error_code ec;
+    return std::filesystem::exists(_recovery_path, ec);
+}
+
+void Autosave::discard_recovery()
+{
+    std::error_code ec;
+    std::filesystem::remove(_recovery_path, ec);
+}
+
+std::unique_ptr<Song> Autosave::recover(
+    audiomod::ModuleContext& modctx,
+    plugins::PluginManager& plugin_manager,
+    std::string* error_msg
+)
+{
+    sys::mapped_file_t* file = sys::map_file(_recovery_path.u8string().c_str());
+    if (file == nullptr)
+    {
+        if (error_msg) *error_msg = "could not open " + _recovery_path.u8string();
+        return nullptr;
+    }
+
+    std::vector<ProjectChunk> chunks;
+    bool ok = read_journal(sys::mapped_file_data(file), sys::mapped_file_size(file), chunks);
+    sys::unmap_file(file);
+
+    if (!ok)
+    {
+        if (error_msg) *error_msg = "the autosave journal is damaged";
+        return nullptr;
+    }
+
+    BinaryWriter image;
+    Song::write_chunks(image, chunks);
+
+    std::unique_ptr<Song> song = Song::from_memory(image.data(), image.size(), modctx, plugin_manager, error_msg);
+    if (song != nullptr) discard_recovery();
+
+    return song;
+}
+
+//////////////////////
+// IO THREAD        //
+//////////////////////
+
+void Autosave::_thread_proc()
+{
+    std::deque<Request> requests;
+
+    while (true)
+    {
+        {
+            std::unique_lock lock(_queue_mutex);
+            _queue_cond.wait(lock, [this]() { return !_queue.empty() || !_running; });
+
+            if (_queue.empty()) break;
+            requests.swap(_queue);
+        }
+
+        for (Request& request : requests)
+            handle(request);
+
+        requests.clear();
+
+        // records only need to reach the os to survive a crash of the program
+        if (_journal.is_open())
+            _journal.flush();
+    }
+}
+
+void Autosave::handle(Request& request)
+{
+    switch (request.kind)
+    {
+        case Request::Snapshot:
+            if (request.clean)
+            {
+                _chunks = std::move(request.chunks);
+                remove_journal();
+            }
+            else if (!std::equal(_chunks.begin(), _chunks.end(), request.chunks.begin(), request.chunks.end(),
+                [](const ProjectChunk& a, const ProjectChunk& b) { return a.id == b.id && a.data == b.data; }))
+            {
+                _chunks = std::move(request.chunks);
+                write_journal();
+            }
+            break;
+
+        case Request::Chunk: {
+            ProjectChunk& chunk = request.chunks[0];
+            auto it = find_chunk(_chunks, chunk.id);
+
+            if (it == _chunks.end() || it->data == chunk.data) break;
+            it->data = std::move(chunk.data);
+
+            // if the song was the same as the file on disk, the
+            // journal starts over from a snapshot that has the change
+            if (_journal.is_open())
+                append_chunk(*it);
+            else
+                write_journal();
+
+            break;
+        }
+
+        case Request::Save: {
+            BinaryWriter image;
+            Song::write_chunks(image, request.chunks);
+            bool saved = replace_file(request.path, image);
+
+            {
+                std::lock_guard lock(_status_mutex);
+                _status = (saved ? "Successfully saved " : "Could not save to ") + request.path.u8string();
+            }
+
+            _chunks = std::move(request.chunks);
+
+            if (saved)
+                remove_journal();
+            else
+                write_journal();
+
+            break;
+        }
+    }
+}
+
+void Autosave::write_journal()
+{
+    if (_journal.is_open()) _journal.close();
+
+    BinaryWriter w;
+    put_journal_header(w);
+    put_snapshot_record(w, _chunks);
+
+    if (!replace_file(_journal_path, w))
+    {
+        std::cerr << "autosave: could not write " << _journal_path.u8string() << "\n";
+        return;
+    }
+
+    _journal_size = w.size();
+    _image_size = w.size();
+    _journal.open(_journal_path, std::ios::out | std::ios::app | std::ios::binary);
+}
+
+void Autosave::append_chunk(const ProjectChunk& chunk)
+{
+    BinaryWriter w;
+    put_chunk_record(w, chunk);
+
+    _journal.write((const char*) w.data(), w.size());
+    _journal_size += w.size();
+
+    // a failed write may have left a partial record, so start over
+    if (_journal.fail() || _journal_size > _image_size * 2 + COMPACT_SLACK)
+        write_journal();
+}
+
+void Autosave::remove_journal()
+{
+    if (_journal.is_open()) _journal.close();
+
+    std::error_code ec;
+    std::filesystem::remove(_journal_path, ec);
+}
+
+
+#ifdef UNIT_TESTS
+// X11 defines macros that collide with names in catch2
+#undef None
+#undef Always
+#undef Success
+#include <catch2/catch_amalgamated.hpp>
+
+static ProjectChunk make_chunk(const char* id, uint32_t index, std::vector<uint8_t> data)
+{
+    return { ProjectChunkId(id, index), std::move(data) };
+}
+
+static const std::vector<uint8_t>& chunk_data(std::vector<ProjectChunk>& chunks, const ProjectChunkId& id)
+{
+    auto it = find_chunk(chunks, id);
+    REQUIRE(it != chunks.end());
+    return it->data;
+}
+
+TEST_CASE("Autosave journal replay", "[autosave]")
+{
+    std::vector<ProjectChunk> snapshot {
+        make_chunk("SONG", 0, { 1, 2, 3, 4 }),
+        make_chunk("TUNE", 0, { 5 }),
+        make_chunk("MIXR", 0, { 6, 7 }),
+        make_chunk("CHAN", 0, { 8, 9, 10 }),
+        make_chunk("CHAN", 1, { 11 }),
+    };
+
+    BinaryWriter w;
+    put_journal_header(w);
+    put_snapshot_record(w, snapshot);
+    size_t snapshot_end = w.size();
+
+    put_chunk_record(w, make_chunk("CHAN", 1, { 12, 13 }));
+    size_t first_edit_end = w.size();
+
+    put_chunk_record(w, make_chunk("SONG", 0, { 14 }));
+
+    std::vector<uint8_t> journal = w.release();
+    std::vector<ProjectChunk> chunks;
+
+    SECTION("Every record is applied")
+    {
+        REQUIRE(read_journal(journal.data(), journal.size(), chunks));
+        REQUIRE(chunks.size() == snapshot.size());
+        REQUIRE(chunk_data(chunks, { "CHAN", 0 }) == std::vector<uint8_t> { 8, 9, 10 });
+        REQUIRE(chunk_data(chunks, { "CHAN", 1 }) == std::vector<uint8_t> { 12, 13 });
+        REQUIRE(chunk_data(chunks, { "SONG", 0 }) == std::vector<uint8_t> { 14 });
+    }
+
+    SECTION("Replay stops before a truncated record")
+    {
+        for (size_t size : { journal.size() - 1, first_edit_end + 4, first_edit_end + 9 })
+        {
+            REQUIRE(read_journal(journal.data(), size, chunks));
+            REQUIRE(chunk_data(chunks, { "CHAN", 1 }) == std::vector<uint8_t> { 12, 13 });
+            REQUIRE(chunk_data(chunks, { "SONG", 0 }) == std::vector<uint8_t> { 1, 2, 3, 4 });
+        }
+    }
+
+    SECTION("Replay stops before a corrupted record")
+    {
+        journal.back() ^= 0x40;
+        REQUIRE(read_journal(journal.data(), journal.size(), chunks));
+        REQUIRE(chunk_data(chunks, { "CHAN", 1 }) == std::vector<uint8_t> { 12, 13 });
+        REQUIRE(chunk_data(chunks, { "SONG", 0 }) == std::vector<uint8_t> { 1, 2, 3, 4 });
+    }
+
+    SECTION("Records after a corrupted one are ignored")
+    {
+        journal[first_edit_end - 1] ^= 0x40;
+        REQUIRE(read_journal(journal.data(), journal.size(), chunks));
+        REQUIRE(chunk_data(chunks, { "CHAN", 1 }) == std::vector<uint8_t> { 11 });
+        REQUIRE(chunk_data(chunks, { "SONG", 0 }) == std::vector<uint8_t> { 1, 2, 3, 4 });
+    }
+
+    SECTION("A journal without a snapshot is rejected")
+    {
+        REQUIRE_FALSE(read_journal(journal.data(), snapshot_end - 1, chunks));
+
+        BinaryWriter edits;
+        put_journal_header(edits);
+        put_chunk_record(edits, make_chunk("SONG", 0, { 14 }));
+        REQUIRE_FALSE(read_journal(edits.data(), edits.size(), chunks));
+
+        journal[0] = 'X';
+        REQUIRE_FALSE(read_journal(journal.data(), journal.size(), chunks));
+    }
+}
+#endif
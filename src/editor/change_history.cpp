@@ -60,6 +60,8 @@ void apply_snapshot(change::ChangeSongMaxPatterns::TrackSnapshot& snapshot, Song
             song.channels[row]->sequence[col] = snapshot.patterns[i];
             i++;
         }
+
+        song.channels[row]->mark_sequence_changed();
     }
 }
 
@@ -213,7 +215,7 @@ void change::ChangeAddEffect::redo(SongEditor& editor) {
 
     auto mod = audiomod::create_module(
         mod_type,
-        editor.modctx,
+        *editor.modctx,
         editor.plugin_manager,
         editor.song->work_scheduler
     );
@@ -271,7 +273,7 @@ void change::ChangeRemoveEffect::undo(SongEditor& editor) {
 
     auto mod = audiomod::create_module(
         mod_type,
-        editor.modctx,
+        *editor.modctx,
         editor.plugin_manager,
         editor.song->work_scheduler
     );
@@ -343,6 +345,7 @@ void change::ChangeAddNote::undo(SongEditor& editor)
         if (note_v == note)
         {
             pattern->notes.erase(it);
+            pattern->mark_changed();
             break;
         }
     }
@@ -352,6 +355,7 @@ void change::ChangeAddNote::undo(SongEditor& editor)
         new_index = pattern_id;
 
         editor.song->channels[channel_index]->sequence[bar] = 0;
+        editor.song->channels[channel_index]->mark_sequence_changed();
         editor.song->set_max_patterns(old_max_patterns);
     }
 }
@@ -370,10 +374,12 @@ void change::ChangeAddNote::redo(SongEditor& editor)
     {
         pattern_id = song->new_pattern(editor.selected_channel);
         channel->sequence[editor.selected_bar] = pattern_id + 1;
+        channel->mark_sequence_changed();
     }
     
     auto& pattern = channel->patterns[pattern_id];
     pattern->notes.push_back(note);
+    pattern->mark_changed();
 }
 
 bool change::ChangeAddNote::merge(Action* other)
@@ -400,6 +406,7 @@ void change::ChangeRemoveNote::redo(SongEditor& editor)
         if (note_v == note)
         {
             pattern->notes.erase(it);
+            pattern->mark_changed();
             break;
         }
     }
@@ -413,6 +420,7 @@ void change::ChangeRemoveNote::undo(SongEditor& editor)
     int pattern_id = editor.song->channels[channel_index]->sequence[bar] - 1;
     auto& pattern = editor.song->channels[channel_index]->patterns[pattern_id];
     pattern->notes.push_back(note);
+    pattern->mark_changed();
 }
 
 bool change::ChangeRemoveNote::merge(Action* other)
@@ -438,6 +446,7 @@ void change::ChangeNote::undo(SongEditor& editor)
         if (note_v == new_note)
         {
             note_v = old_note;
+            pattern->mark_changed();
             break;
         }
     }
@@ -456,6 +465,7 @@ void change::ChangeNote::redo(SongEditor& editor)
         if (note_v == old_note)
         {
             note_v = new_note;
+            pattern->mark_changed();
             break;
         }
     }
@@ -609,6 +619,7 @@ void change::ChangeSequence::undo(SongEditor& editor)
     editor.selected_channel = channel;
     editor.selected_bar = bar;
     editor.song->channels[channel]->sequence[bar] = old_val;
+    editor.song->channels[channel]->mark_sequence_changed();
 }
 
 void change::ChangeSequence::redo(SongEditor& editor)
@@ -616,6 +627,7 @@ void change::ChangeSequence::redo(SongEditor& editor)
     editor.selected_channel = channel;
     editor.selected_bar = bar;
     editor.song->channels[channel]->sequence[bar] = new_val;
+    editor.song->channels[channel]->mark_sequence_changed();
 }
 
 bool change::ChangeSequence::merge(Action* other)
@@ -670,7 +682,7 @@ audiomod::ModuleNodeRc change::ModuleData::load(SongEditor& editor) const
 {
     auto mod = audiomod::create_module(
         type,
-        editor.modctx,
+        *editor.modctx,
         editor.plugin_manager,
         editor.song->work_scheduler
     );
@@ -728,11 +740,13 @@ void change::ChangeRemoveChannel::undo(SongEditor& editor)
 
     // load sequence
     channel->sequence = sequence;
+    channel->mark_sequence_changed();
     
     // load patterns
     for (int i = 0; i < patterns.size(); i++)
     {
         channel->patterns[i]->notes = patterns[i].notes;
+        channel->patterns[i]->mark_changed();
     }
 
     // load volume mod configuration
@@ -1,11 +1,14 @@
 #include <tomlcpp/tomlcpp.hpp>
 #include <stb_image.h>
 #include <fstream>
+#include <sstream>
+#include <chrono>
 #include <filesystem>
 #include <nfd.h>
 
 #include "editor.h"
 #include "../audio.h"
+#include "../sys.h"
 #include "theme.h"
 #include "../ui/ui.h"
 
@@ -124,11 +127,12 @@ const char* UserActionList::combo_str(const std::string& action_name) const {
 // SongEditor singleton //
 //////////////////////////
 
-SongEditor::SongEditor(AudioDevice& device, size_t audio_buffer_size, WindowManager& _win_mgr)
-:   modctx(device.sample_rate(), device.num_channels(), audio_buffer_size),
+SongEditor::SongEditor(WindowManager& _win_mgr)
+:   thread_pool(ThreadPool::default_thread_count(), true),
     plugin_manager(_win_mgr)
 {
-    song = std::make_unique<Song>(4, 8, 8, modctx);
+    open_audio();
+    set_song(std::make_unique<Song>(4, 8, 8, *modctx));
 
     const char* theme_name = "Soundbox Dark";
 
@@ -141,9 +145,11 @@ SongEditor::SongEditor(AudioDevice& device, size_t audio_buffer_size, WindowMana
 
     init_directory();
     theme.custom_directory = data_directory/"themes";
+    autosave = std::make_unique<Autosave>(data_directory/"autosave", *song);
 
     plugin_manager.ladspa_paths.push_back((data_directory/"plugins"/"ladspa").u8string());
     plugin_manager.lv2_paths.push_back((data_directory/"plugins"/"lv2").u8string());
+    plugin_manager.scan_cache_path = data_directory/"plugins"/"scan_cache.bin";
 
     theme.set_imgui_colors();
     plugin_manager.scan_plugins();
@@ -153,11 +159,9 @@ SongEditor::SongEditor(AudioDevice& device, size_t audio_buffer_size, WindowMana
             last_file_path.clear();
             last_file_name.clear();
             
-            //modctx.reset();
-
-            song->stop();
-            song = std::make_unique<Song>(4, 8, 8, modctx);
+            set_song(std::make_unique<Song>(4, 8, 8, *modctx));
             reset();
+            autosave->rebase(*song, true);
             ui::ui_init(*this);
         });
     });
@@ -182,30 +186,7 @@ SongEditor::SongEditor(AudioDevice& device, size_t audio_buffer_size, WindowMana
         );
 
         if (result == NFD_OKAY) {
-            std::ifstream file;
-            file.open(out_path, std::ios::in | std::ios::binary);
-
-            if (file.is_open()) {
-                std::string error_msg = "unknown error";
-                auto new_song = Song::from_file(file, modctx, plugin_manager, &error_msg);
-                file.close();
-
-                if (new_song != nullptr) {
-                    //audio_dest.reset();
-
-                    song->stop();
-                    song.swap(new_song);
-                    reset();
-                    ui::ui_init(*this);
-
-                    last_file_path = out_path;
-                    last_file_name = last_file_path.substr(last_file_path.find_last_of("/\\") + 1);
-                } else {
-                    ui::show_status("Error reading file: %s", error_msg.c_str());
-                }
-            } else {
-                ui::show_status("Could not open %s", out_path);
-            }
+            begin_load(out_path);
         } else if (result != NFD_CANCEL) {
             std::cerr << "Error: " << NFD_GetError() << "\n";
         }
@@ -337,7 +318,7 @@ SongEditor::SongEditor(AudioDevice& device, size_t audio_buffer_size, WindowMana
 
     ui_actions.set_callback("export", [&]() {
         nfdchar_t* out_path = nullptr;
-        nfdresult_t result = NFD_SaveDialog("wav", nullptr, &out_path);
+        nfdresult_t result = NFD_SaveDialog("wav;flac", nullptr, &out_path);
 
         if (result == NFD_OKAY) {
             export_config.active = true;
@@ -350,16 +331,102 @@ SongEditor::SongEditor(AudioDevice& device, size_t audio_buffer_size, WindowMana
     });
     
     reset();
+    commit();
 
-    last_playing = song->is_playing;
+    render_running = true;
+    render_thread = std::thread(&SongEditor::render_proc, this);
 }
 
 SongEditor::~SongEditor()
 {
+    stop_audio();
+
+    // finishes writing saves that are still in progress
+    autosave->finish_save(*song);
+    autosave = nullptr;
+    song_load = nullptr;
+
+    // songs must be destroyed before the module context they were created in
+    song_export = nullptr;
+    song = nullptr;
+    retired_songs.clear();
+    modctx = nullptr;
+
     for (auto it : ui_values)
         free(it.second);
 }
 
+void SongEditor::open_audio()
+{
+    device = std::make_unique<AudioDevice>(audio_config.device);
+
+    int block_size = std::clamp(audio_config.block_size, 16, (int)AudioDevice::MAX_BLOCK_SIZE);
+    modctx = std::make_unique<audiomod::ModuleContext>(device->sample_rate(), device->num_channels(), block_size);
+    modctx->set_thread_pool(&thread_pool);
+}
+
+void SongEditor::stop_audio()
+{
+    if (render_running)
+    {
+        render_running = false;
+        render_thread.join();
+    }
+
+    if (device)
+        device->stop();
+}
+
+void SongEditor::set_audio_config(const AudioConfigData& config)
+{
+    if (config == audio_config) return;
+    audio_config = config;
+
+    stop_audio();
+
+    // keep a copy of the song to load into the new context
+    std::stringstream song_data;
+    song->serialize(song_data);
+    int bar_position = song->playhead_bar();
+    int channel = selected_channel;
+    int bar = selected_bar;
+
+    // everything that references the old context must be destroyed before it is
+    song_load = nullptr;
+    reset();
+    audio_song = nullptr;
+    song = nullptr;
+    retired_songs.clear();
+    modctx = nullptr;
+    device = nullptr;
+
+    open_audio();
+
+    std::string error_msg = "unknown error";
+    std::unique_ptr<Song> new_song = Song::from_file(song_data, *modctx, plugin_manager, &error_msg);
+
+    if (new_song == nullptr)
+    {
+        ui::show_status("Could not reload song: %s", error_msg.c_str());
+        new_song = std::make_unique<Song>(4, 8, 8, *modctx);
+    }
+    else
+    {
+        new_song->seek(bar_position * new_song->beats_per_bar);
+        selected_channel = channel;
+        selected_bar = bar;
+    }
+
+    set_song(std::move(new_song));
+    ui::ui_init(*this);
+    commit();
+
+    last_playing = false;
+    dsp_meter.reset();
+    render_running = true;
+    render_thread = std::thread(&SongEditor::render_proc, this);
+}
+
 void SongEditor::reset()
 {
     undo_stack.clear();
@@ -369,7 +436,6 @@ void SongEditor::reset()
     active_notes.clear();
     selected_channel = 0;
     selected_bar = 0;
-    last_playing = false;
 }
 
 void SongEditor::init_directory()
@@ -457,11 +523,20 @@ void SongEditor::init_directory()
     ImGui::GetIO().IniFilename = data_directory_str.c_str();
 }
 
+void SongEditor::push_change(change::Action* action)
+{
+    // the action may be merged into the previous one and deleted when pushed
+    autosave->record(*action);
+    undo_stack.push(action);
+    redo_stack.clear();
+}
+
 bool SongEditor::undo()
 {
     if (undo_stack.is_empty()) return false;
 
     change::Action* action = undo_stack.pop();
+    autosave->record(*action);
     action->undo(*this);
     redo_stack.push(action);
     return true;
@@ -472,6 +547,7 @@ bool SongEditor::redo()
     if (redo_stack.is_empty()) return false;
 
     change::Action* action = redo_stack.pop();
+    autosave->record(*action);
     action->redo(*this);
     undo_stack.push(action);
     return true;
@@ -528,7 +604,7 @@ void SongEditor::play_note(int channel, int key, float volume, float secs_len)
         });
 
         active_notes.push_back({
-            key, volume, channel, (int)(modctx.sample_rate * secs_len)
+            key, volume, channel, ImGui::GetTime() + secs_len
         });
     }
 }
@@ -544,8 +620,16 @@ void SongEditor::save_preferences() const
     file << "note_preview = " << (note_preview ? "true" : "false") << "\n";
     file << "show_all_channels = " << (show_all_channels ? "true" : "false") << "\n";
 
-    // write plugin paths
+    // write audio settings
+    file << "\n[audio]\n";
+    file << "device = " << std::quoted(audio_config.device.output_device) << "\n";
+    file << "sample_rate = " << audio_config.device.sample_rate << "\n";
+    file << "block_size = " << audio_config.block_size << "\n";
+    file << "latency = " << audio_config.device.latency << "\n";
+
+    // write plugin settings
     file << "\n[plugins]\n";
+    file << "sandbox = " << (plugin_manager.sandbox_plugins ? "true" : "false") << "\n";
 
     // ladspa
     file << "ladspa = [";
@@ -599,10 +683,44 @@ void SongEditor::load_preferences()
         }
     }
 
+    // get audio settings
+    auto audio_table = data.table->getTable("audio");
+    if (audio_table)
+    {
+        AudioConfigData config = audio_config;
+
+        auto device_v = audio_table->getString("device");
+        if (device_v.first) {
+            config.device.output_device = device_v.second;
+        }
+
+        auto sample_rate_v = audio_table->getInt("sample_rate");
+        if (sample_rate_v.first) {
+            config.device.sample_rate = sample_rate_v.second;
+        }
+
+        auto block_size_v = audio_table->getInt("block_size");
+        if (block_size_v.first) {
+            config.block_size = block_size_v.second;
+        }
+
+        auto latency_v = audio_table->getDouble("latency");
+        if (latency_v.first) {
+            config.device.latency = latency_v.second;
+        }
+
+        set_audio_config(config);
+    }
+
     // get plugin paths
     auto plugins = data.table->getTable("plugins");
     if (plugins)
     {
+        auto sandbox_v = plugins->getBool("sandbox");
+        if (sandbox_v.first) {
+            plugin_manager.sandbox_plugins = sandbox_v.second;
+        }
+
         // read ladspa paths
         auto ladspa_paths = plugins->getArray("ladspa");
         if (ladspa_paths)
@@ -649,26 +767,76 @@ bool SongEditor::save_song()
         return save_song_as();
     }
 
-    std::ofstream file;
-    file.open(last_file_path, std::ios::out | std::ios::trunc | std::ios::binary);
+    autosave->save(*song, std::filesystem::u8path(last_file_path));
+    return true;
+}
 
-    if (file.is_open()) {
-        song->serialize(file);
-        file.close();
+bool SongEditor::has_recovery() const
+{
+    return autosave->has_recovery();
+}
 
-        ui::show_status("Successfully saved %s", last_file_path.c_str());
-        return true;
-    } else {
-        ui::show_status("Could not save to %s", last_file_path.c_str());
-        return false;
+void SongEditor::recover_autosave()
+{
+    std::string error_msg = "unknown error";
+    std::unique_ptr<Song> new_song = autosave->recover(*modctx, plugin_manager, &error_msg);
+
+    if (new_song == nullptr)
+    {
+        ui::show_status("Could not recover work: %s", error_msg.c_str());
+        return;
+    }
+
+    last_file_path.clear();
+    last_file_name.clear();
+
+    set_song(std::move(new_song));
+    reset();
+    autosave->rebase(*song, false);
+    ui::ui_init(*this);
+    ui::show_status("Recovered work from the last session");
+}
+
+void SongEditor::discard_recovery()
+{
+    autosave->discard_recovery();
+}
+
+void SongEditor::set_song(std::unique_ptr<Song>&& new_song)
+{
+    if (song)
+    {
+        // a save that is still being serialized is written with the song it was started with
+        if (autosave) autosave->finish_save(*song);
+
+        // stop hearing the old song once the graph is committed. it can't be
+        // destroyed until after that, since the render thread may still be using it
+        song->fx_mixer[0]->disconnect_output();
+        retired_songs.push_back(std::move(song));
     }
+
+    song = std::move(new_song);
+    song->commit();
+    audio_song.store(song.get());
 }
 
-void SongEditor::process(AudioDevice& device)
+void SongEditor::render_proc()
 {
-    mutex.lock();
+    if (!sys::set_thread_realtime())
+        std::cout << "could not set real-time priority for render thread\n";
 
-    //modctx.prepare();
+    while (render_running)
+    {
+        process();
+        device->wait_for_callback(10);
+    }
+}
+
+void SongEditor::process()
+{
+    // the song is kept alive until this read has finished
+    modctx->reclaimer().begin_read();
+    Song* song = audio_song.load();
 
     bool song_playing = song->is_playing;
     if (song_playing != last_playing) {
@@ -678,30 +846,66 @@ void SongEditor::process(AudioDevice& device)
         else song->stop();
     }
 
-    int frames_passed = 0;
+    // always render at least one block, in case the target is smaller than a block
+    const size_t block_samples = modctx->frames_per_buffer * modctx->num_channels;
+    const size_t queue_target = std::max(device->queue_target(), block_samples);
 
-    while (device.samples_queued() < device.sample_rate() * 0.05)
+    const double block_time = (double)modctx->frames_per_buffer / modctx->sample_rate;
+
+    while (device->samples_queued() < queue_target)
     {
+        auto start_time = std::chrono::steady_clock::now();
+
         float* buf;
-        if (song_playing) song->update((double)modctx.frames_per_buffer / device.sample_rate());
-        size_t buf_size = modctx.process(buf);
-        device.queue(buf, buf_size);
+        if (song_playing) song->update(modctx->frames_per_buffer);
+        size_t buf_size = modctx->process(buf);
 
-        frames_passed += modctx.frames_per_buffer;
+        std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - start_time;
+        dsp_meter.record(render_time.count(), block_time);
+
+        device->queue(buf, buf_size);
     }
 
+    modctx->reclaimer().end_read();
+}
+
+void SongEditor::commit()
+{
+    song->commit();
+    modctx->commit();
+
+    // the graph no longer contains the modules of replaced songs
+    for (std::unique_ptr<Song>& old_song : retired_songs)
+        modctx->reclaimer().retire(std::shared_ptr<Song>(std::move(old_song)));
+    
+    retired_songs.clear();
+}
+
+void SongEditor::ui_update()
+{
+    // write the edits of the last frame to the autosave journal
+    autosave->update(*song);
+
+    std::string save_status;
+    if (autosave->poll_status(save_status))
+        ui::show_status(save_status);
+
+    if (song_load && song_load->finished())
+        finish_load();
+
     // cursor follow playhead (if user enabled this feature)
-    if (follow_playhead && song_playing)
-        selected_bar = song->bar_position;
+    if (follow_playhead && song->is_playing)
+        selected_bar = song->playhead_bar();
 
     // process active notes (started from note previews)
+    double now = ImGui::GetTime();
+
     for (int i = active_notes.size() - 1; i >= 0; i--)
     {
         active_note_t& active_note = active_notes[i];
-        active_note.frames_remaining -= frames_passed;
 
         // stop note when done
-        if (active_note.frames_remaining <= 0)
+        if (now >= active_note.end_time)
         {
             // if channel still exists
             if (active_note.channel < song->channels.size())
@@ -716,17 +920,44 @@ void SongEditor::process(AudioDevice& device)
             active_notes.erase(active_notes.begin() + i);
         }
     }
+}
+
+void SongEditor::begin_load(const std::string& file_path)
+{
+    if (song_load) return;
+
+    song_load_path = file_path;
+    song_load = std::make_unique<SongLoader>(file_path.c_str(), *modctx, plugin_manager);
+}
+
+void SongEditor::cancel_load()
+{
+    if (song_load) song_load->cancel();
+}
+
+void SongEditor::finish_load()
+{
+    std::string error_msg = "unknown error";
+    auto new_song = song_load->finish(&error_msg);
+    song_load = nullptr;
 
-    if (song_export)
-        song_export->process();
+    if (new_song != nullptr) {
+        set_song(std::move(new_song));
+        reset();
+        autosave->rebase(*song, true);
+        ui::ui_init(*this);
 
-    mutex.unlock();
+        last_file_path = song_load_path;
+        last_file_name = last_file_path.substr(last_file_path.find_last_of("/\\") + 1);
+    } else {
+        ui::show_status("Error reading file: %s", error_msg.c_str());
+    }
 }
 
 void SongEditor::begin_export()
 {
     if (song_export) return;
-    song_export = std::make_unique<SongExport>(*this, export_config.file_name, export_config.sample_rate);
+    song_export = std::make_unique<SongExport>(*this, export_config);
 
     // if there was an error in song export
     if (!song_export->error().empty())
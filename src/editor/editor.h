@@ -3,11 +3,18 @@
 #include <imgui.h>
 #include <mutex>
 #include <filesystem>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
 #include "theme.h"
 #include "change_history.h"
 #include "../plugins.h"
 #include "../song.h"
 #include "../audiofile.h"
+#include "../threadpool.h"
 
 constexpr uint8_t USERMOD_SHIFT = 1;
 constexpr uint8_t USERMOD_CTRL = 2;
@@ -48,12 +55,10 @@ struct UserActionList {
 };
 
 class SongExport;
+class Autosave;
 
 class SongEditor {
 private:
-    // this mutex is locked by the audio thread while audio is being processed
-    // and is locked by the main thread when a new song is being loaded
-
     std::string last_file_path;
     std::string last_file_name;
 
@@ -63,32 +68,89 @@ private:
     void init_directory();
 
     std::unique_ptr<SongExport> song_export;
-    bool last_playing;
+    std::unique_ptr<Autosave> autosave;
+
+    // a project file that is being opened, and its path
+    std::unique_ptr<SongLoader> song_load;
+    std::string song_load_path;
+
+    // switch to the song that finished loading
+    void finish_load();
+
+    // the song the render thread plays, and whether it was playing on the last block.
+    // replaced songs are kept until the graph is committed without them
+    std::atomic<Song*> audio_song = nullptr;
+    bool last_playing = false;
+    std::vector<std::unique_ptr<Song>> retired_songs;
+
+    // the render thread is woken up every time the audio device
+    // reads from its buffer, and renders ahead to refill it
+    std::unique_ptr<AudioDevice> device;
+    std::thread render_thread;
+    std::atomic<bool> render_running = false;
+
+    void open_audio();
+    void render_proc();
+
+    // render audio into the device's buffer. called from the render thread.
+    // this only reads state that was published by commit(), so it never waits on the ui thread.
+    void process();
 
     struct active_note_t
     {
         int key;
         float volume;
         int channel;
-        int frames_remaining;
+        double end_time; // in ImGui time
     };
 
     std::vector<active_note_t> active_notes;
 public:
-    SongEditor(AudioDevice& device, size_t audio_buffer_size, WindowManager& winmgr);
+    SongEditor(WindowManager& winmgr);
     ~SongEditor();
     std::unique_ptr<Song> song;
     Theme theme;
     UserActionList ui_actions;
-    audiomod::ModuleContext modctx;
+    // real-time worker threads that help process the module graph. only as many
+    // as the graph has independent chains are woken up, and the rest stay asleep
+    ThreadPool thread_pool;
+    std::unique_ptr<audiomod::ModuleContext> modctx;
     plugins::PluginManager plugin_manager;
-    std::mutex mutex;
+
+    // audio device settings
+    struct AudioConfigData {
+        AudioDevice::Config device;
+        int block_size = 128; // frames per block the module graph is processed in
+
+        inline bool operator==(const AudioConfigData& other) const {
+            return device == other.device && block_size == other.block_size;
+        }
+    } audio_config;
+
+    /**
+    * Reopen the audio device and rebuild the module context with new settings.
+    * The song is reloaded into the new context, which clears the undo history.
+    * Nothing is done if the settings did not change.
+    **/
+    void set_audio_config(const AudioConfigData& config);
+
+    inline AudioDevice& audio_device() { return *device; };
+
+    // render time of each block, measured by the render thread
+    DspLoadMeter dsp_meter;
+
+    // stop the render thread and close the audio device
+    void stop_audio();
 
     // exporting
     struct ExportConfigData {
         bool active = false;
         char* file_name = nullptr;
         int sample_rate = 0;
+        bool stems = false; // also write a file for each channel
+        bool bus_stems = false; // also write a file for each fx bus
+        audiofile::SampleFormat format = audiofile::SampleFormat::Int16;
+        bool dither = true; // dither integer formats
     } export_config;
     
     void reset();
@@ -98,11 +160,35 @@ public:
         return data_directory;
     }
 
+    /**
+    * Save the song to the last file it was saved to or opened from. The song is
+    * serialized immediately but written to disk in the background, and the
+    * result is shown in the status bar once it is done.
+    * @returns true if the save was started
+    **/
     bool save_song();
     bool save_song_as();
 
+    // whether the last session did not exit cleanly and left work to recover
+    bool has_recovery() const;
+
+    // replace the current song with the work recovered from the last session
+    void recover_autosave();
+
+    // delete the work left by the last session
+    void discard_recovery();
+
     void play_note(int channel, int key, float volume, float secs_len);
-    void process(AudioDevice& device);
+
+    // replace the current song. the old song is destroyed once the render thread is done with it
+    void set_song(std::unique_ptr<Song>&& new_song);
+
+    // update editor state that depends on playback. called from the ui thread every frame.
+    void ui_update();
+
+    // publish edits made to the song and the module graph to the render thread.
+    // called from the ui thread at the end of every frame.
+    void commit();
 
     // view preferences
     bool follow_playhead = false; // Keep Current Pattern Selected
@@ -121,9 +207,19 @@ public:
     bool show_themes_window = false;
     bool show_plugin_list = false;
     bool show_dir_window = false;
+    bool show_audio_window = false;
+    bool show_profiler = false;
 
     std::vector<audiomod::ModuleNodeRc> mod_interfaces;
 
+    // start opening a project file. its modules are set up in the background,
+    // and the song is replaced once they are
+    void begin_load(const std::string& file_path);
+    void cancel_load();
+    inline const std::unique_ptr<SongLoader>& current_load() {
+        return song_load;
+    };
+
     void begin_export();
     void stop_export();
     inline const std::unique_ptr<SongExport>& current_export() {
@@ -140,10 +236,7 @@ public:
     bool redo();
 
     // push a change to the undo stack
-    inline void push_change(change::Action* action) {
-        undo_stack.push(action);
-        redo_stack.clear();    
-    };
+    void push_change(change::Action* action);
 
     change::Stack undo_stack;
     change::Stack redo_stack;
@@ -154,27 +247,223 @@ public:
     void hide_module_interface(audiomod::ModuleNodeRc& mod);
 };
 
+/**
+* Renders a copy of the song to a file on a background thread, as fast as
+* the machine allows. The copy has its own module context and thread pool,
+* so exporting never waits on the ui or the live audio, and vice versa.
+* Stems of channels and fx buses are rendered in the same pass as the mix.
+**/
 class SongExport
 {
 private:
+    // frames per block. there is no deadline to meet while exporting, so large
+    // blocks cut down the per-block overhead of the graph, modules and plugins.
+    // note events are still placed at their exact frame within a block
+    static constexpr int BLOCK_SIZE = 4096;
+
     std::string _error;
 
-    bool is_done;
+    std::atomic<bool> is_done;
+    std::atomic<bool> _cancelled = false;
     std::unique_ptr<Song> song; // a copy of the current song for the export process
     SongEditor& editor;
+    ThreadPool _thread_pool;
     audiomod::ModuleContext modctx;
     size_t total_frames;
+    std::atomic<size_t> _written_frames = 0;
+    std::filesystem::path _file_name;
     std::ofstream out_file;
-    std::unique_ptr<audiofile::WavWriter> writer;
-    int _step;
+    std::unique_ptr<audiofile::Writer> writer;
+    audiofile::SampleFormat _format;
+    bool _dither;
+    std::thread _thread;
+
+    // a file that a tapped node is written to, next to the main mix
+    struct Stem {
+        std::filesystem::path file_name;
+        std::ofstream file;
+        std::unique_ptr<audiofile::Writer> writer;
+        size_t tap;
+    };
+
+    std::vector<std::unique_ptr<Stem>> _stems;
+    bool add_stem(const audiomod::ModuleNodeRc& node, const std::string& name);
+
+    // a wav or flac writer, depending on the extension of the file name
+    std::unique_ptr<audiofile::Writer> create_writer(std::ostream& stream);
+
+    void _thread_proc();
 
 public:
-    SongExport(SongEditor& editor, const std::filesystem::path file_name, int sample_rate);
+    /**
+    * @param config The file the mix is written to and the format to write it
+    *               in. Stems are written next to the mix, with the name of the
+    *               channel or bus appended
+    **/
+    SongExport(SongEditor& editor, const SongEditor::ExportConfigData& config);
+
+    // cancels the export if it is still running
+    ~SongExport();
 
     float get_progress() const;
-    inline std::string error() const { return _error; };
+    /**
+    * Errors opening the files are reported right after construction, and
+    * errors while rendering once the export has finished
+    **/
+    std::string error() const;
     
     inline bool finished() const { return is_done; };
+
+    // stop exporting and delete the unfinished file. this returns
+    // immediately; the export thread stops after its current block
     void cancel();
-    void process();
+};
+
+/**
+* Keeps a journal of the song in the data directory, so work can be recovered
+* if the program crashes, and writes saved songs to disk.
+*
+* The journal starts with a snapshot of the whole project file, followed by a
+* record for every chunk of the file that changed since. Edits that go through
+* the undo stack mark the chunks they touch, which are serialized at the end of
+* the frame and appended. Since not every edit goes through the undo stack, a
+* snapshot of the song is also taken every few seconds, spread over several
+* frames. Saved songs are serialized over several frames the same way. The
+* version of each chunk is noted as it is serialized, and chunks that changed
+* by the time the rest is done are serialized again. Files are only written
+* from a background thread, which also compacts the journal back into a single
+* snapshot once it grows too long.
+**/
+class Autosave
+{
+public:
+    // seconds between snapshots of the song
+    static constexpr double SNAPSHOT_INTERVAL = 5.0;
+
+    // time spent serializing a snapshot each frame
+    static constexpr double SNAPSHOT_FRAME_BUDGET = 0.001;
+
+private:
+    std::filesystem::path _journal_path;
+    std::filesystem::path _recovery_path;
+
+    // the dimensions of a song. the chunks a song is written as only
+    // stay the same as long as its shape does
+    struct Shape
+    {
+        size_t channels;
+        int length;
+        int max_patterns;
+        size_t buses;
+
+        inline bool operator==(const Shape& other) const {
+            return channels == other.channels && length == other.length &&
+                max_patterns == other.max_patterns && buses == other.buses;
+        }
+
+        inline bool operator!=(const Shape& other) const {
+            return !(*this == other);
+        }
+    };
+
+    static Shape shape_of(const Song& song);
+
+    // work sent to the io thread
+    struct Request
+    {
+        enum Kind : uint8_t { Snapshot, Chunk, Save } kind;
+        std::vector<ProjectChunk> chunks;
+        bool clean = false; // for a snapshot, whether it is the same as a file on disk
+        std::filesystem::path path; // for a save
+    };
+
+    std::deque<Request> _queue;
+    std::mutex _queue_mutex;
+    std::condition_variable _queue_cond;
+    bool _running = true;
+    std::thread _thread;
+
+    std::mutex _status_mutex;
+    std::string _status;
+
+    // ui thread state
+    Shape _base_shape{}; // the shape of the last snapshot that was sent
+    std::vector<ProjectChunkId> _dirty;
+    bool _structure_dirty = false;
+    std::chrono::steady_clock::time_point _last_snapshot;
+
+    // a snapshot that is being serialized
+    bool _building = false;
+    bool _build_clean = false;
+    Shape _build_shape{};
+    std::vector<ProjectChunk> _build;
+    size_t _build_pos = 0;
+
+    // the version of each chunk of the snapshot when it was serialized
+    std::vector<uint64_t> _build_versions;
+
+    // where the snapshot is saved to once it is done, if it is for a save
+    std::filesystem::path _save_path;
+
+    void begin_snapshot(const Song& song, bool clean);
+    void continue_snapshot(const Song& song, double budget);
+    void mark_dirty(const ProjectChunkId& chunk);
+    void send(Request&& request);
+
+    // io thread state
+    std::vector<ProjectChunk> _chunks; // the song as of the last request
+    std::ofstream _journal;
+    size_t _journal_size = 0;
+    size_t _image_size = 0;
+
+    void _thread_proc();
+    void handle(Request& request);
+    void write_journal();
+    void append_chunk(const ProjectChunk& chunk);
+    void remove_journal();
+
+public:
+    Autosave(const std::filesystem::path& directory, const Song& song);
+
+    // writes everything that is still queued, then deletes the journal
+    ~Autosave();
+
+    // mark the parts of the song an action changes. called before it is done, undone or redone
+    void record(const change::Action& action);
+
+    // send the edits made since the last call to the io thread. called once every frame
+    void update(const Song& song);
+
+    /**
+    * Start over from a song that was replaced.
+    * @param clean Whether the song is the same as a file on disk, or a new song.
+    *              If it is not, it is written to the journal
+    **/
+    void rebase(const Song& song, bool clean);
+
+    /**
+    * Serialize the song over the next few frames, then write it to a file in
+    * the background. Edits made in the meantime are included in the file.
+    **/
+    void save(const Song& song, const std::filesystem::path& path);
+
+    // serialize what is left of a save at once. called before the song is replaced or destroyed
+    void finish_save(const Song& song);
+
+    // take the message to show about the last save, if there is one
+    bool poll_status(std::string& status);
+
+    bool has_recovery() const;
+    void discard_recovery();
+
+    /**
+    * Load the song in the journal left by the last session. Edits up to
+    * the last one that was completely written are recovered.
+    * @returns the song, or nullptr if there was an error
+    **/
+    std::unique_ptr<Song> recover(
+        audiomod::ModuleContext& modctx,
+        plugins::PluginManager& plugin_manager,
+        std::string* error_msg
+    );
 };
\ No newline at end of file
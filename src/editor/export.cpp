@@ -1,19 +1,26 @@
 #include "editor.h"
+#include <cctype>
 
-SongExport::SongExport(SongEditor& editor, const std::filesystem::path file_name, int sample_rate)
-:   editor(editor),
-    _error(),
+SongExport::SongExport(SongEditor& editor, const SongEditor::ExportConfigData& config)
+:   _error(),
     is_done(false),
+    editor(editor),
+    _thread_pool(ThreadPool::default_thread_count()),
+    modctx(config.sample_rate, 2, BLOCK_SIZE),
     total_frames(0),
-    _step(0),
-    modctx(sample_rate, 2, 64)
+    _file_name(config.file_name),
+    _format(config.format),
+    _dither(config.dither)
 {
+    // plugins wait for every block instead of keeping up with real time
+    modctx.set_offline(true);
+
     // calculate length of song
     std::unique_ptr<Song>& orig_song = editor.song;
 
     int beat_len = orig_song->length() * orig_song->beats_per_bar;
     float sec_len = (float)beat_len * (60.0f / orig_song->tempo);
-    total_frames = sec_len * sample_rate;
+    total_frames = sec_len * modctx.sample_rate;
 
     // create destination node
     // create a clone of the song
@@ -32,38 +39,126 @@ SongExport::SongExport(SongEditor& editor, const std::filesystem::path file_name
     }
 
     // open file
-    out_file.open(file_name, std::ios::out | std::ios::trunc | std::ios::binary);
+    out_file.open(_file_name, std::ios::out | std::ios::trunc | std::ios::binary);
 
     // if could not open file?
     if (!out_file.is_open()) {
-        _error = std::string("Could not save to ") + file_name.u8string();
+        _error = std::string("Could not save to ") + _file_name.u8string();
         return;
     }
 
     // create writer
-    writer = std::make_unique<audiofile::WavWriter>(
-        out_file,
-        total_frames,
-        modctx.num_channels,
-        modctx.sample_rate
-    );
+    writer = create_writer(out_file);
+
+    // tap the end of each channel's and bus's chain. all stems come
+    // out of the same pass through the graph as the mix
+    if (config.stems)
+    {
+        for (size_t i = 0; i < song->channels.size(); i++)
+        {
+            Channel& channel = *song->channels[i];
+            if (!add_stem(channel.vol_mod, std::to_string(i + 1) + " " + channel.name)) return;
+        }
+    }
+
+    if (config.bus_stems)
+    {
+        for (size_t i = 0; i < song->fx_mixer.size(); i++)
+        {
+            audiomod::FXBus& bus = *song->fx_mixer[i];
+            if (!add_stem(bus.controller, "bus " + std::to_string(i) + " " + bus.name)) return;
+        }
+    }
+
+    // the graph is processed by the export's own threads, so
+    // it does not compete with the live audio for the real-time pool
+    modctx.set_thread_pool(&_thread_pool);
 
     // set up song for exporting
     is_done = false;
 
-    song->bar_position = 0;
+    song->seek(0.0);
     song->is_playing = true;
     song->do_loop = false;
+    song->commit();
+    modctx.commit();
     song->play();
-    //destination.prepare();
+
+    _thread = std::thread(&SongExport::_thread_proc, this);
 }
 
-void SongExport::process()
+std::unique_ptr<audiofile::Writer> SongExport::create_writer(std::ostream& stream)
 {
-    if (is_done) return;
+    // the format is picked from the extension of the file name
+    std::string ext = _file_name.extension().u8string();
+    for (char& ch : ext)
+        ch = tolower((unsigned char)ch);
+
+    if (ext == ".flac")
+    {
+        return std::make_unique<audiofile::FlacWriter>(
+            stream,
+            total_frames,
+            modctx.num_channels,
+            modctx.sample_rate,
+            _format,
+            _dither
+        );
+    }
 
-    while (song->is_playing) {
-        song->update(1.0 / modctx.sample_rate * modctx.frames_per_buffer);
+    return std::make_unique<audiofile::WavWriter>(
+        stream,
+        total_frames,
+        modctx.num_channels,
+        modctx.sample_rate,
+        _format,
+        _dither
+    );
+}
+
+bool SongExport::add_stem(const audiomod::ModuleNodeRc& node, const std::string& name)
+{
+    auto stem = std::make_unique<Stem>();
+
+    // only keep characters that are safe in file names
+    std::string safe_name;
+    for (char ch : name)
+        safe_name += (isalnum((unsigned char)ch) || ch == ' ' || ch == '-' || ch == '_') ? ch : '_';
+
+    stem->file_name = _file_name;
+    stem->file_name.replace_filename(
+        _file_name.stem().u8string() + " - " + safe_name + _file_name.extension().u8string()
+    );
+
+    stem->file.open(stem->file_name, std::ios::out | std::ios::trunc | std::ios::binary);
+
+    if (!stem->file.is_open()) {
+        _error = std::string("Could not save to ") + stem->file_name.u8string();
+        return false;
+    }
+
+    stem->writer = create_writer(stem->file);
+    
+    stem->tap = modctx.add_tap(node);
+    _stems.push_back(std::move(stem));
+    return true;
+}
+
+SongExport::~SongExport()
+{
+    cancel();
+    if (_thread.joinable()) _thread.join();
+}
+
+void SongExport::cancel()
+{
+    _cancelled = true;
+}
+
+void SongExport::_thread_proc()
+{
+    while (song->is_playing && !_cancelled) {
+        song->update(modctx.frames_per_buffer);
 
         float* buf;
         size_t buf_size = modctx.process(buf);
@@ -71,24 +166,45 @@ void SongExport::process()
 
         writer->write_block(buf, buf_size);
 
-        _step++;
+        for (std::unique_ptr<Stem>& stem : _stems)
+            stem->writer->write_block(modctx.tap_output(stem->tap), buf_size);
 
-        if (_step > 1000) {
-            _step = 0;
-            return;
-        }
+        _written_frames.store(writer->written_samples / modctx.num_channels, std::memory_order_relaxed);
+
+        // a module that could not render a block has left a gap in the file
+        if (!modctx.error().empty()) break;
+    }
+
+    writer->flush();
+    out_file.close();
+
+    for (std::unique_ptr<Stem>& stem : _stems)
+    {
+        stem->writer->flush();
+        stem->file.close();
     }
 
-    if (!is_done)
+    // don't leave truncated files behind
+    if (_cancelled || !modctx.error().empty())
     {
-        is_done = true;
-        out_file.close();
-        song = nullptr;
-        //audiomod::ModuleBase::free_garbage_modules();
+        std::error_code ec;
+        std::filesystem::remove(_file_name, ec);
+
+        for (std::unique_ptr<Stem>& stem : _stems)
+            std::filesystem::remove(stem->file_name, ec);
     }
+
+    is_done = true;
+}
+
+std::string SongExport::error() const
+{
+    if (!_error.empty()) return _error;
+    return modctx.error();
 }
 
 float SongExport::get_progress() const
 {
-    return (float)writer->written_samples / writer->total_samples;
-}
\ No newline at end of file
+    if (total_frames == 0) return 1.0f;
+    return (float)_written_frames.load(std::memory_order_relaxed) / total_frames;
+}
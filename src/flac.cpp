@@ -0,0 +1,1135 @@
+#include "audiofile.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+// an encoder for the FLAC format: https://xiph.org/flac/format.html
+using namespace audiofile;
+
+namespace
+{
+    // writes a stream of bits, most significant bit first
+    class BitWriter
+    {
+    private:
+        std::vector<uint8_t>& _out;
+        uint64_t _acc = 0;
+        int _count = 0; // amount of bits in the accumulator that were not written yet
+
+    public:
+        BitWriter(std::vector<uint8_t>& out) : _out(out) {};
+
+        // write the low bits of a value. bits may be at most 32
+        inline void write(uint32_t value, int bits)
+        {
+            if (bits == 0) return;
+
+            uint64_t mask = (bits == 32) ? 0xFFFFFFFFull : ((1ull << bits) - 1);
+            _acc = (_acc << bits) | (value & mask);
+            _count += bits;
+
+            while (_count >= 8)
+            {
+                _count -= 8;
+                _out.push_back((uint8_t)(_acc >> _count));
+            }
+        }
+
+        // write a number of zero bits followed by a one bit
+        inline void write_unary(uint32_t zeros)
+        {
+            while (zeros >= 32)
+            {
+                write(0, 32);
+                zeros -= 32;
+            }
+
+            write(1, zeros + 1);
+        }
+
+        // pad with zero bits up to the next byte
+        inline void align()
+        {
+            if (_count > 0) write(0, 8 - _count);
+        }
+    };
+
+    struct CrcTables
+    {
+        uint8_t crc8[256];
+        uint16_t crc16[256];
+
+        CrcTables()
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                uint8_t c8 = i;
+                for (int j = 0; j < 8; j++)
+                    c8 = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : (c8 << 1);
+                crc8[i] = c8;
+
+                uint16_t c16 = i << 8;
+                for (int j = 0; j < 8; j++)
+                    c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : (c16 << 1);
+                crc16[i] = c16;
+            }
+        }
+    };
+
+    static const CrcTables crc_tables;
+
+    uint8_t crc8(const uint8_t* data, size_t size)
+    {
+        uint8_t crc = 0;
+        for (size_t i = 0; i < size; i++)
+            crc = crc_tables.crc8[crc ^ data[i]];
+        return crc;
+    }
+
+    uint16_t crc16(const uint8_t* data, size_t size)
+    {
+        uint16_t crc = 0;
+        for (size_t i = 0; i < size; i++)
+            crc = (crc << 8) ^ crc_tables.crc16[(crc >> 8) ^ data[i]];
+        return crc;
+    }
+
+    constexpr int MAX_FIXED_ORDER = 4;
+    constexpr int MAX_LPC_ORDER = 12;
+    constexpr int MAX_PARTITION_ORDER = 8;
+    constexpr int MAX_RICE_PARAM = 30;
+
+    enum class SubframeType
+    {
+        Constant,
+        Verbatim,
+        Fixed,
+        LPC
+    };
+
+    // how a channel of a block is going to be encoded
+    struct Subframe
+    {
+        SubframeType type = SubframeType::Verbatim;
+        int bits = 0; // bits per sample in this channel
+        int order = 0;
+
+        // lpc only
+        int precision = 0;
+        int shift = 0;
+        int32_t coefs[MAX_LPC_ORDER];
+
+        std::vector<int32_t> residual;
+        int partition_order = 0;
+        int rice_params[1 << MAX_PARTITION_ORDER];
+
+        // estimated size of the subframe in bits
+        uint64_t size = UINT64_MAX;
+    };
+
+    // fold a signed residual into an unsigned number for rice coding
+    inline uint32_t zigzag(int32_t v)
+    {
+        return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+    }
+
+    // choose a partition order and rice parameters for the residual of a subframe,
+    // and return the estimated amount of bits the residual takes up
+    uint64_t plan_residual(Subframe& sub, size_t block_size)
+    {
+        // the partition sums for the highest partition order. the sums
+        // for lower orders are found by adding neighbouring partitions
+        int max_order = 0;
+        while (
+            max_order < MAX_PARTITION_ORDER &&
+            block_size % (2u << max_order) == 0 &&
+            (block_size >> (max_order + 1)) > (size_t)sub.order
+        ) max_order++;
+
+        uint64_t sums[1 << MAX_PARTITION_ORDER];
+        size_t counts[1 << MAX_PARTITION_ORDER];
+        const size_t partitions = 1 << max_order;
+        const size_t partition_size = block_size >> max_order;
+
+        size_t i = 0;
+        for (size_t p = 0; p < partitions; p++)
+        {
+            // the first partition does not contain the warm-up samples
+            size_t end = (p + 1) * partition_size - sub.order;
+            uint64_t sum = 0;
+            counts[p] = end - i;
+
+            for (; i < end; i++)
+                sum += zigzag(sub.residual[i]);
+
+            sums[p] = sum;
+        }
+
+        uint64_t best_size = UINT64_MAX;
+
+        for (int order = max_order; order >= 0; order--)
+        {
+            const size_t n_parts = 1 << order;
+            uint64_t size = 0;
+            int params[1 << MAX_PARTITION_ORDER];
+
+            for (size_t p = 0; p < n_parts; p++)
+            {
+                // the estimated size with parameter k is n*(k+1) + sum/2^k
+                uint64_t best = UINT64_MAX;
+
+                for (int k = 0; k <= MAX_RICE_PARAM; k++)
+                {
+                    uint64_t bits = counts[p] * (k + 1) + (sums[p] >> k);
+                    if (bits < best)
+                    {
+                        best = bits;
+                        params[p] = k;
+                    }
+                }
+
+                size += best + 5;
+            }
+
+            if (size < best_size)
+            {
+                best_size = size;
+                sub.partition_order = order;
+                memcpy(sub.rice_params, params, n_parts * sizeof(int));
+            }
+
+            // merge neighbouring partitions for the next lower order
+            for (size_t p = 0; p < n_parts / 2; p++)
+            {
+                sums[p] = sums[p * 2] + sums[p * 2 + 1];
+                counts[p] = counts[p * 2] + counts[p * 2 + 1];
+            }
+        }
+
+        return best_size + 6;
+    }
+
+    // try the fixed predictor of the given order
+    void try_fixed(const int32_t* x, size_t n, int bits, int order, Subframe& best, Subframe& scratch)
+    {
+        if ((size_t)order >= n) return;
+
+        scratch.type = SubframeType::Fixed;
+        scratch.bits = bits;
+        scratch.order = order;
+        scratch.residual.resize(n - order);
+
+        for (size_t i = order; i < n; i++)
+        {
+            int64_t r;
+
+            switch (order)
+            {
+                case 0: r = x[i]; break;
+                case 1: r = (int64_t)x[i] - x[i-1]; break;
+                case 2: r = (int64_t)x[i] - 2 * (int64_t)x[i-1] + x[i-2]; break;
+                case 3: r = (int64_t)x[i] - 3 * (int64_t)x[i-1] + 3 * (int64_t)x[i-2] - x[i-3]; break;
+                default: r = (int64_t)x[i] - 4 * (int64_t)x[i-1] + 6 * (int64_t)x[i-2] - 4 * (int64_t)x[i-3] + x[i-4]; break;
+            }
+
+            scratch.residual[i - order] = (int32_t)r;
+        }
+
+        scratch.size = 8 + order * bits + plan_residual(scratch, n);
+        if (scratch.size < best.size) std::swap(best, scratch);
+    }
+
+    // compute the lpc coefficients of every order up to max_order with the
+    // levinson-durbin recursion. coefs[k] holds the coefficients of order k + 1
+    void compute_lpc(const int32_t* x, size_t n, int max_order, double coefs[MAX_LPC_ORDER][MAX_LPC_ORDER])
+    {
+        // hann window, to reduce the influence of the block edges
+        std::vector<double> windowed(n);
+        for (size_t i = 0; i < n; i++)
+            windowed[i] = x[i] * (0.5 - 0.5 * cos(2.0 * M_PI * (i + 0.5) / n));
+
+        double autoc[MAX_LPC_ORDER + 1];
+        for (int lag = 0; lag <= max_order; lag++)
+        {
+            double sum = 0.0;
+            for (size_t i = lag; i < n; i++)
+                sum += windowed[i] * windowed[i - lag];
+            autoc[lag] = sum;
+        }
+
+        // lpc[j] is the weight of the sample j + 1 samples back
+        double lpc[MAX_LPC_ORDER] = {};
+        double prev[MAX_LPC_ORDER];
+        double error = autoc[0];
+
+        for (int i = 0; i < max_order; i++)
+        {
+            double acc = autoc[i + 1];
+            for (int j = 0; j < i; j++)
+                acc -= lpc[j] * autoc[i - j];
+
+            double k = error > 0.0 ? acc / error : 0.0;
+
+            memcpy(prev, lpc, sizeof(prev));
+            lpc[i] = k;
+            for (int j = 0; j < i; j++)
+                lpc[j] = prev[j] - k * prev[i - 1 - j];
+
+            error *= 1.0 - k * k;
+
+            for (int j = 0; j <= i; j++)
+                coefs[i][j] = lpc[j];
+        }
+    }
+
+    // try an lpc predictor with the given unquantized coefficients
+    void try_lpc(const int32_t* x, size_t n, int bits, int order, const double* lpc, Subframe& best, Subframe& scratch)
+    {
+        if ((size_t)order >= n) return;
+
+        // coefficient precision, as libFLAC picks it for full-size blocks
+        const int precision = bits <= 16 ? 13 : 15;
+        const int32_t q_max = (1 << (precision - 1)) - 1;
+        const int32_t q_min = -(1 << (precision - 1));
+
+        double c_max = 0.0;
+        for (int i = 0; i < order; i++)
+            c_max = std::max(c_max, fabs(lpc[i]));
+        if (c_max <= 0.0) return;
+
+        int log2_cmax;
+        frexp(c_max, &log2_cmax);
+        int shift = std::clamp(precision - log2_cmax - 1, 0, 15);
+
+        // quantize, carrying the rounding error over to the next coefficient
+        double error = 0.0;
+        for (int i = 0; i < order; i++)
+        {
+            error += lpc[i] * (1 << shift);
+            int32_t q = (int32_t)lround(error);
+            q = std::clamp(q, q_min, q_max);
+            error -= q;
+            scratch.coefs[i] = q;
+        }
+
+        scratch.type = SubframeType::LPC;
+        scratch.bits = bits;
+        scratch.order = order;
+        scratch.precision = precision;
+        scratch.shift = shift;
+        scratch.residual.resize(n - order);
+
+        for (size_t i = order; i < n; i++)
+        {
+            int64_t sum = 0;
+            for (int j = 0; j < order; j++)
+                sum += (int64_t)scratch.coefs[j] * x[i - 1 - j];
+
+            int64_t r = (int64_t)x[i] - (sum >> shift);
+
+            // the residual has to fit in 32 bits
+            if (r > INT32_MAX || r < INT32_MIN) return;
+            scratch.residual[i - order] = (int32_t)r;
+        }
+
+        scratch.size = 8 + order * bits + 4 + 5 + order * precision + plan_residual(scratch, n);
+        if (scratch.size < best.size) std::swap(best, scratch);
+    }
+
+    // find the cheapest way to encode a channel of a block
+    void plan_subframe(const int32_t* x, size_t n, int bits, Subframe& best, Subframe& scratch)
+    {
+        best.size = UINT64_MAX;
+
+        // silence, or any other constant signal
+        bool constant = true;
+        for (size_t i = 1; i < n && constant; i++)
+            constant = x[i] == x[0];
+
+        if (constant)
+        {
+            best.type = SubframeType::Constant;
+            best.bits = bits;
+            best.order = 0;
+            best.size = 8 + bits;
+            return;
+        }
+
+        for (int order = 0; order <= MAX_FIXED_ORDER; order++)
+            try_fixed(x, n, bits, order, best, scratch);
+
+        int max_lpc_order = std::min(MAX_LPC_ORDER, (int)n - 1);
+        if (max_lpc_order > 0)
+        {
+            double coefs[MAX_LPC_ORDER][MAX_LPC_ORDER];
+            compute_lpc(x, n, max_lpc_order, coefs);
+
+            for (int order : { 4, 8, 12 })
+            {
+                if (order <= max_lpc_order)
+                    try_lpc(x, n, bits, order, coefs[order - 1], best, scratch);
+            }
+        }
+
+        // store the samples as they are if prediction did not help
+        uint64_t verbatim_size = 8 + (uint64_t)n * bits;
+        if (verbatim_size <= best.size)
+        {
+            best.type = SubframeType::Verbatim;
+            best.bits = bits;
+            best.order = 0;
+            best.size = verbatim_size;
+        }
+    }
+
+    void write_subframe(BitWriter& w, const Subframe& sub, const int32_t* x, size_t n)
+    {
+        // zero padding bit, then the type, then the "wasted bits" flag
+        w.write(0, 1);
+
+        switch (sub.type)
+        {
+            case SubframeType::Constant:
+                w.write(0x00, 6);
+                w.write(0, 1);
+                w.write((uint32_t)x[0], sub.bits);
+                return;
+
+            case SubframeType::Verbatim:
+                w.write(0x01, 6);
+                w.write(0, 1);
+                for (size_t i = 0; i < n; i++)
+                    w.write((uint32_t)x[i], sub.bits);
+                return;
+
+            case SubframeType::Fixed:
+                w.write(0x08 | sub.order, 6);
+                w.write(0, 1);
+                for (int i = 0; i < sub.order; i++)
+                    w.write((uint32_t)x[i], sub.bits);
+                break;
+
+            case SubframeType::LPC:
+                w.write(0x20 | (sub.order - 1), 6);
+                w.write(0, 1);
+                for (int i = 0; i < sub.order; i++)
+                    w.write((uint32_t)x[i], sub.bits);
+
+                w.write(sub.precision - 1, 4);
+                w.write(sub.shift, 5);
+                for (int i = 0; i < sub.order; i++)
+                    w.write((uint32_t)sub.coefs[i], sub.precision);
+                break;
+        }
+
+        // residual. 4-bit rice parameters are enough unless one is above 14
+        const size_t n_parts = 1 << sub.partition_order;
+        int method = 0;
+        for (size_t p = 0; p < n_parts; p++)
+        {
+            if (sub.rice_params[p] > 14) method = 1;
+        }
+
+        w.write(method, 2);
+        w.write(sub.partition_order, 4);
+
+        size_t i = 0;
+        for (size_t p = 0; p < n_parts; p++)
+        {
+            const int k = sub.rice_params[p];
+            size_t end = (p + 1) * (n >> sub.partition_order) - sub.order;
+            w.write(k, method == 0 ? 4 : 5);
+
+            for (; i < end; i++)
+            {
+                uint32_t u = zigzag(sub.residual[i]);
+                uint32_t q = u >> k;
+
+                // write the unary quotient and the remainder
+                // together if they fit in one call
+                if (q + 1 + k <= 32)
+                    w.write((1u << k) | (u & ((1u << k) - 1)), q + 1 + k);
+                else
+                {
+                    w.write_unary(q);
+                    if (k > 0) w.write(u & ((1u << k) - 1), k);
+                }
+            }
+        }
+    }
+
+    // encode a frame number with the "utf-8" coding FLAC uses
+    void write_utf8(BitWriter& w, uint32_t value)
+    {
+        if (value < 0x80)
+        {
+            w.write(value, 8);
+            return;
+        }
+
+        int bytes = value < 0x800 ? 2 : value < 0x10000 ? 3 : value < 0x200000 ? 4 : value < 0x4000000 ? 5 : 6;
+        int shift = (bytes - 1) * 6;
+
+        w.write((0xFF00 >> bytes) | (value >> shift), 8);
+
+        while (shift > 0)
+        {
+            shift -= 6;
+            w.write(0x80 | ((value >> shift) & 0x3F), 8);
+        }
+    }
+}
+
+FlacWriter::FlacWriter(
+    std::ostream& stream,
+    size_t total_frames,
+    uint16_t channels,
+    uint32_t sample_rate,
+    SampleFormat format,
+    bool dither
+) :
+Writer(total_frames * channels),
+stream(stream),
+_channels(channels),
+_bits(format == SampleFormat::Int16 ? 16 : 24),
+_quantizer(_bits, dither)
+{
+    _block.number = 0;
+    _block.frames = 0;
+    _block.samples.resize(BLOCK_SIZE * channels);
+
+    // the last block may be shorter than the rest
+    uint32_t block_size = (uint32_t)std::min(total_frames, BLOCK_SIZE);
+    block_size = std::max(block_size, (uint32_t)16);
+
+    std::vector<uint8_t> header;
+    BitWriter w(header);
+
+    w.write('f', 8);
+    w.write('L', 8);
+    w.write('a', 8);
+    w.write('C', 8);
+
+    // STREAMINFO is the only metadata block
+    w.write(1, 1); // last metadata block
+    w.write(0, 7); // block type
+    w.write(34, 24); // block length
+    w.write(block_size, 16); // min block size
+    w.write(block_size, 16); // max block size
+    w.write(0, 24); // min frame size, unknown
+    w.write(0, 24); // max frame size, unknown
+    w.write(sample_rate, 20);
+    w.write(channels - 1, 3);
+    w.write(_bits - 1, 5);
+    w.write((uint32_t)((uint64_t)total_frames >> 32), 4); // total samples per channel
+    w.write((uint32_t)total_frames, 32);
+
+    // md5 signature of the audio data. all zeroes means it was not computed
+    for (int i = 0; i < 4; i++)
+        w.write(0, 32);
+
+    stream.write((const char*)header.data(), header.size());
+
+    _thread = std::thread(&FlacWriter::_thread_proc, this);
+}
+
+FlacWriter::~FlacWriter()
+{
+    flush();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+
+    _cond.notify_all();
+    _thread.join();
+}
+
+void FlacWriter::write_block(const float* data, size_t size)
+{
+    size = std::min(size, total_samples - written_samples);
+
+    int32_t quantized[Quantizer::BATCH_SIZE];
+
+    for (size_t i = 0; i < size; i += Quantizer::BATCH_SIZE)
+    {
+        size_t count = std::min(Quantizer::BATCH_SIZE, size - i);
+        _quantizer.process(data + i, quantized, count);
+
+        // deinterleave into the block
+        for (size_t j = 0; j < count; j++)
+        {
+            size_t sample = written_samples + i + j;
+            size_t channel = sample % _channels;
+
+            _block.samples[channel * BLOCK_SIZE + _block.frames] = quantized[j];
+
+            if (channel == (size_t)_channels - 1 && ++_block.frames == BLOCK_SIZE)
+                submit_block();
+        }
+    }
+
+    written_samples += size;
+}
+
+void FlacWriter::submit_block()
+{
+    Block next;
+    next.number = ++_block_count;
+    next.frames = 0;
+    next.samples.resize(BLOCK_SIZE * _channels);
+
+    {
+        // wait for room in the queue, so a slow encoder
+        // does not let memory use grow without bounds
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [&]() { return _queue.size() < QUEUE_CAPACITY; });
+        _queue.push_back(std::move(_block));
+    }
+
+    _cond.notify_all();
+    _block = std::move(next);
+}
+
+void FlacWriter::flush()
+{
+    if (_block.frames > 0)
+        submit_block();
+
+    // wait for the encoder to write everything
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cond.wait(lock, [&]() { return _queue.empty() && !_encoding; });
+}
+
+void FlacWriter::_thread_proc()
+{
+    std::vector<uint8_t> frame;
+
+    while (true)
+    {
+        Block block;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [&]() { return _quit || !_queue.empty(); });
+            if (_queue.empty()) break;
+
+            block = std::move(_queue.front());
+            _queue.pop_front();
+            _encoding = true;
+        }
+
+        // let write_block continue if it was waiting for room
+        _cond.notify_all();
+
+        frame.clear();
+        encode_block(block, frame);
+        stream.write((const char*)frame.data(), frame.size());
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _encoding = false;
+        }
+
+        _cond.notify_all();
+    }
+}
+
+void FlacWriter::encode_block(const Block& block, std::vector<uint8_t>& out) const
+{
+    const size_t n = block.frames;
+    BitWriter w(out);
+
+    // find the cheapest subframe for each channel. for stereo, also try
+    // encoding the difference between the channels, which is usually small
+    Subframe subframes[4];
+    Subframe scratch;
+    std::vector<Subframe> plans;
+    std::vector<int32_t> side, mid;
+
+    int channel_code = _channels - 1;
+    const int32_t* channel_data[8];
+    const Subframe* channel_subframes[8];
+
+    for (int c = 0; c < _channels; c++)
+        channel_data[c] = block.samples.data() + c * BLOCK_SIZE;
+
+    if (_channels == 2)
+    {
+        const int32_t* left = channel_data[0];
+        const int32_t* right = channel_data[1];
+        side.resize(n);
+        mid.resize(n);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            side[i] = left[i] - right[i];
+            mid[i] = (left[i] + right[i]) >> 1;
+        }
+
+        plan_subframe(left, n, _bits, subframes[0], scratch);
+        plan_subframe(right, n, _bits, subframes[1], scratch);
+        plan_subframe(side.data(), n, _bits + 1, subframes[2], scratch);
+        plan_subframe(mid.data(), n, _bits, subframes[3], scratch);
+
+        uint64_t independent = subframes[0].size + subframes[1].size;
+        uint64_t left_side = subframes[0].size + subframes[2].size;
+        uint64_t right_side = subframes[1].size + subframes[2].size;
+        uint64_t mid_side = subframes[3].size + subframes[2].size;
+        uint64_t best = std::min({ independent, left_side, right_side, mid_side });
+
+        if (best == independent)
+        {
+            channel_subframes[0] = &subframes[0];
+            channel_subframes[1] = &subframes[1];
+        }
+        else if (best == left_side)
+        {
+            channel_code = 8;
+            channel_subframes[0] = &subframes[0];
+            channel_subframes[1] = &subframes[2];
+            channel_data[1] = side.data();
+        }
+        else if (best == right_side)
+        {
+            channel_code = 9;
+            channel_subframes[0] = &subframes[2];
+            channel_subframes[1] = &subframes[1];
+            channel_data[0] = side.data();
+        }
+        else
+        {
+            channel_code = 10;
+            channel_subframes[0] = &subframes[3];
+            channel_subframes[1] = &subframes[2];
+            channel_data[0] = mid.data();
+            channel_data[1] = side.data();
+        }
+    }
+    else
+    {
+        plans.resize(_channels);
+
+        for (int c = 0; c < _channels; c++)
+        {
+            plan_subframe(channel_data[c], n, _bits, plans[c], scratch);
+            channel_subframes[c] = &plans[c];
+        }
+    }
+
+    // frame header
+    w.write(0xFFF8, 16); // sync code, fixed block size
+
+    // block size is written at the end of the header, unless it is the full 4096 frames
+    w.write(n == 4096 ? 0xC : 0x7, 4);
+    w.write(0, 4); // sample rate from STREAMINFO
+    w.write(channel_code, 4);
+    w.write(_bits == 16 ? 0x4 : 0x6, 3);
+    w.write(0, 1);
+    write_utf8(w, block.number);
+    if (n != 4096) w.write((uint32_t)(n - 1), 16);
+
+    w.write(crc8(out.data(), out.size()), 8);
+
+    for (int c = 0; c < _channels; c++)
+        write_subframe(w, *channel_subframes[c], channel_data[c], n);
+
+    w.align();
+
+    uint16_t crc = crc16(out.data(), out.size());
+    w.write(crc, 16);
+}
+
+
+
+#ifdef UNIT_TESTS
+#include <catch2/catch_amalgamated.hpp>
+#include <sstream>
+
+namespace
+{
+    // reads a stream of bits, most significant bit first
+    class BitReader
+    {
+    private:
+        const uint8_t* _data;
+        size_t _size;
+        size_t _pos = 0; // in bits
+
+    public:
+        BitReader(const uint8_t* data, size_t size) : _data(data), _size(size) {};
+
+        inline bool overflow() const { return _pos > _size * 8; }
+        inline size_t byte_pos() const { return _pos / 8; }
+
+        uint32_t read(int bits)
+        {
+            uint32_t value = 0;
+
+            for (int i = 0; i < bits; i++, _pos++)
+            {
+                uint32_t bit = _pos < _size * 8 ? (_data[_pos / 8] >> (7 - _pos % 8)) & 1 : 0;
+                value = (value << 1) | bit;
+            }
+
+            return value;
+        }
+
+        int32_t read_signed(int bits)
+        {
+            int64_t value = read(bits);
+            if (bits > 0 && (value >> (bits - 1)) & 1) value -= (int64_t)1 << bits;
+            return (int32_t)value;
+        }
+
+        uint32_t read_unary()
+        {
+            uint32_t zeros = 0;
+            while (!overflow() && read(1) == 0) zeros++;
+            return zeros;
+        }
+
+        inline void align()
+        {
+            _pos = (_pos + 7) / 8 * 8;
+        }
+    };
+
+    // what a decoded stream was made of
+    struct FlacDecodeStats
+    {
+        int frames = 0;
+        int subframes[4] = {}; // indexed by SubframeType
+        int stereo_modes[4] = {}; // independent, left/side, side/right, mid/side
+    };
+
+    bool decode_residual(BitReader& r, int32_t* residual, size_t n, int order)
+    {
+        int method = r.read(2);
+        if (method > 1) return false;
+
+        int partition_order = r.read(4);
+        const size_t n_parts = 1 << partition_order;
+        size_t i = 0;
+
+        for (size_t p = 0; p < n_parts; p++)
+        {
+            int k = r.read(method == 0 ? 4 : 5);
+
+            // the writer never uses the escape code for unencoded partitions
+            if (k == (method == 0 ? 0xF : 0x1F)) return false;
+
+            size_t end = (p + 1) * (n >> partition_order) - order;
+            for (; i < end; i++)
+            {
+                uint32_t u = (r.read_unary() << k) | r.read(k);
+                residual[i] = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+            }
+        }
+
+        return !r.overflow();
+    }
+
+    bool decode_subframe(BitReader& r, int bits, int32_t* x, size_t n, FlacDecodeStats& stats)
+    {
+        if (r.read(1) != 0) return false;
+        uint32_t type = r.read(6);
+        if (r.read(1) != 0) return false; // wasted bits are not used
+
+        if (type == 0x00)
+        {
+            stats.subframes[(int)SubframeType::Constant]++;
+            int32_t v = r.read_signed(bits);
+            for (size_t i = 0; i < n; i++) x[i] = v;
+        }
+        else if (type == 0x01)
+        {
+            stats.subframes[(int)SubframeType::Verbatim]++;
+            for (size_t i = 0; i < n; i++) x[i] = r.read_signed(bits);
+        }
+        else if (type >= 0x08 && type <= 0x0C)
+        {
+            stats.subframes[(int)SubframeType::Fixed]++;
+            const int order = type & 0x7;
+            for (int i = 0; i < order; i++) x[i] = r.read_signed(bits);
+            if (!decode_residual(r, x + order, n, order)) return false;
+
+            // the residual was decoded in place, add the prediction back
+            for (size_t i = order; i < n; i++)
+            {
+                int64_t prediction;
+
+                switch (order)
+                {
+                    case 0: prediction = 0; break;
+                    case 1: prediction = x[i-1]; break;
+                    case 2: prediction = 2 * (int64_t)x[i-1] - x[i-2]; break;
+                    case 3: prediction = 3 * (int64_t)x[i-1] - 3 * (int64_t)x[i-2] + x[i-3]; break;
+                    default: prediction = 4 * (int64_t)x[i-1] - 6 * (int64_t)x[i-2] + 4 * (int64_t)x[i-3] - x[i-4]; break;
+                }
+
+                x[i] = (int32_t)(x[i] + prediction);
+            }
+        }
+        else if (type >= 0x20)
+        {
+            stats.subframes[(int)SubframeType::LPC]++;
+            const int order = (type & 0x1F) + 1;
+            for (int i = 0; i < order; i++) x[i] = r.read_signed(bits);
+
+            int precision = r.read(4) + 1;
+            int shift = r.read_signed(5);
+            if (shift < 0) return false;
+
+            int32_t coefs[32];
+            for (int i = 0; i < order; i++) coefs[i] = r.read_signed(precision);
+            if (!decode_residual(r, x + order, n, order)) return false;
+
+            for (size_t i = order; i < n; i++)
+            {
+                int64_t sum = 0;
+                for (int j = 0; j < order; j++)
+                    sum += (int64_t)coefs[j] * x[i - 1 - j];
+
+                x[i] = (int32_t)(x[i] + (sum >> shift));
+            }
+        }
+        else return false;
+
+        return !r.overflow();
+    }
+
+    // decode a stream written by FlacWriter into interleaved samples. only the
+    // features the writer uses are supported. returns false if a frame has a
+    // bad crc or could not be decoded
+    bool decode_flac(const std::string& file, std::vector<int32_t>& out, FlacDecodeStats& stats)
+    {
+        const uint8_t* data = (const uint8_t*)file.data();
+        if (file.size() < 42 || file.compare(0, 4, "fLaC") != 0) return false;
+
+        BitReader info(data + 8, 34);
+        info.read(16 + 16 + 24 + 24 + 20);
+        const int channels = info.read(3) + 1;
+        const int bits = info.read(5) + 1;
+        const uint64_t total_frames = ((uint64_t)info.read(4) << 32) | info.read(32);
+
+        size_t pos = 42;
+        std::vector<int32_t> planar;
+
+        while (pos < file.size())
+        {
+            BitReader r(data + pos, file.size() - pos);
+            if (r.read(16) != 0xFFF8) return false;
+
+            int block_code = r.read(4);
+            if (r.read(4) != 0) return false; // sample rate from STREAMINFO
+            int channel_code = r.read(4);
+            int size_code = r.read(3);
+            if (size_code != (bits == 16 ? 0x4 : 0x6)) return false;
+            r.read(1);
+
+            // frame number. the leading one bits tell how many bytes follow
+            uint32_t lead = r.read(8);
+            for (uint32_t mask = 0x40; (lead & 0x80) && (lead & mask); mask >>= 1)
+                r.read(8);
+
+            size_t n;
+            if (block_code == 0xC) n = 4096;
+            else if (block_code == 0x7) n = r.read(16) + 1;
+            else return false;
+
+            size_t header_size = r.byte_pos();
+            if (r.read(8) != crc8(data + pos, header_size)) return false;
+
+            int subframe_channels = channel_code < 8 ? channel_code + 1 : 2;
+            if (subframe_channels != channels || channel_code > 10) return false;
+
+            planar.resize(n * channels);
+
+            for (int c = 0; c < channels; c++)
+            {
+                // the side channel has one more bit
+                bool is_side =
+                    (channel_code == 8 && c == 1) ||
+                    (channel_code == 9 && c == 0) ||
+                    (channel_code == 10 && c == 1);
+                
+                if (!decode_subframe(r, bits + is_side, planar.data() + c * n, n, stats)) return false;
+            }
+
+            r.align();
+            size_t frame_size = r.byte_pos();
+            if (r.read(16) != crc16(data + pos, frame_size) || r.overflow()) return false;
+
+            // undo the stereo decorrelation
+            int32_t* a = planar.data();
+            int32_t* b = planar.data() + n;
+
+            for (size_t i = 0; i < n && channel_code >= 8; i++)
+            {
+                if (channel_code == 8) b[i] = a[i] - b[i];
+                else if (channel_code == 9) a[i] = a[i] + b[i];
+                else
+                {
+                    int32_t mid = (int32_t)((uint32_t)a[i] << 1) | (b[i] & 1);
+                    int32_t side = b[i];
+                    a[i] = (mid + side) >> 1;
+                    b[i] = (mid - side) >> 1;
+                }
+            }
+
+            if (channels == 2) stats.stereo_modes[channel_code < 8 ? 0 : channel_code - 7]++;
+
+            for (size_t i = 0; i < n; i++)
+            {
+                for (int c = 0; c < channels; c++)
+                    out.push_back(planar[c * n + i]);
+            }
+
+            stats.frames++;
+            pos += frame_size + 2;
+        }
+
+        return out.size() == total_frames * channels;
+    }
+
+    // the samples a FlacWriter without dither should store
+    std::vector<int32_t> quantize(const std::vector<float>& samples, int bits)
+    {
+        std::vector<int32_t> out(samples.size());
+        audiofile::Quantizer quantizer(bits, false);
+
+        for (size_t i = 0; i < samples.size(); i += audiofile::Quantizer::BATCH_SIZE)
+        {
+            size_t count = std::min(audiofile::Quantizer::BATCH_SIZE, samples.size() - i);
+            quantizer.process(samples.data() + i, out.data() + i, count);
+        }
+
+        return out;
+    }
+}
+
+TEST_CASE("FlacWriter stream header", "[audiofile]")
+{
+    std::stringstream stream;
+    std::vector<float> samples(48000 * 2, 0.0f);
+
+    for (size_t i = 0; i < 48000; i++)
+    {
+        samples[i * 2] = sinf(i * 0.05f) * 0.5f;
+        samples[i * 2 + 1] = sinf(i * 0.05f) * 0.25f;
+    }
+
+    {
+        audiofile::FlacWriter writer(stream, 48000, 2, 48000);
+        writer.write_block(samples.data(), samples.size());
+    }
+
+    std::string file = stream.str();
+    REQUIRE(file.substr(0, 4) == "fLaC");
+
+    // STREAMINFO: sample rate, channels and bit depth
+    const uint8_t* info = (const uint8_t*)file.data() + 8;
+    uint32_t sample_rate = (info[10] << 12) | (info[11] << 4) | (info[12] >> 4);
+    REQUIRE(sample_rate == 48000);
+    REQUIRE(((info[12] >> 1) & 0x7) + 1 == 2);
+    REQUIRE((((info[12] & 1) << 4) | (info[13] >> 4)) + 1 == 16);
+
+    // the first frame starts right after STREAMINFO
+    REQUIRE((uint8_t)file[42] == 0xFF);
+    REQUIRE((uint8_t)file[43] == 0xF8);
+
+    // a smooth signal compresses well below the size of 16-bit pcm
+    REQUIRE(file.size() < 48000 * 4 / 2);
+}
+
+TEST_CASE("FlacWriter round trip", "[audiofile]")
+{
+    // a block of silence, a block of a ramp, a block of a rich tone and
+    // a short block of noise, so every kind of subframe is used
+    const size_t frames = 4096 * 3 + 1000;
+    std::vector<float> samples(frames * 2, 0.0f);
+    uint32_t rng = 1;
+
+    for (size_t i = 4096; i < frames; i++)
+    {
+        float l, r;
+
+        if (i < 4096 * 2)
+        {
+            l = (i - 4096) / 4096.0f - 0.5f;
+            r = l * 0.5f;
+        }
+        else if (i < 4096 * 3)
+        {
+            l = sinf(i * 0.031f) * 0.3f + sinf(i * 0.173f) * 0.2f + sinf(i * 0.411f) * 0.1f;
+            r = sinf(i * 0.052f) * 0.4f;
+        }
+        else
+        {
+            rng = rng * 1664525 + 1013904223;
+            l = (int32_t)rng / 2147483648.0f;
+            rng = rng * 1664525 + 1013904223;
+            r = (int32_t)rng / 2147483648.0f;
+        }
+
+        samples[i * 2] = l;
+        samples[i * 2 + 1] = r;
+    }
+
+    for (auto format : { audiofile::SampleFormat::Int16, audiofile::SampleFormat::Int24 })
+    {
+        const int bits = format == audiofile::SampleFormat::Int16 ? 16 : 24;
+        std::stringstream stream;
+
+        {
+            audiofile::FlacWriter writer(stream, frames, 2, 48000, format);
+            writer.write_block(samples.data(), samples.size());
+        }
+
+        std::string file = stream.str();
+        std::vector<int32_t> decoded;
+        FlacDecodeStats stats;
+
+        REQUIRE(decode_flac(file, decoded, stats));
+        REQUIRE(stats.frames == 4);
+        REQUIRE(decoded == quantize(samples, bits));
+
+        REQUIRE(stats.subframes[(int)SubframeType::Constant] > 0);
+        REQUIRE(stats.subframes[(int)SubframeType::Verbatim] > 0);
+        REQUIRE(stats.subframes[(int)SubframeType::Fixed] > 0);
+        REQUIRE(stats.subframes[(int)SubframeType::LPC] > 0);
+        REQUIRE(stats.stereo_modes[0] + stats.stereo_modes[1] + stats.stereo_modes[2] + stats.stereo_modes[3] == 4);
+
+        // a flipped bit in the middle of a frame fails the crc
+        file[file.size() / 2] ^= 0x10;
+        decoded.clear();
+        REQUIRE_FALSE(decode_flac(file, decoded, stats));
+    }
+}
+
+TEST_CASE("FlacWriter mono round trip", "[audiofile]")
+{
+    const size_t frames = 5000;
+    std::vector<float> samples(frames);
+
+    for (size_t i = 0; i < frames; i++)
+        samples[i] = sinf(i * 0.02f) * 0.7f;
+
+    std::stringstream stream;
+    {
+        audiofile::FlacWriter writer(stream, frames, 1, 44100);
+        writer.write_block(samples.data(), samples.size());
+    }
+
+    std::vector<int32_t> decoded;
+    FlacDecodeStats stats;
+
+    REQUIRE(decode_flac(stream.str(), decoded, stats));
+    REQUIRE(stats.frames == 2);
+    REQUIRE(decoded == quantize(samples, 16));
+}
+
+#endif
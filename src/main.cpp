@@ -1,5 +1,6 @@
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -48,6 +49,8 @@
 #include "sys.h"
 #include "util.h"
 #include "winmgr.h"
+#include "plugin_hosts/ladspa.h"
+#include "plugin_hosts/sandbox.h"
 
 bool IS_BIG_ENDIAN;
 
@@ -100,6 +103,17 @@ int main(int argc, char** argv)
         IS_BIG_ENDIAN = bint.c[0] == 1;
     }
 
+    // the plugin scanner and sandboxed plugins run this program again,
+    // so that a plugin that crashes does not take down the editor
+    for (int i = 0; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--scan-ladspa") == 0)
+            return plugins::LadspaPlugin::scan_process_main(argv[i + 1]);
+
+        if (strcmp(argv[i], "--host-plugin") == 0)
+            return plugins::SandboxedPlugin::host_process_main(argc - i - 1, argv + i + 1);
+    }
+
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit())
         return 1;
@@ -166,16 +180,10 @@ int main(int argc, char** argv)
 
     ui::show_demo_window = false;
 
-    AudioDevice device(-1);
-
     {
-        const size_t BUFFER_SIZE = 128;
-
-        // initialize song editor
-        SongEditor song_editor(
-            device, BUFFER_SIZE,
-            window_manager
-        );
+        // initialize song editor. this opens the audio device
+        // and starts the render thread
+        SongEditor song_editor(window_manager);
         song_editor.load_preferences();
 
         // application quit
@@ -192,11 +200,6 @@ int main(int argc, char** argv)
 
         bool run_app = true;
 
-        // song processing thread
-        sys::interval_t* audioaux_interval = sys::set_interval(5, [&]() {
-            song_editor.process(device);
-        });
-
         // TODO: run all application logic in another thread (renderer)
         // so that window doesn't freeze when it is being dragged.
         // use glfwWaitEvents(false) on main thread and poll on renderer thread
@@ -237,11 +240,7 @@ int main(int argc, char** argv)
                             ImGui::IsKeyDown(ImGuiMod_Alt) == ((action.modifiers & USERMOD_ALT) != 0))
                         ) {
                             if (action.callback)
-                            {
-                                song_editor.mutex.lock();
                                 action.callback();
-                                song_editor.mutex.unlock();
-                            }
                             else
                                 std::cout << "no callback set for " << action.name << "\n";                    
                         }
@@ -276,9 +275,11 @@ int main(int argc, char** argv)
             ImGui_ImplOpenGL3_NewFrame();
             ImGui_ImplGlfw_NewFrame();
 
-            song_editor.mutex.lock();
+            song_editor.ui_update();
             ui::compute_imgui(song_editor);
-            song_editor.mutex.unlock();
+
+            // publish this frame's edits to the render thread
+            song_editor.commit();
 
             // run worker scheduler
             song->work_scheduler.run();
@@ -294,11 +295,10 @@ int main(int argc, char** argv)
             prev_time = glfwGetTime();
         }
 
-        sys::clear_interval(audioaux_interval);
+        song_editor.stop_audio();
         song_editor.save_preferences();
     }
 
-    device.stop();
     AudioDevice::_pa_stop();
 
 #ifdef ENABLE_LV2
@@ -7,13 +7,15 @@
 using namespace audiomod;
 
 AnalyzerModule::AnalyzerModule(ModuleContext& modctx)
-:   ModuleBase(true), ring_buffer(modctx.sample_rate * 0.5) // hold 0.5 seconds of audio
+:   ModuleBase(true),
+    // hold 0.25 seconds of audio
+    ring_left(modctx.sample_rate / 4),
+    ring_right(modctx.sample_rate / 4)
 {
     id = "effect.analyzer";
     name = "Analyzer";
 
     size_t arr_size = frames_per_window + window_margin * 2;
-    buf = new float[arr_size * modctx.num_channels];
 
     for (int i = 0; i < 2; i++) {
         window_left[i] = new float[arr_size];
@@ -38,7 +40,6 @@ AnalyzerModule::AnalyzerModule(ModuleContext& modctx)
 
 AnalyzerModule::~AnalyzerModule() {
     ready = false;
-    delete[] buf;
 
     for (int i = 0; i < 2; i++) {
         delete[] window_left[i];
@@ -58,38 +59,36 @@ AnalyzerModule::~AnalyzerModule() {
     }
 }
 
-void AnalyzerModule::process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) {
-    for (size_t i = 0; i < buffer_size; i += channel_count) {
-        output[i] = 0;
-        output[i + 1] = 0;
+void AnalyzerModule::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) {
+    mix_buffers(output, inputs, num_inputs, frames * channel_count);
 
-        for (size_t k = 0; k < num_inputs; k++) {
-            output[i] += inputs[k][i];
-            output[i + 1] += inputs[k][i + 1];
+    bool silent = true;
+    for (size_t i = 0; i < frames * channel_count; i++)
+    {
+        if (output[i] != 0.0f)
+        {
+            silent = false;
+            break;
         }
     }
 
-    ring_buffer.write(output, buffer_size);
-    size_t samples_per_window = (frames_per_window + window_margin * 2) * 2;
+    // the analyzer is never bypassed so the display keeps updating,
+    // but it can still let the modules after it be bypassed
+    _silent_output = silent;
+
+    ring_left.write(output, frames);
+    ring_right.write(output + frames, frames);
+    size_t frames_per_read = frames_per_window + window_margin * 2;
 
     // write to window
-    if (!in_use && ring_buffer.queued() > samples_per_window)
+    if (!in_use && ring_left.queued() > frames_per_read && ring_right.queued() > frames_per_read)
     {
         int buf_idx = 1 - window_front;
-        
-        float* left = window_left[buf_idx];
-        float* right = window_right[buf_idx];
-        
-        size_t num_read = ring_buffer.read(buf, samples_per_window);
-        assert(num_read == samples_per_window);
-
-        size_t j = 0;
-
-        for (size_t i = 0; i < samples_per_window; i += channel_count) {
-            left[j] = buf[i];
-            right[j] = buf[i + 1];
-            j++;
-        }
+
+        size_t num_read = ring_left.read(window_left[buf_idx], frames_per_read);
+        assert(num_read == frames_per_read);
+        num_read = ring_right.read(window_right[buf_idx], frames_per_read);
+        assert(num_read == frames_per_read);
 
         if (!in_use) window_front = buf_idx;
     }
@@ -8,15 +8,16 @@ namespace audiomod
 {
     class AnalyzerModule : public ModuleBase {
     protected:
-        void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) override;
+        void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) override;
         void _interface_proc() override;
 
 
-        RingBuffer<float> ring_buffer;
+        // one ring buffer per channel
+        RingBuffer<float> ring_left;
+        RingBuffer<float> ring_right;
 
         const int frames_per_window = 1024;
         const int window_margin = 512; // in frames
-        float* buf;
 
         // 0 = view oscilloscope
         // 1 = view spectum
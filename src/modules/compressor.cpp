@@ -1,9 +1,11 @@
 #include <cstdint>
 #include <cmath>
+#include <cstring>
 #include <imgui.h>
 #include "compressor.h"
 #include "../sys.h"
 #include "../util.h"
+#include "../dsp.h"
 
 using namespace audiomod;
 
@@ -84,7 +86,8 @@ bool CompressorModule::load_state(std::istream& istream, size_t size)
     return true;
 }
 
-void CompressorModule::process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) {
+void CompressorModule::receive_messages()
+{
     // read messages sent from ui thread
     while (true)
     {
@@ -109,7 +112,27 @@ void CompressorModule::process(float** inputs, float* output, size_t num_inputs,
             ui_queue.post(&new_msg, sizeof(new_msg));
         }
     }
-    
+}
+
+void CompressorModule::idle(size_t frames)
+{
+    receive_messages();
+
+    // reset envelope and analytics once, when the module is first bypassed
+    if (!_bypassed)
+    {
+        _bypassed = true;
+        _limit[0] = _limit[1] = 0.0f;
+        memset(_in_buf, 0, sizeof(_in_buf));
+        memset(_out_buf, 0, sizeof(_out_buf));
+        memset(&process_analytics, 0, sizeof(process_analytics));
+    }
+}
+
+void CompressorModule::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) {
+    receive_messages();
+    _bypassed = false;
+
     module_state& state = process_state;
 
     float in_factor = db_to_mult(state.input_gain);
@@ -119,30 +142,24 @@ void CompressorModule::process(float** inputs, float* output, size_t num_inputs,
     float a = powf(0.01f, 1.0f / (state.attack * modctx.sample_rate * 0.001f));
     float r = powf(0.01f, 1.0f / (state.decay * modctx.sample_rate * 0.001f));
     
-    for (size_t i = 0; i < buffer_size; i += channel_count) {
-        // receive inputs
-        output[i] = 0.0f;
-        output[i+1] = 0.0f;
+    mix_buffers(output, inputs, num_inputs, frames * channel_count, in_factor);
 
-        for (size_t k = 0; k < num_inputs; k++)
-        {
-            output[i] += inputs[k][i] * in_factor;
-            output[i+1] += inputs[k][i+1] * in_factor;
-        }
+    for (int c = 0; c < 2; c++)
+    {
+        float* out = output + c * frames;
+        float& limit = _limit[c];
 
-        for (int c = 0; c < 2; c++)
-        {    
+        for (size_t i = 0; i < frames; i++)
+        {
             // write input amplitude to buffer for analytics
-            _in_buf[c][_buf_i[c]] = output[i+c];
+            _in_buf[c][_buf_i[c]] = out[i];
 
-            float vabs = fabsf(output[i+c]);
+            float vabs = fabsf(out[i]);
 
             float target = threshold * powf(vabs / threshold, 1.0f - 1.0f / state.ratio);
 
             // move the limit towards the amplitude of the current sample,
             // modified by the ratio
-            float& limit = _limit[c];
-
             if (target > limit)
                 limit = a * (limit - target) + target;
             else
@@ -150,12 +167,12 @@ void CompressorModule::process(float** inputs, float* output, size_t num_inputs,
 
             // if limit surpasses the threshold, perform limiting
             if (limit > threshold)
-                output[i+c] = (output[i+c] / limit) * threshold;
+                out[i] = (out[i] / limit) * threshold;
 
-            output[i+c] *= out_factor; // output gain control
+            out[i] *= out_factor; // output gain control
 
             // write output amplitude to buffer
-            _out_buf[c][_buf_i[c]] = output[i+c];
+            _out_buf[c][_buf_i[c]] = out[i];
             _buf_i[c] = (_buf_i[c] + 1) % BUFFER_SIZE; // circular buffer
         }
     }
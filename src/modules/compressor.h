@@ -7,7 +7,7 @@ namespace audiomod
 {
     class CompressorModule : public ModuleBase {
     protected:
-        void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) override;
+        void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) override;
         void _interface_proc() override;
 
         ModuleContext& modctx;
@@ -42,6 +42,9 @@ namespace audiomod
         MessageQueue process_queue;
         MessageQueue ui_queue;
         bool waiting = false; // waiting for analytics response
+        bool _bypassed = false; // is the module currently bypassed by the engine
+
+        void receive_messages();
 
         // these are used only by the processing thread       
         float _limit[2];
@@ -54,6 +57,9 @@ namespace audiomod
         void save_state(std::ostream& ostream) override;
         bool load_state(std::istream&, size_t size) override;
 
+        size_t tail_frames() const override { return 0; };
+        void idle(size_t frames) override;
+
         CompressorModule(ModuleContext& modctx);
     };
 }
\ No newline at end of file
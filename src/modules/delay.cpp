@@ -1,5 +1,6 @@
 #include <cmath>
 #include <cstdio>
+#include <algorithm>
 #include <imgui.h>
 #include <math.h>
 #include <sys/types.h>
@@ -12,7 +13,8 @@ using namespace audiomod;
 
 DelayModule::DelayModule(ModuleContext& modctx)
 :   ModuleBase(true),
-    msg_queue(sizeof(module_state_t), 2)
+    msg_queue(sizeof(module_state_t), 2),
+    modctx(modctx)
 {
     id = "effect.delay";
     name = "Delay";
@@ -57,7 +59,7 @@ static double division_to_secs(float tempo, int division_enum)
     return len * (60.0f / tempo);
 }
 
-void DelayModule::process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count)
+void DelayModule::receive_state()
 {
     if (this->panic)
     {
@@ -76,6 +78,29 @@ void DelayModule::process(float** inputs, float* output, size_t num_inputs, size
             handle.read(&process_state, sizeof(module_state_t));
         }    
     }
+}
+
+size_t DelayModule::tail_frames() const
+{
+    float feedback = fabsf(process_state.feedback);
+    float delay_time = std::max(process_state.delay_time[0], process_state.delay_time[1]);
+
+    // feedback at or above unity never dies out
+    if (feedback >= 1.0f) return SIZE_MAX;
+
+    // number of echoes until the signal falls below -80 dB
+    float echoes = feedback > 0.0f ? ceilf(logf(1e-4f) / logf(feedback)) : 0.0f;
+    return (size_t)((echoes + 1.0f) * delay_time * modctx.sample_rate);
+}
+
+void DelayModule::idle(size_t frames)
+{
+    receive_state();
+}
+
+void DelayModule::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count)
+{
+    receive_state();
 
     float delay_time_left = process_state.delay_time[0];
     float delay_time_right = process_state.delay_time[1];
@@ -88,33 +113,28 @@ void DelayModule::process(float** inputs, float* output, size_t num_inputs, size
     float wet_mix = (process_state.mix + 1.0f) / 2.0f;
     float dry_mix = 1.0f - wet_mix;
 
-    float input_frame[2];
-    float delay_frame[2];
-
     delay_line[0].delay = delay_in_samples[0];
     delay_line[1].delay = delay_in_samples[1];
 
-    for (size_t i = 0; i < buffer_size; i += 2)
+    // mix inputs into the output, then process it in place
+    mix_buffers(output, inputs, num_inputs, frames * channel_count);
+
+    for (int c = 0; c < 2; c++)
     {
-        delay_frame[0] = delay_line[0].read();
-        delay_frame[1] = delay_line[1].read();
+        float* out = output + c * frames;
+        DelayLine<float>& line = delay_line[c];
 
-        // get data from inputs
-        input_frame[0] = 0.0f;
-        input_frame[1] = 0.0f;
-        for (size_t j = 0; j < num_inputs; j++)
+        for (size_t i = 0; i < frames; i++)
         {
-            input_frame[0] += inputs[j][i];
-            input_frame[1] += inputs[j][i + 1];
-        }
+            float delayed = line.read();
+            float input = out[i];
 
-        // mix dry and wet mix and write to output
-        output[i] = (input_frame[0] * dry_mix) + (delay_frame[0] * wet_mix);
-        output[i + 1] = (input_frame[1] * dry_mix) + (delay_frame[1] * wet_mix);
+            // mix dry and wet mix and write to output
+            out[i] = (input * dry_mix) + (delayed * wet_mix);
 
-        // update delay line
-        delay_line[0].write(process_state.feedback * (delay_frame[0] + input_frame[0]));
-        delay_line[1].write(process_state.feedback * (delay_frame[1] + input_frame[1]));
+            // update delay line
+            line.write(process_state.feedback * (delayed + input));
+        }
     }
 }
 
@@ -7,7 +7,7 @@ namespace audiomod
 {
     class DelayModule : public ModuleBase {
     protected:
-        void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) override;
+        void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) override;
         void _interface_proc() override;
 
         // two copies of module state for each thread.
@@ -26,6 +26,10 @@ namespace audiomod
 
         // if the buffer was requested to be cleared
         std::atomic<bool> panic = false;
+
+        ModuleContext& modctx;
+
+        void receive_state();
         
     public:
         // delay in seconds
@@ -46,6 +50,9 @@ namespace audiomod
         void save_state(std::ostream& ostream) override;
         bool load_state(std::istream&, size_t size) override;
 
+        size_t tail_frames() const override;
+        void idle(size_t frames) override;
+
         DelayModule(ModuleContext& modctx);
     };
 }
\ No newline at end of file
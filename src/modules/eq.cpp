@@ -31,7 +31,8 @@ EQModule::EQModule(ModuleContext& dest)
     process_state = ui_state;
 }
 
-void EQModule::process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) {
+void EQModule::receive_state()
+{
     // read messages sent from ui thread
     while (true)
     {
@@ -44,51 +45,64 @@ void EQModule::process(float** inputs, float* output, size_t num_inputs, size_t
         
         process_state = state;
         sent_state.clear();
+        _coefficients_dirty = true;
     }
+}
+
+size_t EQModule::tail_frames() const
+{
+    // give the filters some time to ring out
+    return modctx.sample_rate / 10;
+}
+
+void EQModule::idle(size_t frames)
+{
+    receive_state();
+}
+
+void EQModule::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) {
+    receive_state();
 
     module_state& state = process_state;
 
-    for (int c = 0; c < 2; c++) {
-        filter[0][c].low_pass(sample_rate, state.frequency[0], db_to_mult(state.resonance[0]));
-        filter[1][c].high_pass(sample_rate, state.frequency[1], db_to_mult(state.resonance[1]));
+    // the coefficients only change when the ui sends a new state
+    if (_coefficients_dirty)
+    {
+        _coefficients_dirty = false;
+
+        for (int c = 0; c < 2; c++) {
+            filter[0][c].low_pass(sample_rate, state.frequency[0], db_to_mult(state.resonance[0]));
+            filter[1][c].high_pass(sample_rate, state.frequency[1], db_to_mult(state.resonance[1]));
+        }
+
+        for (int i = 0; i < NUM_PEAKS; i++)
+        {
+            if (state.peak_enabled[i])
+                for (int c = 0; c < 2; c++)
+                    peak_filter[i][c].peak(modctx.sample_rate, state.peak_frequency[i], state.peak_resonance[i], 0.3f);
+        }
     }
 
-    float peak_freq[NUM_PEAKS];
-    float peak_reso[NUM_PEAKS];
-    float peak_enable[NUM_PEAKS];
+    bool peak_enable[NUM_PEAKS];
 
     for (int i = 0; i < NUM_PEAKS; i++)
-    {
-        peak_freq[i] = state.peak_frequency[i];
-        peak_reso[i] = state.peak_resonance[i];
         peak_enable[i] = state.peak_enabled[i];
 
-        if (peak_enable[i])
-            for (int c = 0; c < 2; c++)
-                peak_filter[i][c].peak(modctx.sample_rate, peak_freq[i], peak_reso[i], 0.3f);
-    }
+    mix_buffers(output, inputs, num_inputs, frames * channel_count);
 
-    for (int i = 0; i < buffer_size; i += 2)
+    for (int c = 0; c < 2; c++)
     {
-        output[i] = 0.0f;
-        output[i + 1] = 0.0f;
+        float* out = output + c * frames;
 
-        for (int j = 0; j < num_inputs; j++)
+        for (size_t i = 0; i < frames; i++)
         {
-            output[i] += inputs[j][i];
-            output[i + 1] += inputs[j][i + 1];
-        }
+            filter[0][c].process(out + i);
+            filter[1][c].process(out + i);
 
-        for (int c = 0; c < 2; c++)
-        {
-            filter[0][c].process(output + i + c);
-            filter[1][c].process(output + i + c);
-        }
-        for (int j = 0; j < NUM_PEAKS; j++)
-        {
-            if (peak_enable[j]) {
-                peak_filter[j][0].process(output + i);
-                peak_filter[j][1].process(output + i + 1);
+            for (int j = 0; j < NUM_PEAKS; j++)
+            {
+                if (peak_enable[j])
+                    peak_filter[j][c].process(out + i);
             }
         }
     }
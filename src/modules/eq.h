@@ -19,7 +19,7 @@ namespace audiomod
         };
 
     protected:
-        void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) override;
+        void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) override;
         void _interface_proc() override;
 
         ModuleContext& modctx;
@@ -37,12 +37,20 @@ namespace audiomod
         module_state process_state;
         MessageQueue queue;
         std::atomic_flag sent_state;
+
+        // set when the filter coefficients need to be computed from process_state
+        bool _coefficients_dirty = true;
+
+        void receive_state();
     public:
         module_state ui_state;
 
         void save_state(std::ostream& ostream) override;
         bool load_state(std::istream&, size_t size) override;
 
+        size_t tail_frames() const override;
+        void idle(size_t frames) override;
+
         EQModule(ModuleContext& modctx);
     };
 }
\ No newline at end of file
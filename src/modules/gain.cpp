@@ -4,6 +4,7 @@
 #include "gain.h"
 #include "../sys.h"
 #include "../util.h"
+#include "../dsp.h"
 
 using namespace audiomod;
 
@@ -27,19 +28,8 @@ bool GainModule::load_state(std::istream& istream, size_t size)
     return true;
 }
 
-void GainModule::process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) {
-    float factor = db_to_mult(gain);
-    
-    for (size_t i = 0; i < buffer_size; i += channel_count) {
-        output[i] = 0.0f;
-        output[i+1] = 0.0f;
-
-        for (size_t k = 0; k < num_inputs; k++)
-        {
-            output[i] += inputs[k][i] * factor;
-            output[i+1] += inputs[k][i+1] * factor;
-        }
-    }
+void GainModule::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) {
+    mix_buffers(output, inputs, num_inputs, frames * channel_count, db_to_mult(gain));
 }
 
 void GainModule::_interface_proc() {
@@ -5,12 +5,14 @@ namespace audiomod
 {
     class GainModule : public ModuleBase {
     protected:
-        void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) override;
+        void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) override;
         void _interface_proc() override;
         
     public:
         float gain = 0.0f;
 
+        size_t tail_frames() const override { return 0; };
+
         void save_state(std::ostream& ostream) override;
         bool load_state(std::istream& state, size_t size) override;
 
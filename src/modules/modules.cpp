@@ -307,54 +307,50 @@ ModuleNodeRc FXBus::disconnect_output()
     return old_output;
 }
 
+void FXBus::FaderModule::idle(size_t frames)
+{
+    // nothing is playing through the bus, so reset the meters
+    analysis_volume[0].store(0.0f, std::memory_order_relaxed);
+    analysis_volume[1].store(0.0f, std::memory_order_relaxed);
+    smp_accum[0] = smp_accum[1] = 0.0f;
+    smp_count = 0;
+}
+
 void FXBus::FaderModule::process(
-    float** inputs,
+    const float** inputs,
     float* output,
     size_t num_inputs,
-    size_t buffer_size,
+    size_t frames,
     int sample_rate,
     int channel_count
 )
 {
-    float smp[2];
-    float accum[2];
-    bool is_muted = mute || mute_override;
+    bool is_muted = mute.load(std::memory_order_relaxed) || mute_override;
+    _silent_output = is_muted;
 
-    float factor = powf(10.0f, gain / 10.0f);
+    float factor = powf(10.0f, gain.load(std::memory_order_relaxed) / 10.0f);
 
-    // clear buffer to zero
-    for (size_t i = 0; i < buffer_size; i++)
-    {
-        output[i] = 0.0f;
-    }
-
-    for (size_t i = 0; i < buffer_size; i += 2)
-    {
-        smp[0] = 0.0f;
-        smp[1] = 0.0f;
+    // the meters still show what goes into a muted bus
+    mix_buffers(output, inputs, num_inputs, frames * channel_count, factor);
 
-        for (size_t j = 0; j < num_inputs; j++)
-        {
-            smp[0] += inputs[j][i] * factor;
-            smp[1] += inputs[j][i + 1] * factor;
-        }
+    const float* left = output;
+    const float* right = output + frames;
 
-        if (!is_muted)
-        {
-            output[i] = smp[0];
-            output[i + 1] = smp[1];
-        }
-        
-        if (fabsf(smp[0]) > smp_accum[0]) smp_accum[0] = fabsf(smp[0]);
-        if (fabsf(smp[1]) > smp_accum[1]) smp_accum[1] = fabsf(smp[1]);
+    for (size_t i = 0; i < frames; i++)
+    {
+        if (fabsf(left[i]) > smp_accum[0]) smp_accum[0] = fabsf(left[i]);
+        if (fabsf(right[i]) > smp_accum[1]) smp_accum[1] = fabsf(right[i]);
 
         if (++smp_count > window_size)
         {
-            analysis_volume[0] = smp_accum[0];
-            analysis_volume[1] = smp_accum[1];
+            analysis_volume[0].store(smp_accum[0], std::memory_order_relaxed);
+            analysis_volume[1].store(smp_accum[1], std::memory_order_relaxed);
 
             smp_accum[0] = smp_accum[1] = 0.0f;
             smp_count = 0;
         }
     }
+
+    if (is_muted)
+        memset(output, 0, frames * channel_count * sizeof(float));
 }
\ No newline at end of file
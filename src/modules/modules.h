@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include "../audio.h"
 #include "../dsp.h"
 #include "../worker.h"
@@ -60,21 +61,29 @@ namespace audiomod
         class FaderModule : public ModuleBase
         {
         protected:
-            void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) override;
+            void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) override;
 
             // used for calculating loudness
             float smp_count = 0;
             float window_size = 1024;
             float smp_accum[2] = { 0.0f, 0.0f };
         public:
-            float analysis_volume[2] = {0.0f, 0.0f};
-            float gain = 0.0f;
-            bool mute = false;
+            // written by the processing thread, read by the UI thread
+            std::atomic<float> analysis_volume[2] = {0.0f, 0.0f};
+
+            // set by the UI thread while the processing thread reads them
+            std::atomic<float> gain{0.0f};
+            std::atomic<bool> mute{false};
+
+            // used for soloing. only touched by the processing thread
             bool mute_override = false;
 
             FaderModule()
             : ModuleBase(false)
             {}
+
+            size_t tail_frames() const override { return 0; };
+            void idle(size_t frames) override;
         };
         ModuleNodeRc controller;
 
@@ -68,7 +68,7 @@ static double poly_blep(double t, double inc)
     else return 0.0;
 }
 
-void OmniSynth::process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) {
+void OmniSynth::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) {
     // first, get state
     while (true)
     {
@@ -90,7 +90,8 @@ void OmniSynth::process(float** inputs, float* output, size_t num_inputs, size_t
         event(ev);
     }
 
-    memset(output, 0, buffer_size * sizeof(float));
+    memset(output, 0, frames * channel_count * sizeof(float));
+    _silent_output = true;
 }
 
 void OmniSynth::queue_event(const NoteEvent& event)
@@ -74,7 +74,7 @@ namespace audiomod {
         MessageQueue event_queue;
         MessageQueue state_queue;
 
-        void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) override;
+        void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) override;
         void _interface_proc() override;
 
         ModuleContext& modctx;
@@ -128,7 +128,7 @@ void ReverbModule::diffuse(int i, float* values)
     }
 }
 
-void ReverbModule::process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count)
+void ReverbModule::receive_state()
 {
     // receive new state sent from ui thread
     while (true)
@@ -141,37 +141,67 @@ void ReverbModule::process(float** inputs, float* output, size_t num_inputs, siz
         handle.read(&state, sizeof(state));
         
         process_state = state;
+        _params_dirty = true;
     }
+}
 
-    // setup echo delays
-    for (int i = 0; i < REVERB_CHANNEL_COUNT; i++)
-    {
-        float f = (float)(i+1) / REVERB_CHANNEL_COUNT;
-        float d = f * process_state.echo_delay + f * 0.02;
-        assert(d <= MAX_DELAY_LEN);
-        echoes[i].delay = d * modctx.sample_rate;
-    }
+size_t ReverbModule::tail_frames() const
+{
+    float feedback = fabsf(process_state.feedback);
+    if (feedback >= 1.0f) return SIZE_MAX;
 
-    // setup filters
-    for (int i = 0; i < REVERB_CHANNEL_COUNT; i++)
-    {
-        shelf_filters[i].high_shelf(modctx.sample_rate, process_state.shelf_freq, process_state.shelf_gain, 0.5f);
-    }
+    // the longest trip through the diffuser and echo delays
+    float loop_time = process_state.echo_delay + 0.02f + process_state.diffuse * 0.5f;
 
-    // setup diffuser
-    for (int i = 0; i < DIFFUSE_STEPS; i++)
+    // number of trips until the signal falls below -80 dB
+    float loops = feedback > 0.0f ? ceilf(logf(1e-4f) / logf(feedback)) : 0.0f;
+    return (size_t)((loops + 1.0f) * loop_time * modctx.sample_rate);
+}
+
+void ReverbModule::idle(size_t frames)
+{
+    receive_state();
+}
+
+void ReverbModule::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count)
+{
+    receive_state();
+
+    // the delays and filters only change when the ui sends a new state
+    if (_params_dirty)
     {
-        float range = process_state.diffuse * 0.5f / DIFFUSE_STEPS;
-        float range_start = (float)i * range;
+        _params_dirty = false;
 
-        for (int k = 0; k < REVERB_CHANNEL_COUNT; k++)
+        // setup echo delays
+        for (int i = 0; i < REVERB_CHANNEL_COUNT; i++)
+        {
+            float f = (float)(i+1) / REVERB_CHANNEL_COUNT;
+            float d = f * process_state.echo_delay + f * 0.02;
+            assert(d <= MAX_DELAY_LEN);
+            echoes[i].delay = d * modctx.sample_rate;
+        }
+
+        // setup filters
+        for (int i = 0; i < REVERB_CHANNEL_COUNT; i++)
+        {
+            shelf_filters[i].high_shelf(modctx.sample_rate, process_state.shelf_freq, process_state.shelf_gain, 0.5f);
+        }
+
+        // setup diffuser
+        for (int i = 0; i < DIFFUSE_STEPS; i++)
         {
-            float delay_len = diffuse_delay_mod[i][k] * range + range_start;
-            assert(delay_len <= MAX_DELAY_LEN);
-            diffuse_delays[i][k].delay = (float)modctx.sample_rate * delay_len;
+            float range = process_state.diffuse * 0.5f / DIFFUSE_STEPS;
+            float range_start = (float)i * range;
+
+            for (int k = 0; k < REVERB_CHANNEL_COUNT; k++)
+            {
+                float delay_len = diffuse_delay_mod[i][k] * range + range_start;
+                assert(delay_len <= MAX_DELAY_LEN);
+                diffuse_delays[i][k].delay = (float)modctx.sample_rate * delay_len;
+            }
         }
     }
-    
+
     float input_frame[2], out_frame[2];
     float channels[REVERB_CHANNEL_COUNT];
     float delayed[REVERB_CHANNEL_COUNT];
@@ -180,17 +210,16 @@ void ReverbModule::process(float** inputs, float* output, size_t num_inputs, siz
     float dry = 1.0f - process_state.mix;
     float wet = process_state.mix;
 
-    for (size_t smp = 0; smp < buffer_size; smp += 2)
+    // mix inputs into the output, then process it in place
+    mix_buffers(output, inputs, num_inputs, frames * channel_count);
+    float* out_left = output;
+    float* out_right = output + frames;
+
+    for (size_t smp = 0; smp < frames; smp++)
     {
         // obtain input frame
-        input_frame[0] = 0.0f;
-        input_frame[1] = 0.0f;
-
-        for (size_t k = 0; k < num_inputs; k++)
-        {
-            input_frame[0] += inputs[k][smp];
-            input_frame[1] += inputs[k][smp+1];
-        }
+        input_frame[0] = out_left[smp];
+        input_frame[1] = out_right[smp];
 
         // split input frame into internal channels
         k = 0;
@@ -246,8 +275,8 @@ void ReverbModule::process(float** inputs, float* output, size_t num_inputs, siz
             k = (k + 1) % 2;
         }
 
-        output[smp] = input_frame[0] * dry + out_frame[0] * wet;
-        output[smp+1] = input_frame[1] * dry + out_frame[1] * wet;
+        out_left[smp] = input_frame[0] * dry + out_frame[0] * wet;
+        out_right[smp] = input_frame[1] * dry + out_frame[1] * wet;
     }
 }
 
@@ -8,7 +8,7 @@ namespace audiomod
     class ReverbModule : public ModuleBase
     {
     protected:
-        void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) override;
+        void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) override;
         void _interface_proc() override;
 
         // keep two copies of the module state, one for the
@@ -37,7 +37,11 @@ namespace audiomod
         float diffuse_factors[DIFFUSE_STEPS][REVERB_CHANNEL_COUNT];
         float diffuse_delay_mod[DIFFUSE_STEPS][REVERB_CHANNEL_COUNT];
 
+        // set when the delays and filters need to be set up from process_state
+        bool _params_dirty = true;
+
         void diffuse(int index, float* values);
+        void receive_state();
 
         ModuleContext& modctx;
 
@@ -47,5 +51,8 @@ namespace audiomod
 
         void save_state(std::ostream& ostream) override;
         bool load_state(std::istream&, size_t size) override;
+
+        size_t tail_frames() const override;
+        void idle(size_t frames) override;
     };
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
+#include <cstring>
 #include "volume.h"
 #include "../util.h"
 #include "../sys.h"
+#include "../dsp.h"
 
 using namespace audiomod;
 
@@ -12,31 +14,45 @@ VolumeModule::VolumeModule(ModuleContext& modctx) : ModuleBase(false) {
     last_sample[1] = 0.0f;
 }
 
-void VolumeModule::process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) {
-    float r_mult = (panning + 1.0f) / 2.0f;
+void VolumeModule::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) {
+    float cur_panning = panning.load(std::memory_order_relaxed);
+    float cur_target = volume.load(std::memory_order_relaxed);
+    bool is_muted = mute.load(std::memory_order_relaxed) || mute_override;
+
+    float r_mult = (cur_panning + 1.0f) / 2.0f;
     float l_mult = 1.0f - r_mult;
+    float target[2] = { cur_target * l_mult, cur_target * r_mult };
+
+    // a muted channel only outputs zeroes
+    _silent_output = is_muted;
 
-    for (size_t i = 0; i < buffer_size; i += channel_count) {
-        // set both channels to zero
-        output[i] = 0.0f;
-        output[i + 1] = 0.0f;
-        
-        if (!mute && !mute_override) {
-            for (size_t j = 0; j < num_inputs; j++) {
-                if (is_zero_crossing(last_sample[0], inputs[j][i])) cur_volume[0] = volume * l_mult;
-                if (is_zero_crossing(last_sample[1], inputs[j][i + 1])) cur_volume[1] = volume * r_mult;
+    if (is_muted)
+    {
+        memset(output, 0, frames * channel_count * sizeof(float));
+        return;
+    }
 
-                output[i] += inputs[j][i] * cur_volume[0];
-                output[i + 1] += inputs[j][i + 1] * cur_volume[1];
+    mix_buffers(output, inputs, num_inputs, frames * channel_count);
 
+    for (int c = 0; c < 2; c++) {
+        float* out = output + c * frames;
 
-                last_sample[0] = output[i];
-                last_sample[1] = output[i + 1];
-            }
+        // the volume only changes on a zero crossing, to avoid clicks
+        for (size_t i = 0; i < frames; i++) {
+            if (is_zero_crossing(last_sample[c], out[i])) cur_volume[c] = target[c];
+            last_sample[c] = out[i];
+
+            out[i] *= cur_volume[c];
         }
     }
 }
 
+void VolumeModule::idle(size_t frames)
+{
+    last_sample[0] = 0.0f;
+    last_sample[1] = 0.0f;
+}
+
 struct VolumeModuleState {
     float volume, panning;
     uint8_t mute;
@@ -1,23 +1,27 @@
 #pragma once
+#include <atomic>
 #include "../audio.h"
 
 namespace audiomod
 {
     class VolumeModule : public ModuleBase {
     protected:
-        void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) override;
+        void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) override;
         float cur_volume[2];
         float last_sample[2];
     
     public:
-        float volume = 0.5f;
-        float panning = 0.0f;
-        
-        bool mute = false;
+        // set by the UI thread while the processing thread reads them
+        std::atomic<float> volume{0.5f};
+        std::atomic<float> panning{0.0f};
+        std::atomic<bool> mute{false};
 
-        // used for soloing
+        // used for soloing. only touched by the processing thread
         bool mute_override = false;
 
+        size_t tail_frames() const override { return 0; };
+        void idle(size_t frames) override;
+
         VolumeModule(ModuleContext& modctx);
         void save_state(std::ostream& ostream) override;
         bool load_state(std::istream&, size_t size) override;
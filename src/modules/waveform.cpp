@@ -1,6 +1,9 @@
 #include "waveform.h"
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
 #include <imgui.h>
 #include "../sys.h"
 #include <math.h>
@@ -18,7 +21,9 @@ static constexpr double PI2 = 2.0f * PI;
 
 static const size_t NOISE_DATA_SIZE = 1 << 16;
 static float NOISE_DATA[1 << 16];
-static bool PREPROCESSED_DATA_READY = false;
+
+// synths may be created on several threads at once while a song is loading
+static std::once_flag NOISE_DATA_ONCE;
 
 WaveformSynth::Voice::Voice()
 {
@@ -44,15 +49,13 @@ WaveformSynth::WaveformSynth(ModuleContext& modctx)
     name = "Waveform Synth";
 
     // generate static noise data
-    if (!PREPROCESSED_DATA_READY)
+    std::call_once(NOISE_DATA_ONCE, []()
     {
-        PREPROCESSED_DATA_READY = true;
-
         for (size_t i = 0; i < NOISE_DATA_SIZE; i++)
         {
             NOISE_DATA[i] = (double)rand() / RAND_MAX * 2.0 - 1.0;
         }
-    }
+    });
 
     ui_state.waveform_types[0] = Triangle;
     ui_state.volume[0] = 0.5f;
@@ -99,7 +102,7 @@ static double poly_blep(double t, double inc)
     else return 0.0;
 }
 
-void WaveformSynth::process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) {
+void WaveformSynth::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) {
     // obtain state from ui thread
     while (true)
     {
@@ -121,6 +124,54 @@ void WaveformSynth::process(float** inputs, float* output, size_t num_inputs, si
         event(ev);
     }
 
+    // skip processing if no voices are playing
+    bool any_active = block_events.size() > 0;
+    for (size_t j = 0; j < MAX_VOICES; j++)
+    {
+        if (voices[j].active)
+        {
+            any_active = true;
+            break;
+        }
+    }
+
+    if (!any_active)
+    {
+        memset(output, 0, frames * channel_count * sizeof(float));
+        _silent_output = true;
+        return;
+    }
+
+    float* out_left = output;
+    float* out_right = output + frames;
+    memset(output, 0, frames * channel_count * sizeof(float));
+
+    // render up to each event, then apply it
+    size_t start = 0;
+    size_t next_event = 0;
+
+    while (start < frames)
+    {
+        while (next_event < block_events.size() && block_events[next_event].frame <= start)
+            note_event(block_events[next_event++]);
+
+        size_t end = frames;
+        if (next_event < block_events.size())
+            end = std::min((size_t) block_events[next_event].frame, frames);
+
+        render_voices(out_left + start, out_right + start, end - start);
+        start = end;
+    }
+
+    // events past the end of the block
+    while (next_event < block_events.size())
+        note_event(block_events[next_event++]);
+
+    block_events.clear();
+}
+
+void WaveformSynth::render_voices(float* out_left, float* out_right, size_t frames)
+{
     ADSR amp_env_params = process_state.amp_env;
     ADSR filt_env_params = process_state.filt_env;
 
@@ -131,10 +182,7 @@ void WaveformSynth::process(float** inputs, float* output, size_t num_inputs, si
     // setup filter
     float reso_linear = db_to_mult(process_state.filt_reso);
 
-    for (size_t i = 0; i < buffer_size; i += modctx.num_channels) {
-        // set both channels to zero
-        for (size_t ch = 0; ch < modctx.num_channels; ch++) output[i + ch] = 0.0f;
-
+    for (size_t i = 0; i < frames; i++) {
         // compute all voices
         for (size_t j = 0; j < MAX_VOICES; j++) {
             Voice& voice = voices[j];
@@ -158,21 +206,30 @@ void WaveformSynth::process(float** inputs, float* output, size_t num_inputs, si
             float filt_freq = util::lerp(process_state.filt_freq, process_state.filt_freq * filt_env, process_state.filt_amount);
             if (filt_freq < 20.0f) filt_freq = 20.0f; // going too low on frequency will do... Something
 
-            switch (process_state.filter_type)
+            // the coefficients are only recomputed when the cutoff moves,
+            // which it doesn't once the filter envelope has settled
+            if (filt_freq != voice.filter_freq || reso_linear != voice.filter_reso || process_state.filter_type != voice.filter_type)
             {
-                case LowPassFilter:
-                    voice.filter[0].low_pass(modctx.sample_rate, filt_freq, reso_linear);
-                    voice.filter[1].low_pass(modctx.sample_rate, filt_freq, reso_linear);
-                    break;
-
-                case HighPassFilter:
-                    voice.filter[0].high_pass(modctx.sample_rate, filt_freq, reso_linear);
-                    voice.filter[1].high_pass(modctx.sample_rate, filt_freq, reso_linear);
-                    break;
-
-                case BandPassFilter:
-                    // TODO: Band pass filter
-                    break;
+                voice.filter_freq = filt_freq;
+                voice.filter_reso = reso_linear;
+                voice.filter_type = process_state.filter_type;
+
+                switch (process_state.filter_type)
+                {
+                    case LowPassFilter:
+                        voice.filter[0].low_pass(modctx.sample_rate, filt_freq, reso_linear);
+                        voice.filter[1].low_pass(modctx.sample_rate, filt_freq, reso_linear);
+                        break;
+
+                    case HighPassFilter:
+                        voice.filter[0].high_pass(modctx.sample_rate, filt_freq, reso_linear);
+                        voice.filter[1].high_pass(modctx.sample_rate, filt_freq, reso_linear);
+                        break;
+
+                    case BandPassFilter:
+                        // TODO: Band pass filter
+                        break;
+                }
             }
 
             float vibrato_amt = sinf(voice.vibrato_phase) * process_state.vibrato_amount;
@@ -267,8 +324,8 @@ void WaveformSynth::process(float** inputs, float* output, size_t num_inputs, si
             voice.filter[0].process(&voice_l);
             voice.filter[1].process(&voice_r);
 
-            output[i] += voice_l;
-            output[i + 1] += voice_r;
+            out_left[i] += voice_l;
+            out_right[i] += voice_r;
 
             voice.time += 1.0 / modctx.sample_rate;
         }
@@ -276,6 +333,12 @@ void WaveformSynth::process(float** inputs, float* output, size_t num_inputs, si
 }
 
 void WaveformSynth::event(const NoteEvent& event) {
+    // if the list is somehow full, play the event at the start of the block
+    if (!block_events.push(event))
+        note_event(event);
+}
+
+void WaveformSynth::note_event(const NoteEvent& event) {
     if (event.kind == NoteEventKind::NoteOn) {
         // create new voice in first found empty slot
         // if there are no empty slots, replace the first voice in memory
@@ -294,6 +357,7 @@ void WaveformSynth::event(const NoteEvent& event) {
         if (song->get_key_frequency(event.key, &key_freq))
         {
             *voice = Voice(event.key, key_freq, event.volume);
+            if (event.start_offset > 0) skip_voice(*voice, event.start_offset);
         }
     
     } else if (event.kind == NoteEventKind::NoteOff) {
@@ -309,6 +373,23 @@ void WaveformSynth::event(const NoteEvent& event) {
     }
 }
 
+// move a new voice forward as if it had been playing for the given time,
+// so a note that is joined in the middle does not restart its attack
+void WaveformSynth::skip_voice(Voice& voice, uint32_t frames)
+{
+    double time = (double)frames / modctx.sample_rate;
+    voice.time = time;
+
+    // vibrato is not taken into account, it only bends the phase slightly
+    for (size_t osc = 0; osc < 3; osc++) {
+        double freq = voice.freq * pow(2.0, ((double)process_state.coarse[osc] + process_state.fine[osc] / 100.0) / 12.0);
+        voice.phase[osc] = fmod(PI2 * freq * time, PI2);
+    }
+
+    if (time > process_state.vibrato_delay)
+        voice.vibrato_phase = (float) fmod(PI2 * process_state.vibrato_speed * (time - process_state.vibrato_delay), PI2);
+}
+
 void WaveformSynth::queue_event(const NoteEvent& event)
 {
     event_queue.post(&event, sizeof(event));
@@ -23,6 +23,11 @@ namespace audiomod {
             double last_sample[3];
             Filter2ndOrder filter[2];
 
+            // the parameters the filter coefficients were last computed for
+            float filter_freq = -1.0f;
+            float filter_reso = -1.0f;
+            int filter_type = -1;
+
             Voice();
             Voice(int key, float freq, float volume);
         };
@@ -70,7 +75,14 @@ namespace audiomod {
         static constexpr size_t MAX_VOICES = 16;
         Voice voices[MAX_VOICES];
 
-        void process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count) override;
+        // events for the next block, applied at their frame offset
+        NoteEventList block_events;
+
+        void note_event(const NoteEvent& event);
+        void skip_voice(Voice& voice, uint32_t frames);
+        void render_voices(float* out_left, float* out_right, size_t frames);
+
+        void process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count) override;
         void _interface_proc() override;
 
         ModuleContext& modctx;
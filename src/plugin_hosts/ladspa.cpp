@@ -1,11 +1,23 @@
 #include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
 #include <filesystem>
 #include <cstring>
 #include <cmath>
+#include <fstream>
+#include <unordered_map>
 #include "ladspa.h"
 #include "../sys.h"
 #include "../util.h"
 #include "../dsp.h"
+#include "../binio.h"
+#include "../threadpool.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 using namespace plugins;
 
@@ -79,31 +91,304 @@ static std::vector<PluginData> get_plugin_data(const char *path)
     return output;
 }
 
-void LadspaPlugin::scan_plugins(const std::vector<std::filesystem::path>& ladspa_paths, std::vector<PluginData> &plugin_data)
+// a library that takes longer than this to scan is assumed to be stuck
+static constexpr int SCAN_TIMEOUT_MS = 10000;
+
+static constexpr char SCAN_OUTPUT_MAGIC[4] = { 'S', 'n', 'B', 's' };
+static constexpr char SCAN_CACHE_MAGIC[4] = { 'S', 'n', 'B', 'c' };
+static constexpr uint32_t SCAN_CACHE_VERSION = 1;
+
+struct ScannedLibrary
+{
+    std::filesystem::path path;
+    int64_t mtime;
+    uint64_t size;
+    std::vector<PluginData> plugins;
+
+    // whether the cached entry was out of date
+    bool needs_scan;
+};
+
+// the file path and type are not written, as they are known by the reader
+static void write_plugins(BinaryWriter& output, const std::vector<PluginData>& plugins)
+{
+    output.put<uint32_t>(plugins.size());
+
+    for (const PluginData& data : plugins)
+    {
+        output.put<int32_t>(data.index);
+        output.put_string<uint32_t>(data.id);
+        output.put_string<uint32_t>(data.name);
+        output.put_string<uint32_t>(data.author);
+        output.put_string<uint32_t>(data.copyright);
+        output.put<uint8_t>(data.is_instrument);
+    }
+}
+
+static bool read_plugins(BinaryReader& input, const std::filesystem::path& path, std::vector<PluginData>& plugins)
+{
+    uint32_t count = input.get<uint32_t>();
+
+    // every entry is at least 21 bytes, so a bad count can't allocate too much
+    if (count > input.remaining() / 21) return false;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        PluginData data;
+        data.file_path = path;
+        data.type = PluginType::Ladspa;
+        data.index = input.get<int32_t>();
+        input.get_string<uint32_t>(data.id);
+        input.get_string<uint32_t>(data.name);
+        input.get_string<uint32_t>(data.author);
+        input.get_string<uint32_t>(data.copyright);
+        data.is_instrument = input.get<uint8_t>() != 0;
+
+        if (!input.ok()) return false;
+        plugins.push_back(std::move(data));
+    }
+
+    return input.ok();
+}
+
+static std::unordered_map<std::string, ScannedLibrary> load_scan_cache(const std::filesystem::path& cache_path)
 {
-    for (const std::string& directory : ladspa_paths)
+    std::unordered_map<std::string, ScannedLibrary> cache;
+
+    sys::mapped_file_t* file = sys::map_file(cache_path.u8string().c_str());
+    if (file == nullptr) return cache;
+
+    BinaryReader input(sys::mapped_file_data(file), sys::mapped_file_size(file));
+
+    char magic[4];
+    input.get_array(magic, 4);
+    uint32_t version = input.get<uint32_t>();
+    uint32_t count = input.get<uint32_t>();
+
+    if (input.ok() && memcmp(magic, SCAN_CACHE_MAGIC, 4) == 0 && version == SCAN_CACHE_VERSION)
     {
-        if (std::filesystem::exists(directory) && std::filesystem::is_directory(directory))
+        for (uint32_t i = 0; i < count; i++)
         {
-            for (const auto& entry : std::filesystem::directory_iterator(directory))
+            ScannedLibrary lib;
+            std::string path;
+            input.get_string<uint32_t>(path);
+            lib.path = std::filesystem::u8path(path);
+            lib.mtime = input.get<int64_t>();
+            lib.size = input.get<uint64_t>();
+            lib.needs_scan = false;
+
+            // a damaged cache is thrown away as a whole
+            if (!read_plugins(input, lib.path, lib.plugins))
             {
-                // don't read directories
-                if (entry.is_directory()) continue;
+                cache.clear();
+                break;
+            }
 
-                auto& path = entry.path();
-                std::cout << "found LADSPA: " << path << ":\n";
-                
-                // get plugin information for all plugins in library
-                std::vector<PluginData> plugins = get_plugin_data(entry.path().string().c_str());
+            cache[path] = std::move(lib);
+        }
+    }
 
-                for (PluginData& plugin : plugins)
-                {
-                    std::cout << "\t" << plugin.name << " by " << plugin.author << "\n";
-                    plugin_data.push_back(plugin);
-                }
+    sys::unmap_file(file);
+    return cache;
+}
+
+static void save_scan_cache(const std::filesystem::path& cache_path, const std::vector<ScannedLibrary>& libraries)
+{
+    BinaryWriter output;
+    output.put_array(SCAN_CACHE_MAGIC, 4);
+    output.put<uint32_t>(SCAN_CACHE_VERSION);
+    output.put<uint32_t>(libraries.size());
+
+    for (const ScannedLibrary& lib : libraries)
+    {
+        output.put_string<uint32_t>(lib.path.u8string());
+        output.put<int64_t>(lib.mtime);
+        output.put<uint64_t>(lib.size);
+        write_plugins(output, lib.plugins);
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(cache_path.parent_path(), ec);
+
+    // write to a temporary file first, so that the cache
+    // isn't left half-written if the program stops here
+    std::filesystem::path tmp_path = cache_path;
+    tmp_path += ".tmp";
+
+    std::ofstream file(tmp_path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file.is_open()) return;
+
+    file.write((const char*) output.data(), output.size());
+    file.close();
+
+    if (file.fail())
+    {
+        std::filesystem::remove(tmp_path, ec);
+        return;
+    }
+
+    std::filesystem::rename(tmp_path, cache_path, ec);
+}
+
+// read a library in a child process
+static void scan_library(ScannedLibrary& lib)
+{
+    std::string output;
+    int exit_code;
+
+    if (!sys::run_self({ "--scan-ladspa", lib.path.u8string() }, output, exit_code, SCAN_TIMEOUT_MS))
+    {
+        // can't start processes here, so take the risk and read it ourselves
+        lib.plugins = get_plugin_data(lib.path.string().c_str());
+        return;
+    }
+
+    BinaryReader input((const uint8_t*) output.data(), output.size());
+
+    char magic[4];
+    input.get_array(magic, 4);
+
+    if (exit_code != 0 || !input.ok() || memcmp(magic, SCAN_OUTPUT_MAGIC, 4) != 0 ||
+        !read_plugins(input, lib.path, lib.plugins))
+    {
+        // the library stays in the cache with no plugins, so that it
+        // is not scanned again until it changes
+        std::cerr << "could not scan LADSPA library " << lib.path << "\n";
+        lib.plugins.clear();
+    }
+}
+
+struct ScanTask
+{
+    std::vector<ScannedLibrary*> queue;
+    std::atomic<size_t> next = 0;
+};
+
+static void scan_task(void* userdata, size_t thread_index)
+{
+    ScanTask& task = *((ScanTask*) userdata);
+
+    size_t i;
+    while ((i = task.next.fetch_add(1)) < task.queue.size())
+        scan_library(*task.queue[i]);
+}
+
+void LadspaPlugin::scan_plugins(
+    const std::vector<std::filesystem::path>& ladspa_paths,
+    std::vector<PluginData> &plugin_data,
+    const std::filesystem::path& cache_path
+) {
+    std::unordered_map<std::string, ScannedLibrary> cache;
+    if (!cache_path.empty())
+        cache = load_scan_cache(cache_path);
+    
+    std::vector<ScannedLibrary> libraries;
+
+    for (const std::filesystem::path& directory : ladspa_paths)
+    {
+        std::error_code ec;
+        if (!std::filesystem::is_directory(directory, ec)) continue;
+
+        for (const auto& entry : std::filesystem::directory_iterator(directory, ec))
+        {
+            // don't read directories
+            if (entry.is_directory(ec)) continue;
+
+            ScannedLibrary lib;
+            lib.path = entry.path();
+            lib.size = entry.file_size(ec);
+            if (ec) continue;
+            lib.mtime = (int64_t) entry.last_write_time(ec).time_since_epoch().count();
+            if (ec) continue;
+
+            auto it = cache.find(lib.path.u8string());
+            if (it != cache.end() && it->second.mtime == lib.mtime && it->second.size == lib.size)
+            {
+                lib.plugins = std::move(it->second.plugins);
+                lib.needs_scan = false;
+            }
+            else
+            {
+                lib.needs_scan = true;
             }
+
+            libraries.push_back(std::move(lib));
         }
     }
+
+    ScanTask task;
+    for (ScannedLibrary& lib : libraries)
+    {
+        if (lib.needs_scan)
+            task.queue.push_back(&lib);
+    }
+
+    if (!task.queue.empty())
+    {
+        // the threads spend most of their time waiting on child processes,
+        // so use one for every core
+        size_t thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+        ThreadPool pool(std::min(thread_count, task.queue.size()) - 1);
+        pool.run(scan_task, &task);
+    }
+
+    for (ScannedLibrary& lib : libraries)
+    {
+        if (lib.needs_scan)
+        {
+            std::cout << "found LADSPA: " << lib.path << ":\n";
+
+            for (PluginData& plugin : lib.plugins)
+                std::cout << "\t" << plugin.name << " by " << plugin.author << "\n";
+        }
+
+        plugin_data.insert(plugin_data.end(), lib.plugins.begin(), lib.plugins.end());
+    }
+
+    // only rewrite the cache if a library was added, changed or removed
+    if (!cache_path.empty() && (!task.queue.empty() || libraries.size() != cache.size()))
+        save_scan_cache(cache_path, libraries);
+}
+
+int LadspaPlugin::scan_process_main(const char* library_path)
+{
+    // plugins may print to stdout while they are loaded, so give them
+    // stderr instead and keep the real stdout for the results
+#ifdef _WIN32
+    int output_fd = _dup(_fileno(stdout));
+    _dup2(_fileno(stderr), _fileno(stdout));
+    _setmode(output_fd, _O_BINARY);
+#else
+    int output_fd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+#endif
+
+    if (output_fd < 0) return 1;
+
+    std::vector<PluginData> plugins = get_plugin_data(library_path);
+
+    BinaryWriter output;
+    output.put_array(SCAN_OUTPUT_MAGIC, 4);
+    write_plugins(output, plugins);
+
+    const uint8_t* data = output.data();
+    size_t remaining = output.size();
+
+    while (remaining > 0)
+    {
+#ifdef _WIN32
+        int written = _write(output_fd, data, (unsigned int) remaining);
+#else
+        ssize_t written = write(output_fd, data, remaining);
+        if (written < 0 && errno == EINTR) continue;
+#endif
+        if (written <= 0) return 1;
+
+        data += written;
+        remaining -= written;
+    }
+
+    return 0;
 }
 
 // constructor
@@ -249,22 +534,26 @@ LadspaPlugin::LadspaPlugin(audiomod::ModuleContext& modctx, const PluginData& pl
             // input buffer
             if (LADSPA_IS_PORT_INPUT(port))
             {
-                float* input_buf = new float[modctx.frames_per_buffer * 2];
+                float* input_buf = new float[modctx.frames_per_buffer];
                 input_buffers.push_back(input_buf);
+                input_ports.push_back(port_i);
                 descriptor->connect_port(instance, port_i, input_buf);
             }
 
             // output buffer
             else if (LADSPA_IS_PORT_OUTPUT(port))
             {
-                float* output_buf = new float[modctx.frames_per_buffer * 2];
+                float* output_buf = new float[modctx.frames_per_buffer];
                 output_buffers.push_back(output_buf);
+                output_ports.push_back(port_i);
                 descriptor->connect_port(instance, port_i, output_buf);
             }
         }
     }
 
-    input_combined = new float[modctx.frames_per_buffer * 2];
+    input_combined = new float[modctx.frames_per_buffer * modctx.num_channels];
+    input_connections.resize(input_ports.size());
+    output_connections.resize(output_ports.size());
 
     _has_interface = control_value_count() > 0;
     
@@ -341,40 +630,37 @@ PluginModule::OutputValue LadspaPlugin::get_output_value(int index)
     return value;
 }
 
-void LadspaPlugin::process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int _sample_rate, int _channel_count)
+void LadspaPlugin::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int _sample_rate, int channel_count)
 {
-    if (descriptor->run == nullptr) return;
-    bool interleave = false; // TODO add ui checkbox to toggle this
+    // output buffers are shared between nodes, so the whole output must always be written
+    if (descriptor->run == nullptr)
+    {
+        memset(output, 0, frames * channel_count * sizeof(float));
+        return;
+    }
 
-    // initialize input buffers
-    for (size_t i = 0; i < buffer_size; i += 2) {
-        input_combined[i] = 0.0f;
-        input_combined[i + 1] = 0.0f;
+    // a single input can be read directly, otherwise the inputs are mixed
+    const float* input = input_combined;
 
-        for (size_t j = 0; j < num_inputs; j++) {
-            input_combined[i] += inputs[j][i];
-            input_combined[i + 1] += inputs[j][i + 1];
-        }
-    }
+    if (num_inputs == 1)
+        input = inputs[0];
+    else
+        mix_buffers(input_combined, inputs, num_inputs, frames * channel_count);
+
+    // connect the audio ports to the planar buffers. LADSPA plugins
+    // never write to their input ports, so the inputs can be shared
+    connect_stereo_inputs(input, input_buffers.data(), input_connections.data(), input_ports.size(), frames);
+    connect_stereo_outputs(output, output_buffers.data(), output_connections.data(), output_ports.size(), frames);
+
+    for (size_t i = 0; i < input_ports.size(); i++)
+        descriptor->connect_port(instance, input_ports[i], (LADSPA_Data*) input_connections[i]);
+
+    for (size_t i = 0; i < output_ports.size(); i++)
+        descriptor->connect_port(instance, output_ports[i], output_connections[i]);
+
+    descriptor->run(instance, frames);
 
-    size_t sample_count = convert_from_stereo(
-        input_combined,
-        &input_buffers.front(),
-        input_buffers.size(),
-        modctx.frames_per_buffer,
-        interleave
-    );
-
-    descriptor->run(instance, sample_count);
-
-    // write output buffers
-    convert_to_stereo(
-        &output_buffers.front(),
-        output,
-        output_buffers.size(),
-        modctx.frames_per_buffer,
-        interleave
-    );
+    finish_stereo_outputs(output, output_buffers.data(), output_ports.size(), frames);
 }
 
 void LadspaPlugin::save_state(std::ostream& stream)
@@ -5,13 +5,29 @@
 
 namespace plugins
 {
+    class SandboxedPlugin;
+
     class LadspaPlugin : public PluginModule
     {
+    // the helper process of a sandboxed plugin reads the controls directly
+    friend SandboxedPlugin;
+
     private:
         sys::dl_handle lib;
         const LADSPA_Descriptor* descriptor;
         LADSPA_Handle instance;
 
+        // port indices of the audio ports
+        std::vector<unsigned long> input_ports;
+        std::vector<unsigned long> output_ports;
+
+        // buffers the audio ports are connected to for the current block.
+        // these point into the graph's buffers when the plugin is stereo
+        std::vector<const float*> input_connections;
+        std::vector<float*> output_connections;
+
+        // scratch buffers, used when the inputs need to be mixed
+        // or when the plugin does not have two channels
         float* input_combined;
         std::vector<float*> input_buffers;
         std::vector<float*> output_buffers;
@@ -49,10 +65,10 @@ namespace plugins
         virtual PluginType plugin_type() { return PluginType::Ladspa; };
 
         void process(
-            float** inputs,
+            const float** inputs,
             float* output,
             size_t num_inputs,
-            size_t buffer_size,
+            size_t frames,
             int sample_rate,
             int channel_count
         ) override;
@@ -60,7 +76,24 @@ namespace plugins
         bool load_state(std::istream& istream, size_t size) override;
 
         static const char* get_standard_paths();
-        static void scan_plugins(const std::vector<std::filesystem::path>& paths, std::vector<PluginData>& data_out);
+        /**
+        * Find the plugins in every library on the given paths.
+        * Libraries that are new or changed since the last scan are read by
+        * child processes, so a plugin that crashes only fails its own library.
+        * @param cache_path The file the results are cached in, keyed by each
+        *                   library's path, modification time and size. May be empty.
+        **/
+        static void scan_plugins(
+            const std::vector<std::filesystem::path>& paths,
+            std::vector<PluginData>& data_out,
+            const std::filesystem::path& cache_path
+        );
+
+        /**
+        * Entry point of the child process that reads a single library,
+        * started with the --scan-ladspa argument. Writes the results to stdout.
+        **/
+        static int scan_process_main(const char* library_path);
 
         virtual int control_value_count() const override;
         virtual int output_value_count() const override;
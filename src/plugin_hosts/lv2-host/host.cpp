@@ -15,6 +15,7 @@
 #include "lv2interface.h"
 #include "lv2internal.h"
 #include "../../util.h"
+#include "../../dsp.h"
 #include "../../song.h"
 
 using namespace plugins;
@@ -190,8 +191,9 @@ Lv2PluginHost::Lv2PluginHost(audiomod::ModuleContext& modctx, const PluginData&
             lilv_port_is_a(plugin, port, URI.lv2_AudioPort) &&
             is_input_port
         ) {
-            float* input_buf = new float[_modctx.frames_per_buffer * 2];
+            float* input_buf = new float[_modctx.frames_per_buffer];
             audio_input_bufs.push_back(input_buf);
+            audio_input_ports.push_back(i);
             lilv_instance_connect_port(instance, i, input_buf);
         }
 
@@ -200,8 +202,9 @@ Lv2PluginHost::Lv2PluginHost(audiomod::ModuleContext& modctx, const PluginData&
             lilv_port_is_a(plugin, port, URI.lv2_AudioPort) &&
             is_output_port
         ) {
-            float* output_buf = new float[_modctx.frames_per_buffer * 2];
+            float* output_buf = new float[_modctx.frames_per_buffer];
             audio_output_bufs.push_back(output_buf);
+            audio_output_ports.push_back(i);
             lilv_instance_connect_port(instance, i, output_buf);
         }
 
@@ -388,7 +391,9 @@ Lv2PluginHost::Lv2PluginHost(audiomod::ModuleContext& modctx, const PluginData&
         }
     }
 
-    input_combined = new float[_modctx.frames_per_buffer * 2];
+    input_combined = new float[_modctx.frames_per_buffer * _modctx.num_channels];
+    audio_input_connections.resize(audio_input_ports.size());
+    audio_output_connections.resize(audio_output_ports.size());
 
     // create utility atom forge
     lv2_atom_forge_init(&forge, &map);
@@ -432,28 +437,26 @@ void Lv2PluginHost::stop()
 // TODO: i feel like this function is too long
 // it could be broken up into seperate functions, e.g.
 // update_events, write_events
-void Lv2PluginHost::process(float** inputs, float* output, size_t num_inputs, size_t buffer_size, int sample_rate, int channel_count)
+void Lv2PluginHost::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count)
 {
-    bool interleave = false;
+    // a single input can be read directly, otherwise the inputs are mixed
+    const float* input = input_combined;
 
-    // initialize input buffers
-    for (size_t i = 0; i < buffer_size; i += 2) {
-        input_combined[i] = 0.0f;
-        input_combined[i + 1] = 0.0f;
+    if (num_inputs == 1)
+        input = inputs[0];
+    else
+        mix_buffers(input_combined, inputs, num_inputs, frames * channel_count);
 
-        for (size_t j = 0; j < num_inputs; j++) {
-            input_combined[i] += inputs[j][i];
-            input_combined[i + 1] += inputs[j][i + 1];
-        }
-    }
+    // connect the audio ports to the planar buffers. LV2 plugins
+    // must not write to their input ports, so the inputs can be shared
+    connect_stereo_inputs(input, audio_input_bufs.data(), audio_input_connections.data(), audio_input_ports.size(), frames);
+    connect_stereo_outputs(output, audio_output_bufs.data(), audio_output_connections.data(), audio_output_ports.size(), frames);
 
-    size_t sample_count = convert_from_stereo(
-        input_combined,
-        &audio_input_bufs.front(),
-        audio_input_bufs.size(),
-        _modctx.frames_per_buffer,
-        interleave
-    );
+    for (size_t i = 0; i < audio_input_ports.size(); i++)
+        lilv_instance_connect_port(instance, audio_input_ports[i], (void*) audio_input_connections[i]);
+
+    for (size_t i = 0; i < audio_output_ports.size(); i++)
+        lilv_instance_connect_port(instance, audio_output_ports[i], audio_output_connections[i]);
 
     // send buffer capacity to plugins
     for (AtomSequencePort* out : msg_out)
@@ -462,6 +465,12 @@ void Lv2PluginHost::process(float** inputs, float* output, size_t num_inputs, si
     // copy received events
     for (AtomSequencePort* in : msg_in)
     {
+        // events sent from the song already have a frame offset. events must be
+        // in time order, so the received events are played after those
+        int64_t last_frame = 0;
+        LV2_ATOM_SEQUENCE_FOREACH(&in->data.header, ev)
+            last_frame = ev->time.frames;
+
         while (true)
         {
             std::byte ev_buf[256];
@@ -472,6 +481,9 @@ void Lv2PluginHost::process(float** inputs, float* output, size_t num_inputs, si
 
             handle.read(ev_buf, handle.size());
 
+            LV2_Atom_Event* received = (LV2_Atom_Event*) ev_buf;
+            if (received->time.frames < last_frame) received->time.frames = last_frame;
+
             lv2_atom_sequence_append_event(&in->data.header, ATOM_SEQUENCE_CAPACITY, (LV2_Atom_Event*) ev_buf);
         }
         //auto handle = in->shared.get_handle();
@@ -561,7 +573,7 @@ void Lv2PluginHost::process(float** inputs, float* output, size_t num_inputs, si
 
             // beat in bars
             lv2_atom_forge_key(&forge, uri::map(LV2_TIME__barBeat));
-            lv2_atom_forge_float(&forge, song->position);
+            lv2_atom_forge_float(&forge, song->playhead_position());
 
             // beats per minute
             lv2_atom_forge_key(&forge, uri::map(LV2_TIME__beatsPerMinute));
@@ -577,7 +589,7 @@ void Lv2PluginHost::process(float** inputs, float* output, size_t num_inputs, si
         }
     }
 
-    lilv_instance_run(instance, sample_count);
+    lilv_instance_run(instance, frames);
     
     worker_host.process_responses();
     worker_host.end_run();
@@ -586,14 +598,8 @@ void Lv2PluginHost::process(float** inputs, float* output, size_t num_inputs, si
     for (AtomSequencePort* in : msg_in)
         lv2_atom_sequence_clear(&in->data.header);
 
-    // write output buffers
-    convert_to_stereo(
-        &audio_output_bufs.front(),
-        output,
-        audio_output_bufs.size(),
-        _modctx.frames_per_buffer,
-        interleave
-    );
+    // write output buffers that were not connected in place
+    finish_stereo_outputs(output, audio_output_bufs.data(), audio_output_ports.size(), frames);
 
     // port notifications
     // copy port values to the UIHost
@@ -718,6 +724,7 @@ void Lv2PluginHost::send_events(audiomod::ModuleBase& target)
                 // convert it to a NoteEvent and send it to the target module
                 audiomod::NoteEvent note_ev;
                 note_ev.read_midi(midi_ev);
+                note_ev.frame = (uint32_t) ev->time.frames;
                 target.event(note_ev);
             }
         }
@@ -247,7 +247,7 @@ void Lv2Plugin::_interface_proc()
 void Lv2Plugin::event(const audiomod::NoteEvent& event) {
     audiomod::MidiMessage midi_msg;
     event.write_midi(&midi_msg);
-    return host.event({ 0, midi_msg });
+    return host.event({ event.frame, midi_msg });
 }
 
 void Lv2Plugin::queue_event(const audiomod::NoteEvent& event)
@@ -266,13 +266,13 @@ void Lv2Plugin::send_events(audiomod::ModuleBase& target) {
 }
 
 void Lv2Plugin::process(
-    float** inputs,
+    const float** inputs,
     float* output,
     size_t num_inputs,
-    size_t buffer_size,
+    size_t frames,
     int sample_rate,
     int channel_count
 ) {
     host.song = song;
-    return host.process(inputs, output, num_inputs, buffer_size, sample_rate, channel_count);
+    return host.process(inputs, output, num_inputs, frames, sample_rate, channel_count);
 }
\ No newline at end of file
@@ -53,10 +53,10 @@ namespace plugins
         static void scan_plugins(const std::vector<std::filesystem::path>& paths, std::vector<PluginData>& data_out);
 
         void process(
-            float** inputs,
+            const float** inputs,
             float* output,
             size_t num_inputs,
-            size_t buffer_size,
+            size_t frames,
             int sample_rate,
             int channel_count
         ) override;
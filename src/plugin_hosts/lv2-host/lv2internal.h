@@ -376,8 +376,18 @@ namespace lv2 {
         float song_last_tempo = -1.0f;
         bool song_last_playing = false;
 
-        float* input_combined;
+        // port indices of the audio ports
+        std::vector<uint32_t> audio_input_ports;
+        std::vector<uint32_t> audio_output_ports;
+
+        // buffers the audio ports are connected to for the current block.
+        // these point into the graph's buffers when the plugin is stereo
+        std::vector<const float*> audio_input_connections;
+        std::vector<float*> audio_output_connections;
 
+        // scratch buffers, used when the inputs need to be mixed
+        // or when the plugin does not have two channels
+        float* input_combined;
         std::vector<float*> audio_input_bufs;
         std::vector<float*> audio_output_bufs;
 
@@ -469,10 +479,10 @@ namespace lv2 {
         void start();
         void stop();
         void process(
-            float** inputs,
+            const float** inputs,
             float* output,
             size_t num_inputs,
-            size_t buffer_size,
+            size_t frames,
             int sample_rate,
             int channel_count
         );
@@ -0,0 +1,488 @@
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <imgui.h>
+#include "sandbox.h"
+#include "ladspa.h"
+#include "../sys.h"
+#include "../util.h"
+#include "../dsp.h"
+#include "../binio.h"
+
+using namespace plugins;
+
+// the plugin gets this fraction of a block's length to process it.
+// the rest is left for the other modules in the graph
+static constexpr double DEADLINE_FRACTION = 0.5;
+
+// how often a helper that renders offline is checked for having stopped
+static constexpr int64_t OFFLINE_POLL_US = 100000;
+
+// how long the helper may take to create the plugin
+static constexpr int STARTUP_TIMEOUT_MS = 10000;
+
+static constexpr size_t MAX_CONTROLS = 256;
+static constexpr size_t INFO_CAPACITY = 65536;
+
+enum HostState : uint32_t
+{
+    Starting,
+    Ready,
+    Failed
+};
+
+struct SandboxedPlugin::Shared
+{
+    // written by the editor before the helper is started
+    int32_t sample_rate;
+    int32_t num_channels;
+    uint32_t frames_per_buffer;
+
+    // a HostState, set by the helper once the plugin has been created
+    std::atomic<uint32_t> state;
+
+    // the editor increments request when a block is ready, and
+    // the helper copies it to response once the block is processed
+    std::atomic<uint32_t> request;
+    std::atomic<uint32_t> response;
+    std::atomic<uint32_t> quit;
+
+    // parameters of the current block
+    uint32_t frames;
+    uint32_t num_inputs;
+
+    // the plugin's controls, or an error message if the helper failed
+    uint32_t info_size;
+    uint8_t info[INFO_CAPACITY];
+
+    float control_in[MAX_CONTROLS];
+    float control_out[MAX_CONTROLS];
+};
+
+// the input and output buffers follow the header
+static size_t buffer_offset()
+{
+    return (sizeof(SandboxedPlugin::Shared) + 63) / 64 * 64;
+}
+
+static size_t shared_size(size_t frames_per_buffer, size_t num_channels)
+{
+    return buffer_offset() + frames_per_buffer * num_channels * sizeof(float) * 2;
+}
+
+static void set_info(SandboxedPlugin::Shared& shared, const BinaryWriter& info)
+{
+    shared.info_size = std::min(info.size(), INFO_CAPACITY);
+    memcpy(shared.info, info.data(), shared.info_size);
+}
+
+SandboxedPlugin::SandboxedPlugin(audiomod::ModuleContext& modctx, const PluginData& plugin_data)
+    : PluginModule(modctx, plugin_data)
+{
+    if (plugin_data.type != PluginType::Ladspa)
+        throw std::runtime_error("only LADSPA plugins can be run in a separate process");
+
+    static std::atomic<uint32_t> next_id = 0;
+    std::string memory_name =
+        "soundbox-" + std::to_string(sys::current_process_id()) + "-" + std::to_string(next_id++);
+
+    _memory = sys::shared_memory_create(memory_name.c_str(), shared_size(modctx.frames_per_buffer, modctx.num_channels));
+    if (_memory == nullptr)
+        throw std::runtime_error("could not create shared memory for the plugin host");
+
+    uint8_t* memory = (uint8_t*) sys::shared_memory_data(_memory);
+    _shared = new (memory) Shared();
+    _shared->sample_rate = modctx.sample_rate;
+    _shared->num_channels = modctx.num_channels;
+    _shared->frames_per_buffer = modctx.frames_per_buffer;
+
+    _input = (float*) (memory + buffer_offset());
+    _output = _input + modctx.frames_per_buffer * modctx.num_channels;
+
+    _process = sys::spawn_self({
+        "--host-plugin",
+        memory_name,
+        std::to_string(sys::current_process_id()),
+        plugin_data.file_path.u8string(),
+        std::to_string(plugin_data.index)
+    });
+
+    if (_process == nullptr)
+    {
+        _close();
+        throw std::runtime_error("could not start the plugin host");
+    }
+
+    // wait for the helper to create the plugin
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(STARTUP_TIMEOUT_MS);
+
+    while (_shared->state.load(std::memory_order_acquire) == HostState::Starting)
+    {
+        if (!sys::process_running(_process))
+        {
+            _close();
+            throw std::runtime_error(std::string("the plugin host for ") + plugin_data.name + " stopped while loading");
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            _close();
+            throw std::runtime_error(std::string("the plugin host for ") + plugin_data.name + " did not respond");
+        }
+
+        sys::shared_wait(&_shared->state, HostState::Starting, 50000);
+    }
+
+    BinaryReader info(_shared->info, std::min((size_t) _shared->info_size, INFO_CAPACITY));
+
+    if (_shared->state.load() != HostState::Ready)
+    {
+        std::string error;
+        info.get_string<uint32_t>(error);
+        _close();
+        throw std::runtime_error(error);
+    }
+
+    uint32_t in_count = info.get<uint32_t>();
+    for (uint32_t i = 0; i < in_count && i < MAX_CONTROLS && info.ok(); i++)
+    {
+        ControlInput control;
+        info.get_string<uint32_t>(control.name);
+
+        uint8_t flags = info.get<uint8_t>();
+        control.is_toggle = flags & 1;
+        control.is_logarithmic = flags & 2;
+        control.is_sample_rate = flags & 4;
+        control.is_integer = flags & 8;
+        control.has_default = flags & 16;
+
+        control.min = info.get<float>();
+        control.max = info.get<float>();
+        control.default_value = info.get<float>();
+        control.value = info.get<float>();
+        _ctl_in.push_back(control);
+    }
+
+    uint32_t out_count = info.get<uint32_t>();
+    for (uint32_t i = 0; i < out_count && i < MAX_CONTROLS && info.ok(); i++)
+    {
+        std::string name;
+        info.get_string<uint32_t>(name);
+        _ctl_out_names.push_back(name);
+    }
+
+    if (!info.ok())
+    {
+        _close();
+        throw std::runtime_error(std::string("the plugin host for ") + plugin_data.name + " sent invalid data");
+    }
+
+    _ctl_out_values.resize(_ctl_out_names.size());
+    _has_interface = control_value_count() > 0;
+}
+
+SandboxedPlugin::~SandboxedPlugin()
+{
+    _close();
+}
+
+void SandboxedPlugin::_close()
+{
+    if (_process != nullptr)
+    {
+        _shared->quit.store(1, std::memory_order_release);
+        sys::shared_wake(&_shared->request);
+
+        sys::close_process(_process, 1000);
+        _process = nullptr;
+    }
+
+    if (_memory != nullptr)
+    {
+        _shared->~Shared();
+        sys::shared_memory_close(_memory);
+        _memory = nullptr;
+    }
+}
+
+void SandboxedPlugin::_bypass(const float** inputs, float* output, size_t num_inputs, size_t frames, int channel_count)
+{
+    // effects pass their input through, and instruments go silent
+    mix_buffers(output, inputs, num_inputs, frames * channel_count);
+    _silent_output = num_inputs == 0;
+}
+
+void SandboxedPlugin::process(const float** inputs, float* output, size_t num_inputs, size_t frames, int sample_rate, int channel_count)
+{
+    Shared& shared = *_shared;
+    uint32_t previous = _request;
+
+    // the helper is still working on a block that missed its deadline,
+    // or has stopped. don't touch the buffers until it is done
+    if (shared.response.load(std::memory_order_acquire) != previous)
+    {
+        if (modctx.offline())
+            modctx.report_error(std::string("the plugin host for ") + data.name + " stopped");
+
+        _bypass(inputs, output, num_inputs, frames, channel_count);
+        return;
+    }
+
+    // the inputs are mixed here, so only one buffer has to be copied
+    mix_buffers(_input, inputs, num_inputs, frames * channel_count);
+    shared.num_inputs = num_inputs > 0 ? 1 : 0;
+    shared.frames = frames;
+
+    for (size_t i = 0; i < _ctl_in.size(); i++)
+        shared.control_in[i] = _ctl_in[i].value;
+
+    shared.request.store(++_request, std::memory_order_release);
+    sys::shared_wake(&shared.request);
+
+    // nothing is waiting on an offline render, so every block is waited for.
+    // bypassing would leave a gap in the output, so a helper that stops is an error
+    if (modctx.offline())
+    {
+        while (shared.response.load(std::memory_order_acquire) == previous)
+        {
+            if (!sys::process_running(_process))
+            {
+                modctx.report_error(std::string("the plugin host for ") + data.name + " stopped");
+                _bypass(inputs, output, num_inputs, frames, channel_count);
+                return;
+            }
+
+            sys::shared_wait(&shared.response, previous, OFFLINE_POLL_US);
+        }
+    }
+
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::nanoseconds((int64_t) (frames * DEADLINE_FRACTION * 1e9 / sample_rate));
+
+    while (shared.response.load(std::memory_order_acquire) == previous)
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0)
+        {
+            _missed_blocks.fetch_add(1, std::memory_order_relaxed);
+            _bypass(inputs, output, num_inputs, frames, channel_count);
+            return;
+        }
+
+        sys::shared_wait(&shared.response, previous, remaining);
+    }
+
+    memcpy(output, _output, frames * channel_count * sizeof(float));
+
+    for (size_t i = 0; i < _ctl_out_values.size(); i++)
+        _ctl_out_values[i] = shared.control_out[i];
+}
+
+void SandboxedPlugin::_interface_proc()
+{
+    if (!sys::process_running(_process))
+        ImGui::TextDisabled("The plugin host has stopped, so this plugin is bypassed.");
+    else
+    {
+        uint32_t missed = _missed_blocks.load(std::memory_order_relaxed);
+        if (missed > 0)
+            ImGui::TextDisabled("Bypassed %u blocks that took too long", missed);
+    }
+
+    PluginModule::_interface_proc();
+}
+
+int SandboxedPlugin::control_value_count() const {
+    return _ctl_in.size();
+}
+
+PluginModule::ControlValue SandboxedPlugin::get_control_value(int index)
+{
+    ControlValue value;
+    const ControlInput& impl = _ctl_in[index];
+
+    value.name = impl.name.c_str();
+    value.format = impl.is_integer ? "%d" : "%.3f";
+    value.value = impl.value;
+    value.has_default = impl.has_default;
+    value.default_value = impl.default_value;
+    value.max = impl.max;
+    value.min = impl.min;
+    value.is_integer = impl.is_integer;
+    value.is_logarithmic = impl.is_logarithmic;
+    value.is_sample_rate = impl.is_sample_rate;
+    value.is_toggle = impl.is_toggle;
+
+    return value;
+}
+
+void SandboxedPlugin::set_control_value(int index, float value)
+{
+    _ctl_in[index].value = value;
+}
+
+int SandboxedPlugin::output_value_count() const {
+    return _ctl_out_names.size();
+}
+
+PluginModule::OutputValue SandboxedPlugin::get_output_value(int index)
+{
+    OutputValue value;
+
+    static char display_str[64];
+    snprintf(display_str, 64, "%f", _ctl_out_values[index]);
+    value.name = _ctl_out_names[index].c_str();
+    value.value = display_str;
+
+    return value;
+}
+
+// same format as LadspaPlugin, so that projects open either way
+void SandboxedPlugin::save_state(std::ostream& stream)
+{
+    // LV1
+    push_bytes<uint8_t>(stream, (uint8_t) 1);
+
+    // write size of state (used for validation)
+    push_bytes<uint32_t>(stream, _ctl_in.size() * 4);
+
+    // write list of control values
+    for (const ControlInput& control : _ctl_in)
+    {
+        push_bytes<float>(stream, control.value);
+    }
+}
+
+bool SandboxedPlugin::load_state(std::istream& stream, size_t size)
+{
+    // check LV1
+    if (pull_bytesr<uint8_t>(stream) != 1) return false;
+
+    // check size of state
+    uint32_t state_size = pull_bytesr<uint32_t>(stream);
+    if (_ctl_in.size() * 4 != state_size) return false;
+
+    // read list of control values
+    for (ControlInput& control : _ctl_in)
+    {
+        control.value = pull_bytesr<float>(stream);
+    }
+
+    return true;
+}
+
+int SandboxedPlugin::host_process_main(int argc, char** argv)
+{
+    if (argc < 4) return 1;
+
+    sys::shared_memory_t* memory = sys::shared_memory_open(argv[0]);
+    if (memory == nullptr) return 1;
+
+    uint64_t parent_pid = strtoull(argv[1], nullptr, 10);
+
+    Shared& shared = *((Shared*) sys::shared_memory_data(memory));
+    if (sys::shared_memory_size(memory) < shared_size(shared.frames_per_buffer, shared.num_channels))
+    {
+        sys::shared_memory_close(memory);
+        return 1;
+    }
+
+    float* input = (float*) ((uint8_t*) sys::shared_memory_data(memory) + buffer_offset());
+    float* output = input + shared.frames_per_buffer * shared.num_channels;
+
+    PluginData data;
+    data.file_path = std::filesystem::u8path(argv[2]);
+    data.type = PluginType::Ladspa;
+    data.index = atoi(argv[3]);
+    data.name = data.file_path.stem().u8string();
+    data.id = "plugin.ladspa:" + data.name;
+    data.is_instrument = false;
+
+    audiomod::ModuleContext modctx(shared.sample_rate, shared.num_channels, shared.frames_per_buffer);
+    std::unique_ptr<LadspaPlugin> plugin;
+    BinaryWriter info;
+
+    try
+    {
+        plugin = std::make_unique<LadspaPlugin>(modctx, data);
+
+        if (plugin->ctl_in.size() > MAX_CONTROLS || plugin->ctl_out.size() > MAX_CONTROLS)
+            throw std::runtime_error("the plugin has too many controls");
+    }
+    catch (std::exception& err)
+    {
+        info.put_string<uint32_t>(err.what());
+        set_info(shared, info);
+        shared.state.store(HostState::Failed, std::memory_order_release);
+        sys::shared_wake(&shared.state);
+
+        sys::shared_memory_close(memory);
+        return 1;
+    }
+
+    info.put<uint32_t>(plugin->ctl_in.size());
+    for (const LadspaPlugin::ControlInput* control : plugin->ctl_in)
+    {
+        info.put_string<uint32_t>(control->name);
+        info.put<uint8_t>(
+            (control->is_toggle ? 1 : 0) |
+            (control->is_logarithmic ? 2 : 0) |
+            (control->is_sample_rate ? 4 : 0) |
+            (control->is_integer ? 8 : 0) |
+            (control->has_default ? 16 : 0)
+        );
+        info.put<float>(control->min);
+        info.put<float>(control->max);
+        info.put<float>(control->default_value);
+        info.put<float>(control->value);
+    }
+
+    info.put<uint32_t>(plugin->ctl_out.size());
+    for (const LadspaPlugin::ControlOutput* control : plugin->ctl_out)
+        info.put_string<uint32_t>(control->name);
+
+    // this must be read before the editor is told the plugin is ready,
+    // as the first block may be sent right after
+    uint32_t last_request = shared.request.load(std::memory_order_acquire);
+
+    set_info(shared, info);
+    shared.state.store(HostState::Ready, std::memory_order_release);
+    sys::shared_wake(&shared.state);
+
+    // this process only exists to run the plugin
+    sys::set_thread_realtime();
+
+    while (!shared.quit.load(std::memory_order_acquire))
+    {
+        uint32_t request = shared.request.load(std::memory_order_acquire);
+
+        if (request == last_request)
+        {
+            sys::shared_wait(&shared.request, last_request, 100000);
+
+            // stop if the editor went away without telling us
+            if (shared.request.load(std::memory_order_acquire) == last_request && !sys::process_exists(parent_pid))
+                break;
+
+            continue;
+        }
+
+        for (size_t i = 0; i < plugin->ctl_in.size(); i++)
+            plugin->ctl_in[i]->value = shared.control_in[i];
+
+        const float* inputs[1] = { input };
+        plugin->process(inputs, output, shared.num_inputs, shared.frames, shared.sample_rate, shared.num_channels);
+
+        for (size_t i = 0; i < plugin->ctl_out.size(); i++)
+            shared.control_out[i] = plugin->ctl_out[i]->value;
+
+        last_request = request;
+        shared.response.store(request, std::memory_order_release);
+        sys::shared_wake(&shared.response);
+    }
+
+    plugin.reset();
+    sys::shared_memory_close(memory);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+#include "../plugins.h"
+
+namespace plugins
+{
+    /**
+    * Hosts a plugin in a helper process, so that a plugin that crashes or
+    * stalls can not take the engine down with it. Audio blocks and control
+    * values are exchanged through shared memory, and a block the helper does
+    * not finish before its deadline is bypassed. Offline contexts wait for
+    * every block instead, and report an error if the helper stops.
+    * Only LADSPA plugins can be hosted this way for now.
+    **/
+    class SandboxedPlugin : public PluginModule
+    {
+    public:
+        // the block of memory shared with the helper process
+        struct Shared;
+
+    private:
+        sys::shared_memory_t* _memory = nullptr;
+        sys::process_t* _process = nullptr;
+        Shared* _shared = nullptr;
+
+        // planar audio buffers in shared memory
+        float* _input;
+        float* _output;
+
+        struct ControlInput
+        {
+            std::string name;
+            float value;
+
+            bool is_toggle;
+            bool is_logarithmic;
+            bool is_sample_rate;
+            bool is_integer;
+            bool has_default;
+
+            float min, max;
+            float default_value;
+        };
+
+        std::vector<ControlInput> _ctl_in;
+        std::vector<std::string> _ctl_out_names;
+        std::vector<float> _ctl_out_values;
+
+        // id of the last block sent to the helper
+        uint32_t _request = 0;
+
+        // how many blocks were bypassed because the helper missed the deadline
+        std::atomic<uint32_t> _missed_blocks = 0;
+
+        void _close();
+        void _bypass(const float** inputs, float* output, size_t num_inputs, size_t frames, int channel_count);
+
+    protected:
+        void _interface_proc() override;
+
+    public:
+        SandboxedPlugin(audiomod::ModuleContext& modctx, const PluginData& data);
+        ~SandboxedPlugin();
+
+        virtual PluginType plugin_type() { return data.type; };
+
+        void process(
+            const float** inputs,
+            float* output,
+            size_t num_inputs,
+            size_t frames,
+            int sample_rate,
+            int channel_count
+        ) override;
+        void save_state(std::ostream& ostream) override;
+        bool load_state(std::istream& istream, size_t size) override;
+
+        virtual int control_value_count() const override;
+        virtual int output_value_count() const override;
+
+        virtual void set_control_value(int index, float value) override;
+        virtual ControlValue get_control_value(int index) override;
+
+        virtual OutputValue get_output_value(int index) override;
+
+        /**
+        * Entry point of the helper process, started with the --host-plugin
+        * argument. Takes the name of the shared memory, the id of the editor
+        * process, the library path and the plugin index.
+        **/
+        static int host_process_main(int argc, char** argv);
+    }; // class SandboxedPlugin
+} // namespace plugins
@@ -11,6 +11,7 @@
 #include "audio.h"
 #include "plugins.h"
 #include "plugin_hosts/ladspa.h"
+#include "plugin_hosts/sandbox.h"
 #include "sys.h"
 
 #ifdef ENABLE_LV2
@@ -300,7 +301,7 @@ void PluginManager::scan_plugins()
 {
     plugin_data.clear();
 
-    LadspaPlugin::scan_plugins(get_paths(PluginType::Ladspa), plugin_data);
+    LadspaPlugin::scan_plugins(get_paths(PluginType::Ladspa), plugin_data, scan_cache_path);
 #ifdef ENABLE_LV2
     Lv2Plugin::scan_plugins(get_paths(PluginType::Lv2), plugin_data);
 #endif
@@ -316,7 +317,10 @@ audiomod::ModuleNodeRc PluginManager::instantiate_plugin(
     switch (plugin_data.type)
     {
         case plugins::PluginType::Ladspa:
-            plugin = modctx.create<plugins::LadspaPlugin>(modctx, plugin_data);
+            if (sandbox_plugins)
+                plugin = modctx.create<plugins::SandboxedPlugin>(modctx, plugin_data);
+            else
+                plugin = modctx.create<plugins::LadspaPlugin>(modctx, plugin_data);
             break;
 
 #ifdef ENABLE_LV2
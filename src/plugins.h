@@ -108,6 +108,12 @@ namespace plugins
         std::vector<std::filesystem::path> ladspa_paths;
         std::vector<std::filesystem::path> lv2_paths;
 
+        // where scan results are kept between sessions. if empty, every plugin is rescanned
+        std::filesystem::path scan_cache_path;
+
+        // if true, new LADSPA plugins are run in a helper process
+        bool sandbox_plugins = false;
+
         PluginManager(WindowManager& window_manager);
 
         audiomod::ModuleNodeRc instantiate_plugin(
@@ -2,13 +2,17 @@
 #include "audio.h"
 #include "modules/modules.h"
 #include "sys.h"
+#include "binio.h"
+#include "threadpool.h"
 #include "song.h"
 #include "editor/editor.h"
 #include <algorithm>
+#include <climits>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <sstream>
+#include <unordered_map>
 
 /*
 Song data structure (OLD):
@@ -61,21 +65,6 @@ struct file {
 }
 */
 
-static void save_module(std::ostream& out, audiomod::ModuleBase& mod)
-{
-    std::stringstream stream;
-
-    // store module type
-    push_bytes(out, (uint8_t) strlen(mod.id));
-    out << mod.id;
-
-    // store module state
-    mod.save_state(stream);
-    size_t state_size = stream.tellp();
-    push_bytes<uint64_t>(out, state_size);
-    if (state_size > 0) out << stream.rdbuf();
-}
-
 static audiomod::ModuleNodeRc load_module(
     std::istream& input, Song* song,
     audiomod::ModuleContext& modctx,
@@ -119,146 +108,8 @@ static audiomod::ModuleNodeRc load_module(
     return mod;
 }
 
-void Song::serialize(std::ostream& out) const {
-    // magic number
-    out << "SnBx";
-
-    // file version number
-    push_bytes<uint32_t>(out, 1);
-    
-    // song name
-    push_bytes(out, (uint8_t) strlen(name));
-    out << name;
-
-    // v5: project notes
-    push_bytes(out, (uint32_t)project_notes.size());
-    out << project_notes;
-
-    // write song properties
-    push_bytes(out, (uint32_t) length());
-    push_bytes(out, (uint32_t) channels.size());
-    push_bytes(out, (uint32_t) max_patterns());
-    push_bytes(out, (uint32_t) beats_per_bar);
-    push_bytes(out, (float) tempo);
-
-    // v3: tuning data
-    // first entry (12edo) is ignored, so subtract size by 1
-    push_bytes(out, (uint8_t) (tunings.size() - 1));
-    for (Tuning* tuning : tunings)
-    {
-        // ignore first entry (12edo)
-        if (!tuning->is_12edo)
-        {
-            // write name
-            push_bytes(out, (uint32_t) tuning->name.size());
-            out << tuning->name;
-            
-            // write description
-            push_bytes(out, (uint32_t) tuning->desc.size());
-            out << tuning->desc;
-
-            // write key frequencies
-            push_bytes(out, (uint32_t) tuning->key_freqs.size());
-            for (float freq : tuning->key_freqs)
-            {
-                push_bytes(out, (float) freq);
-            }
-
-            // v6: write scala data
-            if (tuning->scl_import == nullptr)
-            {
-                push_bytes(out, (uint32_t) 0);
-                push_bytes(out, (uint32_t) 0);
-            }
-            else
-            {
-                TuningSclImport& scl_import = *tuning->scl_import;
-                
-                // write scl data
-                push_bytes(out, (uint32_t) scl_import.scl.rawText.size());
-                out << scl_import.scl.rawText;
-
-                // write kbm data
-                push_bytes(out, (uint32_t) scl_import.kbm.rawText.size());
-                out << scl_import.kbm.rawText;
-            }
-        }
-    }
-
-    // write the selected tuning
-    push_bytes(out, (uint8_t) selected_tuning);
-
-    // v4: fx mixer
-    push_bytes(out, (uint16_t) fx_mixer.size());
-    for (auto& bus : fx_mixer)
-    {
-        // write bus name
-        push_bytes(out, (uint8_t) strlen(bus->name));
-        out << bus->name;
-
-        // write mute/solo
-        uint8_t fx_state = 0;
-        if (dynamic_cast<audiomod::FXBus::FaderModule&>(bus->controller->module()).mute)   fx_state |= 1;
-        if (bus->solo)              fx_state |= 2;
-        push_bytes(out, (uint8_t) fx_state);
-
-        // write output bus
-        if (bus != fx_mixer[0])
-            push_bytes(out, (uint16_t) bus->target_bus);
-
-        // write effects
-        push_bytes(out, (uint8_t) bus->get_modules().size());
-        for (audiomod::ModuleNodeRc& mod : bus->get_modules())
-            save_module(out, mod->module());
-    }
-
-    // write the channel data
-    for (auto& channel : channels) {
-        push_bytes(out, (uint8_t) strlen(channel->name));
-        out << channel->name;
-
-        audiomod::VolumeModule& vol_mod = channel->vol_mod->module<audiomod::VolumeModule>();
-        push_bytes(out, (float) vol_mod.volume);
-        push_bytes(out, (float) vol_mod.panning);
-
-        // write channel flags (mute, solo)
-        uint8_t channel_flags = 0;
-        if (vol_mod.mute)  channel_flags |= 1;
-        if (channel->solo)          channel_flags |= 2;
-
-        push_bytes(out, (uint8_t) channel_flags);
-
-        // v4: write output fx bus
-        push_bytes(out, (uint16_t) channel->fx_target_idx);
-
-        // save channel instrument
-        save_module(out, channel->synth_mod->module());
-        
-        // v4: store effects
-        push_bytes(out, (uint8_t) channel->effects_rack.modules.size());
-
-        for (audiomod::ModuleNodeRc& mod : channel->effects_rack.modules)
-            save_module(out, mod->module());
-
-        // write channel sequence
-        for (int& id : channel->sequence) {
-            push_bytes(out, (uint32_t) id);
-        }
-
-        // write pattern data
-        for (auto& pattern : channel->patterns) {
-            push_bytes(out, (uint32_t) pattern->notes.size());
-
-            for (Note& note : pattern->notes) {
-                push_bytes(out, (float) note.time);
-                push_bytes(out, (int16_t) note.key);
-                push_bytes(out, (float) note.length);
-            }
-        }
-    }
-}
-
-std::unique_ptr<Song> Song::from_file(
+// load a song in the "SnBx" version 1 format, which is read from start to end
+static std::unique_ptr<Song> load_song_v1(
     std::istream& input,
     audiomod::ModuleContext& modctx,
     plugins::PluginManager& plugin_manager,
@@ -309,11 +160,26 @@ std::unique_ptr<Song> Song::from_file(
     float tempo;
     pull_bytes(input, tempo);
 
+    // the song is allocated from these, so check them against the rest of the
+    // file, which holds a sequence entry and a note count per bar and pattern
+    // of every channel. the stream always reads from memory
+    uint64_t min_size = ((uint64_t)length + max_patterns) * num_channels * sizeof(uint32_t);
+
+    if (
+        !input || num_channels == 0 || length == 0 || max_patterns == 0 ||
+        beats_per_bar == 0 || beats_per_bar > INT_MAX ||
+        min_size > (uint64_t)input.rdbuf()->in_avail()
+    ) {
+        delete[] song_name;
+        if (error_msg) *error_msg = "file is corrupted";
+        return nullptr;
+    }
+
     // create song
     std::unique_ptr<Song> song = std::make_unique<Song>(num_channels, length, max_patterns, modctx);
-    strncpy(song->name, song_name, song->name_capcity);
+    strncpy(song->name, song_name, song->name_capcity - 1);
+    song->name[song->name_capcity - 1] = 0;
     song->project_notes = project_notes;
-    song->name[song_name_size] = 0;
     song->beats_per_bar = beats_per_bar;
     song->tempo = tempo;
 
@@ -411,6 +277,11 @@ std::unique_ptr<Song> Song::from_file(
         uint8_t selected_tuning_uint8;
         pull_bytes(input, selected_tuning_uint8);
         song->selected_tuning = selected_tuning_uint8;
+
+        if (song->selected_tuning >= (int) song->tunings.size()) {
+            if (error_msg) *error_msg = "file is corrupted";
+            return nullptr;
+        }
     }
 
     // fx mixer
@@ -476,6 +347,12 @@ std::unique_ptr<Song> Song::from_file(
         for (auto& bus : song->fx_mixer)
         {
             if (bus == song->fx_mixer.front()) continue;
+
+            if (bus->target_bus >= (int) song->fx_mixer.size()) {
+                if (error_msg) *error_msg = "file is corrupted";
+                return nullptr;
+            }
+
             song->fx_mixer[bus->target_bus]->connect_input(bus->controller);
         }
     }
@@ -488,8 +365,11 @@ std::unique_ptr<Song> Song::from_file(
         uint8_t channel_name_size;
         pull_bytes(input, channel_name_size);
 
-        input.read(channel->name, channel_name_size); // TODO: cap to channel name capacity (16 bytes)
-        channel->name[channel_name_size] = 0;
+        // cut to the capacity of the channel name
+        std::string channel_name(channel_name_size, '\0');
+        input.read(&channel_name.front(), channel_name_size);
+        strncpy(channel->name, channel_name.c_str(), sizeof(channel->name) - 1);
+        channel->name[sizeof(channel->name) - 1] = 0;
 
         // volume, panning
         float volume, panning;
@@ -514,6 +394,11 @@ std::unique_ptr<Song> Song::from_file(
         {
             uint16_t output_bus;
             pull_bytes(input, output_bus);
+            if (output_bus >= song->fx_mixer.size()) {
+                if (error_msg) *error_msg = "file is corrupted";
+                return nullptr;
+            }
+
             channel->fx_target_idx = output_bus;
         }
 
@@ -553,6 +438,11 @@ std::unique_ptr<Song> Song::from_file(
         uint32_t pattern_id;
         for (uint32_t i = 0; i < length; i++) {
             pull_bytes(input, pattern_id);
+            if (pattern_id > max_patterns) {
+                if (error_msg) *error_msg = "file is corrupted";
+                return nullptr;
+            }
+
             channel->sequence[i] = pattern_id;
         }
 
@@ -577,4 +467,1281 @@ std::unique_ptr<Song> Song::from_file(
     }
 
     return song;
-}
\ No newline at end of file
+}
+/*
+Song data structure (version 2):
+
+The file is a table of chunks followed by the chunks themselves. Each chunk
+starts at an offset that is a multiple of 8, and arrays inside a chunk are
+aligned to 4 bytes, so they can be copied straight out of a mapped file.
+Chunks with an unknown id are skipped.
+
+struct chunk_entry {
+    char id[4];
+    uint32_t reserved;
+    uint64_t offset; // from the start of the file
+    uint64_t size;
+}
+
+struct file {
+    char magic[4] = "SnBx";
+    uint32_t version = 2;
+    uint32_t num_chunks;
+    uint32_t reserved;
+    struct chunk_entry chunks[num_chunks];
+}
+
+chunk "SONG": name, project notes, length, num_channels, max_patterns,
+              beats_per_bar, tempo, selected tuning
+chunk "TUNE": tunings besides 12edo, with key frequencies as a float array
+chunk "MIXR": fx buses and their effects
+chunk "CHAN": one per channel, in order. the sequence is an array of uint32,
+              and the notes of each pattern are an array of:
+
+struct note {
+    float time;
+    float length;
+    int32_t key;
+}
+
+Strings are prefixed with their length, and module states with a uint64 size.
+*/
+
+static constexpr uint32_t FILE_VERSION = 2;
+
+// a note as it is stored in a version 2 file
+struct NoteRecord
+{
+    float time;
+    float length;
+    int32_t key;
+};
+
+static_assert(sizeof(NoteRecord) == 12, "NoteRecord must be packed");
+
+static void save_module(BinaryWriter& out, audiomod::ModuleBase& mod)
+{
+    // store module type
+    out.put((uint8_t) strlen(mod.id));
+    out.put_bytes(mod.id, strlen(mod.id));
+
+    // the module writes its state straight into the file buffer.
+    // its size is filled in afterwards
+    size_t size_offset = out.reserve<uint64_t>();
+    WriterStreamBuf buf(out);
+    std::ostream stream(&buf);
+
+    mod.save_state(stream);
+    out.patch<uint64_t>(size_offset, buf.written());
+}
+
+// read a module record. the module is created later, by the song loader
+static bool read_module(
+    BinaryReader& input,
+    std::vector<SongLoader::ModuleLoad>& modules,
+    SongLoader::ModuleLoad::Target target, size_t index,
+    std::string* error_msg
+) {
+    SongLoader::ModuleLoad& mod = modules.emplace_back();
+    mod.target = target;
+    mod.index = index;
+
+    input.get_string<uint8_t>(mod.id);
+    mod.state_size = input.get<uint64_t>();
+    mod.state = input.get_bytes(mod.state_size);
+
+    if (!input.ok()) {
+        if (error_msg != nullptr) *error_msg = "file is corrupted";
+        return false;
+    }
+
+    return true;
+}
+
+// size of the file header and of an entry in the chunk table
+static constexpr size_t HEADER_SIZE = 16;
+static constexpr size_t CHUNK_ENTRY_SIZE = 24;
+
+// write the file header and reserve space for the chunk table
+static void begin_file(BinaryWriter& w, uint32_t num_chunks)
+{
+    w.put_bytes("SnBx", 4);
+    w.put<uint32_t>(FILE_VERSION);
+    w.put<uint32_t>(num_chunks);
+    w.put<uint32_t>(0);
+
+    for (uint32_t i = 0; i < num_chunks; i++)
+    {
+        w.reserve<uint32_t>();
+        w.reserve<uint32_t>();
+        w.reserve<uint64_t>();
+        w.reserve<uint64_t>();
+    }
+}
+
+static void set_chunk_entry(BinaryWriter& w, uint32_t i, const char* id, size_t offset, size_t size)
+{
+    size_t entry = HEADER_SIZE + i * CHUNK_ENTRY_SIZE;
+    w.patch_bytes(entry, id, 4);
+    w.patch<uint64_t>(entry + 8, offset);
+    w.patch<uint64_t>(entry + 16, size);
+}
+
+std::vector<ProjectChunkId> Song::chunk_ids() const
+{
+    std::vector<ProjectChunkId> ids;
+    ids.emplace_back("SONG");
+    ids.emplace_back("TUNE");
+    ids.emplace_back("MIXR");
+
+    for (size_t i = 0; i < channels.size(); i++)
+        ids.emplace_back("CHAN", (uint32_t) i);
+
+    return ids;
+}
+
+void Song::serialize(BinaryWriter& w) const
+{
+    std::vector<ProjectChunkId> ids = chunk_ids();
+    begin_file(w, (uint32_t) ids.size());
+
+    for (uint32_t i = 0; i < ids.size(); i++)
+    {
+        w.align(8);
+        size_t offset = w.size();
+        serialize_chunk(w, ids[i]);
+        set_chunk_entry(w, i, ids[i].id, offset, w.size() - offset);
+    }
+}
+
+void Song::serialize(std::ostream& out) const
+{
+    BinaryWriter w;
+    serialize(w);
+    out.write((const char*) w.data(), w.size());
+}
+
+// the part of a channel chunk that comes before the sequence
+static void save_channel_settings(BinaryWriter& w, Channel& channel)
+{
+    w.put((uint8_t) strlen(channel.name));
+    w.put_bytes(channel.name, strlen(channel.name));
+
+    audiomod::VolumeModule& vol_mod = channel.vol_mod->module<audiomod::VolumeModule>();
+    w.put((float) vol_mod.volume);
+    w.put((float) vol_mod.panning);
+
+    uint8_t channel_flags = 0;
+    if (vol_mod.mute)  channel_flags |= 1;
+    if (channel.solo)           channel_flags |= 2;
+    w.put((uint8_t) channel_flags);
+
+    w.put((uint16_t) channel.fx_target_idx);
+
+    // instrument and effects
+    save_module(w, channel.synth_mod->module());
+
+    w.put((uint8_t) channel.effects_rack.modules.size());
+    for (audiomod::ModuleNodeRc& mod : channel.effects_rack.modules)
+        save_module(w, mod->module());
+}
+
+uint64_t Song::chunk_version(const ProjectChunkId& chunk) const
+{
+    BinaryWriter w;
+
+    // the sequence and the patterns are what makes a channel large, and
+    // they have versions of their own. the rest is small enough to compare
+    if (memcmp(chunk.id, "CHAN", 4) == 0)
+    {
+        Channel& channel = *channels[chunk.index];
+        save_channel_settings(w, channel);
+
+        w.put(channel.sequence_version);
+        for (auto& pattern : channel.patterns)
+            w.put(pattern->version);
+    }
+    else
+    {
+        serialize_chunk(w, chunk);
+    }
+
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < w.size(); i++)
+        hash = (hash ^ w.data()[i]) * 1099511628211ull;
+
+    return hash;
+}
+
+void Song::serialize_chunk(BinaryWriter& w, const ProjectChunkId& chunk) const
+{
+    // song properties
+    if (memcmp(chunk.id, "SONG", 4) == 0)
+    {
+        w.put((uint8_t) strlen(name));
+        w.put_bytes(name, strlen(name));
+        w.put_string<uint32_t>(project_notes);
+
+        w.put((uint32_t) length());
+        w.put((uint32_t) channels.size());
+        w.put((uint32_t) max_patterns());
+        w.put((uint32_t) beats_per_bar);
+        w.put((float) tempo);
+        w.put((uint8_t) selected_tuning);
+    }
+
+    // tuning data
+    else if (memcmp(chunk.id, "TUNE", 4) == 0)
+    {
+        // first entry (12edo) is not stored
+        w.put((uint8_t) (tunings.size() - 1));
+
+        for (Tuning* tuning : tunings)
+        {
+            if (tuning->is_12edo) continue;
+
+            w.put_string<uint32_t>(tuning->name);
+            w.put_string<uint32_t>(tuning->desc);
+
+            w.put((uint32_t) tuning->key_freqs.size());
+            w.align(4);
+            w.put_array(tuning->key_freqs.data(), tuning->key_freqs.size());
+
+            if (tuning->scl_import == nullptr)
+            {
+                w.put((uint32_t) 0);
+                w.put((uint32_t) 0);
+            }
+            else
+            {
+                w.put_string<uint32_t>(tuning->scl_import->scl.rawText);
+                w.put_string<uint32_t>(tuning->scl_import->kbm.rawText);
+            }
+        }
+    }
+
+    // fx mixer
+    else if (memcmp(chunk.id, "MIXR", 4) == 0)
+    {
+        w.put((uint16_t) fx_mixer.size());
+
+        for (auto& bus : fx_mixer)
+        {
+            w.put((uint8_t) strlen(bus->name));
+            w.put_bytes(bus->name, strlen(bus->name));
+
+            uint8_t fx_state = 0;
+            if (dynamic_cast<audiomod::FXBus::FaderModule&>(bus->controller->module()).mute)   fx_state |= 1;
+            if (bus->solo)              fx_state |= 2;
+            w.put((uint8_t) fx_state);
+
+            // the master bus has no output bus, and stores 0
+            w.put((uint16_t) (bus == fx_mixer[0] ? 0 : bus->target_bus));
+
+            w.put((uint8_t) bus->get_modules().size());
+            for (audiomod::ModuleNodeRc& mod : bus->get_modules())
+                save_module(w, mod->module());
+        }
+    }
+
+    // a channel
+    else if (memcmp(chunk.id, "CHAN", 4) == 0)
+    {
+        Channel& channel = *channels[chunk.index];
+        save_channel_settings(w, channel);
+
+        // sequence
+        std::vector<uint32_t> sequence(channel.sequence.begin(), channel.sequence.end());
+        w.align(4);
+        w.put_array(sequence.data(), sequence.size());
+
+        // patterns
+        std::vector<NoteRecord> notes;
+        w.put((uint32_t) channel.patterns.size());
+
+        for (auto& pattern : channel.patterns) {
+            w.put((uint32_t) pattern->notes.size());
+
+            notes.resize(pattern->notes.size());
+            for (size_t i = 0; i < notes.size(); i++)
+            {
+                const Note& note = pattern->notes[i];
+                notes[i].time = swap_little_endian((float) note.time);
+                notes[i].length = swap_little_endian((float) note.length);
+                notes[i].key = swap_little_endian((int32_t) note.key);
+            }
+
+            w.put_bytes(notes.data(), notes.size() * sizeof(NoteRecord));
+        }
+    }
+}
+
+void Song::write_chunks(BinaryWriter& w, const std::vector<ProjectChunk>& chunks)
+{
+    begin_file(w, (uint32_t) chunks.size());
+
+    for (uint32_t i = 0; i < chunks.size(); i++)
+    {
+        w.align(8);
+        size_t offset = w.size();
+        w.put_bytes(chunks[i].data.data(), chunks[i].data.size());
+        set_chunk_entry(w, i, chunks[i].id.id, offset, chunks[i].data.size());
+    }
+}
+
+bool Song::read_chunks(const uint8_t* data, size_t size, std::vector<ProjectChunk>& chunks)
+{
+    BinaryReader header(data, size);
+    const uint8_t* magic_number = header.get_bytes(4);
+    uint32_t version = header.get<uint32_t>();
+    uint32_t num_chunks = header.get<uint32_t>();
+    header.get<uint32_t>();
+
+    if (!header.ok() || memcmp(magic_number, "SnBx", 4) != 0 || version != FILE_VERSION) return false;
+    if (num_chunks > header.remaining() / CHUNK_ENTRY_SIZE) return false;
+
+    // channel chunks are numbered in the order they appear
+    uint32_t num_channels = 0;
+    chunks.clear();
+
+    for (uint32_t i = 0; i < num_chunks; i++)
+    {
+        const char* id = (const char*) header.get_bytes(4);
+        header.get<uint32_t>();
+        uint64_t offset = header.get<uint64_t>();
+        uint64_t chunk_size = header.get<uint64_t>();
+
+        if (offset > size || chunk_size > size - offset) return false;
+
+        uint32_t index = memcmp(id, "CHAN", 4) == 0 ? num_channels++ : 0;
+        chunks.push_back({ ProjectChunkId(id, index), std::vector<uint8_t>(data + offset, data + offset + chunk_size) });
+    }
+
+    return true;
+}
+
+// read the tunings chunk of a version 2 file
+static bool load_tunings(BinaryReader& input, Song& song, std::string* error_msg)
+{
+    uint8_t num_tunings = input.get<uint8_t>();
+
+    for (uint8_t i = 0; i < num_tunings; i++)
+    {
+        std::unique_ptr<Tuning> tuning = std::make_unique<Tuning>();
+
+        input.get_string<uint32_t>(tuning->name);
+        input.get_string<uint32_t>(tuning->desc);
+
+        uint32_t keys_size = input.get<uint32_t>();
+        input.align(4);
+        if (!input.ok() || keys_size > input.remaining() / sizeof(float)) break;
+
+        tuning->key_freqs.resize(keys_size);
+        input.get_array(tuning->key_freqs.data(), keys_size);
+
+        std::string scl_data, kbm_data;
+        input.get_string<uint32_t>(scl_data);
+        input.get_string<uint32_t>(kbm_data);
+        if (!input.ok()) break;
+
+        if (!scl_data.empty())
+        {
+            TuningSclImport* scl_import = new TuningSclImport;
+            tuning->scl_import = scl_import;
+
+            try {
+                scl_import->scl = Tunings::parseSCLData(scl_data);
+                scl_import->kbm = Tunings::parseKBMData(kbm_data);
+            } catch(Tunings::TuningError& err) {
+                if (error_msg) *error_msg = err.what();
+                return false;
+            }
+        }
+        else if (!kbm_data.empty())
+        {
+            input.fail();
+            break;
+        }
+
+        tuning->analyze();
+        song.tunings.push_back(tuning.release());
+    }
+
+    if (!input.ok())
+    {
+        if (error_msg) *error_msg = "file is corrupted";
+        return false;
+    }
+
+    return true;
+}
+
+// read the fx mixer chunk of a version 2 file
+static bool load_mixer(
+    BinaryReader& input, Song& song,
+    audiomod::ModuleContext& modctx,
+    std::vector<SongLoader::ModuleLoad>& modules,
+    std::string* error_msg
+) {
+    uint16_t num_buses = input.get<uint16_t>();
+
+    for (uint16_t i = 0; i < num_buses; i++)
+    {
+        audiomod::FXBus* bus;
+
+        if (i == 0)
+            bus = song.fx_mixer[0].get();
+        else {
+            bus = new audiomod::FXBus(modctx);
+            song.fx_mixer.push_back(std::unique_ptr<audiomod::FXBus>(bus));
+        }
+
+        uint8_t name_size = input.get<uint8_t>();
+        const uint8_t* name = input.get_bytes(name_size);
+
+        if (name_size > bus->name_capacity - 1) {
+            if (error_msg) *error_msg = "name length exceeds capacity";
+            return false;
+        }
+
+        if (name) memcpy(bus->name, name, name_size);
+        bus->name[name_size] = 0;
+
+        uint8_t flags = input.get<uint8_t>();
+        if ((flags & 1) == 1) dynamic_cast<audiomod::FXBus::FaderModule&>(bus->controller->module()).mute = true; // mute
+        if ((flags & 2) == 2) bus->solo = true;            // solo
+
+        uint16_t target_bus = input.get<uint16_t>();
+        if (i > 0) bus->target_bus = target_bus;
+
+        uint8_t mod_count = input.get<uint8_t>();
+        for (uint8_t j = 0; j < mod_count; j++)
+        {
+            if (!read_module(input, modules, SongLoader::ModuleLoad::BusEffect, i, error_msg))
+                return false;
+        }
+    }
+
+    if (!input.ok())
+    {
+        if (error_msg) *error_msg = "file is corrupted";
+        return false;
+    }
+
+    // connect the fx buses
+    for (auto& bus : song.fx_mixer)
+    {
+        if (bus == song.fx_mixer.front()) continue;
+
+        if (bus->target_bus < 0 || bus->target_bus >= (int) song.fx_mixer.size())
+        {
+            if (error_msg) *error_msg = "file is corrupted";
+            return false;
+        }
+
+        song.fx_mixer[bus->target_bus]->connect_input(bus->controller);
+    }
+
+    return true;
+}
+
+// read a channel chunk of a version 2 file
+static bool load_channel(
+    BinaryReader& input, Song& song, size_t channel_index,
+    std::vector<SongLoader::ModuleLoad>& modules,
+    std::string* error_msg
+) {
+    Channel& channel = *song.channels[channel_index];
+
+    auto corrupted = [&]() {
+        if (error_msg) *error_msg = "file is corrupted";
+        return false;
+    };
+
+    // channel name, cut to the capacity of the channel name
+    uint8_t name_size = input.get<uint8_t>();
+    const uint8_t* name = input.get_bytes(name_size);
+    size_t copy_size = std::min((size_t) name_size, sizeof(channel.name) - 1);
+    if (name) memcpy(channel.name, name, copy_size);
+    channel.name[copy_size] = 0;
+
+    audiomod::VolumeModule& vol_mod = channel.vol_mod->module<audiomod::VolumeModule>();
+    vol_mod.volume = input.get<float>();
+    vol_mod.panning = input.get<float>();
+
+    uint8_t channel_flags = input.get<uint8_t>();
+    vol_mod.mute =          (channel_flags & 1) == 1;
+    channel.solo =          (channel_flags & 2) == 2;
+
+    channel.fx_target_idx = input.get<uint16_t>();
+    if (!input.ok() || channel.fx_target_idx >= (int) song.fx_mixer.size()) return corrupted();
+
+    // instrument and effects
+    if (!read_module(input, modules, SongLoader::ModuleLoad::Instrument, channel_index, error_msg))
+        return false;
+
+    uint8_t num_mods = input.get<uint8_t>();
+    for (uint8_t i = 0; i < num_mods; i++)
+    {
+        if (!read_module(input, modules, SongLoader::ModuleLoad::ChannelEffect, channel_index, error_msg))
+            return false;
+    }
+
+    // connect channel to target fx bus
+    song.fx_mixer.front()->disconnect_input(channel.vol_mod);
+    song.fx_mixer[channel.fx_target_idx]->connect_input(channel.vol_mod);
+
+    // sequence. int is stored as uint32
+    static_assert(sizeof(int) == sizeof(uint32_t), "int must be 32 bits");
+    input.align(4);
+    input.get_array((uint32_t*) channel.sequence.data(), channel.sequence.size());
+    channel.mark_sequence_changed();
+
+    for (int pattern_id : channel.sequence)
+    {
+        if (pattern_id < 0 || pattern_id > song.max_patterns()) return corrupted();
+    }
+
+    // patterns
+    uint32_t num_patterns = input.get<uint32_t>();
+    if (!input.ok() || num_patterns != channel.patterns.size()) return corrupted();
+
+    for (auto& pattern : channel.patterns)
+    {
+        uint32_t num_notes = input.get<uint32_t>();
+        if (num_notes > input.remaining() / sizeof(NoteRecord)) return corrupted();
+
+        // notes are decoded straight from the file's memory
+        const uint8_t* records = input.get_bytes(num_notes * sizeof(NoteRecord));
+        pattern->notes.reserve(num_notes);
+
+        for (uint32_t i = 0; i < num_notes; i++)
+        {
+            NoteRecord record;
+            memcpy(&record, records + i * sizeof(NoteRecord), sizeof(NoteRecord));
+
+            pattern->notes.push_back(Note(
+                swap_little_endian(record.time),
+                swap_little_endian(record.key),
+                swap_little_endian(record.length)
+            ));
+        }
+
+        pattern->mark_changed();
+    }
+
+    if (!input.ok()) return corrupted();
+    return true;
+}
+
+// read a song in the chunked version 2 format. its modules are
+// not created, but added to the list of modules to load
+static std::unique_ptr<Song> load_song_v2(
+    const uint8_t* data, size_t size,
+    audiomod::ModuleContext& modctx,
+    std::vector<SongLoader::ModuleLoad>& modules,
+    std::string* error_msg
+) {
+    auto corrupted = [&]() {
+        if (error_msg) *error_msg = "file is corrupted";
+        return nullptr;
+    };
+
+    BinaryReader header(data, size);
+    header.get_bytes(8); // magic and version
+    uint32_t num_chunks = header.get<uint32_t>();
+    header.get<uint32_t>();
+
+    if (!header.ok() || num_chunks > header.remaining() / 24) return corrupted();
+
+    // find the chunks. channels are in the order their chunks appear in
+    BinaryReader song_chunk(nullptr, 0), tune_chunk(nullptr, 0), mixer_chunk(nullptr, 0);
+    bool has_song = false, has_tune = false, has_mixer = false;
+    std::vector<BinaryReader> channel_chunks;
+
+    for (uint32_t i = 0; i < num_chunks; i++)
+    {
+        const uint8_t* id = header.get_bytes(4);
+        header.get<uint32_t>();
+        uint64_t offset = header.get<uint64_t>();
+        uint64_t chunk_size = header.get<uint64_t>();
+
+        if (offset > size || chunk_size > size - offset) return corrupted();
+        BinaryReader chunk(data + offset, chunk_size);
+
+        if (memcmp(id, "SONG", 4) == 0) {
+            song_chunk = chunk;
+            has_song = true;
+        } else if (memcmp(id, "TUNE", 4) == 0) {
+            tune_chunk = chunk;
+            has_tune = true;
+        } else if (memcmp(id, "MIXR", 4) == 0) {
+            mixer_chunk = chunk;
+            has_mixer = true;
+        } else if (memcmp(id, "CHAN", 4) == 0) {
+            channel_chunks.push_back(chunk);
+        }
+    }
+
+    if (!has_song || !has_tune || !has_mixer) return corrupted();
+
+    // song properties
+    BinaryReader& input = song_chunk;
+
+    std::string song_name, project_notes;
+    input.get_string<uint8_t>(song_name);
+    input.get_string<uint32_t>(project_notes);
+
+    uint32_t length = input.get<uint32_t>();
+    uint32_t num_channels = input.get<uint32_t>();
+    uint32_t max_patterns = input.get<uint32_t>();
+    uint32_t beats_per_bar = input.get<uint32_t>();
+    float tempo = input.get<float>();
+    uint8_t selected_tuning = input.get<uint8_t>();
+
+    if (
+        !input.ok() || num_channels == 0 || num_channels != channel_chunks.size() ||
+        length == 0 || max_patterns == 0 || beats_per_bar == 0 || beats_per_bar > INT_MAX
+    ) return corrupted();
+
+    // the song is allocated from these, so check them against the channel
+    // chunks, which hold a sequence entry and a note count per bar and pattern
+    for (const BinaryReader& chunk : channel_chunks)
+    {
+        if ((uint64_t)length + max_patterns > chunk.remaining() / sizeof(uint32_t))
+            return corrupted();
+    }
+
+    std::unique_ptr<Song> song = std::make_unique<Song>(num_channels, length, max_patterns, modctx);
+    strncpy(song->name, song_name.c_str(), song->name_capcity - 1);
+    song->name[song->name_capcity - 1] = 0;
+    song->project_notes = project_notes;
+    song->beats_per_bar = beats_per_bar;
+    song->tempo = tempo;
+    song->selected_tuning = selected_tuning;
+
+    if (!load_tunings(tune_chunk, *song, error_msg)) return nullptr;
+    if (selected_tuning >= song->tunings.size()) return corrupted();
+    if (!load_mixer(mixer_chunk, *song, modctx, modules, error_msg)) return nullptr;
+
+    for (uint32_t i = 0; i < num_channels; i++)
+    {
+        if (!load_channel(channel_chunks[i], *song, i, modules, error_msg))
+            return nullptr;
+    }
+
+    return song;
+}
+
+SongLoader::SongLoader(
+    const uint8_t* data, size_t size,
+    audiomod::ModuleContext& modctx,
+    plugins::PluginManager& plugin_manager
+) :
+    _modctx(modctx),
+    _plugin_manager(plugin_manager)
+{
+    read(data, size);
+}
+
+SongLoader::SongLoader(
+    const char* file_path,
+    audiomod::ModuleContext& modctx,
+    plugins::PluginManager& plugin_manager
+) :
+    _modctx(modctx),
+    _plugin_manager(plugin_manager)
+{
+    // the module states are read from the mapping until the modules are created
+    _file = sys::map_file(file_path);
+
+    if (_file == nullptr)
+    {
+        _error = std::string("could not open ") + file_path;
+        _done = true;
+        return;
+    }
+
+    read(sys::mapped_file_data(_file), sys::mapped_file_size(_file));
+}
+
+SongLoader::~SongLoader()
+{
+    cancel();
+    if (_thread.joinable()) _thread.join();
+
+    // modules that were created but not inserted are destroyed here
+    _modules.clear();
+    _song = nullptr;
+
+    if (_file) sys::unmap_file(_file);
+}
+
+void SongLoader::read(const uint8_t* data, size_t size)
+{
+    BinaryReader input(data, size);
+    const uint8_t* magic_number = input.get_bytes(4);
+    uint32_t version = input.get<uint32_t>();
+
+    if (!input.ok() || memcmp("SnBx", magic_number, 4) != 0)
+        _error = "not a project file";
+
+    else if (version == FILE_VERSION)
+        _song = load_song_v2(data, size, _modctx, _modules, &_error);
+
+    // older files are read from start to end through a stream,
+    // and their modules are created as they are read
+    else if (version == 1)
+    {
+        MemoryStreamBuf buf(data, size);
+        std::istream stream(&buf);
+        _song = load_song_v1(stream, _modctx, _plugin_manager, &_error);
+    }
+
+    else
+        _error = "invalid version";
+
+    if (_song == nullptr)
+    {
+        if (_error.empty()) _error = "unknown error";
+        _modules.clear();
+        _done = true;
+        return;
+    }
+
+    // the song is not heard or processed until it is finished
+    _song->fx_mixer[0]->disconnect_output();
+
+    if (_modules.empty())
+    {
+        _done = true;
+        return;
+    }
+
+    // LADSPA does not say whether instances of a library can be created at
+    // the same time, and all LV2 plugins share the same lilv world. modules
+    // that can't be created at once share a lane, and are created one after
+    // another in the order they appear in the file
+    std::unordered_map<std::string, size_t> lane_indices;
+
+    for (size_t i = 0; i < _modules.size(); i++)
+    {
+        std::string lane_key;
+
+        for (const plugins::PluginData& plugin : _plugin_manager.get_plugin_data())
+        {
+            if (plugin.id != _modules[i].id) continue;
+
+            if (plugin.type == plugins::PluginType::Lv2)
+                lane_key = "lv2";
+            else
+                lane_key = plugin.file_path.u8string();
+
+            break;
+        }
+
+        // built-in modules can always be created at the same time
+        if (lane_key.empty())
+        {
+            _lanes.push_back({ i });
+            continue;
+        }
+
+        auto it = lane_indices.find(lane_key);
+        if (it == lane_indices.end())
+        {
+            lane_indices[lane_key] = _lanes.size();
+            _lanes.push_back({ i });
+        }
+        else
+            _lanes[it->second].push_back(i);
+    }
+
+    // start the longest lanes first, since they finish last
+    std::stable_sort(_lanes.begin(), _lanes.end(), [](const std::vector<size_t>& a, const std::vector<size_t>& b) {
+        return a.size() > b.size();
+    });
+
+    _thread = std::thread(&SongLoader::_thread_proc, this);
+}
+
+void SongLoader::create_module(ModuleLoad& mod)
+{
+    try
+    {
+        mod.node = audiomod::create_module(mod.id.c_str(), _modctx, _plugin_manager, _song->work_scheduler);
+
+        if (mod.node == nullptr)
+        {
+            mod.error = "unknown module type " + mod.id;
+            return;
+        }
+
+        // the state is read in place, without copying it out of the file
+        if (mod.state_size > 0)
+        {
+            MemoryStreamBuf buf(mod.state, mod.state_size);
+            std::istream stream(&buf);
+
+            mod.node->module().song = _song.get();
+            mod.node->module().load_state(stream, mod.state_size);
+        }
+    }
+    catch (std::exception& err)
+    {
+        mod.node = nullptr;
+        mod.error = err.what();
+    }
+}
+
+void SongLoader::_load_task(void* userdata, size_t thread_index)
+{
+    SongLoader& self = *(SongLoader*) userdata;
+
+    size_t lane;
+    while ((lane = self._next_lane++) < self._lanes.size())
+    {
+        for (size_t i : self._lanes[lane])
+        {
+            if (self._cancelled) return;
+
+            self.create_module(self._modules[i]);
+            self._loaded_modules++;
+        }
+    }
+}
+
+void SongLoader::_thread_proc()
+{
+    // setting up plugins is mostly spent waiting on the disk
+    // and in plugin code, so this does not need real-time threads
+    ThreadPool pool(ThreadPool::default_thread_count());
+    pool.run(_load_task, this);
+
+    _done = true;
+}
+
+float SongLoader::get_progress() const
+{
+    if (_modules.empty()) return _done ? 1.0f : 0.0f;
+    return (float) _loaded_modules / _modules.size();
+}
+
+void SongLoader::cancel()
+{
+    _cancelled = true;
+}
+
+std::unique_ptr<Song> SongLoader::finish(std::string* error_msg)
+{
+    if (_thread.joinable()) _thread.join();
+
+    auto fail = [&](const std::string& error) {
+        if (error_msg) *error_msg = error;
+        _modules.clear();
+        _song = nullptr;
+        return nullptr;
+    };
+
+    if (_song == nullptr) return fail(_error);
+    if (_cancelled) return fail("loading was cancelled");
+
+    // modules are inserted in the order they appear in the file, which
+    // is the order they have in their effects racks
+    for (ModuleLoad& mod : _modules)
+    {
+        if (mod.node == nullptr) return fail(mod.error);
+
+        switch (mod.target)
+        {
+            case ModuleLoad::Instrument: {
+                Channel& channel = *_song->channels[mod.index];
+                mod.node->module().parent_name = channel.name;
+                channel.set_instrument(mod.node);
+                break;
+            }
+
+            case ModuleLoad::ChannelEffect: {
+                Channel& channel = *_song->channels[mod.index];
+                mod.node->module().parent_name = channel.name;
+                channel.effects_rack.insert(mod.node);
+                break;
+            }
+
+            case ModuleLoad::BusEffect: {
+                audiomod::FXBus& bus = *_song->fx_mixer[mod.index];
+                mod.node->module().parent_name = bus.name;
+                bus.insert(mod.node);
+                break;
+            }
+        }
+    }
+
+    _modules.clear();
+    _song->fx_mixer[0]->connect_output(_modctx.destination());
+    return std::move(_song);
+}
+
+std::unique_ptr<Song> Song::from_memory(
+    const uint8_t* data, size_t size,
+    audiomod::ModuleContext& modctx,
+    plugins::PluginManager& plugin_manager,
+    std::string* error_msg
+) {
+    SongLoader loader(data, size, modctx, plugin_manager);
+    return loader.finish(error_msg);
+}
+
+std::unique_ptr<Song> Song::from_file(
+    std::istream& input,
+    audiomod::ModuleContext& modctx,
+    plugins::PluginManager& plugin_manager,
+    std::string* error_msg
+) {
+    // read the whole stream in large pieces
+    std::vector<uint8_t> data;
+    size_t size = 0;
+
+    while (input)
+    {
+        data.resize(size + (1 << 16));
+        input.read((char*) data.data() + size, 1 << 16);
+        size += input.gcount();
+    }
+
+    return from_memory(data.data(), size, modctx, plugin_manager, error_msg);
+}
+
+std::unique_ptr<Song> Song::load_file(
+    const char* file_path,
+    audiomod::ModuleContext& modctx,
+    plugins::PluginManager& plugin_manager,
+    std::string* error_msg
+) {
+    SongLoader loader(file_path, modctx, plugin_manager);
+    return loader.finish(error_msg);
+}
+
+
+
+#ifdef UNIT_TESTS
+// X11 defines macros that collide with names in catch2
+#undef None
+#undef Always
+#undef Success
+#include <catch2/catch_amalgamated.hpp>
+
+namespace
+{
+    // the plugin manager only uses the window manager to open plugin
+    // windows, which never happens in these tests
+    alignas(WindowManager) char dummy_window_manager[sizeof(WindowManager)];
+
+    struct SerializeFixture
+    {
+        audiomod::ModuleContext modctx{48000, 2, 128};
+        plugins::PluginManager plugin_manager{*reinterpret_cast<WindowManager*>(dummy_window_manager)};
+
+        std::unique_ptr<Song> load(const std::string& file, std::string* error = nullptr)
+        {
+            return Song::from_memory((const uint8_t*) file.data(), file.size(), modctx, plugin_manager, error);
+        }
+    };
+
+    std::string save(const Song& song)
+    {
+        std::stringstream stream;
+        song.serialize(stream);
+        return stream.str();
+    }
+
+    std::unique_ptr<Song> make_test_song(audiomod::ModuleContext& modctx)
+    {
+        auto song = std::make_unique<Song>(2, 6, 3, modctx);
+        strcpy(song->name, "Round Trip");
+        song->project_notes = "line 1\nline 2";
+        song->tempo = 133.5f;
+        song->beats_per_bar = 3;
+
+        Tuning* tuning = new Tuning();
+        tuning->name = "19edo";
+        for (int key = 0; key < 128; key++)
+            tuning->key_freqs.push_back(440.0f * powf(2.0f, (key - 57) / 19.0f));
+        tuning->analyze();
+        song->tunings.push_back(tuning);
+        song->selected_tuning = 1;
+
+        auto& vol_mod = song->channels[1]->vol_mod->module<audiomod::VolumeModule>();
+        vol_mod.volume = 0.25f;
+        vol_mod.panning = -0.5f;
+        vol_mod.mute = true;
+        song->channels[0]->solo = true;
+        strcpy(song->channels[1]->name, "Bass");
+
+        song->channels[0]->sequence = { 1, 0, 2, 2, 3, 0 };
+        song->channels[1]->sequence = { 0, 1, 1, 0, 0, 3 };
+        song->channels[0]->patterns[0]->add_note(0.0f, 57, 1.0f);
+        song->channels[0]->patterns[0]->add_note(1.5f, 60, 0.5f);
+        song->channels[0]->patterns[2]->add_note(2.0f, 64, 1.0f);
+        song->channels[1]->patterns[0]->add_note(0.25f, 33, 2.75f);
+
+        return song;
+    }
+
+    void require_songs_equal(const Song& a, const Song& b)
+    {
+        REQUIRE(strcmp(a.name, b.name) == 0);
+        REQUIRE(a.project_notes == b.project_notes);
+        REQUIRE(a.tempo == b.tempo);
+        REQUIRE(a.beats_per_bar == b.beats_per_bar);
+        REQUIRE(a.length() == b.length());
+        REQUIRE(a.max_patterns() == b.max_patterns());
+
+        REQUIRE(a.selected_tuning == b.selected_tuning);
+        REQUIRE(a.tunings.size() == b.tunings.size());
+        for (size_t i = 0; i < a.tunings.size(); i++)
+        {
+            REQUIRE(a.tunings[i]->name == b.tunings[i]->name);
+            REQUIRE(a.tunings[i]->key_freqs == b.tunings[i]->key_freqs);
+        }
+
+        REQUIRE(a.channels.size() == b.channels.size());
+        for (size_t i = 0; i < a.channels.size(); i++)
+        {
+            const Channel& ca = *a.channels[i];
+            const Channel& cb = *b.channels[i];
+            auto& va = ca.vol_mod->module<audiomod::VolumeModule>();
+            auto& vb = cb.vol_mod->module<audiomod::VolumeModule>();
+
+            REQUIRE(strcmp(ca.name, cb.name) == 0);
+            REQUIRE(va.volume == vb.volume);
+            REQUIRE(va.panning == vb.panning);
+            REQUIRE(va.mute == vb.mute);
+            REQUIRE(ca.solo == cb.solo);
+            REQUIRE(ca.fx_target_idx == cb.fx_target_idx);
+            REQUIRE(strcmp(ca.synth_mod->module().id, cb.synth_mod->module().id) == 0);
+            REQUIRE(ca.sequence == cb.sequence);
+
+            REQUIRE(ca.patterns.size() == cb.patterns.size());
+            for (size_t j = 0; j < ca.patterns.size(); j++)
+            {
+                const std::vector<Note>& na = ca.patterns[j]->notes;
+                const std::vector<Note>& nb = cb.patterns[j]->notes;
+                REQUIRE(na.size() == nb.size());
+
+                for (size_t k = 0; k < na.size(); k++)
+                {
+                    REQUIRE(na[k].time == nb[k].time);
+                    REQUIRE(na[k].key == nb[k].key);
+                    REQUIRE(na[k].length == nb[k].length);
+                }
+            }
+        }
+    }
+
+    // write a project in the version 1 format. it has no tunings and
+    // no fx buses besides the master bus, and only waveform synths
+    std::string make_v1_file(uint32_t length, uint32_t max_patterns, uint32_t beats_per_bar, uint32_t bad_sequence_entry = 0)
+    {
+        BinaryWriter w;
+        w.put_bytes("SnBx", 4);
+        w.put<uint32_t>(1);
+
+        w.put<uint8_t>(7);
+        w.put_bytes("Version", 7);
+        w.put<uint32_t>(0); // project notes
+
+        const uint32_t num_channels = 2;
+        w.put<uint32_t>(length);
+        w.put<uint32_t>(num_channels);
+        w.put<uint32_t>(max_patterns);
+        w.put<uint32_t>(beats_per_bar);
+        w.put<float>(90.0f);
+
+        w.put<uint8_t>(0); // tunings
+        w.put<uint8_t>(0); // selected tuning
+
+        // the master bus
+        w.put<uint16_t>(1);
+        w.put<uint8_t>(6);
+        w.put_bytes("Master", 6);
+        w.put<uint8_t>(0); // flags
+        w.put<uint8_t>(0); // effects
+
+        for (uint32_t ch = 0; ch < num_channels; ch++)
+        {
+            w.put<uint8_t>(2);
+            w.put_bytes(ch == 0 ? "C0" : "C1", 2);
+            w.put<float>(0.5f + ch * 0.25f);
+            w.put<float>(0.0f);
+            w.put<uint8_t>(ch == 1 ? 1 : 0); // mute the second channel
+            w.put<uint16_t>(0); // master bus
+
+            w.put<uint8_t>(14);
+            w.put_bytes("synth.waveform", 14);
+            w.put<uint64_t>(0); // default state
+            w.put<uint8_t>(0); // effects
+
+            for (uint32_t bar = 0; bar < length; bar++)
+                w.put<uint32_t>(bar == 0 && bad_sequence_entry ? bad_sequence_entry : bar % (max_patterns + 1));
+
+            for (uint32_t pattern = 0; pattern < max_patterns; pattern++)
+            {
+                w.put<uint32_t>(pattern + 1);
+                for (uint32_t note = 0; note <= pattern; note++)
+                {
+                    w.put<float>(note * 0.5f);
+                    w.put<int16_t>(48 + ch * 12 + note);
+                    w.put<float>(0.5f);
+                }
+            }
+        }
+
+        return std::string((const char*) w.data(), w.size());
+    }
+}
+
+TEST_CASE_METHOD(SerializeFixture, "Song round trip", "[serialize]")
+{
+    auto song = make_test_song(modctx);
+    std::string file = save(*song);
+
+    std::string error;
+    auto loaded = load(file, &error);
+    REQUIRE(loaded != nullptr);
+    require_songs_equal(*song, *loaded);
+
+    // saving the loaded song gives the same file
+    REQUIRE(save(*loaded) == file);
+}
+
+TEST_CASE_METHOD(SerializeFixture, "Chunk versions follow edits", "[serialize]")
+{
+    auto song = make_test_song(modctx);
+
+    audiomod::ModuleNodeRc gain = modctx.create<audiomod::GainModule>(modctx);
+    song->channels[0]->effects_rack.insert(gain);
+
+    std::vector<ProjectChunkId> ids = song->chunk_ids();
+    auto versions = [&]() {
+        std::vector<uint64_t> out;
+        for (const ProjectChunkId& id : ids)
+            out.push_back(song->chunk_version(id));
+        return out;
+    };
+
+    std::vector<uint64_t> before = versions();
+    REQUIRE(versions() == before);
+
+    // only the version of the edited chunk changes
+    auto require_changed = [&](const char* id, uint32_t index) {
+        std::vector<uint64_t> after = versions();
+
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            bool edited = ids[i] == ProjectChunkId(id, index);
+            REQUIRE((after[i] != before[i]) == edited);
+        }
+
+        before = after;
+    };
+
+    SECTION("Notes")
+    {
+        song->channels[1]->patterns[2]->add_note(1.0f, 40, 1.0f);
+        require_changed("CHAN", 1);
+    }
+
+    SECTION("Sequence")
+    {
+        song->channels[0]->sequence[1] = 2;
+        song->channels[0]->mark_sequence_changed();
+        require_changed("CHAN", 0);
+    }
+
+    SECTION("Module state")
+    {
+        gain->module<audiomod::GainModule>().gain = 3.0f;
+        require_changed("CHAN", 0);
+
+        song->channels[1]->vol_mod->module<audiomod::VolumeModule>().panning = 0.75f;
+        require_changed("CHAN", 1);
+    }
+
+    SECTION("Song properties")
+    {
+        song->tempo = 90.0f;
+        require_changed("SONG", 0);
+    }
+}
+
+TEST_CASE_METHOD(SerializeFixture, "Song version 1 files", "[serialize]")
+{
+    std::string error;
+    auto song = load(make_v1_file(4, 2, 4), &error);
+    REQUIRE(song != nullptr);
+
+    REQUIRE(strcmp(song->name, "Version") == 0);
+    REQUIRE(song->length() == 4);
+    REQUIRE(song->max_patterns() == 2);
+    REQUIRE(song->beats_per_bar == 4);
+    REQUIRE(song->tempo == 90.0f);
+    REQUIRE(song->channels.size() == 2);
+    REQUIRE(song->channels[0]->sequence == std::vector<int>{ 0, 1, 2, 0 });
+    REQUIRE(song->channels[1]->vol_mod->module<audiomod::VolumeModule>().mute);
+    REQUIRE(song->channels[1]->vol_mod->module<audiomod::VolumeModule>().volume == 0.75f);
+    REQUIRE(song->channels[1]->patterns[1]->notes.size() == 2);
+    REQUIRE(song->channels[1]->patterns[1]->notes[1].key == 61);
+
+    // a version 1 file is saved in the current format, which reads back the same
+    auto loaded = load(save(*song), &error);
+    REQUIRE(loaded != nullptr);
+    require_songs_equal(*song, *loaded);
+}
+
+TEST_CASE_METHOD(SerializeFixture, "Song rejects corrupted properties", "[serialize]")
+{
+    std::string error;
+
+    SECTION("zero beats per bar")
+    {
+        auto song = make_test_song(modctx);
+        song->beats_per_bar = 0;
+        REQUIRE(load(save(*song), &error) == nullptr);
+        REQUIRE(load(make_v1_file(4, 2, 0), &error) == nullptr);
+    }
+
+    SECTION("selected tuning out of range")
+    {
+        auto song = make_test_song(modctx);
+        song->selected_tuning = 2;
+        REQUIRE(load(save(*song), &error) == nullptr);
+    }
+
+    SECTION("sequence entry past the last pattern")
+    {
+        auto song = make_test_song(modctx);
+        song->channels[1]->sequence[2] = 4;
+        REQUIRE(load(save(*song), &error) == nullptr);
+        REQUIRE(load(make_v1_file(4, 2, 4, 3), &error) == nullptr);
+    }
+
+    SECTION("length larger than the file")
+    {
+        std::string file = make_v1_file(4, 2, 4);
+
+        // the length follows the magic number, version, name and notes
+        uint32_t length = 0x7FFFFFFF;
+        memcpy(&file[4 + 4 + 1 + 7 + 4], &length, sizeof(length));
+        REQUIRE(load(file, &error) == nullptr);
+
+        uint32_t max_patterns = 0;
+        memcpy(&file[4 + 4 + 1 + 7 + 4 + 8], &max_patterns, sizeof(max_patterns));
+        REQUIRE(load(file, &error) == nullptr);
+    }
+
+    REQUIRE(error == "file is corrupted");
+}
+
+#endif
@@ -10,6 +10,7 @@
 #include <ios>
 #include <iostream>
 #include <limits>
+#include <map>
 #include <stdexcept>
 #include <string.h>
 #include <math.h>
@@ -25,7 +26,16 @@
 #include "sys.h"
 #include "modules/modules.h"
 
-Pattern::Pattern() { };
+// pattern and sequence versions are drawn from one counter, so a version
+// is never reused, even by a pattern that replaced another one
+static std::atomic<uint64_t> next_version = 1;
+
+Pattern::Pattern() : version(next_version++) { };
+
+void Pattern::mark_changed()
+{
+    version = next_version++;
+}
 
 static unsigned long new_note_id = 0;
 
@@ -47,6 +57,7 @@ void Note::new_id()
 
 Note& Pattern::add_note(float time, int key, float length) {
     notes.push_back(Note(time, key, length));
+    mark_changed();
     return *(notes.end() - 1);
 }
 
@@ -57,7 +68,8 @@ inline bool Pattern::is_empty() const {
 /*************************
 *        CHANNEL         *
 *************************/
-Channel::Channel(int song_length, int max_patterns, Song& song) : song(song)
+Channel::Channel(int song_length, int max_patterns, Song& song)
+    : song(song), sequence_version(next_version++)
 {
     vol_mod = song.mod_ctx().create<audiomod::VolumeModule>(song.mod_ctx());
 
@@ -106,6 +118,11 @@ void Channel::set_fx_target(int fx_index)
     song.fx_mixer[fx_index]->connect_input(vol_mod);
 }
 
+void Channel::mark_sequence_changed()
+{
+    sequence_version = next_version++;
+}
+
 int Channel::first_empty_pattern() const
 {
     int i = 0;
@@ -277,6 +294,12 @@ Song::Song(int num_channels, int length, int max_patterns, audiomod::ModuleConte
     }
 }
 
+Song::~Song()
+{
+    // the processing thread is done with the song by the time it is destroyed
+    delete _playback.load();
+}
+
 // length field
 int Song::length() const { return _length; }
 
@@ -299,6 +322,7 @@ void Song::set_max_patterns(int num_patterns) {
             for (int& num : ch->sequence) {
                 if (num > num_patterns) num = 0;
             }
+            ch->mark_sequence_changed();
 
             ch->patterns.erase(ch->patterns.begin() + num_patterns, ch->patterns.end());
 
@@ -328,6 +352,7 @@ void Song::insert_bar(int position)
 
     for (auto& channel : channels) {
         channel->sequence.insert(channel->sequence.begin() + position, 0);
+        channel->mark_sequence_changed();
     }
 }
 
@@ -337,13 +362,10 @@ void Song::remove_bar(int position)
 
     for (auto& channel : channels) {
         channel->sequence.erase(channel->sequence.begin() + position);
+        channel->mark_sequence_changed();
     }
 
-    if (bar_position >= _length)
-    {
-        bar_position = _length - 1;
-        position = bar_position * beats_per_bar;
-    }
+    // the processing thread keeps the playhead within the new length on its next block
 }
 
 std::vector<int> Song::get_bar_patterns(int bar_position)
@@ -364,6 +386,7 @@ void Song::set_bar_patterns(int bar_position, int* array, size_t size)
     for (size_t ch = 0; ch < size; ch++)
     {
         channels[ch]->sequence[bar_position] = array[ch];
+        channels[ch]->mark_sequence_changed();
     }
 }
 
@@ -438,44 +461,114 @@ bool Song::is_note_playable(int key) const
 }
 
 bool Song::get_key_frequency(int key, float* freq) const {
-    Tuning* tuning = tunings[selected_tuning];
+    // the tunings are edited on the UI thread, so read the copy in the snapshot
+    const Playback* playback = _playback.load(std::memory_order_acquire);
+    if (!playback) return false;
+
+    const std::vector<float>& key_freqs = *playback->key_freqs;
 
     if (key < 0) return false;
-    if (key >= tuning->key_freqs.size()) return false;
+    if (key >= key_freqs.size()) return false;
 
-    *freq = tuning->key_freqs[key];
+    *freq = key_freqs[key];
     return true;
 }
 
-void Song::play() {
-    is_playing = true;
-    position = bar_position * beats_per_bar;
+std::shared_ptr<const Song::Playback::PatternData> Song::make_pattern_data(const Pattern& pattern)
+{
+    const std::vector<Note>& notes = pattern.notes;
 
-    assert(notes_playing == 0);
-    cur_notes.clear();
-    prev_notes.clear();
+    auto data = std::make_shared<Playback::PatternData>();
+    data->notes = notes;
+    data->version = pattern.version;
+    data->edges.reserve(notes.size() * 2);
+
+    for (uint32_t i = 0; i < notes.size(); i++)
+    {
+        // a note with no length is never heard
+        if (notes[i].length <= 0.0f) continue;
+
+        data->edges.push_back({ notes[i].time, true, i });
+        data->edges.push_back({ notes[i].time + notes[i].length, false, i });
+    }
+
+    std::stable_sort(data->edges.begin(), data->edges.end(), [](const Playback::PatternData::Edge& a, const Playback::PatternData::Edge& b) {
+        if (a.time != b.time) return a.time < b.time;
+        return !a.is_start && b.is_start;
+    });
+
+    return data;
 }
 
-void Song::stop() {
-    is_playing = false;
-    position = bar_position * beats_per_bar;
+std::shared_ptr<const Song::Playback::BarEvents> Song::make_bar_events(
+    std::shared_ptr<const Playback::PatternData> prev_pattern,
+    std::shared_ptr<const Playback::PatternData> pattern,
+    int beats_per_bar
+)
+{
+    auto bar = std::make_shared<Playback::BarEvents>();
+    bar->prev_pattern = prev_pattern;
+    bar->pattern = pattern;
+
+    // a note that starts at the beginning of the bar and is part of the same
+    // pattern as before is the same note, and it keeps playing
+    auto carries_on = [&](const Note& note) {
+        return prev_pattern == pattern && note.time <= 0.0f;
+    };
+
+    // stop the notes of the previous bar that reach into this one
+    if (prev_pattern)
+    {
+        for (const Note& note : prev_pattern->notes)
+        {
+            if (note.length <= 0.0f || note.time >= beats_per_bar) continue;
+            if (note.time + note.length < beats_per_bar) continue;
 
-    for (NoteData note_data : cur_notes) {
-        notes_playing--;
+            if (!(carries_on(note) && note.length >= beats_per_bar))
+                bar->events.push_back({ 0.0f, false, note });
+        }
+    }
 
-        channels[note_data.channel_i]->synth_mod->module().event(audiomod::NoteEvent {
-            audiomod::NoteEventKind::NoteOff,
-            note_data.note.key,
-            1.0f
-        });
+    if (pattern)
+    {
+        for (const Playback::PatternData::Edge& edge : pattern->edges)
+        {
+            // notes are cut off at the end of the bar
+            if (edge.time >= beats_per_bar) break;
+
+            const Note& note = pattern->notes[edge.note];
+            if (edge.is_start && carries_on(note) && note.length >= beats_per_bar) continue;
+
+            bar->events.push_back({ edge.time, edge.is_start, note });
+        }
+
+        // the edges are in time order, so the starts are as well
+        float max_end = 0.0f;
+
+        for (const Playback::PatternData::Edge& edge : pattern->edges)
+        {
+            if (edge.time >= beats_per_bar) break;
+            if (!edge.is_start) continue;
+
+            const Note& note = pattern->notes[edge.note];
+            float end = std::min(note.time + note.length, (float) beats_per_bar);
+            max_end = std::max(max_end, end);
+
+            bar->intervals.push_back({ note.time, end, max_end, note });
+        }
     }
 
-    assert(notes_playing == 0);
-    prev_notes.clear();
-    cur_notes.clear();
+    return bar;
 }
 
-void Song::update(double elapsed) {
+// compute which channels and buses are muted by solo
+static void get_solo_mutes(
+    const std::vector<std::unique_ptr<Channel>>& channels,
+    const std::vector<std::unique_ptr<audiomod::FXBus>>& fx_mixer,
+    std::vector<bool>& channel_mutes,
+    std::vector<bool>& bus_mutes
+)
+{
     // first check if any channels are solo'd
     bool solo_mode = false;
     for (auto& channel : channels) {
@@ -486,19 +579,9 @@ void Song::update(double elapsed) {
     }
 
     // if a channel is solo'd, then mute all but the channels that are solo'd
-    if (solo_mode) {
-        for (auto& channel : channels)
-        {
-            dynamic_cast<audiomod::VolumeModule&>(channel->vol_mod->module())
-            .mute_override = !channel->solo;
-        }
-    } else {
-        for (auto& channel : channels)
-        {
-            dynamic_cast<audiomod::VolumeModule&>(channel->vol_mod->module())
-            .mute_override = false;
-        }
-    }
+    channel_mutes.resize(channels.size());
+    for (size_t i = 0; i < channels.size(); i++)
+        channel_mutes[i] = solo_mode && !channels[i]->solo;
 
     // then, do the same for fx channels
     solo_mode = false;
@@ -508,61 +591,384 @@ void Song::update(double elapsed) {
             break;
         }
     }
+
+    bus_mutes.resize(fx_mixer.size());
+    for (size_t i = 0; i < fx_mixer.size(); i++)
+        bus_mutes[i] = solo_mode && !fx_mixer[i]->solo;
+
+    // unmute any buses that are connected to the soloed bus
     if (solo_mode) {
-        for (auto& bus : fx_mixer) {
-            dynamic_cast<audiomod::FXBus::FaderModule&>(bus->controller->module())
-            .mute_override = !bus->solo;
+        for (size_t i = 0; i < fx_mixer.size(); i++) {
+            if (!fx_mixer[i]->solo) continue;
+
+            size_t bus = i;
+            while (bus != 0)
+            {
+                bus_mutes[bus] = false;
+                bus = fx_mixer[bus]->target_bus;
+            }
+
+            bus_mutes[0] = false;
         }
+    }
+}
 
-        // unmute any buses that are connected to the soloed bus
-        for (auto& orig_bus : fx_mixer) {
-            std::unique_ptr<audiomod::FXBus>* bus = &orig_bus;
+// the key frequencies of the selected tuning, or an empty list if the
+// selection is out of range while a tuning is being removed
+static const std::vector<float>& selected_key_freqs(const std::vector<Tuning*>& tunings, int selected_tuning)
+{
+    static const std::vector<float> empty;
+    if (selected_tuning < 0 || selected_tuning >= (int) tunings.size()) return empty;
+    return tunings[selected_tuning]->key_freqs;
+}
 
-            if (bus->get()->solo) {
-                while (bus != &fx_mixer[0])
-                {
-                    dynamic_cast<audiomod::FXBus::FaderModule&>(bus->get()->controller->module())
-                    .mute_override = false;
-                    
-                    bus = &fx_mixer[bus->get()->target_bus];
-                }
+bool Song::playback_outdated(const Playback& playback) const
+{
+    if (
+        playback.length != _length ||
+        playback.beats_per_bar != beats_per_bar ||
+        playback.tempo != tempo ||
+        playback.do_loop != do_loop ||
+        playback.channels.size() != channels.size() ||
+        playback.fx_mixer.size() != fx_mixer.size() ||
+        *playback.key_freqs != selected_key_freqs(tunings, selected_tuning)
+    ) return true;
+
+    std::vector<bool> channel_mutes, bus_mutes;
+    get_solo_mutes(channels, fx_mixer, channel_mutes, bus_mutes);
+
+    for (size_t i = 0; i < fx_mixer.size(); i++)
+    {
+        const Playback::BusData& data = playback.fx_mixer[i];
+        if (data.controller != fx_mixer[i]->controller || data.mute_override != bus_mutes[i])
+            return true;
+    }
+
+    for (size_t i = 0; i < channels.size(); i++)
+    {
+        const Channel& channel = *channels[i];
+        const Playback::ChannelData& data = playback.channels[i];
+
+        if (
+            data.synth_mod != channel.synth_mod ||
+            data.vol_mod != channel.vol_mod ||
+            data.mute_override != channel_mutes[i] ||
+            data.sequence_version != channel.sequence_version ||
+            data.patterns.size() != channel.patterns.size()
+        ) return true;
+
+        for (size_t j = 0; j < channel.patterns.size(); j++)
+        {
+            if (data.patterns[j]->version != channel.patterns[j]->version)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+void Song::commit()
+{
+    Playback* old_playback = _playback.load(std::memory_order_relaxed);
+    if (old_playback && !playback_outdated(*old_playback)) return;
+
+    auto playback = std::make_unique<Playback>();
+    playback->version = ++_playback_version;
+    playback->length = _length;
+    playback->beats_per_bar = beats_per_bar;
+    playback->tempo = tempo;
+    playback->do_loop = do_loop;
+
+    const std::vector<float>& key_freqs = selected_key_freqs(tunings, selected_tuning);
+    if (old_playback && *old_playback->key_freqs == key_freqs)
+        playback->key_freqs = old_playback->key_freqs;
+    else
+        playback->key_freqs = std::make_shared<const std::vector<float>>(key_freqs);
+
+    std::vector<bool> channel_mutes, bus_mutes;
+    get_solo_mutes(channels, fx_mixer, channel_mutes, bus_mutes);
+
+    for (size_t i = 0; i < fx_mixer.size(); i++)
+        playback->fx_mixer.push_back({ fx_mixer[i]->controller, bus_mutes[i] });
+
+    for (size_t i = 0; i < channels.size(); i++)
+    {
+        const Channel& channel = *channels[i];
+        Playback::ChannelData data;
+        data.synth_mod = channel.synth_mod;
+        data.vol_mod = channel.vol_mod;
+        data.mute_override = channel_mutes[i];
+        data.sequence = channel.sequence;
+        data.sequence_version = channel.sequence_version;
+
+        for (size_t j = 0; j < channel.patterns.size(); j++)
+        {
+            const Pattern& pattern = *channel.patterns[j];
 
-                dynamic_cast<audiomod::FXBus::FaderModule&>(bus->get()->controller->module())
-                .mute_override = false;
+            // share the notes with the previous snapshot if the pattern was not edited
+            std::shared_ptr<const Playback::PatternData> shared;
+
+            if (old_playback && i < old_playback->channels.size())
+            {
+                const Playback::ChannelData& old = old_playback->channels[i];
+                if (j < old.patterns.size() && old.patterns[j]->version == pattern.version)
+                    shared = old.patterns[j];
             }
+
+            if (!shared)
+                shared = make_pattern_data(pattern);
+            
+            data.patterns.push_back(std::move(shared));
         }
-    } else {
-        for (auto& bus : fx_mixer) {
-            dynamic_cast<audiomod::FXBus::FaderModule&>(bus->controller->module())
-            .mute_override = false;
+
+        // build the timeline, reusing the bars of the previous snapshot and
+        // the bars made from the same patterns earlier in the song
+        const Playback::ChannelData* old_data = nullptr;
+        if (old_playback && i < old_playback->channels.size() && old_playback->beats_per_bar == beats_per_bar)
+            old_data = &old_playback->channels[i];
+
+        std::map<
+            std::pair<const Playback::PatternData*, const Playback::PatternData*>,
+            std::shared_ptr<const Playback::BarEvents>
+        > built;
+
+        for (size_t bar = 0; bar < data.sequence.size(); bar++)
+        {
+            std::shared_ptr<const Playback::PatternData> pattern, prev_pattern;
+            if (data.sequence[bar] > 0)
+                pattern = data.patterns[data.sequence[bar] - 1];
+            if (bar > 0 && data.sequence[bar - 1] > 0)
+                prev_pattern = data.patterns[data.sequence[bar - 1] - 1];
+
+            if (!pattern && !prev_pattern)
+            {
+                data.timeline.push_back(nullptr);
+                continue;
+            }
+
+            auto matches = [&](const std::shared_ptr<const Playback::BarEvents>& events) {
+                return events && events->pattern == pattern && events->prev_pattern == prev_pattern;
+            };
+
+            std::shared_ptr<const Playback::BarEvents> events;
+
+            if (old_data && bar < old_data->timeline.size() && matches(old_data->timeline[bar]))
+                events = old_data->timeline[bar];
+            
+            auto key = std::make_pair(prev_pattern.get(), pattern.get());
+
+            if (!events)
+            {
+                auto it = built.find(key);
+                if (it != built.end()) events = it->second;
+            }
+
+            if (!events)
+                events = make_bar_events(prev_pattern, pattern, beats_per_bar);
+            
+            built.emplace(key, events);
+
+            data.timeline.push_back(std::move(events));
         }
+
+        playback->channels.push_back(std::move(data));
     }
 
+    Playback* old = _playback.exchange(playback.release(), std::memory_order_seq_cst);
+    modctx.reclaimer().retire(std::shared_ptr<Playback>(old));
+}
+
+const Song::Playback* Song::begin_playback()
+{
+    modctx.reclaimer().begin_read();
+    const Playback* playback = _playback.load(std::memory_order_seq_cst);
+    if (playback == nullptr) return nullptr;
+
+    // forget about notes that were playing on instruments that
+    // have been removed from the song. they may already be destroyed
+    if (playback->version != _last_version)
+    {
+        _last_version = playback->version;
+
+        for (size_t i = playing_notes.size() - 1; i != SIZE_MAX; i--)
+        {
+            bool found = false;
+
+            for (const Playback::ChannelData& channel : playback->channels)
+            {
+                if (channel.synth_mod.get() == playing_notes[i].synth)
+                {
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found) playing_notes.erase(playing_notes.begin() + i);
+        }
+
+        notes_playing = playing_notes.size();
+
+        // the patterns may have changed under the playhead
+        _cursor_bar = -1;
+    }
+
+    return playback;
+}
+
+void Song::end_playback()
+{
+    modctx.reclaimer().end_read();
+}
+
+void Song::play() {
+    const Playback* playback = begin_playback();
+    is_playing = true;
+
+    if (playback)
+    {
+        _bar_position = std::min(_bar_position, playback->length - 1);
+        _position = _bar_position * playback->beats_per_bar;
+        apply_seek(*playback);
+    }
+    else _position = 0.0;
+
+    publish_playhead();
+
+    assert(notes_playing == 0);
+    cur_notes.clear();
+    playing_notes.clear();
+    _cursor_bar = -1;
+    end_playback();
+}
+
+void Song::stop() {
+    const Playback* playback = begin_playback();
+    is_playing = false;
+    _position = playback ? _bar_position * playback->beats_per_bar : 0.0;
+    publish_playhead();
+
+    release_notes(0);
+    end_playback();
+}
+
+// the playhead is moved to note boundaries in whole frames, so positions
+// this close together are considered equal. it is far less than a frame
+static constexpr double POSITION_EPSILON = 1e-6;
+
+void Song::seek(double new_position)
+{
+    const double song_beats = (double)_length * beats_per_bar;
+    new_position = fmod(new_position, song_beats);
+    if (new_position < 0.0) new_position += song_beats;
+
+    _seek_position.store(new_position);
+}
+
+double Song::playhead_position() const
+{
+    // a seek that was not applied yet is shown right away. while
+    // stopped, this is the position playback will start from
+    double seek_position = _seek_position.load(std::memory_order_relaxed);
+    if (seek_position >= 0.0) return seek_position;
+
+    return _shown_position.load(std::memory_order_relaxed);
+}
+
+int Song::playhead_bar() const
+{
+    double seek_position = _seek_position.load(std::memory_order_relaxed);
+    int bar = seek_position >= 0.0
+        ? (int)((seek_position + POSITION_EPSILON) / beats_per_bar)
+        : _shown_bar.load(std::memory_order_relaxed);
+
+    return std::clamp(bar, 0, _length - 1);
+}
+
+void Song::publish_playhead()
+{
+    _shown_position.store(_position, std::memory_order_relaxed);
+    _shown_bar.store(_bar_position, std::memory_order_relaxed);
+}
+
+void Song::apply_seek(const Playback& playback)
+{
+    double new_position = _seek_position.exchange(-1.0);
+    if (new_position < 0.0) return;
+
+    const int bar_beats = playback.beats_per_bar;
+    _position = std::min(new_position, (double)playback.length * bar_beats);
+    _bar_position = std::min((int)((_position + POSITION_EPSILON) / bar_beats), playback.length - 1);
+
+    // the bar is scanned for the notes under the playhead on the next step
+    _cursor_bar = -1;
+}
+
+void Song::release_notes(size_t frame)
+{
+    for (NoteData note_data : playing_notes) {
+        notes_playing--;
+
+        note_data.synth->module().event(audiomod::NoteEvent {
+            audiomod::NoteEventKind::NoteOff,
+            note_data.note.key,
+            1.0f,
+            (uint32_t) frame
+        });
+    }
+
+    assert(notes_playing == 0);
+    playing_notes.clear();
+    cur_notes.clear();
+    _cursor_bar = -1;
+}
+
+void Song::sync_notes(const Playback& playback, double pos_in_bar, size_t frame)
+{
+    const double beats_per_frame = playback.tempo / 60.0 / modctx.sample_rate;
+
     // get notes at playhead
-    float pos_in_bar = fmod(position, (double)beats_per_bar);
     cur_notes.clear();
+    _event_cursors.resize(playback.channels.size());
+
+    for (size_t i = 0; i < playback.channels.size(); i++) {
+        const Playback::ChannelData& channel = playback.channels[i];
+        const Playback::BarEvents* bar = channel.timeline[_bar_position].get();
+        _event_cursors[i] = 0;
+
+        if (bar) {
+            // the notes that start after the playhead are skipped with a binary search.
+            // walking back from there, the notes before an interval whose max_end
+            // is behind the playhead have all ended
+            size_t k = std::upper_bound(
+                bar->intervals.begin(), bar->intervals.end(), pos_in_bar,
+                [](double pos, const Playback::BarEvents::Interval& interval) {
+                    return pos < interval.start;
+                }
+            ) - bar->intervals.begin();
 
-    int channel_i = 0;
-    for (auto& channel : channels) {
-        int pattern_index = channel->sequence[bar_position] - 1;
-        if (pattern_index >= 0) {
-            auto& pattern = channel->patterns[pattern_index];
+            while (k > 0 && bar->intervals[k - 1].max_end > pos_in_bar) {
+                const Playback::BarEvents::Interval& interval = bar->intervals[--k];
 
-            for (Note& note : pattern->notes) {
-                if (pos_in_bar >= note.time && pos_in_bar < note.time + note.length)    
+                if (pos_in_bar < interval.end)
                     cur_notes.push_back({
-                        channel_i,
-                        note
+                        channel.synth_mod.get(),
+                        interval.note
                     });
             }
-        }
 
-        channel_i++;
+            // skip past the events that are already behind the playhead
+            _event_cursors[i] = std::upper_bound(
+                bar->events.begin(), bar->events.end(), pos_in_bar,
+                [](double pos, const Playback::BarEvents::Event& event) {
+                    return pos < event.time;
+                }
+            ) - bar->events.begin();
+        }
     }
 
-    // if there are notes in prev_notes that are not in cur_notes
+    // if there are notes in playing_notes that are not in cur_notes
     // they are notes that just ended
-    for (NoteData& old_note : prev_notes) {
+    for (NoteData& old_note : playing_notes) {
         bool is_old = true;
 
         for (const NoteData& new_note : cur_notes) {
@@ -576,20 +982,21 @@ void Song::update(double elapsed) {
             notes_playing--;
             assert(notes_playing >= 0);
 
-            channels[old_note.channel_i]->synth_mod->module().event(audiomod::NoteEvent {
+            old_note.synth->module().event(audiomod::NoteEvent {
                 audiomod::NoteEventKind::NoteOff,
                 old_note.note.key,
-                1.0f
+                1.0f,
+                (uint32_t) frame
             });
         }
     }
 
-    // if there are notes in cur_notes that are not in prev_notes
+    // if there are notes in cur_notes that are not in playing_notes
     // they are new notes
     for (NoteData& new_note : cur_notes) {
         bool is_new = true;
 
-        for (const NoteData& old_note : prev_notes) {
+        for (const NoteData& old_note : playing_notes) {
             if (new_note.note == old_note.note) {
                 is_new = false;
                 break;
@@ -598,33 +1005,163 @@ void Song::update(double elapsed) {
 
         if (is_new) {
             notes_playing++;
+
+            // a note that started before the playhead continues from where it is
+            double beats_in = pos_in_bar - POSITION_EPSILON - new_note.note.time;
+            uint32_t start_offset = 0;
+            if (beats_in > 0.0)
+                start_offset = (uint32_t) (beats_in / beats_per_frame);
             
-            channels[new_note.channel_i]->synth_mod->module().event(audiomod::NoteEvent {
+            new_note.synth->module().event(audiomod::NoteEvent {
                 audiomod::NoteEventKind::NoteOn,
                 new_note.note.key,
-                1.0f
+                1.0f,
+                (uint32_t) frame,
+                start_offset
+            });
+        }
+    }
+
+    std::swap(playing_notes, cur_notes);
+    _cursor_bar = _bar_position;
+}
+
+void Song::send_note_events(const Playback& playback, double pos_in_bar, size_t frame)
+{
+    for (size_t i = 0; i < playback.channels.size(); i++) {
+        const Playback::ChannelData& channel = playback.channels[i];
+        const Playback::BarEvents* bar = channel.timeline[_bar_position].get();
+        if (!bar) continue;
+
+        size_t& cursor = _event_cursors[i];
+
+        for (; cursor < bar->events.size() && bar->events[cursor].time <= pos_in_bar; cursor++) {
+            const Playback::BarEvents::Event& event = bar->events[cursor];
+
+            if (event.is_start) {
+                notes_playing++;
+                playing_notes.push_back({ channel.synth_mod.get(), event.note });
+            } else {
+                // find the note to stop. it may have been stopped already
+                // if it was playing when the song was edited
+                auto it = std::find_if(playing_notes.begin(), playing_notes.end(), [&](const NoteData& data) {
+                    return data.note == event.note && data.synth == channel.synth_mod.get();
+                });
+
+                if (it == playing_notes.end()) continue;
+                playing_notes.erase(it);
+
+                notes_playing--;
+                assert(notes_playing >= 0);
+            }
+
+            channel.synth_mod->module().event(audiomod::NoteEvent {
+                event.is_start ? audiomod::NoteEventKind::NoteOn : audiomod::NoteEventKind::NoteOff,
+                event.note.key,
+                1.0f,
+                (uint32_t) frame
             });
         }
     }
+}
+
+double Song::next_note_boundary(const Playback& playback) const
+{
+    double next = (double) playback.beats_per_bar;
+
+    for (size_t i = 0; i < playback.channels.size(); i++) {
+        const Playback::BarEvents* bar = playback.channels[i].timeline[_bar_position].get();
+
+        // events are sorted, so the one at the cursor is the closest
+        if (bar && _event_cursors[i] < bar->events.size())
+            next = std::min(next, (double) bar->events[_event_cursors[i]].time);
+    }
+
+    return next;
+}
+
+void Song::update(size_t frames) {
+    const Playback* playback = begin_playback();
+    
+    if (playback == nullptr)
+    {
+        end_playback();
+        return;
+    }
 
-    prev_notes = cur_notes;
+    // apply solo mutes
+    for (const Playback::ChannelData& channel : playback->channels)
+    {
+        dynamic_cast<audiomod::VolumeModule&>(channel.vol_mod->module())
+        .mute_override = channel.mute_override;
+    }
+
+    for (const Playback::BusData& bus : playback->fx_mixer)
+    {
+        dynamic_cast<audiomod::FXBus::FaderModule&>(bus.controller->module())
+        .mute_override = bus.mute_override;
+    }
+
+    apply_seek(*playback);
+
+    const int bar_beats = playback->beats_per_bar;
+    const int song_length = playback->length;
+    const double beats_per_frame = playback->tempo / 60.0 / modctx.sample_rate;
+    if (_bar_position >= song_length) _bar_position = song_length - 1;
 
-    position += elapsed * (tempo / 60.0);
+    // step through the block from one note boundary to the next,
+    // sending the events of each boundary at the frame it falls on
+    size_t frame = 0;
 
-    // if reached past the end of the song
-    if (position >= _length * beats_per_bar) {
-        if (do_loop) // loop back to the beginning of the song
-            position -= _length * beats_per_bar;
-        else {
-            // stop the song and set cursor to the beginning
-            bar_position = 0;
-            position = 0;
-            stop();
-            return;
+    while (frame < frames)
+    {
+        double pos_in_bar = fmod(_position + POSITION_EPSILON, (double)bar_beats);
+
+        // moving on to the next bar starts from the top of its events. a full
+        // scan is only needed when the playhead jumped or the song was edited
+        if (_cursor_bar >= 0 && _bar_position == _cursor_bar + 1) {
+            std::fill(_event_cursors.begin(), _event_cursors.end(), 0);
+            _cursor_bar = _bar_position;
         }
+
+        if (_bar_position != _cursor_bar)
+            sync_notes(*playback, pos_in_bar, frame);
+        else
+            send_note_events(*playback, pos_in_bar, frame);
+
+        pos_in_bar -= POSITION_EPSILON;
+        double boundary = next_note_boundary(*playback);
+
+        // the first frame at or after the boundary
+        size_t step = (size_t) ceil((boundary - POSITION_EPSILON - pos_in_bar) / beats_per_frame);
+        step = std::clamp(step, (size_t)1, frames - frame);
+
+        frame += step;
+        _position += step * beats_per_frame;
+
+        // if reached past the end of the song
+        if (_position + POSITION_EPSILON >= song_length * bar_beats) {
+            if (playback->do_loop) { // loop back to the beginning of the song
+                _position = std::max(_position - song_length * bar_beats, 0.0);
+                _cursor_bar = -1;
+            } else {
+                // stop the song and set cursor to the beginning
+                _bar_position = 0;
+                _position = 0;
+                is_playing = false;
+                release_notes(frame < frames ? frame : frames - 1);
+                publish_playhead();
+                end_playback();
+                return;
+            }
+        }
+
+        _bar_position = (int)((_position + POSITION_EPSILON) / bar_beats);
+        if (_bar_position >= song_length) _bar_position = song_length - 1;
     }
 
-    bar_position = position / beats_per_bar;
+    publish_playhead();
+    end_playback();
 }
 
 Tuning* Song::load_scale_tun(std::istream& input, std::string* err)
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <sys/types.h>
 #include <unordered_map>
 #include <vector>
@@ -9,6 +10,8 @@
 #include <istream>
 #include <string>
 #include <mutex>
+#include <atomic>
+#include <thread>
 
 #include <TUN_Scale.h>
 #include <Tunings.h>
@@ -17,6 +20,7 @@
 #include <imgui.h>
 #include "modules/modules.h"
 #include "worker.h"
+#include "sys.h"
 
 struct Note {
     float time;
@@ -46,11 +50,40 @@ struct Pattern {
     Pattern();
 
     std::vector<Note> notes;
+
+    // changes on every edit, and is never shared by two different note lists,
+    // so the playback snapshot only rebuilds the patterns that were edited.
+    // call mark_changed() after editing the notes
+    uint64_t version;
+    void mark_changed();
+
     Note& add_note(float time, int key, float length);
     inline bool is_empty() const; 
 };
 
 class Song;
+class BinaryWriter;
+
+// identifies a chunk of a project file. only channel chunks use the index
+struct ProjectChunkId
+{
+    char id[4];
+    uint32_t index;
+
+    ProjectChunkId(const char* id, uint32_t index = 0) : index(index) {
+        memcpy(this->id, id, 4);
+    };
+
+    inline bool operator==(const ProjectChunkId& other) const noexcept {
+        return memcmp(id, other.id, 4) == 0 && index == other.index;
+    }
+};
+
+struct ProjectChunk
+{
+    ProjectChunkId id;
+    std::vector<uint8_t> data;
+};
 
 class Channel {
 private:
@@ -71,6 +104,11 @@ public:
     char name[16];
     std::vector<int> sequence;
     std::vector<std::unique_ptr<Pattern>> patterns;
+
+    // like Pattern::version, but for the sequence.
+    // call mark_sequence_changed() after editing the sequence
+    uint64_t sequence_version;
+    void mark_sequence_changed();
     
     int first_empty_pattern() const;
     void set_instrument(audiomod::ModuleNodeRc new_instrument);
@@ -117,21 +155,171 @@ private:
     int _length;
     int _max_patterns;
 
+    /**
+    * An immutable copy of everything the processing thread needs to play the song.
+    * It is built on the thread that edits the song and published with an atomic
+    * swap, so the song can be edited during playback without locking.
+    **/
+    struct Playback {
+        /**
+        * A pattern's notes prepared for playback. Every note start and end is
+        * listed in time order, so the processing thread can walk through a bar
+        * with a cursor instead of scanning every note on each block.
+        **/
+        struct PatternData {
+            struct Edge {
+                float time;
+                bool is_start;
+                uint32_t note; // index into notes
+            };
+
+            std::vector<Note> notes;
+            uint64_t version; // the version of the pattern this was made from
+
+            // sorted by time, with note ends before note starts at the same time
+            std::vector<Edge> edges;
+        };
+
+        /**
+        * The note events of one bar of a channel, in time order. The events at the
+        * start of a bar stop the notes of the previous bar that are still sounding,
+        * unless the same pattern carries them on. Bars made from the same pair of
+        * patterns share one list, which is reused by later snapshots as long as
+        * neither pattern is edited.
+        **/
+        struct BarEvents {
+            struct Event {
+                float time;
+                bool is_start;
+                Note note;
+            };
+
+            // the span of a note of the bar's pattern, used to find the notes
+            // under the playhead when it jumps
+            struct Interval {
+                float start;
+                float end;
+
+                // the latest end of this interval and every interval before it
+                float max_end;
+                Note note;
+            };
+
+            // the patterns this bar was built from
+            std::shared_ptr<const PatternData> prev_pattern;
+            std::shared_ptr<const PatternData> pattern;
+
+            std::vector<Event> events;
+
+            // sorted by start time. the intervals that contain a position are
+            // found with a binary search, walking back until max_end is behind it
+            std::vector<Interval> intervals;
+        };
+
+        struct ChannelData {
+            audiomod::ModuleNodeRc synth_mod;
+            audiomod::ModuleNodeRc vol_mod;
+            bool mute_override;
+            std::vector<int> sequence;
+            uint64_t sequence_version;
+
+            // patterns that have not changed share their notes with the previous snapshot
+            std::vector<std::shared_ptr<const PatternData>> patterns;
+
+            // the events of every bar in the song, or null for empty bars
+            std::vector<std::shared_ptr<const BarEvents>> timeline;
+        };
+
+        struct BusData {
+            audiomod::ModuleNodeRc controller;
+            bool mute_override;
+        };
+
+        uint64_t version;
+        std::vector<ChannelData> channels;
+        std::vector<BusData> fx_mixer;
+
+        // frequencies of the selected tuning, shared with the previous snapshot if unchanged
+        std::shared_ptr<const std::vector<float>> key_freqs;
+        int length;
+        int beats_per_bar;
+        float tempo;
+        bool do_loop;
+    };
+
+    std::atomic<Playback*> _playback = nullptr;
+    uint64_t _playback_version = 0;
+
+    bool playback_outdated(const Playback& playback) const;
+
+    // build the sorted list of note starts and ends of a pattern
+    static std::shared_ptr<const Playback::PatternData> make_pattern_data(const Pattern& pattern);
+
+    // build the events of a bar playing pattern after prev_pattern.
+    // either pattern may be null
+    static std::shared_ptr<const Playback::BarEvents> make_bar_events(
+        std::shared_ptr<const Playback::PatternData> prev_pattern,
+        std::shared_ptr<const Playback::PatternData> pattern,
+        int beats_per_bar
+    );
+
+    // the following is only accessed by the processing thread
     struct NoteData {
-        int channel_i;
+        audiomod::ModuleNode* synth;
         Note note;
     };
 
-    std::vector<NoteData> prev_notes;
+    std::vector<NoteData> playing_notes;
     std::vector<NoteData> cur_notes;
+    uint64_t _last_version = 0;
+
+    // index of the next event to send in each channel's current bar
+    std::vector<size_t> _event_cursors;
+
+    // the bar the event cursors point into, or -1 if they need to be found again
+    int _cursor_bar = -1;
+
+    const Playback* begin_playback();
+    void end_playback();
     audiomod::ModuleContext& modctx;
 
+    // look up the notes of the current bar that are at the playhead,
+    // send note on and note off events to match, and place the event cursors.
+    // this is done when the playhead jumps and when the song was edited
+    void sync_notes(const Playback& playback, double pos_in_bar, size_t frame);
+
+    // send the timeline events that the playhead has reached
+    void send_note_events(const Playback& playback, double pos_in_bar, size_t frame);
+
+    // the position in the current bar of the next note start or end, or
+    // the end of the bar if there are no more notes in the bar
+    double next_note_boundary(const Playback& playback) const;
+
+    // send note off events for all playing notes
+    void release_notes(size_t frame);
+
+    // position requested by seek(), or a negative number if there is none
+    std::atomic<double> _seek_position = -1.0;
+
+    // move the playhead to the position requested by seek(), if there is one
+    void apply_seek(const Playback& playback);
+
+    // the playhead, in beats and in bars. only the processing thread moves it
+    int _bar_position = 0;
+    double _position = 0.0;
+
+    // a copy of the playhead for other threads, updated after every block
+    std::atomic<int> _shown_bar = 0;
+    std::atomic<double> _shown_position = 0.0;
+    void publish_playhead();
+
     // this variable is solely for debug purpose
     int notes_playing = 0;
 
 public:
     Song(const Song&) = delete; // disable copy
     Song(int num_channels, int length, int max_patterns, audiomod::ModuleContext& modctx);
+    ~Song();
     
     std::mutex mutex;
 
@@ -147,8 +335,6 @@ public:
     std::vector<std::unique_ptr<Channel>> channels;
 
     int beats_per_bar = 8;
-    int bar_position = 0;
-    double position = 0.0;
     std::atomic<bool> is_playing = false;
     bool do_loop = true;
     float tempo = 120;
@@ -180,13 +366,51 @@ public:
     void delete_fx_bus(std::unique_ptr<audiomod::FXBus>& bus_to_delete);
 
     bool is_note_playable(int key) const;
+
+    /**
+    * Look up the frequency of a key in the tuning of the published snapshot.
+    * Only call this from the processing thread, while a module is processed.
+    * @returns false if the key is not in the tuning
+    **/
     bool get_key_frequency(int key, float* freq) const;
 
+    /**
+    * Publish the current state of the song to the processing thread, if it was
+    * changed since the last commit. Edits to the song are not heard until they
+    * are committed. This must be called from the thread that edits the song,
+    * and should be followed by ModuleContext::commit.
+    **/
+    void commit();
+
     // only call these functions from the processing thread
     // other threads set is_playing
     void play();
     void stop();
-    void update(double elasped);
+
+    /**
+    * Move the playhead to a position in beats. This can be called from any
+    * thread; the processing thread moves the playhead before its next block.
+    * Notes that overlap the new position are started right away, instead of
+    * being silent until the next note starts.
+    * @param new_position The position in beats, wrapped to the length of the song
+    **/
+    void seek(double new_position);
+
+    /**
+    * Get where the playhead is, in beats or bars, to show it in the editor.
+    * This includes a seek that has not been applied yet.
+    **/
+    double playhead_position() const;
+    int playhead_bar() const;
+
+    /**
+    * Advance the playhead by a block of frames. Note events are sent to the
+    * synths with their frame offset in the block, so that notes start and
+    * end at the exact frame regardless of the block size.
+    * This must be called before the block is processed.
+    * @param frames The amount of frames in the block
+    **/
+    void update(size_t frames);
 
     /**
     * Load scale data in the AnaMark tuning file format
@@ -213,11 +437,152 @@ public:
     */
     bool load_kbm(const char* file_path, Tuning& tuning, std::string* error);
 
+    /**
+    * Write the song in the chunked project file format. The file is built in
+    * memory and written to the stream all at once.
+    **/
     void serialize(std::ostream& out) const;
+    void serialize(BinaryWriter& out) const;
+
+    // the chunks the song is currently written as, in file order
+    std::vector<ProjectChunkId> chunk_ids() const;
+
+    // write the contents of a single chunk. arrays within it are aligned
+    // relative to the start of the chunk, so it can be written on its own
+    void serialize_chunk(BinaryWriter& out, const ProjectChunkId& chunk) const;
+
+    /**
+    * Get a value that changes whenever the contents of a chunk may have changed.
+    * Patterns and sequences are represented by their versions, so this is much
+    * cheaper than serializing the chunk.
+    **/
+    uint64_t chunk_version(const ProjectChunkId& chunk) const;
+
+    // write a project file out of chunks that were serialized earlier
+    static void write_chunks(BinaryWriter& out, const std::vector<ProjectChunk>& chunks);
+
+    // split a chunked project file into its chunks, without loading the song
+    static bool read_chunks(const uint8_t* data, size_t size, std::vector<ProjectChunk>& chunks);
+
+    /**
+    * Load a song from the contents of a project file in memory. Both the
+    * chunked format and the older "SnBx" version 1 format can be read.
+    * @param data The contents of the file, which are only read during the call
+    * @param error_msg the pointer to the string which may hold the error message
+    * @returns the loaded song, or nullptr if there was an error
+    **/
+    static std::unique_ptr<Song> from_memory(
+        const uint8_t* data, size_t size,
+        audiomod::ModuleContext& audio_dest,
+        plugins::PluginManager& plugin_manager,
+        std::string *error_msg
+    );
+
+    // load a song from a stream, by reading all of it into memory first
     static std::unique_ptr<Song> from_file(
         std::istream& input,
         audiomod::ModuleContext& audio_dest,
         plugins::PluginManager& plugin_manager,
         std::string *error_msg
     );
-};
\ No newline at end of file
+
+    // load a project file by mapping it into memory
+    static std::unique_ptr<Song> load_file(
+        const char* file_path,
+        audiomod::ModuleContext& audio_dest,
+        plugins::PluginManager& plugin_manager,
+        std::string *error_msg
+    );
+};
+/**
+* Loads a project file in three steps, so that creating its modules, which
+* may mean loading and setting up plugins, does not hold up the thread that
+* edits the module graph:
+*   1. The constructor reads the file into a song that does not have its
+*      modules yet.
+*   2. The modules are created and their states loaded on a thread pool in
+*      the background. Modules that a plugin API does not allow to be set up
+*      at the same time are set up one after another.
+*   3. finish() inserts the modules into the song.
+* The constructor and finish() edit the module graph, so they must be
+* called from the thread that does so.
+**/
+class SongLoader
+{
+public:
+    // a module that was read from the file, and is created in the background
+    struct ModuleLoad
+    {
+        enum Target : uint8_t { Instrument, ChannelEffect, BusEffect } target;
+        size_t index; // the channel or fx bus the module belongs to
+
+        std::string id;
+        const uint8_t* state;
+        size_t state_size;
+
+        audiomod::ModuleNodeRc node;
+        std::string error;
+    };
+
+private:
+    audiomod::ModuleContext& _modctx;
+    plugins::PluginManager& _plugin_manager;
+    sys::mapped_file_t* _file = nullptr;
+
+    std::unique_ptr<Song> _song;
+    std::string _error;
+
+    std::vector<ModuleLoad> _modules;
+
+    // indices of modules that are created in order on the same thread
+    std::vector<std::vector<size_t>> _lanes;
+    std::atomic<size_t> _next_lane = 0;
+    std::atomic<size_t> _loaded_modules = 0;
+
+    std::atomic<bool> _cancelled = false;
+    std::atomic<bool> _done = false;
+    std::thread _thread;
+
+    void read(const uint8_t* data, size_t size);
+    void create_module(ModuleLoad& mod);
+
+    static void _load_task(void* userdata, size_t thread_index);
+    void _thread_proc();
+
+public:
+    SongLoader(const SongLoader&) = delete;
+
+    // load a project file by mapping it into memory
+    SongLoader(
+        const char* file_path,
+        audiomod::ModuleContext& modctx,
+        plugins::PluginManager& plugin_manager
+    );
+
+    // load a project file in memory, which must stay valid until the loader is destroyed
+    SongLoader(
+        const uint8_t* data, size_t size,
+        audiomod::ModuleContext& modctx,
+        plugins::PluginManager& plugin_manager
+    );
+
+    // cancels loading if it is still running
+    ~SongLoader();
+
+    // the fraction of modules that were created
+    float get_progress() const;
+
+    // whether finish() can be called without waiting
+    inline bool finished() const { return _done; };
+
+    // stop creating modules. this returns immediately; the
+    // loader stops after the modules it is currently creating
+    void cancel();
+
+    /**
+    * Wait for the modules to be created and insert them into the song.
+    * @param error_msg the pointer to the string which may hold the error message
+    * @returns the loaded song, or nullptr if there was an error or loading was cancelled
+    **/
+    std::unique_ptr<Song> finish(std::string* error_msg);
+};
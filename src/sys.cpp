@@ -2,6 +2,8 @@
 #include <chrono>
 #include <iostream>
 #include <atomic>
+#include <climits>
+#include <thread>
 #include "sys.h"
 
 using namespace sys;
@@ -39,6 +41,314 @@ const char* sys::dl_error()
 	return "Win32 error messages unimplemented";
 }
 
+semaphore_t* sys::semaphore_create()
+{
+	return (semaphore_t*) CreateSemaphore(nullptr, 0, LONG_MAX, nullptr);
+}
+
+void sys::semaphore_destroy(semaphore_t* sem)
+{
+	CloseHandle((HANDLE) sem);
+}
+
+void sys::semaphore_post(semaphore_t* sem)
+{
+	ReleaseSemaphore((HANDLE) sem, 1, nullptr);
+}
+
+bool sys::semaphore_wait(semaphore_t* sem, int timeout_ms)
+{
+	return WaitForSingleObject((HANDLE) sem, timeout_ms) == WAIT_OBJECT_0;
+}
+
+bool sys::set_thread_realtime()
+{
+	return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+}
+
+struct sys::mapped_file_t
+{
+	HANDLE file;
+	HANDLE mapping;
+	const uint8_t* data;
+	size_t size;
+};
+
+mapped_file_t* sys::map_file(const char* file_path)
+{
+	HANDLE file = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	mapped_file_t* output = new mapped_file_t { file, nullptr, nullptr, (size_t)size.QuadPart };
+
+	// an empty file cannot be mapped
+	if (output->size == 0) return output;
+
+	output->mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (output->mapping != nullptr)
+		output->data = (const uint8_t*) MapViewOfFile(output->mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (output->data == nullptr)
+	{
+		unmap_file(output);
+		return nullptr;
+	}
+
+	return output;
+}
+
+void sys::unmap_file(mapped_file_t* file)
+{
+	if (file->data) UnmapViewOfFile(file->data);
+	if (file->mapping) CloseHandle(file->mapping);
+	CloseHandle(file->file);
+	delete file;
+}
+
+// quote an argument the way CommandLineToArgvW splits them
+static std::wstring quote_argument(const std::wstring& arg)
+{
+	std::wstring out = L"\"";
+	size_t backslashes = 0;
+
+	for (wchar_t c : arg)
+	{
+		if (c == L'\\')
+		{
+			backslashes++;
+			continue;
+		}
+
+		// backslashes are only special before a quote
+		out.append(c == L'"' ? backslashes * 2 + 1 : backslashes, L'\\');
+		backslashes = 0;
+		out += c;
+	}
+
+	out.append(backslashes * 2, L'\\');
+	out += L'"';
+	return out;
+}
+
+static std::wstring widen(const std::string& str)
+{
+	int size = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, nullptr, 0);
+	std::wstring out(size, 0);
+	MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, out.data(), size);
+	out.resize(size - 1);
+	return out;
+}
+
+bool sys::run_self(const std::vector<std::string>& args, std::string& output, int& exit_code, int timeout_ms)
+{
+	wchar_t exe_path[MAX_PATH];
+	DWORD exe_len = GetModuleFileNameW(nullptr, exe_path, MAX_PATH);
+	if (exe_len == 0 || exe_len == MAX_PATH) return false;
+
+	std::wstring command_line = quote_argument(exe_path);
+	for (const std::string& arg : args)
+		command_line += L" " + quote_argument(widen(arg));
+
+	SECURITY_ATTRIBUTES attributes = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+	HANDLE read_pipe, write_pipe;
+	if (!CreatePipe(&read_pipe, &write_pipe, &attributes, 0)) return false;
+	SetHandleInformation(read_pipe, HANDLE_FLAG_INHERIT, 0);
+
+	STARTUPINFOW startup_info = {};
+	startup_info.cb = sizeof(startup_info);
+	startup_info.dwFlags = STARTF_USESTDHANDLES;
+	startup_info.hStdInput = INVALID_HANDLE_VALUE;
+	startup_info.hStdOutput = write_pipe;
+	startup_info.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+	PROCESS_INFORMATION process;
+	BOOL started = CreateProcessW(
+		exe_path, command_line.data(), nullptr, nullptr, TRUE,
+		CREATE_NO_WINDOW, nullptr, nullptr, &startup_info, &process
+	);
+
+	CloseHandle(write_pipe);
+
+	if (!started)
+	{
+		CloseHandle(read_pipe);
+		return false;
+	}
+
+	// other processes started at the same time may have inherited the write end
+	// of the pipe, so the end of the output is found by waiting for the process
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	bool timed_out = false;
+	bool exited = false;
+	char buf[4096];
+
+	while (true)
+	{
+		DWORD available = 0;
+		if (!PeekNamedPipe(read_pipe, nullptr, 0, nullptr, &available, nullptr)) break;
+
+		if (available > 0)
+		{
+			DWORD read = 0;
+			if (!ReadFile(read_pipe, buf, std::min<DWORD>(available, sizeof(buf)), &read, nullptr)) break;
+			output.append(buf, read);
+			continue;
+		}
+
+		// read what is left after the process exits
+		if (exited) break;
+		exited = WaitForSingleObject(process.hProcess, 10) == WAIT_OBJECT_0;
+
+		if (!exited && std::chrono::steady_clock::now() >= deadline)
+		{
+			timed_out = true;
+			TerminateProcess(process.hProcess, 1);
+			break;
+		}
+	}
+
+	CloseHandle(read_pipe);
+	WaitForSingleObject(process.hProcess, INFINITE);
+
+	DWORD code = 0;
+	GetExitCodeProcess(process.hProcess, &code);
+	CloseHandle(process.hProcess);
+	CloseHandle(process.hThread);
+
+	// a crash shows up as an exception code, such as 0xC0000005
+	exit_code = (timed_out || code >= 0xC0000000) ? -1 : (int) code;
+	return true;
+}
+
+struct sys::process_t
+{
+	HANDLE handle;
+};
+
+process_t* sys::spawn_self(const std::vector<std::string>& args)
+{
+	wchar_t exe_path[MAX_PATH];
+	DWORD exe_len = GetModuleFileNameW(nullptr, exe_path, MAX_PATH);
+	if (exe_len == 0 || exe_len == MAX_PATH) return nullptr;
+
+	std::wstring command_line = quote_argument(exe_path);
+	for (const std::string& arg : args)
+		command_line += L" " + quote_argument(widen(arg));
+
+	STARTUPINFOW startup_info = {};
+	startup_info.cb = sizeof(startup_info);
+
+	PROCESS_INFORMATION process;
+	if (!CreateProcessW(
+		exe_path, command_line.data(), nullptr, nullptr, FALSE,
+		CREATE_NO_WINDOW, nullptr, nullptr, &startup_info, &process
+	)) return nullptr;
+
+	CloseHandle(process.hThread);
+	return new process_t { process.hProcess };
+}
+
+bool sys::process_running(process_t* process)
+{
+	return WaitForSingleObject(process->handle, 0) == WAIT_TIMEOUT;
+}
+
+void sys::close_process(process_t* process, int timeout_ms)
+{
+	if (WaitForSingleObject(process->handle, timeout_ms) != WAIT_OBJECT_0)
+	{
+		TerminateProcess(process->handle, 1);
+		WaitForSingleObject(process->handle, INFINITE);
+	}
+
+	CloseHandle(process->handle);
+	delete process;
+}
+
+uint64_t sys::current_process_id()
+{
+	return GetCurrentProcessId();
+}
+
+bool sys::process_exists(uint64_t pid)
+{
+	HANDLE handle = OpenProcess(SYNCHRONIZE, FALSE, (DWORD) pid);
+	if (handle == nullptr) return false;
+
+	bool running = WaitForSingleObject(handle, 0) == WAIT_TIMEOUT;
+	CloseHandle(handle);
+	return running;
+}
+
+struct sys::shared_memory_t
+{
+	HANDLE mapping;
+	void* data;
+	size_t size;
+};
+
+shared_memory_t* sys::shared_memory_create(const char* name, size_t size)
+{
+	std::string full_name = std::string("Local\\") + name;
+
+	HANDLE mapping = CreateFileMappingA(
+		INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		(DWORD) ((uint64_t) size >> 32), (DWORD) size, full_name.c_str()
+	);
+	if (mapping == nullptr) return nullptr;
+
+	if (GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		CloseHandle(mapping);
+		return nullptr;
+	}
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (data == nullptr)
+	{
+		CloseHandle(mapping);
+		return nullptr;
+	}
+
+	return new shared_memory_t { mapping, data, size };
+}
+
+shared_memory_t* sys::shared_memory_open(const char* name)
+{
+	std::string full_name = std::string("Local\\") + name;
+
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, full_name.c_str());
+	if (mapping == nullptr) return nullptr;
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (data == nullptr)
+	{
+		CloseHandle(mapping);
+		return nullptr;
+	}
+
+	// the mapping's size is rounded up to whole pages
+	MEMORY_BASIC_INFORMATION info;
+	VirtualQuery(data, &info, sizeof(info));
+
+	return new shared_memory_t { mapping, data, info.RegionSize };
+}
+
+void sys::shared_memory_close(shared_memory_t* memory)
+{
+	// the name goes away along with the last handle to the mapping
+	UnmapViewOfFile(memory->data);
+	CloseHandle(memory->mapping);
+	delete memory;
+}
+
 dl_handle sys::dl_open(const char* file_path)
 {
 	return LoadLibrary(file_path);
@@ -58,6 +368,30 @@ void* sys::dl_sym(dl_handle handle, const char *symbol_name)
 #include <thread>
 #include <time.h>
 #include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+
+extern char** environ;
 
 struct interval_impl
 {
@@ -91,6 +425,274 @@ void sys::clear_interval(interval_t* interval)
 	delete impl;
 }
 
+struct sys::mapped_file_t
+{
+	const uint8_t* data;
+	size_t size;
+};
+
+mapped_file_t* sys::map_file(const char* file_path)
+{
+	int fd = open(file_path, O_RDONLY);
+	if (fd < 0) return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	mapped_file_t* output = new mapped_file_t { nullptr, (size_t)st.st_size };
+
+	// an empty file cannot be mapped
+	if (output->size > 0)
+	{
+		void* data = mmap(nullptr, output->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			delete output;
+			return nullptr;
+		}
+
+		// the whole file is about to be read from start to end
+		madvise(data, output->size, MADV_SEQUENTIAL);
+		output->data = (const uint8_t*) data;
+	}
+
+	// the mapping stays valid after the descriptor is closed
+	close(fd);
+	return output;
+}
+
+void sys::unmap_file(mapped_file_t* file)
+{
+	if (file->data) munmap((void*) file->data, file->size);
+	delete file;
+}
+
+static std::string self_path()
+{
+	char buf[PATH_MAX];
+
+#ifdef __APPLE__
+	uint32_t size = sizeof(buf);
+	if (_NSGetExecutablePath(buf, &size) != 0) return "";
+	return buf;
+#else
+	ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+	if (len < 0) return "";
+
+	buf[len] = 0;
+	return buf;
+#endif
+}
+
+bool sys::run_self(const std::vector<std::string>& args, std::string& output, int& exit_code, int timeout_ms)
+{
+	std::string exe_path = self_path();
+	if (exe_path.empty()) return false;
+
+	std::vector<char*> argv;
+	argv.push_back(exe_path.data());
+	for (const std::string& arg : args)
+		argv.push_back((char*) arg.c_str());
+	argv.push_back(nullptr);
+
+	// neither end of the pipe may be inherited by processes
+	// that other threads start at the same time
+	int fds[2];
+#ifdef __linux__
+	if (pipe2(fds, O_CLOEXEC) != 0) return false;
+#else
+	if (pipe(fds) != 0) return false;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+
+	pid_t pid;
+	int err = posix_spawn(&pid, exe_path.c_str(), &actions, nullptr, argv.data(), environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+
+	if (err != 0)
+	{
+		close(fds[0]);
+		return false;
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	bool timed_out = false;
+	char buf[4096];
+
+	while (true)
+	{
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (remaining <= 0)
+		{
+			timed_out = true;
+			break;
+		}
+
+		pollfd pfd = { fds[0], POLLIN, 0 };
+		int res = poll(&pfd, 1, (int) remaining);
+		if (res < 0 && errno == EINTR) continue;
+		if (res < 0) break;
+
+		if (res == 0)
+		{
+			timed_out = true;
+			break;
+		}
+
+		ssize_t count = read(fds[0], buf, sizeof(buf));
+		if (count < 0 && errno == EINTR) continue;
+		if (count <= 0) break;
+
+		output.append(buf, count);
+	}
+
+	close(fds[0]);
+	if (timed_out) kill(pid, SIGKILL);
+
+	int status = 0;
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+	exit_code = (!timed_out && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+	return true;
+}
+
+struct sys::process_t
+{
+	pid_t pid;
+	bool exited;
+};
+
+process_t* sys::spawn_self(const std::vector<std::string>& args)
+{
+	std::string exe_path = self_path();
+	if (exe_path.empty()) return nullptr;
+
+	std::vector<char*> argv;
+	argv.push_back(exe_path.data());
+	for (const std::string& arg : args)
+		argv.push_back((char*) arg.c_str());
+	argv.push_back(nullptr);
+
+	pid_t pid;
+	if (posix_spawn(&pid, exe_path.c_str(), nullptr, nullptr, argv.data(), environ) != 0)
+		return nullptr;
+
+	return new process_t { pid, false };
+}
+
+bool sys::process_running(process_t* process)
+{
+	if (!process->exited && waitpid(process->pid, nullptr, WNOHANG) == process->pid)
+		process->exited = true;
+
+	return !process->exited;
+}
+
+void sys::close_process(process_t* process, int timeout_ms)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+	while (process_running(process))
+	{
+		if (std::chrono::steady_clock::now() >= deadline)
+		{
+			kill(process->pid, SIGKILL);
+			while (waitpid(process->pid, nullptr, 0) < 0 && errno == EINTR);
+			break;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	delete process;
+}
+
+uint64_t sys::current_process_id()
+{
+	return getpid();
+}
+
+bool sys::process_exists(uint64_t pid)
+{
+	return kill((pid_t) pid, 0) == 0 || errno == EPERM;
+}
+
+struct sys::shared_memory_t
+{
+	std::string name;
+	void* data;
+	size_t size;
+
+	// whether this process created the memory and owns its name
+	bool owner;
+};
+
+shared_memory_t* sys::shared_memory_create(const char* name, size_t size)
+{
+	std::string full_name = std::string("/") + name;
+
+	int fd = shm_open(full_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0) return nullptr;
+
+	if (ftruncate(fd, size) != 0)
+	{
+		close(fd);
+		shm_unlink(full_name.c_str());
+		return nullptr;
+	}
+
+	void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		shm_unlink(full_name.c_str());
+		return nullptr;
+	}
+
+	return new shared_memory_t { full_name, data, size, true };
+}
+
+shared_memory_t* sys::shared_memory_open(const char* name)
+{
+	std::string full_name = std::string("/") + name;
+
+	int fd = shm_open(full_name.c_str(), O_RDWR, 0);
+	if (fd < 0) return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	void* data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) return nullptr;
+	return new shared_memory_t { full_name, data, (size_t) st.st_size, false };
+}
+
+void sys::shared_memory_close(shared_memory_t* memory)
+{
+	munmap(memory->data, memory->size);
+	if (memory->owner) shm_unlink(memory->name.c_str());
+	delete memory;
+}
+
 dl_handle sys::dl_open(const char *file_path)
 {
 	return dlopen(file_path, RTLD_NOW);
@@ -111,4 +713,135 @@ const char* sys::dl_error()
 	return dlerror();
 }
 
+#ifdef __APPLE__
+// macOS has no unnamed POSIX semaphores or sem_timedwait, but GCD semaphores
+// are also safe to signal from a real-time thread
+semaphore_t* sys::semaphore_create()
+{
+	return (semaphore_t*) dispatch_semaphore_create(0);
+}
+
+void sys::semaphore_destroy(semaphore_t* sem)
+{
+	dispatch_release((dispatch_semaphore_t) sem);
+}
+
+void sys::semaphore_post(semaphore_t* sem)
+{
+	dispatch_semaphore_signal((dispatch_semaphore_t) sem);
+}
+
+bool sys::semaphore_wait(semaphore_t* sem, int timeout_ms)
+{
+	dispatch_time_t timeout = dispatch_time(DISPATCH_TIME_NOW, (int64_t) timeout_ms * NSEC_PER_MSEC);
+	return dispatch_semaphore_wait((dispatch_semaphore_t) sem, timeout) == 0;
+}
+#else
+semaphore_t* sys::semaphore_create()
+{
+	sem_t* sem = new sem_t;
+	sem_init(sem, 0, 0);
+	return (semaphore_t*) sem;
+}
+
+void sys::semaphore_destroy(semaphore_t* sem)
+{
+	sem_destroy((sem_t*) sem);
+	delete (sem_t*) sem;
+}
+
+void sys::semaphore_post(semaphore_t* sem)
+{
+	sem_post((sem_t*) sem);
+}
+
+bool sys::semaphore_wait(semaphore_t* sem, int timeout_ms)
+{
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+
+	if (ts.tv_nsec >= 1000000000)
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	int res;
+	while ((res = sem_timedwait((sem_t*) sem, &ts)) == -1 && errno == EINTR);
+	return res == 0;
+}
+#endif
+
+bool sys::set_thread_realtime()
+{
+	// stay below the priority that audio servers such as JACK usually use
+	sched_param param;
+	param.sched_priority = std::min(70, sched_get_priority_max(SCHED_FIFO));
+	return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+}
+
+#endif
+
+const uint8_t* sys::mapped_file_data(mapped_file_t* file)
+{
+	return file->data;
+}
+
+size_t sys::mapped_file_size(mapped_file_t* file)
+{
+	return file->size;
+}
+
+void* sys::shared_memory_data(shared_memory_t* memory)
+{
+	return memory->data;
+}
+
+size_t sys::shared_memory_size(shared_memory_t* memory)
+{
+	return memory->size;
+}
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free,
+	"shared_wait requires a plain 32-bit atomic");
+
+#ifdef __linux__
+void sys::shared_wait(std::atomic<uint32_t>* address, uint32_t expected, int64_t timeout_us)
+{
+	if (timeout_us <= 0) return;
+
+	timespec timeout;
+	timeout.tv_sec = timeout_us / 1000000;
+	timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+
+	// not FUTEX_PRIVATE_FLAG, since the other side is in another process
+	syscall(SYS_futex, (uint32_t*) address, FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+void sys::shared_wake(std::atomic<uint32_t>* address)
+{
+	syscall(SYS_futex, (uint32_t*) address, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+#else
+// there is no portable way to sleep on an address shared between
+// processes elsewhere, so the waiter polls, yielding at first and then sleeping
+void sys::shared_wait(std::atomic<uint32_t>* address, uint32_t expected, int64_t timeout_us)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us);
+
+	for (int i = 0; address->load(std::memory_order_acquire) == expected; i++)
+	{
+		if (std::chrono::steady_clock::now() >= deadline) return;
+
+		if (i < 64)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+}
+
+void sys::shared_wake(std::atomic<uint32_t>* address)
+{}
 #endif
@@ -20,14 +20,89 @@
 #include <ostream>
 #include <istream>
 #include <functional>
+#include <atomic>
+#include <string>
+#include <vector>
 
 namespace sys {
     struct interval_t;
+    struct semaphore_t;
     typedef void* dl_handle;
     
     interval_t* set_interval(int ms, const std::function<void()>&& callback_proc);
     void clear_interval(interval_t* interval);
 
+    // a counting semaphore, safe to post from a real-time thread
+    semaphore_t* semaphore_create();
+    void semaphore_destroy(semaphore_t* sem);
+    void semaphore_post(semaphore_t* sem);
+
+    // returns false if the timeout elapsed before the semaphore was posted
+    bool semaphore_wait(semaphore_t* sem, int timeout_ms);
+
+    // try to give the calling thread real-time scheduling priority.
+    // returns false if the OS did not allow it
+    bool set_thread_realtime();
+
+    // a read-only view of a whole file, mapped into memory
+    struct mapped_file_t;
+
+    // returns nullptr if the file could not be opened or mapped
+    mapped_file_t* map_file(const char* file_path);
+    void unmap_file(mapped_file_t* file);
+    const uint8_t* mapped_file_data(mapped_file_t* file);
+    size_t mapped_file_size(mapped_file_t* file);
+
+    /**
+    * Run this program again in a new process, and collect what it writes to
+    * stdout. The process is killed if it does not exit within the timeout.
+    * @param args The arguments, not including the program name
+    * @param exit_code Set to the exit code of the process, or -1 if it
+    *                  crashed or was killed
+    * @returns false if the process could not be started
+    **/
+    bool run_self(const std::vector<std::string>& args, std::string& output, int& exit_code, int timeout_ms);
+
+    struct process_t;
+
+    /**
+    * Start this program again in a new process, without waiting for it.
+    * @returns nullptr if the process could not be started
+    **/
+    process_t* spawn_self(const std::vector<std::string>& args);
+    bool process_running(process_t* process);
+
+    /**
+    * Wait for a process to exit and free its handle. The process
+    * is killed if it has not exited within the timeout.
+    **/
+    void close_process(process_t* process, int timeout_ms);
+
+    uint64_t current_process_id();
+    bool process_exists(uint64_t pid);
+
+    struct shared_memory_t;
+
+    /**
+    * Create a block of memory that other processes can map by name.
+    * The memory is zero-filled, and the name is removed when the
+    * creator closes it.
+    * @returns nullptr if the memory could not be created
+    **/
+    shared_memory_t* shared_memory_create(const char* name, size_t size);
+    shared_memory_t* shared_memory_open(const char* name);
+    void shared_memory_close(shared_memory_t* memory);
+    void* shared_memory_data(shared_memory_t* memory);
+    size_t shared_memory_size(shared_memory_t* memory);
+
+    /**
+    * Wait until the value at an address in shared memory is no longer
+    * `expected`, shared_wake is called on it or the timeout passes.
+    * This may also return early, so the caller must check the value again.
+    **/
+    void shared_wait(std::atomic<uint32_t>* address, uint32_t expected, int64_t timeout_us);
+    void shared_wake(std::atomic<uint32_t>* address);
+
     dl_handle dl_open(const char* file_path);
     int dl_close(dl_handle handle);
     void* dl_sym(dl_handle handle, const char* symbol_name);
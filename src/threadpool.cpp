@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <chrono>
+#include "threadpool.h"
+#include "sys.h"
+
+// how long a worker thread checks for new work before going to sleep. this keeps
+// wake-up latency low between the parallel parts of an audio block, without
+// holding on to a core at real-time priority in between blocks
+static constexpr std::chrono::microseconds SPIN_TIME(50);
+
+// how long the calling thread waits for the workers to finish before going
+// to sleep. tasks may last anywhere from a few microseconds to seconds
+static constexpr std::chrono::microseconds DONE_SPIN_TIME(50);
+
+ThreadPool::ThreadPool(size_t num_threads, bool realtime)
+:   _realtime(realtime)
+{
+    for (size_t i = 0; i < num_threads; i++)
+        _workers.push_back(std::make_unique<Worker>());
+
+    for (size_t i = 0; i < num_threads; i++)
+        _workers[i]->thread = std::thread(&ThreadPool::_thread_proc, this, std::ref(*_workers[i]), i + 1);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+
+    for (std::unique_ptr<Worker>& worker : _workers)
+        worker->cond.notify_all();
+
+    for (std::unique_ptr<Worker>& worker : _workers)
+        worker->thread.join();
+}
+
+size_t ThreadPool::default_thread_count()
+{
+    size_t hw_threads = std::thread::hardware_concurrency();
+
+    // leave one core for the calling thread and one for the ui
+    if (hw_threads <= 2) return 0;
+    return hw_threads - 2;
+}
+
+void ThreadPool::run(ThreadPoolTask task, void* userdata, size_t max_threads)
+{
+    size_t worker_count = std::min(_workers.size(), max_threads > 0 ? max_threads - 1 : 0);
+
+    if (worker_count == 0)
+    {
+        task(userdata, 0);
+        return;
+    }
+
+    _task = task;
+    _userdata = userdata;
+    _pending.store(worker_count, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < worker_count; i++)
+    {
+        Worker& worker = *_workers[i];
+
+        // a worker sets sleeping before checking its generation one last
+        // time, so either it sees the new generation or it is woken up here
+        worker.generation.fetch_add(1);
+
+        if (worker.sleeping.load())
+        {
+            { std::lock_guard<std::mutex> lock(_mutex); }
+            worker.cond.notify_one();
+        }
+    }
+
+    // the calling thread helps out
+    task(userdata, 0);
+    _wait_done();
+}
+
+void ThreadPool::_wait_done()
+{
+    auto spin_end = std::chrono::steady_clock::now() + DONE_SPIN_TIME;
+
+    while (_pending.load(std::memory_order_acquire) != 0)
+    {
+        if (std::chrono::steady_clock::now() >= spin_end)
+        {
+            // the last worker to finish checks _caller_waiting after
+            // decrementing _pending, so one of the two sees the other
+            std::unique_lock<std::mutex> lock(_mutex);
+            _caller_waiting.store(true);
+            _done_cond.wait(lock, [&]() { return _pending.load() == 0; });
+            _caller_waiting.store(false);
+            return;
+        }
+
+        std::this_thread::yield();
+    }
+}
+
+void ThreadPool::_thread_proc(Worker& worker, size_t thread_index)
+{
+    uint32_t last_generation = 0;
+
+    if (_realtime)
+        sys::set_thread_realtime();
+
+    while (true)
+    {
+        // spin for a bit before sleeping. under real-time scheduling, yield()
+        // only gives way to threads of the same priority, so this is bounded
+        // by time rather than by a number of iterations
+        auto spin_end = std::chrono::steady_clock::now() + SPIN_TIME;
+        uint32_t generation;
+
+        while ((generation = worker.generation.load(std::memory_order_acquire)) == last_generation &&
+            std::chrono::steady_clock::now() < spin_end)
+        {
+            std::this_thread::yield();
+        }
+
+        if (generation == last_generation)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            worker.sleeping.store(true);
+            worker.cond.wait(lock, [&]() {
+                return _quit || worker.generation.load() != last_generation;
+            });
+            worker.sleeping.store(false);
+
+            if (_quit) break;
+            generation = worker.generation.load(std::memory_order_acquire);
+        }
+
+        last_generation = generation;
+        _task(_userdata, thread_index);
+
+        if (_pending.fetch_sub(1) == 1 && _caller_waiting.load())
+        {
+            { std::lock_guard<std::mutex> lock(_mutex); }
+            _done_cond.notify_one();
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+
+typedef void (*ThreadPoolTask)(void* userdata, size_t thread_index);
+
+/**
+* A fixed set of worker threads that all run the same task when
+* ThreadPool::run is called. This is meant for work that is split up
+* by the task itself (e.g. by pulling from a shared queue), such as
+* processing the module graph on the audio thread.
+**/
+class ThreadPool
+{
+public:
+    /**
+    * @param num_threads The number of worker threads to create. The thread
+    *                    calling run() also participates, so a pool with zero
+    *                    threads simply runs the task on the caller.
+    * @param realtime If true, the worker threads ask for real-time scheduling priority
+    **/
+    ThreadPool(size_t num_threads, bool realtime = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    // number of worker threads, not including the calling thread
+    inline size_t thread_count() const { return _workers.size(); };
+
+    /**
+    * Run a task on the worker threads and on the calling thread, and
+    * wait for all of them to return. The calling thread has a thread index of 0.
+    * Workers that are not needed are left asleep.
+    * This must not be called from multiple threads at once.
+    * @param task The procedure to run
+    * @param userdata The userdata passed to the procedure
+    * @param max_threads The most threads to run the task on, including the calling thread
+    **/
+    void run(ThreadPoolTask task, void* userdata, size_t max_threads = SIZE_MAX);
+
+    // a reasonable amount of worker threads for this machine
+    static size_t default_thread_count();
+
+private:
+    struct Worker
+    {
+        std::thread thread;
+
+        // incremented every time the worker is given the task
+        std::atomic<uint32_t> generation = 0;
+
+        // set while the worker sleeps on cond, so run() knows to wake it
+        std::atomic<bool> sleeping = false;
+        std::condition_variable cond;
+    };
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    bool _realtime;
+
+    std::mutex _mutex;
+    bool _quit = false;
+
+    // signaled by the last worker to finish a task, if the calling thread went to sleep
+    std::condition_variable _done_cond;
+    std::atomic<bool> _caller_waiting = false;
+
+    ThreadPoolTask _task = nullptr;
+    void* _userdata = nullptr;
+
+    // number of worker threads that have not finished the current task
+    std::atomic<size_t> _pending = 0;
+
+    // wait for every worker thread to finish the current task
+    void _wait_done();
+
+    void _thread_proc(Worker& worker, size_t thread_index);
+};
@@ -0,0 +1,111 @@
+#include "ui.h"
+using namespace ui;
+
+void ui::render_audio_settings_window(SongEditor &editor)
+{
+    ImGuiStyle& style = ImGui::GetStyle();
+
+    // settings are edited here and only applied when the user clicks
+    // Apply, since applying them reopens the device and reloads the song
+    static SongEditor::AudioConfigData config;
+    static std::vector<AudioDevice::DeviceInfo> devices;
+
+    static const int rate_values[] = { 0, 44100, 48000, 88200, 96000 };
+    static const char* rate_options[] = {
+        "Device default",
+        "44.1 kHz",
+        "48 kHz",
+        "88.2 kHz",
+        "96 kHz"
+    };
+
+    static const int block_sizes[] = { 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+
+    if (!editor.show_audio_window) return;
+
+    if (ImGui::Begin("Audio Settings", &editor.show_audio_window, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoDocking))
+    {
+        if (ImGui::IsWindowAppearing())
+        {
+            config = editor.audio_config;
+            devices = AudioDevice::output_devices();
+        }
+
+        AudioDevice& device = editor.audio_device();
+        ImGui::Text("Running on %s at %i Hz", device.device_name().c_str(), device.sample_rate());
+        ImGui::Text("%i frames per block", editor.modctx->frames_per_buffer);
+
+        ImGui::Separator();
+
+        // output device selection
+        const char* device_label = config.device.output_device.empty() ? "Default" : config.device.output_device.c_str();
+
+        if (ImGui::BeginCombo("Output Device", device_label))
+        {
+            if (ImGui::Selectable("Default", config.device.output_device.empty()))
+                config.device.output_device.clear();
+
+            for (const AudioDevice::DeviceInfo& info : devices)
+            {
+                if (ImGui::Selectable(info.name.c_str(), info.name == config.device.output_device))
+                    config.device.output_device = info.name;
+            }
+
+            ImGui::EndCombo();
+        }
+
+        // sample rate selection
+        int rate_sel = 0;
+        for (int i = 0; i < IM_ARRAYSIZE(rate_values); i++)
+            if (rate_values[i] == config.device.sample_rate) rate_sel = i;
+
+        if (ImGui::BeginCombo("Sample Rate", rate_options[rate_sel]))
+        {
+            for (int i = 0; i < IM_ARRAYSIZE(rate_options); i++)
+            {
+                if (ImGui::Selectable(rate_options[i], rate_sel == i))
+                    config.device.sample_rate = rate_values[i];
+
+                if (rate_sel == i)
+                    ImGui::SetItemDefaultFocus();
+            }
+
+            ImGui::EndCombo();
+        }
+
+        // block size selection
+        char block_label[16];
+        snprintf(block_label, 16, "%i", config.block_size);
+
+        if (ImGui::BeginCombo("Block Size", block_label))
+        {
+            for (int size : block_sizes)
+            {
+                snprintf(block_label, 16, "%i", size);
+                if (ImGui::Selectable(block_label, size == config.block_size))
+                    config.block_size = size;
+            }
+
+            ImGui::EndCombo();
+        }
+
+        // latency, shown in milliseconds
+        float latency_ms = config.device.latency * 1000.0;
+        if (ImGui::SliderFloat("Latency", &latency_ms, AudioDevice::MIN_LATENCY * 1000.0, AudioDevice::MAX_LATENCY * 1000.0, "%.0f ms"))
+            config.device.latency = latency_ms / 1000.0;
+
+        ImGui::Separator();
+
+        bool changed = !(config == editor.audio_config);
+        push_btn_disabled(style, !changed);
+        if (ImGui::Button("Apply") && changed)
+        {
+            editor.set_audio_config(config);
+            show_status("Audio device reopened");
+        }
+        pop_btn_disabled();
+
+        ImGui::SameLine();
+        ImGui::TextDisabled("(clears undo history)");
+    } ImGui::End();
+}
@@ -48,8 +48,10 @@ void ui::render_channel_settings(SongEditor &editor)
             ImGui::AlignTextToFramePadding();
             ImGui::Text("Panning");
             ImGui::SameLine();
-            ImGui::SliderFloat("##channel_panning", &vol_mod.panning, -1, 1, "%.2f");
-            if (ImGui::IsItemClicked(ImGuiMouseButton_Middle)) vol_mod.panning = 0.0f;
+            float panning = vol_mod.panning;
+            ImGui::SliderFloat("##channel_panning", &panning, -1, 1, "%.2f");
+            if (ImGui::IsItemClicked(ImGuiMouseButton_Middle)) panning = 0.0f;
+            vol_mod.panning = panning;
             
             // change detection
             {
@@ -128,7 +130,7 @@ void ui::render_channel_settings(SongEditor &editor)
                 try {
                     auto mod = audiomod::create_module(
                         mod_id,
-                        editor.modctx,
+                        *editor.modctx,
                         editor.plugin_manager,
                         editor.song->work_scheduler
                     );
@@ -155,7 +157,7 @@ void ui::render_channel_settings(SongEditor &editor)
                 try {
                     auto mod = audiomod::create_module(
                         result.module_id,
-                        editor.modctx,
+                        *editor.modctx,
                         editor.plugin_manager,
                         editor.song->work_scheduler
                     );
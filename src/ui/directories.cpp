@@ -71,6 +71,10 @@ void ui::render_directories_window(SongEditor &editor)
                     plugins.remove_path(plugins::PluginType::Ladspa, path_to_delete);
             }
 
+            ImGui::Checkbox("Run plugins in a separate process", &plugins.sandbox_plugins);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("A plugin that crashes or stalls is bypassed\ninstead of stopping the audio.\nApplies to plugins loaded from now on.");
+
             if (ImGui::BeginPopup("adddirectory"))
             {
                 if (ImGui::IsWindowAppearing())
@@ -52,6 +52,46 @@ void ui::render_export_window(SongEditor &editor)
                 ImGui::EndCombo();
             }
 
+            // bit depth selection
+            static const char* format_options[] = {
+                "16-bit",
+                "24-bit",
+                "32-bit float"
+            };
+
+            static audiofile::SampleFormat format_values[] = {
+                audiofile::SampleFormat::Int16,
+                audiofile::SampleFormat::Int24,
+                audiofile::SampleFormat::Float32
+            };
+
+            int format_sel = (int)export_config.format;
+
+            ImGui::AlignTextToFramePadding();
+            ImGui::Text("Bit Depth");
+            ImGui::SameLine();
+            if (ImGui::BeginCombo("###export_format", format_options[format_sel])) {
+                for (int i = 0; i < IM_ARRAYSIZE(format_options); i++) {
+                    if (ImGui::Selectable(format_options[i], format_sel == i)) {
+                        export_config.format = format_values[i];
+                    }
+
+                    if (format_sel == i) {
+                        ImGui::SetItemDefaultFocus();
+                    }
+                }
+                
+                ImGui::EndCombo();
+            }
+
+            // dither only applies to integer formats
+            if (export_config.format != audiofile::SampleFormat::Float32) {
+                ImGui::Checkbox("Dither", &export_config.dither);
+            }
+
+            ImGui::Checkbox("Export channel stems", &export_config.stems);
+            ImGui::Checkbox("Export FX bus stems", &export_config.bus_stems);
+
             if (ImGui::Button("Export")) {
                 editor.begin_export();
             }
@@ -70,10 +110,14 @@ void ui::render_export_window(SongEditor &editor)
                 ImGui::ProgressBar(song_export->get_progress(), bar_size);
 
                 if (song_export->finished()) {
+                    std::string error = song_export->error();
                     editor.export_config.active = false;
                     editor.stop_export();
 
-                    ui::show_status("Successfully exported to %s", export_config.file_name);
+                    if (error.empty())
+                        ui::show_status("Successfully exported to %s", export_config.file_name);
+                    else
+                        ui::show_status("Could not export %s: %s", export_config.file_name, error.c_str());
                 }
             } else {
                 ImGui::ProgressBar(0.0f, bar_size, "");
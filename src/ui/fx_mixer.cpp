@@ -82,7 +82,7 @@ void ui::render_fx_mixer(SongEditor &editor)
         ImGui::Separator();
         if (ImGui::Button("Add", ImVec2(-1.0f, 0.0f)))
         {
-            auto bus = std::make_unique<audiomod::FXBus>(editor.modctx);
+            auto bus = std::make_unique<audiomod::FXBus>(*editor.modctx);
             song.fx_mixer[0]->connect_input(bus->controller);
             song.fx_mixer.push_back(std::move(bus));
         }
@@ -200,7 +200,7 @@ void ui::render_fx_mixer(SongEditor &editor)
                     try {
                         auto mod = audiomod::create_module(
                             result.module_id,
-                            editor.modctx,
+                            *editor.modctx,
                             editor.plugin_manager,
                             editor.song->work_scheduler
                         );
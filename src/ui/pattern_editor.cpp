@@ -262,6 +262,7 @@ void ui::render_pattern_editor(SongEditor &editor)
                     {
                         int pattern = song.new_pattern(editor.selected_channel);
                         selected_channel->sequence[editor.selected_bar] = pattern + 1;
+                        selected_channel->mark_sequence_changed();
                         selected_pattern = selected_channel->patterns[pattern].get();
                     }
                     
@@ -358,6 +359,8 @@ void ui::render_pattern_editor(SongEditor &editor)
 
             // mouse note dragging
             if (selected_note != nullptr && did_mouse_move) {
+                note_pattern->mark_changed();
+
                 float new_len = (mouse_px - mouse_start) + note_start_length;
                 if (min_step > 0) {
                     float note_end = selected_note->time + new_len;
@@ -454,6 +457,7 @@ void ui::render_pattern_editor(SongEditor &editor)
                             ));
 
                             note_pattern->notes.erase(it);
+                            note_pattern->mark_changed();
                             break;
                         }
                     }
@@ -659,8 +663,8 @@ void ui::render_pattern_editor(SongEditor &editor)
         }
 
         // draw playhead
-        if (song.is_playing && selected_channel->sequence[song.bar_position] - 1 == pattern_id) {
-            Vec2 playhead_pos = draw_origin + Vec2(PIANO_KEY_WIDTH + fmodf(song.position, song.beats_per_bar) * CELL_SIZE.x, viewport_scroll.y);
+        if (song.is_playing && selected_channel->sequence[song.playhead_bar()] - 1 == pattern_id) {
+            Vec2 playhead_pos = draw_origin + Vec2(PIANO_KEY_WIDTH + fmodf(song.playhead_position(), song.beats_per_bar) * CELL_SIZE.x, viewport_scroll.y);
             draw_list->AddRectFilled(playhead_pos, playhead_pos + Vec2(1.0f, canvas_size.y + style.WindowPadding.y * 2.0f), vec4_color(style.Colors[ImGuiCol_Text]));
         }
 
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <chrono>
+#include "ui.h"
+#include "../modules/modules.h"
+using namespace ui;
+
+namespace
+{
+    struct ProfileRow
+    {
+        std::string channel;
+        std::string module;
+        audiomod::ProfileStats stats;
+    };
+}
+
+static void collect_node(std::vector<ProfileRow>& rows, const std::string& channel, audiomod::ModuleNodeRc& node)
+{
+    if (!node) return;
+
+    audiomod::ModuleBase& mod = node->module();
+
+    ProfileRow& row = rows.emplace_back();
+    row.channel = channel;
+    row.module = mod.name.empty() ? mod.id : mod.name;
+    row.stats = node->profile().collect();
+}
+
+void ui::render_profiler_window(SongEditor &editor)
+{
+    // statistics are collected once every this many seconds,
+    // so that the numbers are readable
+    static constexpr double UPDATE_INTERVAL = 1.0;
+
+    static std::vector<ProfileRow> rows;
+    static std::chrono::steady_clock::time_point last_update;
+
+    // only time nodes while someone is looking at the results
+    editor.modctx->set_profiling(editor.show_profiler);
+    if (!editor.show_profiler) return;
+
+    if (ImGui::Begin("Profiler", &editor.show_profiler))
+    {
+        Song& song = *editor.song;
+        auto now = std::chrono::steady_clock::now();
+
+        if (ImGui::IsWindowAppearing() || std::chrono::duration<double>(now - last_update).count() >= UPDATE_INTERVAL)
+        {
+            last_update = now;
+            rows.clear();
+
+            for (auto& channel : song.channels)
+            {
+                collect_node(rows, channel->name, channel->synth_mod);
+
+                for (auto& mod : channel->effects_rack.modules)
+                    collect_node(rows, channel->name, mod);
+
+                collect_node(rows, channel->name, channel->vol_mod);
+            }
+
+            for (auto& bus : song.fx_mixer)
+            {
+                for (auto& mod : bus->get_modules())
+                    collect_node(rows, bus->name, mod);
+
+                collect_node(rows, bus->name, bus->controller);
+            }
+
+            // most expensive first
+            std::stable_sort(rows.begin(), rows.end(), [](const ProfileRow& a, const ProfileRow& b) {
+                return a.stats.total_us > b.stats.total_us;
+            });
+        }
+
+        const audiomod::ModuleContext& modctx = *editor.modctx;
+        double block_us = (double)modctx.frames_per_buffer / modctx.sample_rate * 1e6;
+        ImGui::Text("Block time: %.0f us", block_us);
+
+        if (ImGui::BeginTable("profile", 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Resizable))
+        {
+            ImGui::TableSetupScrollFreeze(0, 1);
+            ImGui::TableSetupColumn("Channel");
+            ImGui::TableSetupColumn("Module");
+            ImGui::TableSetupColumn("Mean (us)");
+            ImGui::TableSetupColumn("p99 (us)");
+            ImGui::TableSetupColumn("Max (us)");
+            ImGui::TableSetupColumn("% of block");
+            ImGui::TableHeadersRow();
+
+            for (const ProfileRow& row : rows)
+            {
+                ImGui::TableNextRow();
+
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(row.channel.c_str());
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(row.module.c_str());
+
+                // node was bypassed or not processed at all
+                if (row.stats.count == 0)
+                {
+                    for (int i = 0; i < 4; i++)
+                    {
+                        ImGui::TableNextColumn();
+                        ImGui::TextDisabled("-");
+                    }
+
+                    continue;
+                }
+
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", row.stats.mean_us);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", row.stats.p99_us);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", row.stats.max_us);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", row.stats.mean_us / block_us * 100.0);
+            }
+
+            ImGui::EndTable();
+        }
+    } ImGui::End();
+}
@@ -149,7 +149,7 @@ void ui::render_track_editor(SongEditor& editor)
         }
 
         // draw playhead
-        double song_pos = song.is_playing ? (song.position / song.beats_per_bar) : (song.bar_position);
+        double song_pos = song.is_playing ? (song.playhead_position() / song.beats_per_bar) : (song.playhead_bar());
         Vec2 playhead_pos = canvas_p0 + Vec2(song_pos * CELL_SIZE.x + CHANNEL_COLUMN_WIDTH, viewport_scroll.y);
         draw_list->AddRectFilled(playhead_pos, playhead_pos + Vec2(1.0f, canvas_size.y), vec4_color(style.Colors[ImGuiCol_Text]));
 
@@ -238,6 +238,7 @@ void ui::render_track_editor(SongEditor& editor)
                 if (pattern_input <= song.max_patterns())
                 {
                     cell = pattern_input;
+                    song.channels[editor.selected_channel]->mark_sequence_changed();
 
                     // register change
                     if (cell != old_value)
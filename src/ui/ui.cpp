@@ -197,6 +197,7 @@ void ui::ui_init(SongEditor& editor)
             if (pattern_id > 0) {
                 auto& pattern = channel->patterns[pattern_id - 1];
                 pattern->notes = editor.note_clipboard;
+                pattern->mark_changed();
             }
         }
     });
@@ -220,6 +221,8 @@ void ui::ui_init(SongEditor& editor)
                 note.key = std::clamp(note.key, 0, 96);
                 note.new_id(); // this is so song player doesn't indefinitely play the old key
             }
+
+            pattern->mark_changed();
         }
     };
 
@@ -259,22 +262,18 @@ void ui::ui_init(SongEditor& editor)
 
     // song next bar
     user_actions.set_callback("song_next_bar", [&song]() {
-        song.bar_position++;
-        song.position += song.beats_per_bar;
-
-        // wrap around
-        if (song.bar_position >= song.length()) song.bar_position -= song.length();
-        if (song.position >= song.length() * song.beats_per_bar) song.position -= song.length() * song.beats_per_bar;
+        if (song.is_playing)
+            song.seek(song.playhead_position() + song.beats_per_bar);
+        else
+            song.seek((song.playhead_bar() + 1) * song.beats_per_bar);
     });
 
     // song previous bar
     user_actions.set_callback("song_prev_bar", [&song]() {
-        song.bar_position--;
-        song.position -= song.beats_per_bar;
-
-        // wrap around
-        if (song.bar_position < 0) song.bar_position += song.length();
-        if (song.position < 0) song.position += song.length() * song.beats_per_bar;
+        if (song.is_playing)
+            song.seek(song.playhead_position() - song.beats_per_bar);
+        else
+            song.seek((song.playhead_bar() - 1) * song.beats_per_bar);
     });
 
     // mute selected channel
@@ -335,16 +334,17 @@ void ui::ui_init(SongEditor& editor)
     user_actions.set_callback("new_pattern", [&]() {
         int pattern_id = song.new_pattern(editor.selected_channel);
         song.channels[editor.selected_channel]->sequence[editor.selected_bar] = pattern_id + 1;
+        song.channels[editor.selected_channel]->mark_sequence_changed();
     });
 
     // move playhead to cursor
     user_actions.set_callback("goto_cursor", [&]() {
-        song.bar_position = editor.selected_bar;
+        song.seek(editor.selected_bar * song.beats_per_bar);
     });
 
     // move playhead to start
     user_actions.set_callback("goto_start", [&]() {
-        song.bar_position = 0;
+        song.seek(0.0);
     });
 }
 
@@ -645,6 +645,51 @@ void ui::prompt_unsaved_work(std::function<void ()> callback)
     if (ImGui::MenuItem(label, user_actions.combo_str(action_name))) \
         deferred_actions.push_back(action_name)
 
+// dsp load and xrun counts, shown on the right side of the menu bar
+static void render_audio_meter(SongEditor& editor)
+{
+    AudioDevice& device = editor.audio_device();
+    DspLoadMeter& meter = editor.dsp_meter;
+
+    uint64_t xruns = device.underrun_count() + device.overrun_count();
+    float load = meter.load();
+
+    char meter_text[64];
+    snprintf(meter_text, 64, "DSP %3.0f%%  XRUN %llu", load * 100.0f, (unsigned long long) xruns);
+
+    ImGuiStyle& style = ImGui::GetStyle();
+    float text_width = ImGui::CalcTextSize(meter_text).x + style.ItemSpacing.x * 2.0f;
+    ImGui::SetCursorPosX(ImGui::GetWindowWidth() - text_width);
+
+    // warn when the render thread is close to its deadline
+    bool warn = load > 0.8f || meter.peak() >= 1.0f;
+    if (warn) ImGui::PushStyleColor(ImGuiCol_Text, IM_COL32(255, 80, 80, 255));
+    
+    if (ImGui::Selectable(meter_text, false, 0, ImVec2(text_width - style.ItemSpacing.x, 0.0f)))
+    {
+        device.reset_xrun_counts();
+        meter.reset();
+    }
+
+    if (warn) ImGui::PopStyleColor();
+
+    if (ImGui::IsItemHovered())
+    {
+        ImGui::BeginTooltip();
+        ImGui::Text("DSP load: %.1f%% (peak %.1f%%)", load * 100.0f, meter.peak() * 100.0f);
+        ImGui::Text("Block render time: %.2f ms / %.2f ms", meter.render_time() * 1000.0f, meter.block_time() * 1000.0f);
+        ImGui::Text("Late blocks: %llu", (unsigned long long) meter.late_blocks());
+        ImGui::Text("Underruns: %llu", (unsigned long long) device.underrun_count());
+        ImGui::Text("Overruns: %llu", (unsigned long long) device.overrun_count());
+        ImGui::Text("Buffer fill: %.1f ms (target %.1f ms)",
+            (double)device.samples_queued() / device.num_channels() / device.sample_rate() * 1000.0,
+            (double)device.queue_target() / device.num_channels() / device.sample_rate() * 1000.0
+        );
+        ImGui::TextDisabled("Click to reset");
+        ImGui::EndTooltip();
+    }
+}
+
 void ui::compute_imgui(SongEditor& editor) {
     ImGuiStyle& style = ImGui::GetStyle();
     Song& song = *editor.song;
@@ -751,6 +796,10 @@ void ui::compute_imgui(SongEditor& editor) {
             {
                 editor.show_dir_window = !editor.show_dir_window;
             }
+
+            if (ImGui::MenuItem("Audio Settings..."))
+                editor.show_audio_window = !editor.show_audio_window;
+
             ImGui::MenuItem("MIDI Configuration...");
             
             ImGui::EndMenu();
@@ -766,6 +815,9 @@ void ui::compute_imgui(SongEditor& editor) {
 
             if (ImGui::MenuItem("Plugin List..."))
                 editor.show_plugin_list = !editor.show_plugin_list;
+
+            if (ImGui::MenuItem("Profiler..."))
+                editor.show_profiler = !editor.show_profiler;
             
             ImGui::EndMenu();
         }
@@ -781,6 +833,7 @@ void ui::compute_imgui(SongEditor& editor) {
         }
 #endif
 
+        render_audio_meter(editor);
         ImGui::EndMainMenuBar();
     }
 
@@ -789,11 +842,13 @@ void ui::compute_imgui(SongEditor& editor) {
     render_track_editor(editor);
     render_pattern_editor(editor);
     render_fx_mixer(editor);  
+    render_profiler_window(editor);
 
     render_tunings_window(editor);  
     render_plugin_list(editor);
     render_themes_window(editor);
     render_directories_window(editor);
+    render_audio_settings_window(editor);
     render_export_window(editor);
 
     // render module interfaces
@@ -924,6 +979,59 @@ void ui::compute_imgui(SongEditor& editor) {
         ImGui::EndPopup();
     }
 
+    // progress of a song that is being opened
+    if (editor.current_load()) {
+        ImGui::SetNextWindowPos(ImVec2(io.DisplaySize.x * 0.5f, io.DisplaySize.y * 0.5f), ImGuiCond_Always, ImVec2(0.5f, 0.5f));
+        ImGui::OpenPopup("Opening song##song_load");
+    }
+
+    if (ImGui::BeginPopupModal("Opening song##song_load", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings)) {
+        const std::unique_ptr<SongLoader>& song_load = editor.current_load();
+
+        if (!song_load) {
+            ImGui::CloseCurrentPopup();
+        } else {
+            ImGui::Text("Loading modules...");
+            ImGui::ProgressBar(song_load->get_progress(), ImVec2(ImGui::GetTextLineHeight() * 16.0f, 0.0f));
+
+            if (ImGui::Button("Cancel")) {
+                editor.cancel_load();
+            }
+        }
+
+        ImGui::EndPopup();
+    }
+
+    // recover work prompt, shown once if the last session did not exit cleanly
+    static bool checked_recovery = false;
+    if (!checked_recovery) {
+        checked_recovery = true;
+
+        if (editor.has_recovery()) {
+            ImGui::SetNextWindowPos(ImVec2(io.DisplaySize.x * 0.5f, io.DisplaySize.y * 0.5f), ImGuiCond_Always, ImVec2(0.5f, 0.5f));
+            ImGui::OpenPopup("Recover work##recover_work");
+        }
+    }
+
+    if (ImGui::BeginPopupModal("Recover work##recover_work", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings)) {
+        ImGui::Text("Soundbox did not close properly last time.");
+        ImGui::Text("Do you want to recover your unsaved work?");
+        ImGui::NewLine();
+
+        if (ImGui::Button("Yes")) {
+            ImGui::CloseCurrentPopup();
+            editor.recover_autosave();
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button("No")) {
+            ImGui::CloseCurrentPopup();
+            editor.discard_recovery();
+        }
+
+        ImGui::EndPopup();
+    }
+
     // show status info as an overlay
     if (status_time == -30.0) status_time = ImGui::GetTime();
 
@@ -92,9 +92,11 @@ namespace ui
     void render_track_editor(SongEditor& editor);
     void render_pattern_editor(SongEditor& editor);
     void render_fx_mixer(SongEditor& editor);
+    void render_profiler_window(SongEditor& editor);
 
     void render_plugin_list(SongEditor& editor);
     void render_directories_window(SongEditor& editor);
+    void render_audio_settings_window(SongEditor& editor);
     void render_tunings_window(SongEditor& editor);
     void render_themes_window(SongEditor& editor);
     void render_export_window(SongEditor& editor);
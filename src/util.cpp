@@ -67,6 +67,44 @@ MessageQueue::read_handle_t MessageQueue::read()
     return read_handle_t(this->ringbuf);
 }
 
+// deferred reclamation
+void EpochReclaimer::begin_read()
+{
+    if (_read_depth++ == 0)
+        _begin_count.fetch_add(1, std::memory_order_seq_cst);
+}
+
+void EpochReclaimer::end_read()
+{
+    assert(_read_depth > 0);
+    if (--_read_depth == 0)
+        _end_count.fetch_add(1, std::memory_order_release);
+}
+
+void EpochReclaimer::retire(std::shared_ptr<void> object)
+{
+    if (!object) return;
+
+    // a read that began before this point may have seen the object,
+    // so it must be kept alive until that many reads have ended
+    uint64_t epoch = _begin_count.load(std::memory_order_seq_cst);
+    _retired.push_back({ std::move(object), epoch });
+}
+
+void EpochReclaimer::collect()
+{
+    uint64_t end_count = _end_count.load(std::memory_order_acquire);
+
+    for (size_t i = 0; i < _retired.size();)
+    {
+        if (_retired[i].epoch <= end_count)
+        {
+            _retired.erase(_retired.begin() + i);
+        }
+        else i++;
+    }
+}
+
 
 
 #ifdef UNIT_TESTS
@@ -255,4 +293,37 @@ TEST_CASE("MessageQueue test", "[utils]")
         REQUIRE(std::string(buf) == str2);
     }
 }
-#endif
\ No newline at end of file
+
+TEST_CASE("EpochReclaimer", "[utils]")
+{
+    EpochReclaimer reclaimer;
+    std::weak_ptr<int> object;
+
+    // an object retired during a read must outlive the read
+    reclaimer.begin_read();
+    {
+        auto ptr = std::make_shared<int>(5);
+        object = ptr;
+        reclaimer.retire(ptr);
+    }
+
+    reclaimer.collect();
+    REQUIRE_FALSE(object.expired());
+    
+    reclaimer.end_read();
+    reclaimer.collect();
+    REQUIRE(object.expired());
+    REQUIRE(reclaimer.retired_count() == 0);
+
+    // an object retired while no read is active can be destroyed right away
+    {
+        auto ptr = std::make_shared<int>(6);
+        object = ptr;
+        reclaimer.retire(ptr);
+    }
+
+    reclaimer.collect();
+    REQUIRE(object.expired());
+}
+
+#endif
@@ -1,6 +1,6 @@
 /**
 * Provides useful mathematical functions (things such as min, max, clamp, e.t.c.)
-* as well as classes for Ring Buffers, Message Queues, and Spinlocks.
+* as well as classes for Ring Buffers, Message Queues, Spinlocks and deferred reclamation.
 * TODO: move debug log function out of this code
 **/
 
@@ -9,6 +9,8 @@
 #include <cmath>
 #include <vector>
 #include <atomic>
+#include <memory>
+#include <cstdint>
 
 // debug log
 #ifdef _NDEBUG
@@ -112,6 +114,9 @@ public:
         delete[] audio_buffer;
     }
     
+    // the amount of elements the buffer can hold
+    inline size_t capacity() const { return audio_buffer_capacity; }
+
     /**
     * Returns the number of elements that are queued for reading
     **/
@@ -333,3 +338,48 @@ public:
         return spinlock_guard(*this);
     };
 };
+
+/**
+* Defers the destruction of objects that are shared with a real-time reader thread.
+* The reader brackets every access with begin_read() and end_read(), and the writer
+* hands objects it has replaced to retire(). collect() then destroys the retired objects
+* that the reader can no longer be using, so the reader never waits or frees memory.
+*
+* Only one reader thread is supported. retire() and collect() must be called
+* from the same thread.
+**/
+class EpochReclaimer
+{
+private:
+    std::atomic<uint64_t> _begin_count = 0;
+    std::atomic<uint64_t> _end_count = 0;
+
+    // reads may be nested. only the outermost read is counted
+    int _read_depth = 0;
+
+    struct retired_t {
+        std::shared_ptr<void> object;
+        uint64_t epoch; // the read count at the time the object was retired
+    };
+
+    std::vector<retired_t> _retired;
+
+public:
+    EpochReclaimer() = default;
+    EpochReclaimer(const EpochReclaimer&) = delete;
+
+    void begin_read();
+    void end_read();
+
+    /**
+    * Schedule an object for destruction. The object must already be unreachable
+    * by new reads, e.g. by having replaced the atomic pointer the reader loads.
+    * @param object The object to destroy
+    **/
+    void retire(std::shared_ptr<void> object);
+
+    // destroy the retired objects that are no longer being read
+    void collect();
+
+    inline size_t retired_count() const { return _retired.size(); };
+};
@@ -18,6 +18,7 @@ bool WorkScheduler::schedule(WorkProcedure proc, void* userdata, size_t size)
         memcpy(call.data, userdata, size);
     }   
 
+    SpinLock::spinlock_guard guard(schedule_lock);
     return schedule_queue.post(&call, sizeof(call));
 }
 
@@ -38,4 +38,8 @@ private:
     };
 
     MessageQueue schedule_queue;
+
+    // modules may be processed on multiple threads at once,
+    // so the queue must be guarded against concurrent writers
+    SpinLock schedule_lock;
 };
\ No newline at end of file